@@ -0,0 +1,16 @@
+#!/bin/sh
+
+echo "Benchmark-Suite for Libcupsfilters"
+#Number of runs per case and JSON report can be given in the environment
+RUNS=${RUNS:-5}
+REPORT=${REPORT:-benchmark_summary.json}
+echo "Running each benchmark $RUNS times..."
+
+mkdir -p cupsfilters/test_files/output_files
+./testfilters --benchmark $RUNS cupsfilters/test-filter-benchmarks.txt > $REPORT
+exit_code=$?
+echo "Results written to $REPORT"
+
+#Delete the output_files folder all together...
+rm -r cupsfilters/test_files/output_files
+exit $exit_code
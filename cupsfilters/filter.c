@@ -14,17 +14,33 @@
 
 #include "config.h"
 #include "filter.h"
+#include "raster.h"
 #include <limits.h>
 #include <math.h>
 #include <errno.h>
 #include <signal.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <stdint.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif // HAVE_SYS_EVENTFD_H
 #include <cups/file.h>
 #include <cups/array.h>
 #include <cupsfilters/libcups2-private.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif // HAVE_PTHREAD_H
+#ifdef HAVE_SENDFILE
+#  include <sys/sendfile.h>
+#endif // HAVE_SENDFILE
 
 
 extern char **environ;
@@ -38,8 +54,100 @@ typedef struct filter_function_pid_s    // Filter in filter chain
 {
   char          *name;                  // Filter executable name
   int           pid;                    // PID of filter process
+  int           stage;                  // Position of filter in chain
+  double        start;                  // Time when filter got started
 } filter_function_pid_t;
 
+typedef struct filter_stage_log_s       // Log function wrapper of a filter
+{
+  cf_logfunc_t  logfunc;                // Original log function
+  void          *logdata;               // Original log function data
+  int           pages;                  // Number of "PAGE: " messages
+} filter_stage_log_t;
+
+typedef struct filter_stage_report_s    // Statistics sent by a forked filter
+{
+  int           pid;                    // PID of filter process
+  int           pages;                  // Number of "PAGE: " messages
+  long long     bytes_in,               // Bytes read
+                bytes_out;              // Bytes written
+} filter_stage_report_t;
+
+struct cf_filter_cancel_s		// Cancellation token
+{
+  int		fds[2];			// eventfd (twice) or pipe, readable
+					// when canceled
+};
+
+struct cf_filter_cancel_watch_s		// Process killed on cancellation
+{
+  int		cancelfd;		// Descriptor of cancellation token
+  int		stoppipe[2];		// Pipe to stop the watch
+  pid_t		pid;			// Process to kill
+  int		pidfd;			// Process file descriptor or -1
+#ifdef HAVE_PTHREAD_H
+  pthread_t	thread;			// Thread waiting for cancellation
+#endif // HAVE_PTHREAD_H
+};
+
+struct cf_filter_memory_budget_s	// Job-wide memory budget, in shared
+					// memory for forked filters
+{
+  size_t	limit;			// Maximum number of bytes
+  size_t	used;			// Bytes currently reserved
+  size_t	peak;			// Maximum of bytes reserved
+};
+
+typedef union filter_memory_block_u	// Header of cfFilterMemoryAlloc()
+					// buffers
+{
+  struct
+  {
+    size_t	size;			// Usable size of the buffer
+    size_t	reserved;		// Bytes reserved from budget
+    cf_filter_memory_budget_t *budget;	// Budget the bytes are from
+    int		fd;			// Temporary file backing the
+					// buffer, -1 for heap memory
+  }		b;
+  char		pad[64];		// Keep buffers aligned for SIMD
+} filter_memory_block_t;
+
+#ifdef HAVE_PTHREAD_H
+typedef struct filter_function_thread_s // Filter in threaded filter chain
+{
+  cf_filter_filter_in_chain_t *filter;  // Filter function to run
+  cf_filter_data_t *data;               // Job and printer data
+  int           inputfd,                // Input of this stage
+                outputfd,               // Output of this stage
+                inputseekable;          // Is input stream seekable?
+  struct stat   inputst,                // Identity of input FD
+                outputst;               // Identity of output FD
+  cf_filter_data_t stagedata;           // Copy of data with the log
+                                        // function of this stage
+  filter_stage_log_t stagelog;          // Log function wrapper
+  cf_filter_stage_stats_t stats;        // Resource usage of this stage
+  pthread_t     thread;                 // Thread running the filter
+  int           started;                // Was the thread started?
+  int           status;                 // Return value of filter function
+} filter_function_thread_t;
+#endif // HAVE_PTHREAD_H
+
+
+//
+// Local globals...
+//
+
+#if defined(HAVE_PTHREAD_H) && defined(F_SETPIPE_SZ)
+static const int filter_chain_pipe_size = 1024 * 1024;
+					// Capacity of the pipes between the
+					// stages of a threaded filter chain
+#endif // HAVE_PTHREAD_H && F_SETPIPE_SZ
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t filter_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Protects the CF_FILTER_STATS_EXT
+					// records
+#endif // HAVE_PTHREAD_H
+
 
 //
 // 'fcntl_add_cloexec()' - Add FD_CLOEXEC flag to the flags
@@ -53,74 +161,791 @@ fcntl_add_cloexec(int fd) // File descriptor to add FD_CLOEXEC to
 }
 
 
+//
+// 'filter_pidfd_open()' - Get a file descriptor which becomes readable
+//                         when the given child process terminates and
+//                         keeps referring to it after it got reaped.
+//
+
+static int				// O - File descriptor or -1
+filter_pidfd_open(pid_t pid)		// I - Process ID
+{
+#ifdef SYS_pidfd_open
+  int	fd;				// Process file descriptor
+
+
+  if ((fd = (int)syscall(SYS_pidfd_open, pid, 0)) >= 0)
+    fcntl_add_cloexec(fd);
+
+  return (fd);
+#else
+  (void)pid;
+
+  return (-1);
+#endif // SYS_pidfd_open
+}
+
+
 //
 // 'fcntl_add_nonblock()' - Add O_NONBLOCK flag to the flags
 //                          of a given file descriptor.
 //
 
-static int                 // Return value of fcntl()
-fcntl_add_nonblock(int fd) // File descriptor to add O_NONBLOCK to
-{
-  return (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK));
+static int                 // Return value of fcntl()
+fcntl_add_nonblock(int fd) // File descriptor to add O_NONBLOCK to
+{
+  return (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK));
+}
+
+
+//
+// 'filter_chain_link()' - Create the connection between two filters
+//                         of a chain. If the first one writes and the
+//                         second one reads CUPS/PWG Raster via
+//                         cfRasterOpen() the pages are passed as
+//                         shared memory frames through a socket, so
+//                         they do not get encoded and parsed again,
+//                         otherwise we use a pipe.
+//
+
+static int                          // O - 0 on success, -1 on error
+filter_chain_link(cf_filter_function_t from,
+				    // I - Filter writing into the link
+		  cf_filter_function_t to,
+				    // I - Filter reading from the link
+		  int frames,       // I - Raster frames allowed?
+		  int fds[2],       // O - Read and write end
+		  int *framed)      // O - 1 if link uses raster frames
+{
+  static const cf_filter_function_t writers[] =
+  {					// Filters writing with cfRasterOpen()
+    cfFilterImageToRaster,
+    cfFilterPCLmToRaster,
+    cfFilterPWGToRaster,
+    cfFilterRasterToPWG
+  };
+  static const cf_filter_function_t readers[] =
+  {					// Filters reading with cfRasterOpen()
+    cfFilterPWGToPDF,
+    cfFilterPWGToRaster,
+    cfFilterRasterToPWG
+  };
+  int	i, j;
+
+
+  *framed = 0;
+
+  if (frames)
+  {
+    for (i = 0; i < (int)(sizeof(writers) / sizeof(writers[0])); i ++)
+      if (writers[i] == from)
+	break;
+    for (j = 0; j < (int)(sizeof(readers) / sizeof(readers[0])); j ++)
+      if (readers[j] == to)
+	break;
+    if (i < (int)(sizeof(writers) / sizeof(writers[0])) &&
+	j < (int)(sizeof(readers) / sizeof(readers[0])) &&
+	cfRasterFrameSocketPair(fds) == 0)
+    {
+      *framed = 1;
+      return (0);
+    }
+  }
+
+  if (pipe(fds) < 0)
+    return (-1);
+
+  fcntl_add_cloexec(fds[0]);
+  fcntl_add_cloexec(fds[1]);
+
+  return (0);
+}
+
+
+//
+// 'cfCUPSLogFunc()' - Output log messages on stderr, compatible to
+//                     CUPS, meaning that the debug level is
+//                     represented by a prefix like "DEBUG: ", "INFO:
+//                     ", ...
+//
+
+void
+cfCUPSLogFunc(void *data,
+	     cf_loglevel_t level,
+	     const char *message,
+	     ...)
+{
+  va_list arglist;
+
+
+  (void)data; // No extra data needed
+
+  switch(level)
+  {
+    case CF_LOGLEVEL_UNSPEC:
+    case CF_LOGLEVEL_DEBUG:
+    default:
+      fprintf(stderr, "DEBUG: ");
+      break;
+    case CF_LOGLEVEL_INFO:
+      fprintf(stderr, "INFO: ");
+      break;
+    case CF_LOGLEVEL_WARN:
+      fprintf(stderr, "WARN: ");
+      break;
+    case CF_LOGLEVEL_ERROR:
+    case CF_LOGLEVEL_FATAL:
+      fprintf(stderr, "ERROR: ");
+      break;
+    case CF_LOGLEVEL_CONTROL:
+      break;
+  }      
+  va_start(arglist, message);
+  vfprintf(stderr, message, arglist);
+  va_end(arglist);
+  fputc('\n', stderr);
+  fflush(stderr);
+}
+
+
+//
+// 'cfCUPSIsCanceledFunc()' - Return 1 if the job is canceled, which
+//                            is the case when the integer pointed at
+//                            by data is not zero.
+//
+
+int
+cfCUPSIsCanceledFunc(void *data)
+{
+  return (*((int *)data) != 0 ? 1 : 0);
+}
+
+
+//
+// 'cfFilterCancelNew()' - Create a cancellation token. Set
+//                         cfFilterCancelIsCanceled() as
+//                         iscanceledfunc and the token as
+//                         iscanceleddata of the filter data, then
+//                         cfFilterCancel() stops the job within
+//                         milliseconds, also in sub-processes and
+//                         external programs (Ghostscript, ...) the
+//                         filter functions are waiting on.
+//
+
+cf_filter_cancel_t *			// O - Cancellation token or NULL
+cfFilterCancelNew(void)
+{
+  cf_filter_cancel_t *token;		// Cancellation token
+
+
+  if ((token = calloc(1, sizeof(cf_filter_cancel_t))) == NULL)
+    return (NULL);
+
+#ifdef HAVE_SYS_EVENTFD_H
+  if ((token->fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) >= 0)
+  {
+    token->fds[1] = token->fds[0];
+    return (token);
+  }
+#endif // HAVE_SYS_EVENTFD_H
+
+  if (pipe(token->fds) < 0)
+  {
+    free(token);
+    return (NULL);
+  }
+
+  fcntl_add_cloexec(token->fds[0]);
+  fcntl_add_cloexec(token->fds[1]);
+  fcntl_add_nonblock(token->fds[0]);
+  fcntl_add_nonblock(token->fds[1]);
+
+  return (token);
+}
+
+
+//
+// 'cfFilterCancelDelete()' - Free a cancellation token.
+//
+
+void
+cfFilterCancelDelete(cf_filter_cancel_t *token) // I - Cancellation token
+{
+  if (!token)
+    return;
+
+  close(token->fds[0]);
+  if (token->fds[1] != token->fds[0])
+    close(token->fds[1]);
+  free(token);
+}
+
+
+//
+// 'cfFilterCancel()' - Cancel the job of a cancellation token. Can be
+//                      called from any thread or from a signal handler.
+//
+
+void
+cfFilterCancel(cf_filter_cancel_t *token) // I - Cancellation token
+{
+  uint64_t	one = 1;		// Value to add to the eventfd
+  ssize_t	bytes;
+
+
+  if (!token)
+    return;
+
+  // The descriptor is never read, so it stays readable from now on
+  do
+    bytes = write(token->fds[1], &one,
+		  token->fds[1] == token->fds[0] ? sizeof(one) : 1);
+  while (bytes < 0 && errno == EINTR);
+}
+
+
+//
+// 'cfFilterCancelIsCanceled()' - Return 1 if the job of the
+//                                cancellation token supplied as data
+//                                is canceled, to be used as
+//                                iscanceledfunc.
+//
+
+int					// O - 1 if canceled, 0 otherwise
+cfFilterCancelIsCanceled(void *data)	// I - Cancellation token
+{
+  cf_filter_cancel_t	*token = (cf_filter_cancel_t *)data;
+  struct pollfd		pfd;		// Token's descriptor
+
+
+  if (!token)
+    return (0);
+
+  pfd.fd     = token->fds[0];
+  pfd.events = POLLIN;
+
+  return (poll(&pfd, 1, 0) > 0 ? 1 : 0);
+}
+
+
+//
+// 'cfFilterCancelGetFd()' - Get a file descriptor which becomes
+//                           readable when the job gets canceled, for
+//                           waiting on it with poll() together with
+//                           the file descriptors a filter function
+//                           is blocking on. Returns -1 if the
+//                           is-canceled function is not
+//                           cfFilterCancelIsCanceled().
+//
+
+int					// O - File descriptor or -1
+cfFilterCancelGetFd(cf_filter_iscanceledfunc_t iscanceled,
+					// I - Is-canceled function
+		    void *icd)		// I - Is-canceled function data
+{
+  if (iscanceled != cfFilterCancelIsCanceled || !icd)
+    return (-1);
+
+  return (((cf_filter_cancel_t *)icd)->fds[0]);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// 'cancel_watch_thread()' - Wait for the job getting canceled or the
+//                           watch getting stopped, kill the watched
+//                           process in the former case.
+//
+// The callers reap the process before stopping the watch, so its PID can
+// already belong to another process when the job gets canceled.  The
+// signal goes through the process file descriptor therefore, which still
+// refers to the reaped process, only kernels without pidfd_open() get the
+// signal sent to the PID.
+//
+
+static void *				// O - Thread exit value (unused)
+cancel_watch_thread(void *arg)		// I - Watch
+{
+  cf_filter_cancel_watch_t *watch = (cf_filter_cancel_watch_t *)arg;
+  struct pollfd	pfds[2];		// Cancellation and stop descriptors
+
+
+  pfds[0].fd     = watch->cancelfd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = watch->stoppipe[0];
+  pfds[1].events = POLLIN;
+
+  while (poll(pfds, 2, -1) < 0 && errno == EINTR);
+
+  if (!pfds[1].revents && pfds[0].revents)
+  {
+#ifdef SYS_pidfd_send_signal
+    if (watch->pidfd >= 0)
+      syscall(SYS_pidfd_send_signal, watch->pidfd, SIGTERM, NULL, 0);
+    else
+#endif // SYS_pidfd_send_signal
+      kill(watch->pid, SIGTERM);
+  }
+
+  return (NULL);
+}
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'cfFilterCancelWatchPid()' - Send SIGTERM to the given child process
+//                              (renderer, ...) as soon as the job gets
+//                              canceled, also while the filter function
+//                              is blocked writing to or reading from
+//                              it. Returns NULL if this is not needed
+//                              as the is-canceled function is not
+//                              cfFilterCancelIsCanceled(), the filter
+//                              function has to poll then.
+//
+
+cf_filter_cancel_watch_t *		// O - Watch or NULL
+cfFilterCancelWatchPid(cf_filter_iscanceledfunc_t iscanceled,
+					// I - Is-canceled function
+		       void *icd,	// I - Is-canceled function data
+		       pid_t pid)	// I - Process to kill on cancel
+{
+#ifdef HAVE_PTHREAD_H
+  cf_filter_cancel_watch_t *watch;	// Watch
+  int		cancelfd;		// Cancellation descriptor
+
+
+  if (pid <= 0 || (cancelfd = cfFilterCancelGetFd(iscanceled, icd)) < 0 ||
+      (watch = calloc(1, sizeof(cf_filter_cancel_watch_t))) == NULL)
+    return (NULL);
+
+  watch->cancelfd = cancelfd;
+  watch->pid      = pid;
+  watch->pidfd    = filter_pidfd_open(pid);
+
+  if (pipe(watch->stoppipe) < 0)
+  {
+    if (watch->pidfd >= 0)
+      close(watch->pidfd);
+    free(watch);
+    return (NULL);
+  }
+
+  fcntl_add_cloexec(watch->stoppipe[0]);
+  fcntl_add_cloexec(watch->stoppipe[1]);
+
+  if (pthread_create(&watch->thread, NULL, cancel_watch_thread, watch))
+  {
+    close(watch->stoppipe[0]);
+    close(watch->stoppipe[1]);
+    if (watch->pidfd >= 0)
+      close(watch->pidfd);
+    free(watch);
+    return (NULL);
+  }
+
+  return (watch);
+#else
+  (void)iscanceled;
+  (void)icd;
+  (void)pid;
+
+  return (NULL);
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'cfFilterCancelUnwatch()' - Stop watching a process for cancellation,
+//                             to be called after it has terminated, it
+//                             can also have been reaped already.
+//
+
+void
+cfFilterCancelUnwatch(cf_filter_cancel_watch_t *watch) // I - Watch or NULL
+{
+#ifdef HAVE_PTHREAD_H
+  char	stop = 'S';			// Stop message
+
+
+  if (!watch)
+    return;
+
+  while (write(watch->stoppipe[1], &stop, 1) < 0 && errno == EINTR);
+  pthread_join(watch->thread, NULL);
+
+  close(watch->stoppipe[0]);
+  close(watch->stoppipe[1]);
+  if (watch->pidfd >= 0)
+    close(watch->pidfd);
+  free(watch);
+#else
+  (void)watch;
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'filter_memory_reserve()' - Reserve between min_bytes and max_bytes
+//                             of a memory budget.
+//
+
+static size_t				// O - Bytes reserved, 0 on failure
+filter_memory_reserve(cf_filter_memory_budget_t *budget, // I - Budget
+		      size_t min_bytes,	// I - Minimum to reserve
+		      size_t max_bytes)	// I - Maximum to reserve
+{
+  size_t	used,			// Bytes reserved by others
+		avail,			// Bytes available
+		bytes,			// Bytes to reserve
+		peak;			// Peak usage
+
+
+  used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+  do
+  {
+    avail = (used < budget->limit ? budget->limit - used : 0);
+    if (avail < min_bytes || max_bytes == 0)
+      return (0);
+    bytes = (max_bytes < avail ? max_bytes : avail);
+  }
+  while (!__atomic_compare_exchange_n(&budget->used, &used, used + bytes, 0,
+				      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  used += bytes;
+  peak = __atomic_load_n(&budget->peak, __ATOMIC_RELAXED);
+  while (used > peak &&
+	 !__atomic_compare_exchange_n(&budget->peak, &peak, used, 0,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  return (bytes);
+}
+
+
+//
+// 'filter_memory_spill()' - Allocate a buffer backed by a deleted
+//                           temporary file.
+//
+
+static filter_memory_block_t *		// O - Buffer or NULL on error
+filter_memory_spill(size_t size,	// I - Size of buffer
+		    cf_logfunc_t log,	// I - Log function
+		    void *ld)		// I - Log function data
+{
+  filter_memory_block_t	*block;		// New buffer
+  char		tempfile[1024];		// Temporary file name
+  int		fd;			// Temporary file
+
+
+  if ((fd = cupsCreateTempFd(NULL, NULL, tempfile, sizeof(tempfile))) < 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterMemoryAlloc: Unable to create temporary file: %s",
+		 strerror(errno));
+    return (NULL);
+  }
+  unlink(tempfile);
+  fcntl_add_cloexec(fd);
+
+  if (ftruncate(fd, (off_t)(sizeof(filter_memory_block_t) + size)) < 0 ||
+      (block = mmap(NULL, sizeof(filter_memory_block_t) + size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterMemoryAlloc: Unable to map temporary file: %s",
+		 strerror(errno));
+    close(fd);
+    return (NULL);
+  }
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterMemoryAlloc: Memory budget exhausted, buffering "
+	       "%zu bytes in a temporary file.", size);
+
+  block->b.size     = size;
+  block->b.reserved = 0;
+  block->b.budget   = NULL;
+  block->b.fd       = fd;
+
+  return (block);
+}
+
+
+//
+// 'cfFilterMemoryBudgetNew()' - Create a memory budget, to be added to
+//                               the filter data as extension
+//                               CF_FILTER_MEMORY_BUDGET_EXT.
+//
+
+cf_filter_memory_budget_t *		// O - Budget or NULL on error
+cfFilterMemoryBudgetNew(size_t limit)	// I - Maximum number of bytes
+{
+  cf_filter_memory_budget_t *budget;	// New budget
+
+
+  if ((budget = mmap(NULL, sizeof(cf_filter_memory_budget_t),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+		     0)) == MAP_FAILED)
+    return (NULL);
+
+  budget->limit = limit;
+  budget->used  = 0;
+  budget->peak  = 0;
+
+  return (budget);
+}
+
+
+//
+// 'cfFilterMemoryBudgetDelete()' - Delete a memory budget.
+//
+
+void
+cfFilterMemoryBudgetDelete(cf_filter_memory_budget_t *budget) // I - Budget
+{
+  if (budget)
+    munmap(budget, sizeof(cf_filter_memory_budget_t));
+}
+
+
+//
+// 'cfFilterMemoryBudgetGetPeak()' - Get the maximum number of bytes which
+//                                   were reserved from a memory budget.
+//
+
+size_t					// O - Peak usage in bytes
+cfFilterMemoryBudgetGetPeak(cf_filter_memory_budget_t *budget) // I - Budget
+{
+  return (budget ? __atomic_load_n(&budget->peak, __ATOMIC_RELAXED) : 0);
+}
+
+
+//
+// 'cfFilterMemoryAvailable()' - Get the number of bytes still available
+//                               in the job's memory budget.
+//
+
+size_t					// O - Bytes, SIZE_MAX without budget
+cfFilterMemoryAvailable(cf_filter_data_t *data) // I - Job and printer data
+{
+  cf_filter_memory_budget_t *budget;	// Memory budget
+  size_t	used;			// Bytes reserved
+
+
+  if ((budget = (cf_filter_memory_budget_t *)
+       cfFilterDataGetExt(data, CF_FILTER_MEMORY_BUDGET_EXT)) == NULL)
+    return (SIZE_MAX);
+
+  used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+  return (used < budget->limit ? budget->limit - used : 0);
+}
+
+
+//
+// 'cfFilterMemoryReserve()' - Reserve as much memory as available, but
+//                             between min_bytes and max_bytes, from the
+//                             job's memory budget.
+//
+
+size_t					// O - Bytes reserved, 0 if not even
+					//     min_bytes are available
+cfFilterMemoryReserve(cf_filter_data_t *data, // I - Job and printer data
+		      size_t min_bytes,	// I - Minimum to reserve
+		      size_t max_bytes)	// I - Maximum to reserve
+{
+  cf_filter_memory_budget_t *budget;	// Memory budget
+
+
+  if ((budget = (cf_filter_memory_budget_t *)
+       cfFilterDataGetExt(data, CF_FILTER_MEMORY_BUDGET_EXT)) == NULL)
+    return (max_bytes);
+
+  return (filter_memory_reserve(budget, min_bytes, max_bytes));
+}
+
+
+//
+// 'cfFilterMemoryRelease()' - Give memory reserved with
+//                             cfFilterMemoryReserve() back to the job's
+//                             memory budget.
+//
+
+void
+cfFilterMemoryRelease(cf_filter_data_t *data, // I - Job and printer data
+		      size_t bytes)	// I - Bytes to give back
+{
+  cf_filter_memory_budget_t *budget;	// Memory budget
+
+
+  if (bytes &&
+      (budget = (cf_filter_memory_budget_t *)
+       cfFilterDataGetExt(data, CF_FILTER_MEMORY_BUDGET_EXT)) != NULL)
+    __atomic_sub_fetch(&budget->used, bytes, __ATOMIC_ACQ_REL);
+}
+
+
+//
+// 'cfFilterMemoryAlloc()' - Allocate a zero-initialized buffer, from the
+//                           heap while within the job's memory budget,
+//                           otherwise backed by a temporary file.
+//
+
+void *					// O - Buffer or NULL on error
+cfFilterMemoryAlloc(cf_filter_data_t *data, // I - Job and printer data
+		    size_t size)	// I - Size of buffer
+{
+  cf_filter_memory_budget_t *budget;	// Memory budget
+  filter_memory_block_t	*block;		// New buffer
+  size_t	reserved = 0;		// Bytes reserved from budget
+
+
+  if (size > SIZE_MAX - sizeof(filter_memory_block_t))
+    return (NULL);
+
+  budget = (cf_filter_memory_budget_t *)
+           cfFilterDataGetExt(data, CF_FILTER_MEMORY_BUDGET_EXT);
+
+  if (budget && (reserved = filter_memory_reserve(budget, size, size)) == 0 &&
+      size > 0)
+  {
+    if ((block = filter_memory_spill(size, data ? data->logfunc : NULL,
+				     data ? data->logdata : NULL)) == NULL)
+      return (NULL);
+  }
+  else
+  {
+    if ((block = calloc(1, sizeof(filter_memory_block_t) + size)) == NULL)
+    {
+      if (reserved)
+	__atomic_sub_fetch(&budget->used, reserved, __ATOMIC_ACQ_REL);
+      return (NULL);
+    }
+
+    block->b.size     = size;
+    block->b.reserved = reserved;
+    block->b.budget   = budget;
+    block->b.fd       = -1;
+  }
+
+  return (block + 1);
+}
+
+
+//
+// 'cfFilterMemoryRealloc()' - Enlarge a buffer from cfFilterMemoryAlloc(),
+//                             moving it into a temporary file when the
+//                             job's memory budget is exhausted.
+//
+
+void *					// O - Buffer or NULL on error
+cfFilterMemoryRealloc(cf_filter_data_t *data, // I - Job and printer data
+		      void *ptr,	// I - Buffer or NULL
+		      size_t size)	// I - New size of buffer
+{
+  filter_memory_block_t	*block,		// Buffer
+			*newblock;	// Enlarged buffer
+  size_t	extra;			// Additional bytes
+
+
+  if (!ptr)
+    return (cfFilterMemoryAlloc(data, size));
+
+  block = (filter_memory_block_t *)ptr - 1;
+
+  if (size <= block->b.size)
+    return (ptr);
+
+  if (size > SIZE_MAX - sizeof(filter_memory_block_t))
+    return (NULL);
+
+  extra = size - block->b.size;
+
+  if (block->b.fd >= 0)
+  {
+    //
+    // Grow the temporary file and map it again...
+    //
+
+    if (ftruncate(block->b.fd,
+		  (off_t)(sizeof(filter_memory_block_t) + size)) < 0 ||
+	(newblock = mmap(NULL, sizeof(filter_memory_block_t) + size,
+			 PROT_READ | PROT_WRITE, MAP_SHARED, block->b.fd,
+			 0)) == MAP_FAILED)
+      return (NULL);
+
+    munmap(block, sizeof(filter_memory_block_t) + size - extra);
+    newblock->b.size = size;
+
+    return (newblock + 1);
+  }
+
+  if (!block->b.budget ||
+      filter_memory_reserve(block->b.budget, extra, extra) == extra)
+  {
+    //
+    // Still within the budget, grow on the heap...
+    //
+
+    if ((newblock = realloc(block, sizeof(filter_memory_block_t) +
+			    size)) == NULL)
+    {
+      if (block->b.budget)
+	__atomic_sub_fetch(&block->b.budget->used, extra, __ATOMIC_ACQ_REL);
+      return (NULL);
+    }
+
+    memset((char *)(newblock + 1) + newblock->b.size, 0, extra);
+    newblock->b.size = size;
+    if (newblock->b.budget)
+      newblock->b.reserved += extra;
+
+    return (newblock + 1);
+  }
+
+  //
+  // Budget exhausted, move the buffer into a temporary file...
+  //
+
+  if ((newblock = filter_memory_spill(size, data ? data->logfunc : NULL,
+				      data ? data->logdata : NULL)) == NULL)
+    return (NULL);
+
+  memcpy(newblock + 1, block + 1, block->b.size);
+  cfFilterMemoryFree(ptr);
+
+  return (newblock + 1);
 }
 
 
 //
-// 'cfCUPSLogFunc()' - Output log messages on stderr, compatible to
-//                     CUPS, meaning that the debug level is
-//                     represented by a prefix like "DEBUG: ", "INFO:
-//                     ", ...
+// 'cfFilterMemoryFree()' - Free a buffer from cfFilterMemoryAlloc() and
+//                          give its memory back to the budget.
 //
 
 void
-cfCUPSLogFunc(void *data,
-	     cf_loglevel_t level,
-	     const char *message,
-	     ...)
+cfFilterMemoryFree(void *ptr)		// I - Buffer or NULL
 {
-  va_list arglist;
-
+  filter_memory_block_t	*block;		// Buffer
+  int		fd;			// Temporary file
 
-  (void)data; // No extra data needed
-
-  switch(level)
-  {
-    case CF_LOGLEVEL_UNSPEC:
-    case CF_LOGLEVEL_DEBUG:
-    default:
-      fprintf(stderr, "DEBUG: ");
-      break;
-    case CF_LOGLEVEL_INFO:
-      fprintf(stderr, "INFO: ");
-      break;
-    case CF_LOGLEVEL_WARN:
-      fprintf(stderr, "WARN: ");
-      break;
-    case CF_LOGLEVEL_ERROR:
-    case CF_LOGLEVEL_FATAL:
-      fprintf(stderr, "ERROR: ");
-      break;
-    case CF_LOGLEVEL_CONTROL:
-      break;
-  }      
-  va_start(arglist, message);
-  vfprintf(stderr, message, arglist);
-  va_end(arglist);
-  fputc('\n', stderr);
-  fflush(stderr);
-}
 
+  if (!ptr)
+    return;
 
-//
-// 'cfCUPSIsCanceledFunc()' - Return 1 if the job is canceled, which
-//                            is the case when the integer pointed at
-//                            by data is not zero.
-//
+  block = (filter_memory_block_t *)ptr - 1;
 
-int
-cfCUPSIsCanceledFunc(void *data)
-{
-  return (*((int *)data) != 0 ? 1 : 0);
+  if (block->b.fd >= 0)
+  {
+    fd = block->b.fd;
+    munmap(block, sizeof(filter_memory_block_t) + block->b.size);
+    close(fd);
+  }
+  else
+  {
+    if (block->b.budget && block->b.reserved)
+      __atomic_sub_fetch(&block->b.budget->used, block->b.reserved,
+			 __ATOMIC_ACQ_REL);
+    free(block);
+  }
 }
 
 
@@ -231,6 +1056,287 @@ cfFilterDataRemoveExt(cf_filter_data_t *data,
 }
 
 
+//
+// 'cfFilterStatsClear()' - Free the per-filter statistics collected
+//                          in a cf_filter_stats_t record, so that it
+//                          can be re-used or freed.
+//
+
+void
+cfFilterStatsClear(cf_filter_stats_t *stats) // I - Statistics record
+{
+  int i;
+
+
+  if (!stats)
+    return;
+
+  for (i = 0; i < stats->num_stages; i ++)
+    free(stats->stages[i].name);
+  free(stats->stages);
+
+  stats->num_stages = 0;
+  stats->stages     = NULL;
+}
+
+
+//
+// 'external_log_line()' - Log a line which an external filter has
+//                         written to stderr, with the log level
+//                         given by its prefix, and count the pages.
+//
+
+static void
+external_log_line(cf_logfunc_t log,	// I - Log function
+		  void *ld,		// I - Log function data
+		  const char *filter_name,
+					// I - Filter name for logging
+		  char *buf,		// I - Line
+		  int *pages)		// IO - Number of "PAGE: " lines
+{
+  cf_loglevel_t	log_level;		// Log level of filter's log message
+  char		*msg;			// Filter log message
+
+
+  if (strncmp(buf, "DEBUG: ", 7) == 0)
+  {
+    log_level = CF_LOGLEVEL_DEBUG;
+    msg = buf + 7;
+  }
+  else if (strncmp(buf, "DEBUG2: ", 8) == 0)
+  {
+    log_level = CF_LOGLEVEL_DEBUG;
+    msg = buf + 8;
+  }
+  else if (strncmp(buf, "INFO: ", 6) == 0)
+  {
+    log_level = CF_LOGLEVEL_INFO;
+    msg = buf + 6;
+  }
+  else if (strncmp(buf, "WARNING: ", 9) == 0)
+  {
+    log_level = CF_LOGLEVEL_WARN;
+    msg = buf + 9;
+  }
+  else if (strncmp(buf, "ERROR: ", 7) == 0)
+  {
+    log_level = CF_LOGLEVEL_ERROR;
+    msg = buf + 7;
+  }
+  else if (strncmp(buf, "PAGE: ", 6) == 0 ||
+	   strncmp(buf, "ATTR: ", 6) == 0 ||
+	   strncmp(buf, "STATE: ", 7) == 0 ||
+	   strncmp(buf, "PPD: ", 5) == 0)
+  {
+    log_level = CF_LOGLEVEL_CONTROL;
+    msg = buf;
+    if (!strncmp(buf, "PAGE: ", 6) && isdigit(buf[6] & 255))
+      (*pages) ++;
+  }
+  else
+  {
+    log_level = CF_LOGLEVEL_DEBUG;
+    msg = buf;
+  }
+
+  if (!log)
+    return;
+
+  if (log_level == CF_LOGLEVEL_CONTROL)
+    log(ld, log_level, "%s", msg);
+  else
+    log(ld, log_level, "cfFilterExternal (%s): %s", filter_name, msg);
+}
+
+
+//
+// 'get_time()' - Get the time of the given clock in seconds.
+//
+
+static double				// O - Time in seconds
+get_time(clockid_t clock)		// I - Clock to read
+{
+  struct timespec ts;			// Current time
+
+
+  if (clock_gettime(clock, &ts))
+    return (0.0);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'read_io_counters()' - Read the characters read and written by a
+//                        process or thread from its "io" file in
+//                        /proc.
+//
+
+static void
+read_io_counters(const char *path,	// I - "io" file to read
+		 long long *rchar,	// O - Bytes read, -1 if unknown
+		 long long *wchar)	// O - Bytes written, -1 if unknown
+{
+  FILE		*fp;			// "io" file
+  char		line[256];		// Line from file
+
+
+  *rchar = -1;
+  *wchar = -1;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return;
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (!strncmp(line, "rchar: ", 7))
+      *rchar = strtoll(line + 7, NULL, 10);
+    else if (!strncmp(line, "wchar: ", 7))
+      *wchar = strtoll(line + 7, NULL, 10);
+  }
+
+  fclose(fp);
+}
+
+
+//
+// 'stage_log_func()' - Log function used for the filters in a chain
+//                      to count the "PAGE: " messages before passing
+//                      the messages on to the original log function.
+//
+
+static void
+stage_log_func(void *data,		// I - Log function wrapper
+	       cf_loglevel_t level,	// I - Log level
+	       const char *message,	// I - printf-style message
+	       ...)			// I - Additional arguments
+{
+  filter_stage_log_t *stagelog = (filter_stage_log_t *)data;
+  va_list	arglist;		// Argument list
+  char		buf[2048],		// Formatted message
+		*msg = buf;		// Message to pass on
+  int		len;			// Length of message
+
+
+  va_start(arglist, message);
+  len = vsnprintf(buf, sizeof(buf), message, arglist);
+  va_end(arglist);
+
+  if (len >= (int)sizeof(buf) && (msg = malloc(len + 1)) != NULL)
+  {
+    va_start(arglist, message);
+    vsnprintf(msg, len + 1, message, arglist);
+    va_end(arglist);
+  }
+  else if (msg == NULL)
+    msg = buf;
+
+  if (level == CF_LOGLEVEL_CONTROL && !strncmp(msg, "PAGE: ", 6) &&
+      isdigit(msg[6] & 255))
+    stagelog->pages ++;
+
+  if (stagelog->logfunc)
+    stagelog->logfunc(stagelog->logdata, level, "%s", msg);
+
+  if (msg != buf)
+    free(msg);
+}
+
+
+//
+// 'filter_stats_report()' - Log the statistics of the filters run by a
+//                           filter function as a JSON line and append
+//                           them to the CF_FILTER_STATS_EXT extension
+//                           of the filter data if present.
+//
+
+static void
+filter_stats_report(cf_filter_data_t *data,
+					// I - Job and printer data
+		    const char *caller,	// I - Reporting function
+		    cf_filter_stage_stats_t *stages,
+					// I - Statistics of the filters
+		    int num_stages)	// I - Number of filters
+{
+  cf_filter_stats_t *ext;		// Statistics extension
+  cf_filter_stage_stats_t *temp;	// Re-allocated statistics
+  cf_logfunc_t	log = data->logfunc;
+  void		*ld = data->logdata;
+  char		*line, *ptr;		// JSON line
+  const char	*name;			// Name of the filter
+  size_t	linesize;		// Size of JSON line
+  int		i;
+
+
+  if (num_stages <= 0)
+    return;
+
+  if (log)
+  {
+    for (i = 0, linesize = 3; i < num_stages; i ++)
+      linesize += 256 + 2 * (stages[i].name ? strlen(stages[i].name) : 20);
+
+    if ((line = (char *)malloc(linesize)) != NULL)
+    {
+      ptr = line;
+      *ptr++ = '[';
+      for (i = 0; i < num_stages; i ++)
+      {
+	ptr += snprintf(ptr, linesize - (ptr - line), "%s{\"name\":\"",
+			i ? "," : "");
+	for (name = stages[i].name ? stages[i].name : "Unspecified filter";
+	     *name; name ++)
+	{
+	  if (*name == '\"' || *name == '\\')
+	    *ptr++ = '\\';
+	  *ptr++ = *name;
+	}
+	ptr += snprintf(ptr, linesize - (ptr - line),
+			"\",\"wall\":%.3f,\"cpu\":%.3f,\"maxrss\":%ld,"
+			"\"in\":%lld,\"out\":%lld,\"pages\":%d,\"status\":%d}",
+			stages[i].wall_time, stages[i].cpu_time,
+			stages[i].max_rss, stages[i].bytes_in,
+			stages[i].bytes_out, stages[i].pages,
+			stages[i].status);
+      }
+      *ptr++ = ']';
+      *ptr   = '\0';
+
+      log(ld, CF_LOGLEVEL_INFO, "%s: Statistics: %s", caller, line);
+      free(line);
+    }
+  }
+
+  if ((ext = (cf_filter_stats_t *)cfFilterDataGetExt(data,
+						      CF_FILTER_STATS_EXT)) ==
+      NULL)
+    return;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&filter_stats_mutex);
+#endif // HAVE_PTHREAD_H
+
+  if ((temp = (cf_filter_stage_stats_t *)
+       realloc(ext->stages, (ext->num_stages + num_stages) *
+	       sizeof(cf_filter_stage_stats_t))) != NULL)
+  {
+    ext->stages = temp;
+    for (i = 0; i < num_stages; i ++)
+    {
+      temp = ext->stages + ext->num_stages + i;
+      *temp      = stages[i];
+      temp->name = strdup(stages[i].name ? stages[i].name :
+			  "Unspecified filter");
+    }
+    ext->num_stages += num_stages;
+  }
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock(&filter_stats_mutex);
+#endif // HAVE_PTHREAD_H
+}
+
+
 //
 // 'cfFilterGetEnvVar()' - Auxiliary function for cfFilterExternal(),
 //                         gets value of an environment variable in a
@@ -258,60 +1364,343 @@ cfFilterGetEnvVar(char *name,	// I - Name of environment variable to read
 
 
 //
-// 'cfFilterAddEnvVar()' - Auxiliary function for cfFilterExternal(),
-//                   adds/sets an environment variable in a list of
-//                   environment variables as used by the execve()
-//                   function
+// 'cfFilterAddEnvVar()' - Auxiliary function for cfFilterExternal(),
+//                   adds/sets an environment variable in a list of
+//                   environment variables as used by the execve()
+//                   function
+//
+
+int				// O - Index of where the new value got
+				//     inserted in the list
+cfFilterAddEnvVar(char *name,   // I - Name of environment variable to set
+		  char *value,  // I - Value of environment variable to set
+		  char ***env)  // I - List of environment variable serttings
+{
+  char *p;
+  int i = 0,
+      name_len;
+
+
+  if (!name || !env || !name[0])
+    return (-1);
+
+  // Assemble a "VAR=VALUE" string and the string length of "VAR"
+  if ((p = strchr(name, '=')) != NULL)
+  {
+    // User supplied "VAR=VALUE" as name and NULL as value
+    if (value)
+      return (-1);
+    name_len = p - name;
+    p = strdup(name);
+  }
+  else
+  {
+    // User supplied variable name and value as the name and as the value
+    name_len = strlen(name);
+    p = (char *)calloc(strlen(name) + (value ? strlen(value) : 0) + 2,
+		       sizeof(char));
+    sprintf(p, "%s=%s", name, (value ? value : ""));
+  }
+
+  // Check whether we already have this variable in the list and update its
+  // value if it is there
+  if (*env)
+    for (i = 0; (*env)[i]; i ++)
+      if (strncmp((*env)[i], p, name_len) == 0 && (*env)[i][name_len] == '=')
+      {
+	free((*env)[i]);
+	(*env)[i] = p;
+	return (i);
+      }
+
+  // Add the variable as new item to the list
+  *env = (char **)realloc(*env, (i + 2) * sizeof(char *));
+  (*env)[i] = p;
+  (*env)[i + 1] = NULL;
+  return (i);
+}
+
+
+//
+// 'copy_data_buffered()' - Copy data from one file descriptor to
+//                          another (and optionally to a "tee"
+//                          file) through a user-space buffer.
+//
+
+static int				// O - 0 on success, 1 on read or write
+					//     error on the main stream
+copy_data_buffered(int inputfd,		// I - Input file descriptor
+		   int outputfd,	// I - Output file descriptor
+		   int *teefd,		// IO - Copy file descriptor or -1,
+					//      closed and set to -1 on error
+		   ssize_t *total,	// IO - Total bytes passed on
+		   const char *prefix,	// I - Prefix for log messages
+		   cf_logfunc_t log,	// I - Log function
+		   void *ld)		// I - Log function data
+{
+  ssize_t	bytes;			// Bytes read/written
+  char		buffer[65536];		// Read/write buffer
+
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    *total += bytes;
+    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		 "%s: Passing on%s %d bytes, total %lld bytes.",
+		 prefix, *teefd >= 0 ? " and copying" : "", (int)bytes,
+		 (long long)*total);
+
+    if (*teefd >= 0)
+      if (write(*teefd, buffer, (size_t)bytes) != bytes)
+      {
+	if (log) log(ld, CF_LOGLEVEL_ERROR,
+		     "%s: Unable to write %d bytes to the copy, stopping copy, continuing job output.",
+		     prefix, (int)bytes);
+	close(*teefd);
+	*teefd = -1;
+      }
+
+    if (write(outputfd, buffer, (size_t)bytes) != bytes)
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "%s: Unable to pass on %d bytes: %s",
+		   prefix, (int)bytes, strerror(errno));
+      return (1);
+    }
+  }
+
+  if (bytes < 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "%s: Data read error: %s", prefix, strerror(errno));
+    return (1);
+  }
+
+  return (0);
+}
+
+
+//
+// 'copy_data()' - Copy data from one file descriptor to another (and
+//                 optionally to a "tee" file) without copying it
+//                 through user space where the kernel supports it.
+//
+// Depending on the file descriptor types splice(), tee(),
+// copy_file_range(), or sendfile() are used. When the kernel refuses
+// the zero-copy transfer (for example EINVAL for unsupported file
+// types or file systems) the remaining data is copied with
+// copy_data_buffered(). The method used is reported via the log
+// function.
 //
 
-int				// O - Index of where the new value got
-				//     inserted in the list
-cfFilterAddEnvVar(char *name,   // I - Name of environment variable to set
-		  char *value,  // I - Value of environment variable to set
-		  char ***env)  // I - List of environment variable serttings
+static int				// O - 0 on success, 1 on read or write
+					//     error on the main stream
+copy_data(int inputfd,			// I - Input file descriptor
+	  int outputfd,			// I - Output file descriptor
+	  int *teefd,			// IO - Copy file descriptor or -1,
+					//      closed and set to -1 on error
+	  const char *prefix,		// I - Prefix for log messages
+	  cf_logfunc_t log,		// I - Log function
+	  void *ld)			// I - Log function data
 {
-  char *p;
-  int i = 0,
-      name_len;
+  ssize_t	total = 0;		// Total bytes passed on
+  const char	*method = "read/write";	// Method used for the transfer
+  int		ret;			// Return value
+#if defined(HAVE_SPLICE) || defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+  ssize_t	bytes,			// Bytes transferred in one call
+		teebytes;		// Bytes still to be copied to tee file
+  struct stat	inputst,		// Type of input
+		outputst;		// Type of output
+  const size_t	chunk = 1024 * 1024;	// Bytes to request per call
+  int		in_pipe, out_pipe,	// Input/output are pipes?
+		in_reg, out_reg;	// Input/output are regular files?
+
+
+  if (fstat(inputfd, &inputst) || fstat(outputfd, &outputst))
+    goto buffered;
+
+  in_pipe  = S_ISFIFO(inputst.st_mode);
+  out_pipe = S_ISFIFO(outputst.st_mode);
+  in_reg   = S_ISREG(inputst.st_mode);
+  out_reg  = S_ISREG(outputst.st_mode);
+  bytes    = 0;
+
+  if (*teefd >= 0)
+  {
+#  if defined(HAVE_TEE) && defined(HAVE_SPLICE)
+    //
+    // Duplicate the data from the input pipe into the output pipe with
+    // tee(), then move the same amount from the input pipe into the
+    // copy file with splice()...
+    //
 
+    if (!in_pipe || !out_pipe)
+      goto buffered;
 
-  if (!name || !env || !name[0])
-    return (-1);
+    method = "tee/splice";
+    while (*teefd >= 0)
+    {
+      while ((bytes = tee(inputfd, outputfd, chunk, 0)) < 0 && errno == EINTR);
+      if (bytes <= 0)
+	break;
 
-  // Assemble a "VAR=VALUE" string and the string length of "VAR"
-  if ((p = strchr(name, '=')) != NULL)
+      total += bytes;
+      for (teebytes = bytes; teebytes > 0;)
+      {
+	ssize_t moved = splice(inputfd, NULL, *teefd, NULL, teebytes,
+			       SPLICE_F_MOVE | SPLICE_F_MORE);
+	if (moved < 0 && errno == EINTR)
+	  continue;
+	if (moved <= 0)
+	{
+	  // Could not write the copy, drop the data already passed on
+	  // to the output from the input pipe and continue without copy
+	  char	buffer[4096];		// Buffer for dropped data
+
+	  if (log) log(ld, CF_LOGLEVEL_ERROR,
+		       "%s: Unable to write %d bytes to the copy, stopping copy, continuing job output.",
+		       prefix, (int)teebytes);
+	  close(*teefd);
+	  *teefd = -1;
+	  while (teebytes > 0 &&
+		 (moved = read(inputfd, buffer,
+			       teebytes < (ssize_t)sizeof(buffer) ?
+			       (size_t)teebytes : sizeof(buffer))) > 0)
+	    teebytes -= moved;
+	  break;
+	}
+	teebytes -= moved;
+      }
+    }
+
+    if (bytes < 0)
+    {
+      if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+	goto buffered;
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "%s: Data transfer error: %s", prefix, strerror(errno));
+      ret = 1;
+      goto done;
+    }
+    if (bytes == 0)
+    {
+      ret = 0;
+      goto done;
+    }
+
+    // Copy file got closed on error, pass on the rest without copy
+    method = "tee/splice, then splice";
+#  else
+    goto buffered;
+#  endif // HAVE_TEE && HAVE_SPLICE
+  }
+
+  if (in_pipe || out_pipe)
   {
-    // User supplied "VAR=VALUE" as name and NULL as value
-    if (value)
-      return (-1);
-    name_len = p - name;
-    p = strdup(name);
+#  ifdef HAVE_SPLICE
+    //
+    // At least one side is a pipe, move the data with splice()...
+    //
+
+    if (*teefd < 0 && total == 0)
+      method = "splice";
+    do
+    {
+      while ((bytes = splice(inputfd, NULL, outputfd, NULL, chunk,
+			     SPLICE_F_MOVE | SPLICE_F_MORE)) < 0 &&
+	     errno == EINTR);
+      if (bytes > 0)
+	total += bytes;
+    }
+    while (bytes > 0);
+#  else
+    goto buffered;
+#  endif // HAVE_SPLICE
+  }
+  else if (in_reg && out_reg)
+  {
+#  ifdef HAVE_COPY_FILE_RANGE
+    //
+    // File to file, let the file system copy (or reflink) the data...
+    //
+
+    method = "copy_file_range";
+    do
+    {
+      while ((bytes = copy_file_range(inputfd, NULL, outputfd, NULL, chunk,
+				      0)) < 0 && errno == EINTR);
+      if (bytes > 0)
+	total += bytes;
+    }
+    while (bytes > 0);
+#  else
+    goto buffered;
+#  endif // HAVE_COPY_FILE_RANGE
+  }
+  else if (in_reg)
+  {
+#  ifdef HAVE_SENDFILE
+    //
+    // From a file into a socket or device...
+    //
+
+    method = "sendfile";
+    do
+    {
+      while ((bytes = sendfile(outputfd, inputfd, NULL, chunk)) < 0 &&
+	     errno == EINTR);
+      if (bytes > 0)
+	total += bytes;
+    }
+    while (bytes > 0);
+#  else
+    goto buffered;
+#  endif // HAVE_SENDFILE
   }
   else
+    goto buffered;
+
+  if (bytes < 0)
   {
-    // User supplied variable name and value as the name and as the value
-    name_len = strlen(name);
-    p = (char *)calloc(strlen(name) + (value ? strlen(value) : 0) + 2,
-		       sizeof(char));
-    sprintf(p, "%s=%s", name, (value ? value : ""));
+    if (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+	errno == EOPNOTSUPP || errno == ESPIPE || errno == EBADF)
+    {
+      //
+      // The kernel does not support this transfer for these files,
+      // the file positions are where the zero-copy transfer stopped, so
+      // continue with read()/write()...
+      //
+
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "%s: Zero-copy transfer with %s not possible (%s) after %lld bytes, falling back to read/write.",
+		   prefix, method, strerror(errno), (long long)total);
+      goto buffered;
+    }
+
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "%s: Data transfer error: %s", prefix, strerror(errno));
+    ret = 1;
+    goto done;
   }
 
-  // Check whether we already have this variable in the list and update its
-  // value if it is there
-  if (*env)
-    for (i = 0; (*env)[i]; i ++)
-      if (strncmp((*env)[i], p, name_len) == 0 && (*env)[i][name_len] == '=')
-      {
-	free((*env)[i]);
-	(*env)[i] = p;
-	return (i);
-      }
+  ret = 0;
+  goto done;
 
-  // Add the variable as new item to the list
-  *env = (char **)realloc(*env, (i + 2) * sizeof(char *));
-  (*env)[i] = p;
-  (*env)[i + 1] = NULL;
-  return (i);
+ buffered:
+  if (total > 0)
+    method = "zero-copy, then read/write";
+#endif // HAVE_SPLICE || HAVE_COPY_FILE_RANGE || HAVE_SENDFILE
+
+  ret = copy_data_buffered(inputfd, outputfd, teefd, &total, prefix, log, ld);
+
+#if defined(HAVE_SPLICE) || defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+ done:
+#endif // HAVE_SPLICE || HAVE_COPY_FILE_RANGE || HAVE_SENDFILE
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "%s: Passed on %lld bytes using %s.",
+	       prefix, (long long)total, method);
+
+  return (ret);
 }
 
 
@@ -340,12 +1729,12 @@ cfFilterTee(int inputfd,            // I - File descriptor input stream
                                     //     name)
 {
   const char           *filename = (const char *)parameters;
-  ssize_t	       bytes, total = 0;      // Bytes read/written
-  char	               buffer[65536];         // Read/write buffer
   cf_logfunc_t         log = data->logfunc;   // Log function
   void                 *ld = data->logdata;   // log function data
   int                  teefd = -1;            // File descriptor for "tee"ed
                                               // copy
+  char                 prefix[1024];          // Prefix for log messages
+  int                  ret;
 
 
   (void)inputseekable;
@@ -354,44 +1743,15 @@ cfFilterTee(int inputfd,            // I - File descriptor input stream
   if (filename)
     teefd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
 
-  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
-  {
-    total += bytes;
-    if (log)
-      log(ld, CF_LOGLEVEL_DEBUG,
-	  "cfFilterTee (%s): Passing on%s %d bytes, total %d bytes.",
-	  filename, teefd >= 0 ? " and copying" : "", bytes, total);
-
-    if (teefd >= 0)
-      if (write(teefd, buffer, (size_t)bytes) != bytes)
-      {
-	if (log)
-	  log(ld, CF_LOGLEVEL_ERROR,
-	      "cfFilterTee (%s): Unable to write %d bytes to the copy, stopping copy, continuing job output.",
-	      filename, (int)bytes);
-	close(teefd);
-	teefd = -1;
-      }
-
-    if (write(outputfd, buffer, (size_t)bytes) != bytes)
-    {
-      if (log)
-	log(ld, CF_LOGLEVEL_ERROR,
-	    "cfFilterTee (%s): Unable to pass on %d bytes.",
-	    filename, (int)bytes);
-      if (teefd >= 0)
-	close(teefd);
-      close(inputfd);
-      close(outputfd);
-      return (1);
-    }
-  }
+  snprintf(prefix, sizeof(prefix), "cfFilterTee (%s)",
+	   filename ? filename : "(null)");
+  ret = copy_data(inputfd, outputfd, &teefd, prefix, log, ld);
 
   if (teefd >= 0)
     close(teefd);
   close(inputfd);
   close(outputfd);
-  return (0);
+  return (ret);
 }
 
 
@@ -545,68 +1905,361 @@ cfFilterPOpen(cf_filter_function_t filter_func,
 //                      cfFilterPOpen().
 //
 
-int                                // O - Error status
-cfFilterPClose(int fd,             // I - Pipe file descriptor
-	       int filter_pid,     // I - PID of forked filter process
-	       cf_filter_data_t *data)
-{
-  int		status,		 // Exit status
-                retval;		 // Return value
-  cf_logfunc_t log = data->logfunc;
-  void          *ld = data->logdata;
+int                                // O - Error status
+cfFilterPClose(int fd,             // I - Pipe file descriptor
+	       int filter_pid,     // I - PID of forked filter process
+	       cf_filter_data_t *data)
+{
+  int		status,		 // Exit status
+                retval;		 // Return value
+  cf_logfunc_t log = data->logfunc;
+  void          *ld = data->logdata;
+
+
+  //
+  // close the stream...
+  //
+
+  close(fd);
+
+  //
+  // Wait for the child process to exit...
+  //
+
+  retval = 0;
+
+ retry_wait:
+  if (waitpid (filter_pid, &status, 0) == -1)
+  {
+    if (errno == EINTR)
+      goto retry_wait;
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG,
+	  "cfFilterPClose: Filter function (PID %d) stopped with an error: %s!",
+	  filter_pid, strerror(errno));
+    goto out;
+  }
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+               "cfFilterPClose: Filter function (PID %d) exited with no errors.",
+               filter_pid);
+
+  // How did the filter function terminate
+  if (WIFEXITED(status))
+    // Via exit() anywhere or return() in the main() function
+    retval = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    // Via signal
+    retval = 256 * WTERMSIG(status);
+
+ out:
+  return (retval);
+}
+
+
+//
+// 'compare_filter_pids()' - Compare two filter PIDs...
+//
+
+static int					// O - Result of comparison
+compare_filter_pids(filter_function_pid_t *a,	// I - First filter
+		    filter_function_pid_t *b)	// I - Second filter
+{
+  return (a->pid - b->pid);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// 'close_if_unchanged()' - Close a file descriptor of a threaded
+//                          filter chain stage if it still refers to
+//                          the file it referred to when the chain was
+//                          set up.
+//
+// Filter functions usually close their input and output themselves,
+// but not all of them do. In a forked chain this does not matter as
+// the process exit closes everything, in a threaded chain we must
+// close left-over descriptors to give the neighbouring stages their
+// EOF or EPIPE. A descriptor number which got closed by the filter
+// function can get re-used by another thread meanwhile, we only close
+// it if it still refers to the same file. For the pipes between the
+// stages this is safe, no one else opens them. The input and output of
+// the chain can be files which another thread opens again, as another
+// job of a filter worker (see cfFilterWorkerServe()) printing the same
+// file does, and then such a descriptor gets closed by mistake, so
+// filter functions should not rely on this and close their input and
+// output themselves.
+//
+
+static void
+close_if_unchanged(int fd,		// I - File descriptor
+		   struct stat *orig)	// I - Original identity of fd
+{
+  struct stat	st;			// Current identity of fd
+
+
+  if (fd > 1 && fstat(fd, &st) == 0 &&
+      st.st_dev == orig->st_dev && st.st_ino == orig->st_ino)
+    close(fd);
+}
+
+
+//
+// 'filter_chain_thread()' - Run one filter function of a threaded
+//                           filter chain.
+//
+
+static void *				// O - Thread exit value (unused)
+filter_chain_thread(void *arg)		// I - Filter chain stage
+{
+  filter_function_thread_t *stage = (filter_function_thread_t *)arg;
+  cf_logfunc_t	log = stage->data->logfunc;
+  void		*ld = stage->data->logdata;
+  struct rusage	usage;			// Resource usage of the process
+  double	start;			// Time when the filter got started
+
+
+  //
+  // Give the filter function its own copy of the filter data with a
+  // log function counting its pages...
+  //
+
+  stage->stagedata         = *stage->data;
+  stage->stagelog.logfunc  = log;
+  stage->stagelog.logdata  = ld;
+  stage->stagelog.pages    = 0;
+  stage->stagedata.logfunc = stage_log_func;
+  stage->stagedata.logdata = &stage->stagelog;
+
+  start = get_time(CLOCK_MONOTONIC);
+
+  stage->status = (stage->filter->function)(stage->inputfd, stage->outputfd,
+					    stage->inputseekable,
+					    &stage->stagedata,
+					    stage->filter->parameters);
+
+  close_if_unchanged(stage->inputfd, &stage->inputst);
+  close_if_unchanged(stage->outputfd, &stage->outputst);
+
+  //
+  // Per-thread resource usage, RSS is only available for the whole
+  // process...
+  //
+
+  stage->stats.name      = stage->filter->name;
+  stage->stats.wall_time = get_time(CLOCK_MONOTONIC) - start;
+  stage->stats.cpu_time  = get_time(CLOCK_THREAD_CPUTIME_ID);
+  stage->stats.pages     = stage->stagelog.pages;
+  stage->stats.status    = stage->status;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    stage->stats.max_rss = usage.ru_maxrss;
+  read_io_counters("/proc/thread-self/io", &stage->stats.bytes_in,
+		   &stage->stats.bytes_out);
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterChain: %s completed with status %d.",
+	       stage->filter->name ? stage->filter->name :
+	       "Unspecified filter", stage->status);
+
+  return (NULL);
+}
+
+
+//
+// 'filter_chain_threaded()' - Run the filter functions of a filter
+//                             chain in threads of the calling process
+//                             instead of forked sub-processes
+//
+// The stages are connected by pipes, which are bounded in-kernel ring
+// buffers, so the filter functions keep their file descriptor based
+// interface. Filter functions running in the same process share all
+// global state, so only filter functions which do not call exit() and
+// do not keep per-job data in global variables can be run this way.
+//
+
+static int				// O - Error status
+filter_chain_threaded(int inputfd,	// I - File descriptor input stream
+		      int outputfd,	// I - File descriptor output stream
+		      int inputseekable,// I - Is input stream seekable?
+		      cf_filter_data_t *data,
+					// I - Job and printer data
+		      cups_array_t *filter_chain,
+					// I - Filters to run
+		      int frames)	// I - Raster frames allowed?
+{
+  filter_function_thread_t *stages;	// Stages of the chain
+  cf_filter_stage_stats_t *stats;	// Statistics of the stages
+  cf_filter_filter_in_chain_t *filter;	// Current filter
+  int		i,			// Looping var
+		num_stages,		// Number of stages
+		pipefds[2],		// Pipe between two stages
+		framed,			// Link uses raster frames?
+		retval = 0;		// Return value
+  cf_logfunc_t	log = data->logfunc;
+  void		*ld = data->logdata;
+
+
+  num_stages = cupsArrayGetCount(filter_chain);
+  if ((stages = (filter_function_thread_t *)
+       calloc(num_stages, sizeof(filter_function_thread_t))) == NULL)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterChain: Could not allocate memory for threaded filter chain");
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  //
+  // Create all file descriptors of the chain before starting any
+  // thread, see close_if_unchanged()...
+  //
+
+  if (inputfd < 0)
+    inputfd = open("/dev/null", O_RDONLY);
+  if (outputfd < 0)
+    outputfd = open("/dev/null", O_WRONLY);
+
+  for (i = 0, filter =
+	 (cf_filter_filter_in_chain_t *)cupsArrayGetFirst(filter_chain);
+       filter;
+       i ++, filter =
+	 (cf_filter_filter_in_chain_t *)cupsArrayGetNext(filter_chain))
+    stages[i].filter = filter;
+
+  for (i = 0; i < num_stages; i ++)
+  {
+    filter                  = stages[i].filter;
+    stages[i].data          = data;
+    stages[i].inputfd       = (i == 0 ? inputfd : stages[i].inputfd);
+    stages[i].inputseekable = (i == 0 ? inputseekable : 0);
+
+    if (i < num_stages - 1)
+    {
+      if (filter_chain_link(filter->function, stages[i + 1].filter->function,
+			    frames, pipefds, &framed) < 0)
+      {
+	if (log) log(ld, CF_LOGLEVEL_ERROR,
+		     "cfFilterChain: Could not create pipe for output of %s: %s",
+		     filter->name ? filter->name : "Unspecified filter",
+		     strerror(errno));
+	stages[i].outputfd = -1;
+	if (outputfd > 1)
+	  close(outputfd);
+	retval = 1;
+	break;
+      }
+#ifdef F_SETPIPE_SZ
+      if (!framed)
+	fcntl(pipefds[1], F_SETPIPE_SZ, filter_chain_pipe_size);
+#endif // F_SETPIPE_SZ
+      if (framed && log)
+	log(ld, CF_LOGLEVEL_DEBUG,
+	    "cfFilterChain: Passing raster pages from %s to %s as shared memory frames.",
+	    filter->name ? filter->name : "Unspecified filter",
+	    stages[i + 1].filter->name ? stages[i + 1].filter->name :
+	    "Unspecified filter");
+      stages[i].outputfd      = pipefds[1];
+      stages[i + 1].inputfd   = pipefds[0];
+    }
+    else
+      stages[i].outputfd = outputfd;
+
+    fstat(stages[i].inputfd, &stages[i].inputst);
+    fstat(stages[i].outputfd, &stages[i].outputst);
+  }
+
+  //
+  // Start the filter functions...
+  //
+
+  if (!retval)
+  {
+    for (i = 0; i < num_stages; i ++)
+    {
+      filter = stages[i].filter;
+
+      if (pthread_create(&stages[i].thread, NULL, filter_chain_thread,
+			 stages + i))
+      {
+	if (log) log(ld, CF_LOGLEVEL_ERROR,
+		     "cfFilterChain: Could not create thread to start %s: %s",
+		     filter->name ? filter->name : "Unspecified filter",
+		     strerror(errno));
+	retval = 1;
+	break;
+      }
+
+      stages[i].started = 1;
 
+      if (log) log(ld, CF_LOGLEVEL_INFO,
+		   "cfFilterChain: %s (thread) started.",
+		   filter->name ? filter->name : "Unspecified filter");
+    }
+  }
 
   //
-  // close the stream...
+  // Close the descriptors of the stages which did not get started, so
+  // that the running ones get EOF or EPIPE and terminate...
   //
 
-  close(fd);
+  for (i = 0; i < num_stages; i ++)
+    if (!stages[i].started)
+    {
+      if (stages[i].inputfd > 1)
+	close(stages[i].inputfd);
+      if (stages[i].outputfd > 1)
+	close(stages[i].outputfd);
+    }
 
   //
-  // Wait for the child process to exit...
+  // Wait for the filter functions to finish. There is no way to kill
+  // a thread as we do with hanging filter processes, cancellation is
+  // left to the filter functions polling data->iscanceledfunc...
   //
 
-  retval = 0;
-
- retry_wait:
-  if (waitpid (filter_pid, &status, 0) == -1)
+  for (i = 0; i < num_stages; i ++)
   {
-    if (errno == EINTR)
-      goto retry_wait;
-    if (log)
-      log(ld, CF_LOGLEVEL_DEBUG,
-	  "cfFilterPClose: Filter function (PID %d) stopped with an error: %s!",
-	  filter_pid, strerror(errno));
-    goto out;
-  }
+    if (!stages[i].started)
+      continue;
 
-  if (log) log(ld, CF_LOGLEVEL_DEBUG,
-               "cfFilterPClose: Filter function (PID %d) exited with no errors.",
-               filter_pid);
+    filter = stages[i].filter;
+    pthread_join(stages[i].thread, NULL);
 
-  // How did the filter function terminate
-  if (WIFEXITED(status))
-    // Via exit() anywhere or return() in the main() function
-    retval = WEXITSTATUS(status);
-  else if (WIFSIGNALED(status))
-    // Via signal
-    retval = 256 * WTERMSIG(status);
+    if (stages[i].status)
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterChain: %s (thread) stopped with status %d",
+		   filter->name ? filter->name : "Unspecified filter",
+		   stages[i].status);
+      retval = 1;
+    }
+    else
+    {
+      if (log) log(ld, CF_LOGLEVEL_INFO,
+		   "cfFilterChain: %s (thread) exited with no errors.",
+		   filter->name ? filter->name : "Unspecified filter");
+    }
+  }
 
- out:
-  return (retval);
-}
+  //
+  // Report the resource usage of the stages...
+  //
 
+  if ((stats = (cf_filter_stage_stats_t *)
+       calloc(num_stages, sizeof(cf_filter_stage_stats_t))) != NULL)
+  {
+    for (i = 0; i < num_stages && stages[i].started; i ++)
+      stats[i] = stages[i].stats;
+    filter_stats_report(data, "cfFilterChain", stats, i);
+    free(stats);
+  }
 
-//
-// 'compare_filter_pids()' - Compare two filter PIDs...
-//
+  free(stages);
 
-static int					// O - Result of comparison
-compare_filter_pids(filter_function_pid_t *a,	// I - First filter
-		    filter_function_pid_t *b)	// I - Second filter
-{
-  return (a->pid - b->pid);
+  return (retval);
 }
+#endif // HAVE_PTHREAD_H
 
 
 //
@@ -614,6 +2267,11 @@ compare_filter_pids(filter_function_pid_t *a,	// I - First filter
 //                     format conversion which non of the individual
 //                     filter functions does
 //
+// By default each filter function is run in its own forked
+// sub-process. With the option "filter-chain-threads=true" the
+// filter functions are run in threads of the calling process instead,
+// saving the fork() overhead for each stage.
+//
 
 int                                // O - Error status
 cfFilterChain(int inputfd,         // I - File descriptor input stream
@@ -627,21 +2285,30 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
   cf_filter_filter_in_chain_t *filter,  // Current filter
 		*next;		     // Next filter
   int		current,	     // Current filter
+		stage,		     // Position of current filter in chain
+		num_stages,	     // Number of filters in chain
 		filterfds[2][2],     // Pipes for filters
+		statspipe[2],	     // Pipe for statistics of the filters
 		pid,		     // Process ID of filter
 		status,		     // Exit status
 		retval,		     // Return value
-		ret;
+		ret,
+		frames,		     // Raster frames allowed?
+		framed,		     // Link uses raster frames?
+		cancelfd;	     // Cancellation token's descriptor
   int		infd, outfd;         // Temporary file descriptors
-  char          buf[4096];
-  ssize_t       bytes;
   cups_array_t	*pids;		     // Executed filters array
-  filter_function_pid_t	*pid_entry,  // Entry in executed filters array
-		key;		     // Search key for filters
+  filter_function_pid_t	*pid_entry;  // Entry in executed filters array
+  cf_filter_stage_stats_t *stats;    // Statistics of the filters
+  int		*stage_pids;	     // PIDs of the filters
+  filter_stage_log_t stagelog;	     // Log function wrapper of a filter
+  filter_stage_report_t report;	     // Statistics report of a filter
+  struct rusage	usage;		     // Resource usage of a filter
   cf_logfunc_t log = data->logfunc;
   void          *ld = data->logdata;
   cf_filter_iscanceledfunc_t iscanceled = data->iscanceledfunc;
   void          *icd = data->iscanceleddata;
+  const char    *val;
 
 
   //
@@ -679,34 +2346,67 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
 
   if (cupsArrayGetCount(filter_chain) == 0)
   {
+    int teefd = -1;			// No copy
+
     if (log) log(ld, CF_LOGLEVEL_INFO,
 		 "cfFilterChain: No filter at all in chain, passing through the data.");
-    while ((bytes = read(inputfd, buf, sizeof(buf))) > 0)
-      if (write(outputfd, buf, bytes) < bytes)
-      {
-	if (log) log(ld, CF_LOGLEVEL_ERROR,
-		     "cfFilterChain: Data write error: %s", strerror(errno));
-	retval = 1;
-	break;
-      }
-    if (bytes < 0)
-    {
-      if (log) log(ld, CF_LOGLEVEL_ERROR,
-		     "cfFilterChain: Data read error: %s", strerror(errno));
-      retval = 1;
-    }
+    retval = copy_data(inputfd, outputfd, &teefd, "cfFilterChain", log, ld);
     close(inputfd);
     close(outputfd);
     return (retval);
   }
 
+  //
+  // Pass raster pages between suitable filters as shared memory
+  // frames unless turned off...
+  //
+
+  frames = ((val = cupsGetOption("filter-chain-raster-frames",
+				 data->num_options, data->options)) == NULL ||
+	    (strcasecmp(val, "false") && strcasecmp(val, "off") &&
+	     strcasecmp(val, "no")));
+
+  //
+  // Run the filters in threads instead of sub-processes if requested...
+  //
+
+  if ((val = cupsGetOption("filter-chain-threads", data->num_options,
+			   data->options)) != NULL &&
+      (!strcasecmp(val, "true") || !strcasecmp(val, "on") ||
+       !strcasecmp(val, "yes")))
+  {
+#ifdef HAVE_PTHREAD_H
+    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		 "cfFilterChain: Running the filters in threads.");
+    return (filter_chain_threaded(inputfd, outputfd, inputseekable, data,
+				  filter_chain, frames));
+#else
+    if (log) log(ld, CF_LOGLEVEL_WARN,
+		 "cfFilterChain: Threads not supported, running the filters in sub-processes.");
+#endif // HAVE_PTHREAD_H
+  }
+
   //
   // Execute all of the filters...
   //
 
+  num_stages      = cupsArrayGetCount(filter_chain);
+  stats           = (cf_filter_stage_stats_t *)
+                    calloc(num_stages, sizeof(cf_filter_stage_stats_t));
+  stage_pids      = (int *)calloc(num_stages, sizeof(int));
+  if (pipe(statspipe) < 0)
+    statspipe[0] = statspipe[1] = -1;
+  else
+  {
+    fcntl_add_cloexec(statspipe[0]);
+    fcntl_add_cloexec(statspipe[1]);
+    fcntl_add_nonblock(statspipe[0]);
+  }
+
   pids            = cupsArrayNew((cups_array_cb_t)compare_filter_pids, NULL,
 				 NULL, 0, NULL, NULL);
   current         = 0;
+  stage           = 0;
   filterfds[0][0] = inputfd;
   filterfds[0][1] = -1;
   filterfds[1][0] = -1;
@@ -714,7 +2414,7 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
 
   for (filter = (cf_filter_filter_in_chain_t *)cupsArrayGetFirst(filter_chain);
        filter;
-       filter = next, current = 1 - current)
+       filter = next, current = 1 - current, stage ++)
   {
     next = (cf_filter_filter_in_chain_t *)cupsArrayGetNext(filter_chain);
 
@@ -731,16 +2431,21 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
 
     if (next)
     {
-      if (pipe(filterfds[1 - current]) < 0)
+      if (filter_chain_link(filter->function, next->function, frames,
+			    filterfds[1 - current], &framed) < 0)
       {
 	if (log) log(ld, CF_LOGLEVEL_ERROR,
 		     "cfFilterChain: Could not create pipe for output of %s: %s",
 		     filter->name ? filter->name : "Unspecified filter",
 		     strerror(errno));
-	return (1);
+	retval = 1;
+	break;
       }
-      fcntl_add_cloexec(filterfds[1 - current][0]);
-      fcntl_add_cloexec(filterfds[1 - current][1]);
+      if (framed && log)
+	log(ld, CF_LOGLEVEL_DEBUG,
+	    "cfFilterChain: Passing raster pages from %s to %s as shared memory frames.",
+	    filter->name ? filter->name : "Unspecified filter",
+	    next->name ? next->name : "Unspecified filter");
     }
     else
       filterfds[1 - current][1] = outputfd;
@@ -767,14 +2472,41 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
 	outfd = open("/dev/null", O_WRONLY);
 
       //
-      // Execute filter function...
+      // Execute filter function, counting its pages...
       //
 
+      stagelog.logfunc = log;
+      stagelog.logdata = ld;
+      stagelog.pages   = 0;
+      data->logfunc    = stage_log_func;
+      data->logdata    = &stagelog;
+
       ret = (filter->function)(infd, outfd, inputseekable, data,
 			       filter->parameters);
 
+      data->logfunc    = log;
+      data->logdata    = ld;
+
       close(infd);
       close(outfd);
+
+      //
+      // Tell the parent about the pages and the I/O, CPU time and
+      // memory it gets from wait4()...
+      //
+
+      if (statspipe[1] >= 0)
+      {
+	report.pid   = getpid();
+	report.pages = stagelog.pages;
+	read_io_counters("/proc/self/io", &report.bytes_in, &report.bytes_out);
+	if (write(statspipe[1], &report, sizeof(report)) < 0 && log)
+	  log(ld, CF_LOGLEVEL_DEBUG,
+	      "cfFilterChain: Could not report statistics of %s: %s",
+	      filter->name ? filter->name : "Unspecified filter",
+	      strerror(errno));
+      }
+
       if (log) log(ld, CF_LOGLEVEL_DEBUG,
 		   "cfFilterChain: %s completed with status %d.",
 		   filter->name ? filter->name : "Unspecified filter", ret);
@@ -790,7 +2522,19 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
       pid_entry = malloc(sizeof(filter_function_pid_t));
       pid_entry->pid = pid;
       pid_entry->name = filter->name ? filter->name : "Unspecified filter";
+      pid_entry->stage = stage;
+      pid_entry->start = get_time(CLOCK_MONOTONIC);
       cupsArrayAdd(pids, pid_entry);
+
+      if (stats)
+      {
+	stats[stage].name      = pid_entry->name;
+	stats[stage].bytes_in  = -1;
+	stats[stage].bytes_out = -1;
+	stats[stage].status    = -1;
+      }
+      if (stage_pids)
+	stage_pids[stage] = pid;
     }
     else
     {
@@ -816,6 +2560,8 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
     close(filterfds[1][0]);
   if (filterfds[1][1] > 1)
     close(filterfds[1][1]);
+  if (statspipe[1] >= 0)
+    close(statspipe[1]);
 
   //
   // Start dynamic timeout clock on first filter exit.  When a filter
@@ -826,8 +2572,35 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
   time_t first_exit_time = 0;
   while (cupsArrayGetCount(pids) > 0)
   {
-    pid = waitpid(-1, &status, WNOHANG);
-    if (pid == 0)
+    //
+    // Only reap our own filters, a filter worker runs the chains of
+    // several jobs in the same process...
+    //
+
+    for (pid = 0, pid_entry = (filter_function_pid_t *)cupsArrayGetFirst(pids);
+	 pid_entry;
+	 pid_entry = (filter_function_pid_t *)cupsArrayGetNext(pids))
+    {
+      if ((pid = wait4(pid_entry->pid, &status, WNOHANG, &usage)) > 0 ||
+	  (pid < 0 && errno == ECHILD))
+	break;
+      pid = 0;
+    }
+
+    if (pid <= 0 && iscanceled && iscanceled(icd))
+    {
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "cfFilterChain: Job canceled, killing filters ...");
+      for (pid_entry = (filter_function_pid_t *)cupsArrayGetFirst(pids);
+	   pid_entry;
+	   pid_entry = (filter_function_pid_t *)cupsArrayGetNext(pids))
+      {
+	kill(pid_entry->pid, SIGTERM);
+	free(pid_entry);
+      }
+      break;
+    }
+    else if (pid == 0)
     {
       if (first_exit_time && (time(NULL) - first_exit_time) > 60)
       {
@@ -842,66 +2615,108 @@ cfFilterChain(int inputfd,         // I - File descriptor input stream
 	}
 	break;
       }
-      sleep(1);
+      // Wait a second, but wake up right away on cancellation
+      if ((cancelfd = cfFilterCancelGetFd(iscanceled, icd)) >= 0)
+      {
+	struct pollfd pfd;		// Cancellation token's descriptor
+
+	pfd.fd     = cancelfd;
+	pfd.events = POLLIN;
+	poll(&pfd, 1, 1000);
+      }
+      else
+	sleep(1);
       continue;
     }
     else if (pid < 0)
     {
-      if (errno == EINTR && iscanceled && iscanceled(icd))
-      {
-	if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		     "cfFilterChain: Job canceled, killing filters ...");
-	for (pid_entry = (filter_function_pid_t *)cupsArrayGetFirst(pids);
-	     pid_entry;
-	     pid_entry = (filter_function_pid_t *)cupsArrayGetNext(pids))
-        {
-	  kill(pid_entry->pid, SIGTERM);
-	  free(pid_entry);
-	}
-	break;
-      }
-      else
-	continue;
+      //
+      // Someone else reaped the filter, its exit status is lost...
+      //
+
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterChain: %s (PID %d) exited without reporting a "
+		   "status", pid_entry->name, pid_entry->pid);
+      cupsArrayRemove(pids, pid_entry);
+      free(pid_entry);
+      retval = 1;
+      if (!first_exit_time)
+	first_exit_time = time(NULL);
     }
     else
     {
-      key.pid = pid;
-      if ((pid_entry = (filter_function_pid_t *)cupsArrayFind(pids, &key)) != NULL)
+      cupsArrayRemove(pids, pid_entry);
+      if (stats)
       {
-	cupsArrayRemove(pids, pid_entry);
-	if (status)
-        {
-	  if (WIFEXITED(status))
-          {
-	    if (log) log(ld, CF_LOGLEVEL_ERROR,
-			 "cfFilterChain: %s (PID %d) stopped with status %d",
-			 pid_entry->name, pid, WEXITSTATUS(status));
-	    if (WEXITSTATUS(status))
-	      retval = 1;
-	  }
-	  else
-          {
-	    if (log) log(ld, CF_LOGLEVEL_ERROR,
-			 "cfFilterChain: %s (PID %d) crashed on signal %d",
-			 pid_entry->name, pid, WTERMSIG(status));
-	  }
-	  retval = 1;
+	stats[pid_entry->stage].wall_time =
+	  get_time(CLOCK_MONOTONIC) - pid_entry->start;
+	stats[pid_entry->stage].cpu_time =
+	  usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+	  usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+	stats[pid_entry->stage].max_rss = usage.ru_maxrss;
+	stats[pid_entry->stage].status =
+	  (WIFEXITED(status) ? WEXITSTATUS(status) :
+	   256 * WTERMSIG(status));
+      }
+      if (status)
+      {
+	if (WIFEXITED(status))
+	{
+	  if (log) log(ld, CF_LOGLEVEL_ERROR,
+		       "cfFilterChain: %s (PID %d) stopped with status %d",
+		       pid_entry->name, pid, WEXITSTATUS(status));
+	  if (WEXITSTATUS(status))
+	    retval = 1;
 	}
 	else
-        {
-	  if (log) log(ld, CF_LOGLEVEL_INFO,
-		       "cfFilterChain: %s (PID %d) exited with no errors.",
-		       pid_entry->name, pid);
+	{
+	  if (log) log(ld, CF_LOGLEVEL_ERROR,
+		       "cfFilterChain: %s (PID %d) crashed on signal %d",
+		       pid_entry->name, pid, WTERMSIG(status));
 	}
-	free(pid_entry);
-	if (retval && !first_exit_time)
-	  first_exit_time = time(NULL);
+	retval = 1;
+      }
+      else
+      {
+	if (log) log(ld, CF_LOGLEVEL_INFO,
+		     "cfFilterChain: %s (PID %d) exited with no errors.",
+		     pid_entry->name, pid);
       }
+      free(pid_entry);
+      if (retval && !first_exit_time)
+	first_exit_time = time(NULL);
     }
   }
 
   cupsArrayDelete(pids);
 
+  //
+  // Collect the pages and I/O reported by the filters and report the
+  // statistics of the chain...
+  //
+
+  if (statspipe[0] >= 0)
+  {
+    while (read(statspipe[0], &report, sizeof(report)) ==
+	   (ssize_t)sizeof(report))
+      for (current = 0; stats && stage_pids && current < stage; current ++)
+	if (stage_pids[current] == report.pid)
+	{
+	  stats[current].pages     = report.pages;
+	  stats[current].bytes_in  = report.bytes_in;
+	  stats[current].bytes_out = report.bytes_out;
+	  break;
+	}
+    close(statspipe[0]);
+  }
+
+  if (stats)
+  {
+    filter_stats_report(data, "cfFilterChain", stats, stage);
+    free(stats);
+  }
+  free(stage_pids);
+
   return (retval);
 }
 
@@ -975,18 +2790,20 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
   int           i;
   int           is_backend = 0;      // Do we call a CUPS backend?
   int		pid,		     // Process ID of filter
-                stderrpid,           // Process ID for stderr logging process
+                pidfd = -1,          // Process file descriptor of filter
                 wpid;                // PID reported as terminated
   int		fd;		     // Temporary file descriptor
   int           backfd, sidefd;      // file descriptors for back and side
                                      // channels
-  int           stderrpipe[2];       // Pipe to log stderr
-  cups_file_t   *fp;                 // File pointer to read log lines
+  int           stderrpipe[2],       // Pipe to log stderr
+                stderrfd = -1;       // Our end of the pipe
+  int           cancelfd;            // Cancellation token's descriptor
+  struct pollfd pfds[3];             // Descriptors to wait on
+  int           nfds;                // Number of descriptors to wait on
   char          tmp_name[BUFSIZ] = "";
   char          buf[2048];           // Log line buffer
-  cf_loglevel_t log_level;           // Log level of filter's log message
+  size_t        buflen = 0;          // Bytes in log line buffer
   char          *ptr1, *ptr2,
-                *msg,                // Filter log message
                 *filter_name;        // Filter name for logging
   char          filter_path[1024];   // Full path of the filter
   char          **argv = NULL,		     // Command line args for filter
@@ -999,6 +2816,11 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
   cups_option_t *opt;
   int           status = 65536;
   int           wstatus;
+  struct rusage usage;               // Resource usage of the filter
+  cf_filter_stage_stats_t stats;     // Statistics of the filter
+  double        start = 0.0,         // Time when the filter got started
+                kill_time = 0.0,     // Time when we killed the filter
+                exit_time = 0.0;     // Time when the filter got reaped
   cf_logfunc_t  log = data->logfunc;
   void          *ld = data->logdata;
   cf_filter_iscanceledfunc_t iscanceled = data->iscanceledfunc;
@@ -1413,6 +3235,13 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
     if (log) log(ld, CF_LOGLEVEL_INFO,
 		 "cfFilterExternal (%s): %s (PID %d) started.",
 		 filter_name, filter_path, pid);
+    start = get_time(CLOCK_MONOTONIC);
+    memset(&stats, 0, sizeof(stats));
+    stats.name      = filter_name;
+    stats.bytes_in  = -1;
+    stats.bytes_out = -1;
+    stats.pages     = -1;
+    stats.status    = -1;
   }
   else
   {
@@ -1429,117 +3258,145 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
     close(inputfd);
   if (outputfd >= 0)
     close(outputfd);
+  close(stderrpipe[1]);
+  stderrfd = stderrpipe[0];
+  fcntl_add_cloexec(stderrfd);
+  fcntl_add_nonblock(stderrfd);
 
   //
-  // Log the filter's stderr
+  // Supervise the filter: Log its stderr, watch for it terminating
+  // and for the job getting canceled, all in one loop, without extra
+  // process for logging. If the kernel supports process file
+  // descriptors we get woken up immediately when the filter exits,
+  // otherwise we poll for its exit status.
   //
 
-  if ((stderrpid = fork()) == 0)
+  pidfd = filter_pidfd_open(pid);
+  cancelfd = cfFilterCancelGetFd(iscanceled, icd);
+  stats.pages = 0;
+  status = 0;
+
+  while (pid > 0 || stderrfd >= 0)
   {
+    nfds = 0;
+    if (stderrfd >= 0)
+    {
+      pfds[nfds].fd     = stderrfd;
+      pfds[nfds].events = POLLIN;
+      nfds ++;
+    }
+    if (pid > 0 && pidfd >= 0)
+    {
+      pfds[nfds].fd     = pidfd;
+      pfds[nfds].events = POLLIN;
+      nfds ++;
+    }
+    if (pid > 0 && cancelfd >= 0 && !kill_time)
+    {
+      pfds[nfds].fd     = cancelfd;
+      pfds[nfds].events = POLLIN;
+      nfds ++;
+    }
+
+    // A killed filter can leave children behind which still hold its
+    // stderr, so after it got reaped we do not wait for them forever
+    if (poll(pfds, nfds,
+	     (pid > 0 && (pidfd < 0 || kill_time ||
+			  (iscanceled && cancelfd < 0))) ||
+	     (pid <= 0 && kill_time) ? 100 : -1) < 0 &&
+	errno != EINTR && errno != EAGAIN)
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterExternal (%s): Unable to wait for %s: %s",
+		   filter_name, params->exec_mode > 0 ? "backend" : "filter",
+		   strerror(errno));
+      break;
+    }
+
     //
-    // Child process goes here...
+    // Log the complete lines the filter has written to stderr...
     //
 
-    close(stderrpipe[1]);
-    fp = cupsFileOpenFd(stderrpipe[0], "r");
-    while (cupsFileGets(fp, buf, sizeof(buf)))
-      if (log)
+    while (stderrfd >= 0)
+    {
+      ssize_t bytes = read(stderrfd, buf + buflen, sizeof(buf) - 1 - buflen);
+
+      if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+	break;
+
+      if (bytes > 0)
+	buflen += (size_t)bytes;
+
+      buf[buflen] = '\0';
+      ptr1 = buf;
+      while ((ptr2 = strchr(ptr1, '\n')) != NULL)
       {
-	if (strncmp(buf, "DEBUG: ", 7) == 0)
-	{
-	  log_level = CF_LOGLEVEL_DEBUG;
-	  msg = buf + 7;
-	}
-	else if (strncmp(buf, "DEBUG2: ", 8) == 0)
-	{
-	  log_level = CF_LOGLEVEL_DEBUG;
-	  msg = buf + 8;
-	}
-	else if (strncmp(buf, "INFO: ", 6) == 0)
-	{
-	  log_level = CF_LOGLEVEL_INFO;
-	  msg = buf + 6;
-	}
-	else if (strncmp(buf, "WARNING: ", 9) == 0)
-	{
-	  log_level = CF_LOGLEVEL_WARN;
-	  msg = buf + 9;
-	}
-	else if (strncmp(buf, "ERROR: ", 7) == 0)
-	{
-	  log_level = CF_LOGLEVEL_ERROR;
-	  msg = buf + 7;
-	}
-	else if (strncmp(buf, "PAGE: ", 6) == 0 ||
-		 strncmp(buf, "ATTR: ", 6) == 0 ||
-		 strncmp(buf, "STATE: ", 7) == 0 ||
-		 strncmp(buf, "PPD: ", 5) == 0)
-	{
-	  log_level = CF_LOGLEVEL_CONTROL;
-	  msg = buf;
-	}
-	else
+	*ptr2 = '\0';
+	external_log_line(log, ld, filter_name, ptr1, &stats.pages);
+	ptr1 = ptr2 + 1;
+      }
+
+      if (bytes <= 0 || (ptr1 == buf && buflen == sizeof(buf) - 1))
+      {
+	// EOF, error, or line too long for the buffer
+	if (*ptr1)
+	  external_log_line(log, ld, filter_name, ptr1, &stats.pages);
+	buflen = 0;
+	if (bytes <= 0)
 	{
-	  log_level = CF_LOGLEVEL_DEBUG;
-	  msg = buf;
+	  close(stderrfd);
+	  stderrfd = -1;
 	}
-	if (log_level == CF_LOGLEVEL_CONTROL)
-	  log(ld, log_level, msg);
-	else
-	  log(ld, log_level, "cfFilterExternal (%s): %s",
-	      filter_name, msg);
       }
-    cupsFileClose(fp);
-    // No need to close the fd stderrpipe[0], as cupsFileClose(fp) does this
-    // already
-    // Ignore errors of the logging process
-    exit(0);
-  }
-  else if (stderrpid > 0)
-  {
-    if (log) log(ld, CF_LOGLEVEL_INFO,
-		 "cfFilterExternal (%s): Logging (PID %d) started.",
-		 filter_name, stderrpid);
-  }
-  else
-  {
-    if (log) log(ld, CF_LOGLEVEL_ERROR,
-		 "cfFilterExternal (%s): Unable to fork process for logging",
-		 filter_name);
-    close(stderrpipe[0]);
-    close(stderrpipe[1]);
-    status = 1;
-    goto out;
-  }
-
-  close(stderrpipe[0]);
-  close(stderrpipe[1]);
+      else
+      {
+	buflen -= (size_t)(ptr1 - buf);
+	memmove(buf, ptr1, buflen);
+      }
+    }
 
-  //
-  // Wait for filter and logging processes to finish
-  //
+    if (pid <= 0 && kill_time && stderrfd >= 0 &&
+	get_time(CLOCK_MONOTONIC) - exit_time > 1.0)
+    {
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "cfFilterExternal (%s): Stderr of killed %s still open, closing it ...",
+		   filter_name, params->exec_mode > 0 ? "backend" : "filter");
+      close(stderrfd);
+      stderrfd = -1;
+    }
 
-  status = 0;
+    //
+    // Cancel the job if requested...
+    //
 
-  while (pid > 0 || stderrpid > 0)
-  {
-    if ((wpid = wait(&wstatus)) < 0)
+    if (pid > 0 && iscanceled && iscanceled(icd))
     {
-      if (errno == EINTR && iscanceled && iscanceled(icd))
+      if (!kill_time)
       {
 	if (log) log(ld, CF_LOGLEVEL_DEBUG,
 		     "cfFilterExternal (%s): Job canceled, killing %s ...",
 		     filter_name, params->exec_mode > 0 ? "backend" : "filter");
 	kill(pid, SIGTERM);
-	pid = -1;
-	kill(stderrpid, SIGTERM);
-	stderrpid = -1;
-	break;
+	kill_time = get_time(CLOCK_MONOTONIC);
+      }
+      else if (kill_time > 0.0 &&
+	       get_time(CLOCK_MONOTONIC) - kill_time > 5.0)
+      {
+	if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		     "cfFilterExternal (%s): %s did not stop, killing it hard ...",
+		     filter_name, params->exec_mode > 0 ? "Backend" : "Filter");
+	kill(pid, SIGKILL);
+	kill_time = -1.0;
       }
-      else
-	continue;
     }
 
+    //
+    // Check whether the filter has terminated...
+    //
+
+    if (pid <= 0 || (wpid = wait4(pid, &wstatus, WNOHANG, &usage)) != pid)
+      continue;
+
     // How did the filter terminate
     if (wstatus)
     {
@@ -1549,21 +3406,18 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
 	if (log) log(ld, CF_LOGLEVEL_ERROR,
 		     "cfFilterExternal (%s): %s (PID %d) stopped with status %d",
 		     filter_name,
-		     (wpid == pid ?
-		      (params->exec_mode > 0 ? "Backend" : "Filter") :
-		      "Logging"),
+		     (params->exec_mode > 0 ? "Backend" : "Filter"),
 		     wpid, WEXITSTATUS(wstatus));
       }
       else
       {
 	// Via signal
-	if (log) log(ld, CF_LOGLEVEL_ERROR,
-		     "cfFilterExternal (%s): %s (PID %d) crashed on signal %d",
+	if (log) log(ld, kill_time ? CF_LOGLEVEL_DEBUG : CF_LOGLEVEL_ERROR,
+		     "cfFilterExternal (%s): %s (PID %d) %s on signal %d",
 		     filter_name,
-		     (wpid == pid ?
-		      (params->exec_mode > 0 ? "Backend" : "Filter") :
-		      "Logging"),
-		     wpid, WTERMSIG(wstatus));
+		     (params->exec_mode > 0 ? "Backend" : "Filter"),
+		     wpid, kill_time ? "stopped" : "crashed",
+		     WTERMSIG(wstatus));
       }
       status = 1;
     }
@@ -1572,14 +3426,35 @@ cfFilterExternal(int inputfd,              // I - File descriptor input stream
       if (log) log(ld, CF_LOGLEVEL_INFO,
 		   "cfFilterExternal (%s): %s (PID %d) exited with no errors.",
 		   filter_name,
-		   (wpid == pid ?
-		    (params->exec_mode > 0 ? "Backend" : "Filter") : "Logging"),
+		   (params->exec_mode > 0 ? "Backend" : "Filter"),
 		   wpid);
     }
-    if (wpid == pid)
-      pid = -1;
-    else  if (wpid == stderrpid)
-      stderrpid = -1;
+
+    stats.wall_time = get_time(CLOCK_MONOTONIC) - start;
+    stats.cpu_time  = usage.ru_utime.tv_sec +
+		      usage.ru_utime.tv_usec / 1000000.0 +
+		      usage.ru_stime.tv_sec +
+		      usage.ru_stime.tv_usec / 1000000.0;
+    stats.max_rss   = usage.ru_maxrss;
+    stats.status    = (WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) :
+		       256 * WTERMSIG(wstatus));
+    exit_time       = get_time(CLOCK_MONOTONIC);
+    pid = -1;
+  }
+
+  if (stderrfd >= 0)
+    close(stderrfd);
+  if (pidfd >= 0)
+    close(pidfd);
+
+  //
+  // Report the resource usage of the filter
+  //
+
+  if (start > 0.0)
+  {
+    snprintf(buf, sizeof(buf), "cfFilterExternal (%s)", filter_name);
+    filter_stats_report(data, buf, &stats, 1);
   }
 
   //
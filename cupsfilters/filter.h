@@ -52,6 +52,18 @@ extern "C" {
 
 typedef int (*cf_filter_iscanceledfunc_t)(void *data);
 
+typedef struct cf_filter_cancel_s cf_filter_cancel_t;
+					// Cancellation token, see
+					// cfFilterCancelNew()
+
+typedef struct cf_filter_cancel_watch_s cf_filter_cancel_watch_t;
+					// Process to kill on cancellation,
+					// see cfFilterCancelWatchPid()
+
+typedef struct cf_filter_memory_budget_s cf_filter_memory_budget_t;
+					// Job-wide memory budget, see
+					// cfFilterMemoryBudgetNew()
+
 typedef struct cf_filter_data_s
 {
   char *printer;             // Print queue name or NULL
@@ -90,6 +102,34 @@ typedef struct cf_filter_data_ext_s
   void *ext;
 } cf_filter_data_ext_t;
 
+typedef struct cf_filter_stage_stats_s // Resource usage of one filter
+				       // function or external filter
+{
+  char       *name;          // Name of the filter
+  double     wall_time;      // Elapsed time in seconds
+  double     cpu_time;       // User + system CPU time in seconds
+  long       max_rss;        // Peak resident set size in kB (of the
+			     // whole process for threaded filters)
+  long long  bytes_in;       // Bytes read by the filter, as accounted
+			     // by the kernel, -1 if unknown
+  long long  bytes_out;      // Bytes written by the filter, as accounted
+			     // by the kernel, -1 if unknown
+  int        pages;          // Pages reported via "PAGE: " log messages
+  int        status;         // Exit status of the filter
+} cf_filter_stage_stats_t;
+
+typedef struct cf_filter_stats_s // Statistics of the filters run, add
+				 // as extension CF_FILTER_STATS_EXT to
+				 // the filter data to collect them
+{
+  int        num_stages;     // Number of filters run
+  cf_filter_stage_stats_t *stages; // Statistics of each filter
+} cf_filter_stats_t;
+
+#  define CF_FILTER_STATS_EXT "cfFilterStats"
+
+#  define CF_FILTER_MEMORY_BUDGET_EXT "cfFilterMemoryBudget"
+
 typedef int (*cf_filter_function_t)(int inputfd, int outputfd,
 				    int inputseekable, cf_filter_data_t *data,
 				    void *parameters);
@@ -133,6 +173,28 @@ typedef struct cf_filter_external_s // Parameters for the
                              // by these ones, NULL if none
 } cf_filter_external_t;
 
+typedef struct cf_filter_worker_s // Parameters for the cfFilterWorker()
+				  // filter function
+{
+  const char *socket_path;   // Unix domain socket of the worker, required
+  const char *filter;        // Name of the filter function in the worker,
+			     // required
+  cf_filter_function_t function;
+                             // Filter function to run in-process if the
+			     // worker is not running, NULL for failing
+  void *parameters;          // Parameters for this filter function
+} cf_filter_worker_t;
+
+typedef struct cf_filter_worker_filter_s // Filter function offered by a
+					 // worker, for
+					 // cfFilterWorkerServe()
+{
+  const char *name;          // Name under which the function is requested
+  cf_filter_function_t function;
+                             // Filter function
+  void *parameters;          // Parameters for the filter function
+} cf_filter_worker_filter_t;
+
 typedef struct cf_filter_texttopdf_parameter_s // parameters container of
 					       // environemnt variables needed
 					       // by texttopdf filter
@@ -169,6 +231,37 @@ extern void cfCUPSLogFunc(void *data,
 extern int cfCUPSIsCanceledFunc(void *data);
 
 
+extern cf_filter_cancel_t *cfFilterCancelNew(void);
+
+
+extern void cfFilterCancelDelete(cf_filter_cancel_t *token);
+
+
+extern void cfFilterCancel(cf_filter_cancel_t *token);
+
+
+extern int cfFilterCancelIsCanceled(void *data);
+
+// Use cfFilterCancelIsCanceled() as iscanceledfunc and a token created
+// with cfFilterCancelNew() as iscanceleddata to make jobs stop within
+// milliseconds after cfFilterCancel() is called on the token. The
+// token is backed by an eventfd (a pipe on systems without), so
+// blocking waits of the filter functions and of forked sub-processes
+// can include it and external programs get SIGTERM right away.
+
+
+extern int cfFilterCancelGetFd(cf_filter_iscanceledfunc_t iscanceled,
+			       void *icd);
+
+
+extern cf_filter_cancel_watch_t *cfFilterCancelWatchPid(
+					cf_filter_iscanceledfunc_t iscanceled,
+					void *icd, pid_t pid);
+
+
+extern void cfFilterCancelUnwatch(cf_filter_cancel_watch_t *watch);
+
+
 extern void *cfFilterDataAddExt(cf_filter_data_t *data, const char *name,
 				void *ext);
 
@@ -179,6 +272,55 @@ extern void *cfFilterDataGetExt(cf_filter_data_t *data, const char *name);
 extern void *cfFilterDataRemoveExt(cf_filter_data_t *data, const char *name);
 
 
+extern void cfFilterStatsClear(cf_filter_stats_t *stats);
+
+
+extern cf_filter_memory_budget_t *cfFilterMemoryBudgetNew(size_t limit);
+
+
+extern void cfFilterMemoryBudgetDelete(cf_filter_memory_budget_t *budget);
+
+
+extern size_t cfFilterMemoryBudgetGetPeak(cf_filter_memory_budget_t *budget);
+
+
+extern size_t cfFilterMemoryAvailable(cf_filter_data_t *data);
+
+
+extern size_t cfFilterMemoryReserve(cf_filter_data_t *data, size_t min_bytes,
+				    size_t max_bytes);
+
+
+extern void cfFilterMemoryRelease(cf_filter_data_t *data, size_t bytes);
+
+
+extern void *cfFilterMemoryAlloc(cf_filter_data_t *data, size_t size);
+
+
+extern void *cfFilterMemoryRealloc(cf_filter_data_t *data, void *ptr,
+				   size_t size);
+
+
+extern void cfFilterMemoryFree(void *ptr);
+
+// A memory budget created with cfFilterMemoryBudgetNew() and added to
+// the filter data as extension CF_FILTER_MEMORY_BUDGET_EXT limits the
+// memory which all filters of a job (or of all jobs sharing the
+// budget) use for their big buffers: image tile caches, whole-page
+// bitmaps, ... The budget lives in shared memory, so filters running
+// in forked sub-processes of cfFilterChain() draw from it, too.
+//
+// cfFilterMemoryReserve() reserves between min_bytes and max_bytes
+// (as much as available), returning the amount reserved, 0 if not
+// even min_bytes are available, for filters which can adapt, like
+// using a smaller cache. cfFilterMemoryAlloc() and
+// cfFilterMemoryRealloc() return zero-initialized buffers from the
+// heap while within the budget and otherwise from a deleted temporary
+// file mapped into memory, which the kernel can write back to disk
+// instead of running out of memory. Without budget everything is
+// allocated from the heap.
+
+
 extern char *cfFilterGetEnvVar(char *name, char **env);
 
 
@@ -219,6 +361,26 @@ extern int cfFilterChain(int inputfd,
 // List of filters to execute in a chain, next filter takes output of
 // previous filter as input, all get the same filter data, parameters
 // are supplied individually in the array
+//
+// Option "filter-chain-threads=true" runs the filter functions in
+// threads of the calling process instead of in forked sub-processes.
+// Only use this with filter functions which do not call exit() and do
+// not keep job data in global variables. Filters running in threads
+// cannot be killed, so they have to poll data->iscanceledfunc to stop
+// on cancellation.
+//
+// For each filter wall time, CPU time, peak RSS, bytes read and
+// written, and pages are measured. At the end of the chain they are
+// logged as a JSON line and if a cf_filter_stats_t record is attached
+// as extension CF_FILTER_STATS_EXT they get also appended to it.
+//
+// Between a raster-producing filter (cfFilterImageToRaster(),
+// cfFilterPCLmToRaster(), cfFilterPWGToRaster(),
+// cfFilterRasterToPWG()) and a raster-consuming one
+// (cfFilterPWGToPDF(), cfFilterPWGToRaster(), cfFilterRasterToPWG())
+// whole pages are passed as shared memory frames instead of encoded
+// raster data through a pipe (see cfRasterOpen()). Option
+// "filter-chain-raster-frames=false" turns this off.
 
 
 extern int cfFilterExternal(int inputfd,
@@ -245,6 +407,42 @@ extern int cfFilterExternal(int inputfd,
 // https://www.ibm.com/docs/en/aix/7.2?topic=configuration-printer-interface-scripts
 
 
+extern int cfFilterWorker(int inputfd,
+			  int outputfd,
+			  int inputseekable,
+			  cf_filter_data_t *data,
+			  void *parameters);
+
+// Parameters: cf_filter_worker_t*
+//
+// Socket of the worker, name of the filter function to run in it,
+// and filter function to run in-process if the worker is not
+// running.
+//
+// The job's file descriptors and data (except back/side channel and
+// extensions) are passed to the worker, log messages and the exit
+// status come back from there. As the worker stays running, library
+// initialization and caches (fonts, color profiles, ...) are shared
+// by all jobs instead of being set up again for each job.
+
+
+extern int cfFilterWorkerServe(const char *socket_path,
+			       cf_filter_worker_filter_t *filters,
+			       int num_filters,
+			       int max_jobs,
+			       cf_logfunc_t log,
+			       void *ld,
+			       cf_filter_iscanceledfunc_t iscanceled,
+			       void *icd);
+
+// Run a worker for cfFilterWorker() listening on socket_path (which
+// gets accessible only for the calling user) and offering the given
+// filter functions. Up to max_jobs (0: unlimited) jobs are run at
+// once, each in its own thread, so the filter functions must not
+// keep job data in global variables. Returns when iscanceled()
+// returns 1 and the running jobs are done.
+
+
 extern int cfFilterOpenBackAndSidePipes(cf_filter_data_t *data);
 
 
@@ -449,6 +647,13 @@ extern int cfFilterUniversal(int inputfd,
 //           format, otherwise NULL to produce the job's final output
 //           format
 //	     texttopdf_params: parameters for texttopdf
+//
+// The chain of filter functions is the cheapest path through the graph
+// of available conversions, by estimated cost from the number of pages
+// and the resolution. If a cf_filter_stats_t record from earlier jobs
+// is attached as CF_FILTER_STATS_EXT, the CPU time per page measured
+// for each filter is used instead. All candidate chains and the reason
+// for the choice are logged at debug level.
 
 
 #  ifdef __cplusplus
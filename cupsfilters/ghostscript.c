@@ -509,6 +509,7 @@ gs_spawn (const char *filename,
   int n;
   int numargs;
   int pid, gspid, errpid;
+  cf_filter_cancel_watch_t *cancelwatch = NULL;
   cups_file_t *logfp;
   cf_loglevel_t log_level;
   char *msg;
@@ -680,6 +681,9 @@ gs_spawn (const char *filename,
   if (log) log(ld, CF_LOGLEVEL_DEBUG,
 	       "cfFilterGhostscript: Started Ghostscript (PID %d)", gspid);
 
+  // Kill Ghostscript right away when the job gets canceled
+  cancelwatch = cfFilterCancelWatchPid(iscanceled, icd, gspid);
+
   close(infds[0]);
   close(errfds[1]);
 
@@ -820,6 +824,7 @@ gs_spawn (const char *filename,
   }
 
  out:
+  cfFilterCancelUnwatch(cancelwatch);
   free(gsargv);
 
   return (status);
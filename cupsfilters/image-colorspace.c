@@ -12,6 +12,7 @@
 //
 // Contents:
 //
+//   _cfImageColorKernel()        - Select the SIMD converters.
 //   cfImageCMYKToBlack()         - Convert CMYK data to black.
 //   cfImageCMYKToCMY()           - Convert CMYK colors to CMY.
 //   cfImageCMYKToCMYK()          - Convert CMYK colors to CMYK.
@@ -37,12 +38,57 @@
 //   cfImageWhiteToWhite()        - Convert luminance colors to device-
 //                                  dependent luminance.
 //   cie_lab()                    - Map CIE Lab transformation...
+//   cmy_avx2()                   - Compute one color of cfImageRGBToCMY()
+//                                  using AVX2.
+//   cmy_neon()                   - Compute one color of cfImageRGBToCMY()
+//                                  using NEON.
+//   cmyk_to_black_avx2()         - Convert CMYK colors to black using AVX2.
+//   cmyk_to_black_neon()         - Convert CMYK colors to black using NEON.
+//   cmyk_to_cmy_avx2()           - Convert CMYK colors to CMY using AVX2.
+//   cmyk_to_cmy_neon()           - Convert CMYK colors to CMY using NEON.
+//   cmyk_to_rgb_avx2()           - Convert CMYK colors to RGB using AVX2.
+//   cmyk_to_rgb_neon()           - Convert CMYK colors to RGB using NEON.
+//   cmyk_to_white_avx2()         - Convert CMYK colors to luminance using
+//                                  AVX2.
+//   cmyk_to_white_neon()         - Convert CMYK colors to luminance using
+//                                  NEON.
+//   color_init()                 - Pick the fastest converters the CPU
+//                                  supports.
+//   color_none()                 - Convert no pixels, for CPUs without SIMD
+//                                  converters.
+//   color_simd()                 - Get the SIMD converters in use.
+//   div_neon()                   - Divide words exactly by multiplying and
+//                                  shifting.
 //   hue_rotate()                 - Rotate the hue, maintaining luminance.
 //   ident()                      - Make an identity matrix.
+//   load3_avx2()                 - Load 16 pixels with three colors, one
+//                                  vector per color.
+//   load4_avx2()                 - Load 16 pixels with four colors, one
+//                                  vector per color.
+//   luma_avx2()                  - Compute the luminance of 16 RGB pixels
+//                                  using AVX2.
+//   luma_neon()                  - Compute the luminance of 16 RGB pixels
+//                                  using NEON.
 //   mult()                       - Multiply two matrices.
+//   pack_avx2()                  - Pack 16 words into bytes with unsigned
+//                                  saturation.
+//   rgb_to_black_avx2()          - Convert RGB colors to black using AVX2.
+//   rgb_to_black_neon()          - Convert RGB colors to black using NEON.
+//   rgb_to_cmy_avx2()            - Convert RGB colors to CMY using AVX2.
+//   rgb_to_cmy_neon()            - Convert RGB colors to CMY using NEON.
+//   rgb_to_cmyk_avx2()           - Convert RGB colors to CMYK using AVX2.
+//   rgb_to_cmyk_neon()           - Convert RGB colors to CMYK using NEON.
 //   rgb_to_lab()                 - Convert an RGB color to CIE Lab.
+//   rgb_to_white_avx2()          - Convert RGB colors to luminance using
+//                                  AVX2.
+//   rgb_to_white_neon()          - Convert RGB colors to luminance using
+//                                  NEON.
 //   rgb_to_xyz()                 - Convert an RGB color to CIE XYZ.
 //   saturate()                   - Make a saturation matrix.
+//   store3_avx2()                - Store 16 pixels with three colors from
+//                                  one vector per color.
+//   store4_avx2()                - Store 16 pixels with four colors from
+//                                  one vector per color.
 //   x_form()                     - Transform a 3D point using a matrix...
 //   x_rotate()                   - Rotate about the x (red) axis...
 //   y_rotate()                   - Rotate about the y (green) axis...
@@ -55,6 +101,13 @@
 //
 
 #include "image-private.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define COLOR_X86 1
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  define COLOR_NEON 1
+#  include <arm_neon.h>
+#endif // __GNUC__ && __x86_64__
 
 
 //
@@ -89,6 +142,28 @@
 typedef int cups_clut_t[3][256];
 
 
+//
+// SIMD converters, used when there is no color profile...
+//
+
+typedef int (*color_convert_t)(const cf_ib_t *in, cf_ib_t *out, int count);
+					// Converter for the leading pixels,
+					// returns the number converted
+
+typedef struct color_kernel_s		// SIMD converters
+{
+  const char		*name;		// Name of converters
+  color_convert_t	cmyk_to_black,	// cfImageCMYKToBlack()
+			cmyk_to_cmy,	// cfImageCMYKToCMY()
+			cmyk_to_rgb,	// cfImageCMYKToRGB()
+			cmyk_to_white,	// cfImageCMYKToWhite()
+			rgb_to_black,	// cfImageRGBToBlack()
+			rgb_to_cmy,	// cfImageRGBToCMY()
+			rgb_to_cmyk,	// cfImageRGBToCMYK()
+			rgb_to_white;	// cfImageRGBToWhite()
+} color_kernel_t;
+
+
 //
 // Local globals...
 //
@@ -108,6 +183,9 @@ static cups_cspace_t	cfImageColorSpace = CUPS_CSPACE_RGB;
 //
 
 static float	cie_lab(float x, float xn);
+static void	color_init(void);
+static int	color_none(const cf_ib_t *in, cf_ib_t *out, int count);
+static const color_kernel_t *color_simd(void);
 static void	hue_rotate(float [3][3], float);
 static void	ident(float [3][3]);
 static void	mult(float [3][3], float [3][3], float [3][3]);
@@ -120,6 +198,119 @@ static void	x_rotate(float [3][3], float, float);
 static void	y_rotate(float [3][3], float, float);
 static void	z_rotate(float [3][3], float, float);
 static void	z_shear(float [3][3], float, float);
+#ifdef COLOR_X86
+static __m128i	cmy_avx2(__m128i w, __m128i c, __m128i k);
+static int	cmyk_to_black_avx2(const cf_ib_t *in, cf_ib_t *out,
+				   int count);
+static int	cmyk_to_cmy_avx2(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	cmyk_to_rgb_avx2(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	cmyk_to_white_avx2(const cf_ib_t *in, cf_ib_t *out,
+				   int count);
+static void	load3_avx2(const cf_ib_t *in, __m128i v[3]);
+static void	load4_avx2(const cf_ib_t *in, __m128i v[4]);
+static __m128i	luma_avx2(__m128i r, __m128i g, __m128i b);
+static __m128i	pack_avx2(__m256i v);
+static int	rgb_to_black_avx2(const cf_ib_t *in, cf_ib_t *out,
+				  int count);
+static int	rgb_to_cmy_avx2(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	rgb_to_cmyk_avx2(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	rgb_to_white_avx2(const cf_ib_t *in, cf_ib_t *out,
+				  int count);
+static void	store3_avx2(cf_ib_t *out, const __m128i v[3]);
+static void	store4_avx2(cf_ib_t *out, const __m128i v[4]);
+#endif // COLOR_X86
+#ifdef COLOR_NEON
+static uint8x16_t cmy_neon(uint8x16_t w, uint8x16_t c, uint8x16_t k);
+static int	cmyk_to_black_neon(const cf_ib_t *in, cf_ib_t *out,
+				   int count);
+static int	cmyk_to_cmy_neon(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	cmyk_to_rgb_neon(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	cmyk_to_white_neon(const cf_ib_t *in, cf_ib_t *out,
+				   int count);
+static uint8x8_t div_neon(uint16x8_t s, uint16_t mul, int shift);
+static uint8x16_t luma_neon(uint8x16_t r, uint8x16_t g, uint8x16_t b);
+static int	rgb_to_black_neon(const cf_ib_t *in, cf_ib_t *out,
+				  int count);
+static int	rgb_to_cmy_neon(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	rgb_to_cmyk_neon(const cf_ib_t *in, cf_ib_t *out, int count);
+static int	rgb_to_white_neon(const cf_ib_t *in, cf_ib_t *out,
+				  int count);
+#endif // COLOR_NEON
+
+
+//
+// SIMD globals...
+//
+
+static const color_kernel_t color_kernels[] =
+{					// Converters, fastest first
+#ifdef COLOR_X86
+  { "avx2", cmyk_to_black_avx2, cmyk_to_cmy_avx2, cmyk_to_rgb_avx2,
+    cmyk_to_white_avx2, rgb_to_black_avx2, rgb_to_cmy_avx2,
+    rgb_to_cmyk_avx2, rgb_to_white_avx2 },
+#endif // COLOR_X86
+#ifdef COLOR_NEON
+  { "neon", cmyk_to_black_neon, cmyk_to_cmy_neon, cmyk_to_rgb_neon,
+    cmyk_to_white_neon, rgb_to_black_neon, rgb_to_cmy_neon,
+    rgb_to_cmyk_neon, rgb_to_white_neon },
+#endif // COLOR_NEON
+  { "c",    color_none, color_none, color_none, color_none, color_none,
+    color_none, color_none, color_none }
+};
+static const color_kernel_t *color_kernel = color_kernels +
+		    sizeof(color_kernels) / sizeof(color_kernels[0]) - 1;
+					// Converters in use
+static pthread_once_t	color_once = PTHREAD_ONCE_INIT;
+					// Converter selection
+#ifdef COLOR_X86
+static signed char	color_split[3][3][16],
+					// Shuffles from 3 vectors of pixels
+					// to each color
+			color_join[3][3][16];
+					// Shuffles from each color to 3
+					// vectors of pixels
+#endif // COLOR_X86
+
+
+//
+// '_cfImageColorKernel()' - Select the SIMD converters.
+//
+// The fastest converters the CPU supports are used by default.  Passing
+// the name of other converters ("avx2", "neon" or "c") selects those if the
+// CPU supports them, for testing and benchmarking; NULL just returns the
+// name of the converters in use.  All converters give the same output.
+//
+
+const char *				// O - Name of converters in use
+_cfImageColorKernel(const char *name)	// I - Name of converters or NULL
+{
+  const color_kernel_t	*k;		// Current converters
+
+
+  pthread_once(&color_once, color_init);
+
+  if (name)
+  {
+    for (k = color_kernels;
+         k < color_kernels + sizeof(color_kernels) / sizeof(color_kernels[0]);
+	 k ++)
+    {
+#ifdef COLOR_X86
+      if (k->rgb_to_white == rgb_to_white_avx2 &&
+          !__builtin_cpu_supports("avx2"))
+        continue;
+#endif // COLOR_X86
+
+      if (!strcmp(k->name, name))
+      {
+	__atomic_store_n(&color_kernel, k, __ATOMIC_RELEASE);
+	break;
+      }
+    }
+  }
+
+  return (__atomic_load_n(&color_kernel, __ATOMIC_ACQUIRE)->name);
+}
 
 
 //
@@ -133,6 +324,7 @@ cfImageCMYKToBlack(
     int             count)		// I - Number of pixels
 {
   int	k;				// Black value
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -149,6 +341,12 @@ cfImageCMYKToBlack(
       count --;
     }
   else
+  {
+    n      = (*color_simd()->cmyk_to_black)(in, out, count);
+    in    += 4 * n;
+    out   += 1 * n;
+    count -= n;
+
     while (count > 0)
     {
       k = (31 * in[0] + 61 * in[1] + 8 * in[2]) / 100 + in[3];
@@ -161,6 +359,7 @@ cfImageCMYKToBlack(
       in += 4;
       count --;
     }
+  }
 }
 
 
@@ -176,6 +375,7 @@ cfImageCMYKToCMY(
 {
   int	c, m, y, k;			// CMYK values
   int	cc, cm, cy;			// Calibrated CMY values
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -220,6 +420,12 @@ cfImageCMYKToCMY(
       count --;
     }
   else
+  {
+    n      = (*color_simd()->cmyk_to_cmy)(in, out, count);
+    in    += 4 * n;
+    out   += 3 * n;
+    count -= n;
+
     while (count > 0)
     {
       c = *in++;
@@ -248,6 +454,7 @@ cfImageCMYKToCMY(
 
       count --;
     }
+  }
 }
 
 
@@ -335,6 +542,7 @@ cfImageCMYKToRGB(
 {
   int	c, m, y, k;			// CMYK values
   int	cr, cg, cb;			// Calibrated RGB values
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -382,6 +590,16 @@ cfImageCMYKToRGB(
   }
   else
   {
+    if (cfImageColorSpace != CUPS_CSPACE_CIELab &&
+        cfImageColorSpace != CUPS_CSPACE_CIEXYZ &&
+        cfImageColorSpace < CUPS_CSPACE_ICC1)
+    {
+      n      = (*color_simd()->cmyk_to_rgb)(in, out, count);
+      in    += 4 * n;
+      out   += 3 * n;
+      count -= n;
+    }
+
     while (count > 0)
     {
       c = 255 - *in++;
@@ -431,6 +649,7 @@ cfImageCMYKToWhite(
     int             count)		// I - Number of pixels
 {
   int	w;				// White value
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -450,6 +669,11 @@ cfImageCMYKToWhite(
   }
   else
   {
+    n      = (*color_simd()->cmyk_to_white)(in, out, count);
+    in    += 4 * n;
+    out   += 1 * n;
+    count -= n;
+
     while (count > 0)
     {
       w = 255 - (31 * in[0] + 61 * in[1] + 8 * in[2]) / 100 - in[3];
@@ -590,6 +814,9 @@ cfImageRGBToBlack(
     cf_ib_t         *out,		// I - Output pixels
     int             count)		// I - Number of pixels
 {
+  int	n;				// Pixels converted by SIMD code
+
+
   if (cfImageHaveProfile)
     while (count > 0)
     {
@@ -598,12 +825,19 @@ cfImageRGBToBlack(
       count --;
     }
   else
+  {
+    n      = (*color_simd()->rgb_to_black)(in, out, count);
+    in    += 3 * n;
+    out   += 1 * n;
+    count -= n;
+
     while (count > 0)
     {
       *out++ = 255 - (31 * in[0] + 61 * in[1] + 8 * in[2]) / 100;
       in += 3;
       count --;
     }
+  }
 }
 
 
@@ -619,6 +853,7 @@ cfImageRGBToCMY(
 {
   int	c, m, y, k;			// CMYK values
   int	cc, cm, cy;			// Calibrated CMY values
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -666,6 +901,12 @@ cfImageRGBToCMY(
       count --;
     }
   else
+  {
+    n      = (*color_simd()->rgb_to_cmy)(in, out, count);
+    in    += 3 * n;
+    out   += 3 * n;
+    count -= n;
+
     while (count > 0)
     {
       c    = 255 - in[0];
@@ -679,6 +920,7 @@ cfImageRGBToCMY(
       in += 3;
       count --;
     }
+  }
 }
 
 
@@ -695,6 +937,7 @@ cfImageRGBToCMYK(
   int	c, m, y, k,			// CMYK values
 	km;				// Maximum K value
   int	cc, cm, cy;			// Calibrated CMY values
+  int	n;				// Pixels converted by SIMD code
 
 
   if (cfImageHaveProfile)
@@ -748,6 +991,12 @@ cfImageRGBToCMYK(
       count --;
     }
   else
+  {
+    n      = (*color_simd()->rgb_to_cmyk)(in, out, count);
+    in    += 3 * n;
+    out   += 4 * n;
+    count -= n;
+
     while (count > 0)
     {
       c = 255 - *in++;
@@ -769,6 +1018,7 @@ cfImageRGBToCMYK(
 
       count --;
     }
+  }
 }
 
 
@@ -872,6 +1122,9 @@ cfImageRGBToWhite(
     cf_ib_t         *out,		// I - Output pixels
     int             count)		// I - Number of pixels
 {
+  int	n;				// Pixels converted by SIMD code
+
+
   if (cfImageHaveProfile)
   {
     while (count > 0)
@@ -883,6 +1136,11 @@ cfImageRGBToWhite(
   }
   else
   {
+    n      = (*color_simd()->rgb_to_white)(in, out, count);
+    in    += 3 * n;
+    out   += 1 * n;
+    count -= n;
+
     while (count > 0)
     {
       *out++ = (31 * in[0] + 61 * in[1] + 8 * in[2]) / 100;
@@ -1133,6 +1391,379 @@ cie_lab(float x,			// I - Raw color value
 }
 
 
+#ifdef COLOR_X86
+//
+// 'cmy_avx2()' - Compute one color of cfImageRGBToCMY() using AVX2.
+//
+
+__attribute__((target("avx2")))
+static __m128i				// O - Color
+cmy_avx2(__m128i w,			// I - Color weighting the ink
+	 __m128i c,			// I - Ink
+	 __m128i k)			// I - Black
+{
+  __m256i	t;			// Weighted ink
+
+
+  //
+  // (255 - w / 4) * (c - k) / 255 + k, dividing exactly by multiplying with
+  // 32897 / 2^23...
+  //
+
+  t = _mm256_mullo_epi16(
+	  _mm256_cvtepu8_epi16(
+	      _mm_sub_epi8(_mm_set1_epi8(-1),
+			   _mm_and_si128(_mm_srli_epi16(w, 2),
+					 _mm_set1_epi8(0x3f)))),
+	  _mm256_cvtepu8_epi16(_mm_sub_epi8(c, k)));
+  t = _mm256_srli_epi16(_mm256_mulhi_epu16(t,
+					   _mm256_set1_epi16((short)32897)),
+			7);
+
+  return (_mm_add_epi8(pack_avx2(t), k));
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'cmy_neon()' - Compute one color of cfImageRGBToCMY() using NEON.
+//
+
+static uint8x16_t			// O - Color
+cmy_neon(uint8x16_t w,			// I - Color weighting the ink
+	 uint8x16_t c,			// I - Ink
+	 uint8x16_t k)			// I - Black
+{
+  uint8x16_t	weight = vsubq_u8(vdupq_n_u8(255), vshrq_n_u8(w, 2)),
+		ink = vsubq_u8(c, k);	// Factors
+
+
+  return (vaddq_u8(vcombine_u8(div_neon(vmull_u8(vget_low_u8(weight),
+						 vget_low_u8(ink)),
+					32897, 23),
+			       div_neon(vmull_u8(vget_high_u8(weight),
+						 vget_high_u8(ink)),
+					32897, 23)), k));
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'cmyk_to_black_avx2()' - Convert CMYK colors to black using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+cmyk_to_black_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[4];			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 16)
+  {
+    load4_avx2(in, v);
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_adds_epu8(luma_avx2(v[0], v[1], v[2]), v[3]));
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'cmyk_to_black_neon()' - Convert CMYK colors to black using NEON.
+//
+
+static int				// O - Number of pixels converted
+cmyk_to_black_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x4_t	v;			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 16)
+  {
+    v = vld4q_u8(in);
+    vst1q_u8(out, vqaddq_u8(luma_neon(v.val[0], v.val[1], v.val[2]),
+			    v.val[3]));
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'cmyk_to_cmy_avx2()' - Convert CMYK colors to CMY using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+cmyk_to_cmy_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[4];			// Colors of 16 pixels
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 48)
+  {
+    load4_avx2(in, v);
+    for (i = 0; i < 3; i ++)
+      v[i] = _mm_adds_epu8(v[i], v[3]);
+    store3_avx2(out, v);
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'cmyk_to_cmy_neon()' - Convert CMYK colors to CMY using NEON.
+//
+
+static int				// O - Number of pixels converted
+cmyk_to_cmy_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x4_t	v;			// Colors of 16 pixels
+  uint8x16x3_t	o;			// Converted colors
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 48)
+  {
+    v = vld4q_u8(in);
+    for (i = 0; i < 3; i ++)
+      o.val[i] = vqaddq_u8(v.val[i], v.val[3]);
+    vst3q_u8(out, o);
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'cmyk_to_rgb_avx2()' - Convert CMYK colors to RGB using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+cmyk_to_rgb_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[4],			// Colors of 16 pixels
+		ones = _mm_set1_epi8(-1);
+					// All bits set
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 48)
+  {
+    load4_avx2(in, v);
+    for (i = 0; i < 3; i ++)
+      v[i] = _mm_subs_epu8(_mm_xor_si128(v[i], ones), v[3]);
+    store3_avx2(out, v);
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'cmyk_to_rgb_neon()' - Convert CMYK colors to RGB using NEON.
+//
+
+static int				// O - Number of pixels converted
+cmyk_to_rgb_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x4_t	v;			// Colors of 16 pixels
+  uint8x16x3_t	o;			// Converted colors
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 48)
+  {
+    v = vld4q_u8(in);
+    for (i = 0; i < 3; i ++)
+      o.val[i] = vqsubq_u8(vmvnq_u8(v.val[i]), v.val[3]);
+    vst3q_u8(out, o);
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'cmyk_to_white_avx2()' - Convert CMYK colors to luminance using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+cmyk_to_white_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[4],			// Colors of 16 pixels
+		ones = _mm_set1_epi8(-1);
+					// All bits set
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 16)
+  {
+    load4_avx2(in, v);
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_xor_si128(_mm_adds_epu8(luma_avx2(v[0], v[1], v[2]),
+						 v[3]), ones));
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'cmyk_to_white_neon()' - Convert CMYK colors to luminance using NEON.
+//
+
+static int				// O - Number of pixels converted
+cmyk_to_white_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x4_t	v;			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 64, out += 16)
+  {
+    v = vld4q_u8(in);
+    vst1q_u8(out, vmvnq_u8(vqaddq_u8(luma_neon(v.val[0], v.val[1],
+						 v.val[2]), v.val[3])));
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+//
+// 'color_init()' - Pick the fastest converters the CPU supports.
+//
+
+static void
+color_init(void)
+{
+#ifdef COLOR_X86
+  int	i;				// Looping var
+
+
+  //
+  // Byte shuffles between 48 bytes of pixels with three colors and one
+  // vector of 16 bytes per color...
+  //
+
+  memset(color_split, 0x80, sizeof(color_split));
+  memset(color_join, 0x80, sizeof(color_join));
+
+  for (i = 0; i < 48; i ++)
+  {
+    color_split[i % 3][i / 16][i / 3] = i % 16;
+    color_join[i / 16][i % 3][i % 16] = i / 3;
+  }
+
+  if (!__builtin_cpu_supports("avx2"))
+    color_kernel = color_kernels + 1;
+  else
+#endif // COLOR_X86
+  color_kernel = color_kernels;
+}
+
+
+//
+// 'color_none()' - Convert no pixels, for CPUs without SIMD converters.
+//
+
+static int				// O - Number of pixels converted (0)
+color_none(const cf_ib_t *in,		// I - Input pixels
+	   cf_ib_t       *out,		// I - Output pixels
+	   int           count)		// I - Number of pixels
+{
+  (void)in;
+  (void)out;
+  (void)count;
+
+  return (0);
+}
+
+
+//
+// 'color_simd()' - Get the SIMD converters in use.
+//
+
+static const color_kernel_t *		// O - Converters
+color_simd(void)
+{
+  pthread_once(&color_once, color_init);
+
+  return (__atomic_load_n(&color_kernel, __ATOMIC_ACQUIRE));
+}
+
+
+#ifdef COLOR_NEON
+//
+// 'div_neon()' - Divide words exactly by multiplying and shifting.
+//
+
+static uint8x8_t			// O - Quotients
+div_neon(uint16x8_t s,			// I - Dividends
+	 uint16_t   mul,		// I - Multiplier
+	 int        shift)		// I - Bits to shift, at least 16
+{
+  uint16x8_t	q;			// Product shifted by 16 bits
+
+
+  q = vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(s), mul), 16),
+		   vshrn_n_u32(vmull_n_u16(vget_high_u16(s), mul), 16));
+
+  return (vmovn_u16(vshlq_u16(q, vdupq_n_s16(16 - shift))));
+}
+#endif // COLOR_NEON
+
+
 //
 // 'hue_rotate()' - Rotate the hue, maintaining luminance.
 //
@@ -1225,6 +1856,120 @@ ident(float mat[3][3])			// I - Matrix to identify
 }
 
 
+#ifdef COLOR_X86
+//
+// 'load3_avx2()' - Load 16 pixels with three colors, one vector per color.
+//
+
+__attribute__((target("avx2")))
+static void
+load3_avx2(const cf_ib_t *in,		// I - Pixels
+	   __m128i       v[3])		// O - Colors
+{
+  __m128i	a = _mm_loadu_si128((const __m128i *)in),
+		b = _mm_loadu_si128((const __m128i *)(in + 16)),
+		c = _mm_loadu_si128((const __m128i *)(in + 32));
+					// Pixel data
+  int		i;			// Looping var
+
+
+  for (i = 0; i < 3; i ++)
+    v[i] = _mm_or_si128(
+	       _mm_or_si128(
+		   _mm_shuffle_epi8(a, _mm_loadu_si128((__m128i *)color_split[i][0])),
+		   _mm_shuffle_epi8(b, _mm_loadu_si128((__m128i *)color_split[i][1]))),
+	       _mm_shuffle_epi8(c, _mm_loadu_si128((__m128i *)color_split[i][2])));
+}
+
+
+//
+// 'load4_avx2()' - Load 16 pixels with four colors, one vector per color.
+//
+
+__attribute__((target("avx2")))
+static void
+load4_avx2(const cf_ib_t *in,		// I - Pixels
+	   __m128i       v[4])		// O - Colors
+{
+  __m128i	t[4],			// Colors of 4 pixels each
+		u[4],			// Colors of 8 pixels each
+		group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+				      2, 6, 10, 14, 3, 7, 11, 15);
+					// Group the colors of 4 pixels
+  int		i;			// Looping var
+
+
+  for (i = 0; i < 4; i ++)
+    t[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16 * i)),
+			    group);
+
+  u[0] = _mm_unpacklo_epi32(t[0], t[1]);
+  u[1] = _mm_unpackhi_epi32(t[0], t[1]);
+  u[2] = _mm_unpacklo_epi32(t[2], t[3]);
+  u[3] = _mm_unpackhi_epi32(t[2], t[3]);
+  v[0] = _mm_unpacklo_epi64(u[0], u[2]);
+  v[1] = _mm_unpackhi_epi64(u[0], u[2]);
+  v[2] = _mm_unpacklo_epi64(u[1], u[3]);
+  v[3] = _mm_unpackhi_epi64(u[1], u[3]);
+}
+
+
+//
+// 'luma_avx2()' - Compute the luminance of 16 RGB pixels using AVX2.
+//
+
+__attribute__((target("avx2")))
+static __m128i				// O - (31 * r + 61 * g + 8 * b) / 100
+luma_avx2(__m128i r,			// I - Red
+	  __m128i g,			// I - Green
+	  __m128i b)			// I - Blue
+{
+  __m256i	s;			// Weighted sum
+
+
+  s = _mm256_add_epi16(
+	  _mm256_add_epi16(
+	      _mm256_mullo_epi16(_mm256_cvtepu8_epi16(r),
+				 _mm256_set1_epi16(31)),
+	      _mm256_mullo_epi16(_mm256_cvtepu8_epi16(g),
+				 _mm256_set1_epi16(61))),
+	  _mm256_slli_epi16(_mm256_cvtepu8_epi16(b), 3));
+
+  //
+  // Divide by 100, (s * 5243) >> 19 is exact for all sums up to 25500...
+  //
+
+  return (pack_avx2(_mm256_srli_epi16(
+			_mm256_mulhi_epu16(s, _mm256_set1_epi16(5243)), 3)));
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'luma_neon()' - Compute the luminance of 16 RGB pixels using NEON.
+//
+
+static uint8x16_t			// O - (31 * r + 61 * g + 8 * b) / 100
+luma_neon(uint8x16_t r,			// I - Red
+	  uint8x16_t g,			// I - Green
+	  uint8x16_t b)			// I - Blue
+{
+  uint16x8_t	lo, hi;			// Weighted sums
+
+
+  lo = vmlal_u8(vmlal_u8(vmull_u8(vget_low_u8(r), vdup_n_u8(31)),
+			 vget_low_u8(g), vdup_n_u8(61)),
+		vget_low_u8(b), vdup_n_u8(8));
+  hi = vmlal_u8(vmlal_u8(vmull_u8(vget_high_u8(r), vdup_n_u8(31)),
+			 vget_high_u8(g), vdup_n_u8(61)),
+		vget_high_u8(b), vdup_n_u8(8));
+
+  return (vcombine_u8(div_neon(lo, 5243, 19), div_neon(hi, 5243, 19)));
+}
+#endif // COLOR_NEON
+
+
 //
 // 'mult()' - Multiply two matrices.
 //
@@ -1256,6 +2001,281 @@ mult(float a[3][3],			// I - First matrix
 }
 
 
+#ifdef COLOR_X86
+//
+// 'pack_avx2()' - Pack 16 words into bytes with unsigned saturation.
+//
+
+__attribute__((target("avx2")))
+static __m128i				// O - Bytes
+pack_avx2(__m256i v)			// I - Words
+{
+  return (_mm_packus_epi16(_mm256_castsi256_si128(v),
+			   _mm256_extracti128_si256(v, 1)));
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_X86
+//
+// 'rgb_to_black_avx2()' - Convert RGB colors to black using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+rgb_to_black_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[3];			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 16)
+  {
+    load3_avx2(in, v);
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_xor_si128(luma_avx2(v[0], v[1], v[2]),
+				   _mm_set1_epi8(-1)));
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'rgb_to_black_neon()' - Convert RGB colors to black using NEON.
+//
+
+static int				// O - Number of pixels converted
+rgb_to_black_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x3_t	v;			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 16)
+  {
+    v = vld3q_u8(in);
+    vst1q_u8(out, vmvnq_u8(luma_neon(v.val[0], v.val[1], v.val[2])));
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'rgb_to_cmy_avx2()' - Convert RGB colors to CMY using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+rgb_to_cmy_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[3],			// Colors of 16 pixels
+		o[3],			// Converted colors
+		c, m, y, k,		// Inks
+		ones = _mm_set1_epi8(-1);
+					// All bits set
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 48)
+  {
+    load3_avx2(in, v);
+
+    c = _mm_xor_si128(v[0], ones);
+    m = _mm_xor_si128(v[1], ones);
+    y = _mm_xor_si128(v[2], ones);
+    k = _mm_min_epu8(c, _mm_min_epu8(m, y));
+
+    o[0] = cmy_avx2(v[1], c, k);
+    o[1] = cmy_avx2(v[2], m, k);
+    o[2] = cmy_avx2(v[0], y, k);
+    store3_avx2(out, o);
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'rgb_to_cmy_neon()' - Convert RGB colors to CMY using NEON.
+//
+
+static int				// O - Number of pixels converted
+rgb_to_cmy_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x3_t	v,			// Colors of 16 pixels
+		o;			// Converted colors
+  uint8x16_t	c, m, y, k;		// Inks
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 48)
+  {
+    v = vld3q_u8(in);
+
+    c = vmvnq_u8(v.val[0]);
+    m = vmvnq_u8(v.val[1]);
+    y = vmvnq_u8(v.val[2]);
+    k = vminq_u8(c, vminq_u8(m, y));
+
+    o.val[0] = cmy_neon(v.val[1], c, k);
+    o.val[1] = cmy_neon(v.val[2], m, k);
+    o.val[2] = cmy_neon(v.val[0], y, k);
+    vst3q_u8(out, o);
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
+#ifdef COLOR_X86
+//
+// 'rgb_to_cmyk_avx2()' - Convert RGB colors to CMYK using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+rgb_to_cmyk_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[4],			// Colors of 16 pixels
+		km,			// Largest ink
+		ones = _mm_set1_epi8(-1);
+					// All bits set
+  __m256	kf, mf;			// Smallest and largest ink
+  __m256i	q[2];			// Black of 8 pixels each
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 64)
+  {
+    load3_avx2(in, v);
+
+    for (i = 0; i < 3; i ++)
+      v[i] = _mm_xor_si128(v[i], ones);
+
+    v[3] = _mm_min_epu8(v[0], _mm_min_epu8(v[1], v[2]));
+    km   = _mm_max_epu8(v[0], _mm_max_epu8(v[1], v[2]));
+
+    //
+    // k = k * k * k / (km * km) in single precision, which truncates to
+    // the same quotient as the integer division of the scalar code for all
+    // inks and leaves k unchanged when km == k...
+    //
+
+    for (i = 0; i < 2; i ++)
+    {
+      kf   = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+				    _mm_srli_si128(v[3], 8 * i)));
+      mf   = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+				    _mm_srli_si128(km, 8 * i)));
+      q[i] = _mm256_cvttps_epi32(
+		 _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(kf, kf), kf),
+			       _mm256_max_ps(_mm256_mul_ps(mf, mf),
+					     _mm256_set1_ps(1.0f))));
+    }
+
+    v[3] = pack_avx2(_mm256_permute4x64_epi64(_mm256_packus_epi32(q[0], q[1]),
+					      0xd8));
+
+    for (i = 0; i < 3; i ++)
+      v[i] = _mm_sub_epi8(v[i], v[3]);
+
+    store4_avx2(out, v);
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'rgb_to_cmyk_neon()' - Convert RGB colors to CMYK using NEON.
+//
+
+static int				// O - Number of pixels converted
+rgb_to_cmyk_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x3_t	v;			// Colors of 16 pixels
+  uint8x16x4_t	o;			// Converted colors
+  uint8x16_t	km;			// Largest ink
+  uint16x8_t	k16, m16;		// Inks of 8 pixels
+  float32x4_t	kf, mf;			// Inks of 4 pixels
+  uint32x4_t	q[4];			// Black of 4 pixels each
+  int		n, i;			// Looping vars
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 64)
+  {
+    v = vld3q_u8(in);
+
+    for (i = 0; i < 3; i ++)
+      o.val[i] = vmvnq_u8(v.val[i]);
+
+    o.val[3] = vminq_u8(o.val[0], vminq_u8(o.val[1], o.val[2]));
+    km       = vmaxq_u8(o.val[0], vmaxq_u8(o.val[1], o.val[2]));
+
+    //
+    // k = k * k * k / (km * km) in single precision, which truncates to
+    // the same quotient as the integer division of the scalar code for all
+    // inks and leaves k unchanged when km == k...
+    //
+
+    for (i = 0; i < 4; i ++)
+    {
+      k16  = vmovl_u8(i < 2 ? vget_low_u8(o.val[3]) : vget_high_u8(o.val[3]));
+      m16  = vmovl_u8(i < 2 ? vget_low_u8(km) : vget_high_u8(km));
+      kf   = vcvtq_f32_u32(vmovl_u16((i & 1) ? vget_high_u16(k16) :
+					       vget_low_u16(k16)));
+      mf   = vcvtq_f32_u32(vmovl_u16((i & 1) ? vget_high_u16(m16) :
+					       vget_low_u16(m16)));
+      q[i] = vcvtq_u32_f32(vdivq_f32(vmulq_f32(vmulq_f32(kf, kf), kf),
+				     vmaxq_f32(vmulq_f32(mf, mf),
+					       vdupq_n_f32(1.0f))));
+    }
+
+    o.val[3] = vcombine_u8(vmovn_u16(vcombine_u16(vmovn_u32(q[0]),
+						  vmovn_u32(q[1]))),
+			   vmovn_u16(vcombine_u16(vmovn_u32(q[2]),
+						  vmovn_u32(q[3]))));
+
+    for (i = 0; i < 3; i ++)
+      o.val[i] = vsubq_u8(o.val[i], o.val[3]);
+
+    vst4q_u8(out, o);
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
 //
 // 'rgb_to_lab()' - Convert an RGB color to CIE Lab.
 //
@@ -1342,6 +2362,59 @@ rgb_to_lab(cf_ib_t *val)		// IO - Color value
 }
 
 
+#ifdef COLOR_X86
+//
+// 'rgb_to_white_avx2()' - Convert RGB colors to luminance using AVX2.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of pixels converted
+rgb_to_white_avx2(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  __m128i	v[3];			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 16)
+  {
+    load3_avx2(in, v);
+    _mm_storeu_si128((__m128i *)out, luma_avx2(v[0], v[1], v[2]));
+  }
+
+  return (n);
+}
+#endif // COLOR_X86
+
+
+#ifdef COLOR_NEON
+//
+// 'rgb_to_white_neon()' - Convert RGB colors to luminance using NEON.
+//
+
+static int				// O - Number of pixels converted
+rgb_to_white_neon(
+    const cf_ib_t *in,			// I - Input pixels
+    cf_ib_t       *out,			// I - Output pixels
+    int           count)		// I - Number of pixels
+{
+  uint8x16x3_t	v;			// Colors of 16 pixels
+  int		n;			// Pixels converted
+
+
+  for (n = 0; count - n >= 16; n += 16, in += 48, out += 16)
+  {
+    v = vld3q_u8(in);
+    vst1q_u8(out, luma_neon(v.val[0], v.val[1], v.val[2]));
+  }
+
+  return (n);
+}
+#endif // COLOR_NEON
+
+
 //
 // 'rgb_to_xyz()' - Convert an RGB color to CIE XYZ.
 //
@@ -1425,6 +2498,56 @@ saturate(float mat[3][3],		// I - Matrix to append to
 }
 
 
+#ifdef COLOR_X86
+//
+// 'store3_avx2()' - Store 16 pixels with three colors from one vector per
+//                   color.
+//
+
+__attribute__((target("avx2")))
+static void
+store3_avx2(cf_ib_t       *out,		// O - Pixels
+	    const __m128i v[3])		// I - Colors
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < 3; i ++)
+    _mm_storeu_si128((__m128i *)(out + 16 * i),
+		     _mm_or_si128(
+			 _mm_or_si128(
+			     _mm_shuffle_epi8(v[0], _mm_loadu_si128((__m128i *)color_join[i][0])),
+			     _mm_shuffle_epi8(v[1], _mm_loadu_si128((__m128i *)color_join[i][1]))),
+			 _mm_shuffle_epi8(v[2], _mm_loadu_si128((__m128i *)color_join[i][2]))));
+}
+
+
+//
+// 'store4_avx2()' - Store 16 pixels with four colors from one vector per
+//                   color.
+//
+
+__attribute__((target("avx2")))
+static void
+store4_avx2(cf_ib_t       *out,		// O - Pixels
+	    const __m128i v[4])		// I - Colors
+{
+  __m128i	lo[2], hi[2];		// Pairs of colors
+
+
+  lo[0] = _mm_unpacklo_epi8(v[0], v[1]);
+  hi[0] = _mm_unpackhi_epi8(v[0], v[1]);
+  lo[1] = _mm_unpacklo_epi8(v[2], v[3]);
+  hi[1] = _mm_unpackhi_epi8(v[2], v[3]);
+
+  _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lo[0], lo[1]));
+  _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(lo[0], lo[1]));
+  _mm_storeu_si128((__m128i *)(out + 32), _mm_unpacklo_epi16(hi[0], hi[1]));
+  _mm_storeu_si128((__m128i *)(out + 48), _mm_unpackhi_epi16(hi[0], hi[1]));
+}
+#endif // COLOR_X86
+
+
 // 
 // 'x_form()' - Transform a 3D point using a matrix...
 //
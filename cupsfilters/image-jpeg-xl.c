@@ -11,6 +11,11 @@
 //   _cfIsJPEGXL()                          - Check if the file header indicates JPEG‑XL format.
 //   _cfImageReadJPEGXL()                   - Read a JPEG‑XL image file using libjxl and fill a 
 //                                            cf_image_t structure.
+//   jxl_get_runner()                       - Get a thread-parallel runner for the decoder.
+//   jxl_out_free()                         - Free the per-thread buffers of the image-out callback.
+//   jxl_out_init()                         - Allocate the per-thread buffers of the image-out callback.
+//   jxl_out_row()                          - Convert a run of decoded pixels and put it into the image.
+//   jxl_put_runner()                       - Keep a runner for the next image.
 //
 
 
@@ -24,10 +29,63 @@
 #ifdef HAVE_LIBJXL
 #include "image-jpeg-xl.h"
 #include <jxl/decode.h>
+#include <jxl/thread_parallel_runner.h>
 #include <jxl/types.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>  // For PRIu64 
+#include <pthread.h>
+#include <unistd.h>
+
+
+//
+// Types...
+//
+
+typedef struct jxl_thread_s       // Buffers of a decoder thread
+{
+  uint8_t *in;                    // Copy of decoded pixels
+  cf_ib_t *out;                   // Converted pixels
+} jxl_thread_t;
+
+typedef struct jxl_out_s          // Image-out callback data
+{
+  cf_image_t *img;                // Image
+  int channels;                   // Channels of decoded pixels
+  int color;                      // Non-zero for RGB(A) images
+  int alpha;                      // Non-zero if there is an alpha channel
+  int saturation;                 // Color saturation level
+  int hue;                        // Color hue adjustment
+  const cf_ib_t *lut;             // RGB gamma/brightness LUT or NULL
+  size_t num_threads;             // Number of decoder threads
+  jxl_thread_t *threads;          // Buffers of the decoder threads
+  int error;                      // Non-zero if a row could not be put
+} jxl_out_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t jxl_runner_lock = PTHREAD_MUTEX_INITIALIZER;
+                                  // Lock for the kept runner
+static void *jxl_runner = NULL;   // Runner kept for the next image
+static size_t jxl_runner_threads = 0;
+                                  // Number of threads of kept runner
+static pid_t jxl_runner_pid = 0;  // Process which created kept runner
+
+
+//
+// Local functions...
+//
+
+static void *jxl_get_runner(size_t threads);
+static void jxl_out_free(void *run_opaque);
+static void *jxl_out_init(void *init_opaque, size_t num_threads,
+                          size_t num_pixels_per_thread);
+static void jxl_out_row(void *run_opaque, size_t thread_id, size_t x,
+                        size_t y, size_t num_pixels, const void *pixels);
+static void jxl_put_runner(void *runner, size_t threads);
 
 
 //
@@ -51,8 +109,11 @@ _cfIsJPEGXL(const unsigned char *header,
 
 //
 // _cfImageReadJPEGXL() - Read a JPEG‑XL image using libjxl.
-// Reads the entire file from the given FILE pointer, decodes it using libjxl,
-// and fills the provided cf_image_t structure. Returns 0 on success, nonzero on failure.
+// Reads the entire file from the given FILE pointer and decodes it using
+// libjxl on a thread-parallel runner.  Decoded pixels are converted and
+// stored in the cf_image_t structure by the image-out callback as they
+// come out of the decoder, so no full-size pixel buffer is needed.
+// Returns 0 on success, nonzero on failure.
 //
 
 int
@@ -67,9 +128,14 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   JxlDecoder *dec = NULL;
   JxlBasicInfo info;
   JxlDecoderStatus status;
+  JxlPixelFormat format;
+  jxl_out_t out;
+  void *runner = NULL;
+  size_t threads;
   uint8_t *jxl_data = NULL;
   long jxl_size;
   size_t bytes_read;
+  int ret = 1;
 
   //
   // Read entire file into memory
@@ -78,8 +144,7 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   fseek(fp, 0, SEEK_END);
   jxl_size = ftell(fp);
   fseek(fp, 0, SEEK_SET);
-  jxl_data = (uint8_t*)malloc(jxl_size);
-  if (!jxl_data)
+  if (jxl_size <= 0 || (jxl_data = (uint8_t*)malloc(jxl_size)) == NULL)
   {
     fclose(fp);
     return 1;
@@ -100,15 +165,26 @@ _cfImageReadJPEGXL( cf_image_t      *img,
     return 1;
   }
 
-  status = JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE);
-  if (status != JXL_DEC_SUCCESS)
+  //
+  // Spread decoding over the CPUs...
+  //
+
+  threads = (size_t)_cfImageGetThreads(img->data);
+  if (threads > 1 && (runner = jxl_get_runner(threads)) != NULL &&
+      JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner,
+                                  runner) != JXL_DEC_SUCCESS)
   {
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    jxl_put_runner(runner, threads);
+    runner = NULL;
   }
 
+  DEBUG_printf(("DEBUG: Decoding JXL image with %u threads.\n",
+                runner ? (unsigned)threads : 1));
+
+  status = JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE);
+  if (status != JXL_DEC_SUCCESS)
+    goto done;
+
   JxlDecoderSetInput(dec, jxl_data, jxl_size);
 
   //
@@ -117,20 +193,10 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   
   status = JxlDecoderProcessInput(dec);
   if (status != JXL_DEC_BASIC_INFO)
-  {
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
-  }
+    goto done;
 
   if (JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS)
-  {
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
-  }
+    goto done;
 
   img->xsize = info.xsize;
   img->ysize = info.ysize;
@@ -144,10 +210,7 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   {
     DEBUG_printf(("DEBUG: JXL image has invalid dimensions %ux%u!\n",
                   (unsigned)img->xsize, (unsigned)img->ysize));
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    goto done;
   }
 
   //
@@ -176,7 +239,6 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   // Set up pixel format for decoding
   //
   
-  JxlPixelFormat format;
   format.num_channels = (info.num_color_channels == 1) ? 1 : 3;
   if (info.alpha_bits > 0)
   {
@@ -186,58 +248,184 @@ _cfImageReadJPEGXL( cf_image_t      *img,
   format.endianness = JXL_NATIVE_ENDIAN;
   format.align = 0;
 
-  size_t buffer_size;
-  if (JxlDecoderImageOutBufferSize(dec, &format, &buffer_size) != JXL_DEC_SUCCESS)
+  //
+  // Have the decoder hand us the pixels as soon as they are done, the
+  // callback converts them and puts them into the image...
+  //
+
+  memset(&out, 0, sizeof(out));
+  out.img        = img;
+  out.channels   = format.num_channels;
+  out.color      = info.num_color_channels == 3;
+  out.alpha      = info.alpha_bits > 0;
+  out.saturation = saturation;
+  out.hue        = hue;
+  out.lut        = lut;
+
+  if (JxlDecoderSetImageOutMultithreadedCallback(dec, &format, jxl_out_init,
+                                                 jxl_out_row, jxl_out_free,
+                                                 &out) != JXL_DEC_SUCCESS)
+    goto done;
+
+  //
+  // Process to get the full image
+  //
+  
+  status = JxlDecoderProcessInput(dec);
+  if (status != JXL_DEC_FULL_IMAGE || out.error)
+    goto done;
+
+  ret = 0;
+
+  //
+  // Cleanup
+  //
+
+ done:
+
+  JxlDecoderDestroy(dec);
+  if (runner)
+    jxl_put_runner(runner, threads);
+  free(jxl_data);
+  fclose(fp);
+
+  return ret;
+}
+
+
+//
+// jxl_get_runner() - Get a thread-parallel runner for the decoder.
+// Takes the runner kept from the previous image when it has the right
+// number of threads, creates a new one otherwise.
+//
+
+static void *
+jxl_get_runner(size_t threads)
+{
+  void *runner = NULL;
+
+  pthread_mutex_lock(&jxl_runner_lock);
+
+  //
+  // The threads of a runner do not survive fork(), so a runner created
+  // by the parent of a forked filter is of no use...
+  //
+
+  if (jxl_runner && jxl_runner_pid != getpid())
+    jxl_runner = NULL;
+
+  if (jxl_runner && jxl_runner_threads == threads)
   {
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    runner = jxl_runner;
+    jxl_runner = NULL;
   }
 
-  uint8_t *pixels = (uint8_t*)malloc(buffer_size);
-  if (!pixels)
+  pthread_mutex_unlock(&jxl_runner_lock);
+
+  if (!runner)
+    runner = JxlThreadParallelRunnerCreate(NULL, threads);
+
+  return runner;
+}
+
+
+//
+// jxl_out_free() - Free the per-thread buffers of the image-out callback.
+//
+
+static void
+jxl_out_free(void *run_opaque)
+{
+  jxl_out_t *out = (jxl_out_t *)run_opaque;
+  size_t i;
+
+  for (i = 0; i < out->num_threads; i ++)
   {
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    free(out->threads[i].in);
+    free(out->threads[i].out);
   }
 
-  if (JxlDecoderSetImageOutBuffer(dec, &format, pixels, buffer_size) != JXL_DEC_SUCCESS)
+  free(out->threads);
+  out->threads = NULL;
+  out->num_threads = 0;
+}
+
+
+//
+// jxl_out_init() - Allocate the per-thread buffers of the image-out
+// callback.  The decoder calls this before the first jxl_out_row().
+//
+
+static void *
+jxl_out_init(void   *init_opaque,
+             size_t num_threads,
+             size_t num_pixels_per_thread)
+{
+  jxl_out_t *out = (jxl_out_t *)init_opaque;
+  int bpp = cfImageGetDepth(out->img);
+  size_t i;
+
+  if ((out->threads = calloc(num_threads, sizeof(jxl_thread_t))) == NULL)
   {
-    free(pixels);
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    out->error = 1;
+    return NULL;
   }
 
-  //
-  // Process to get the full image
-  //
-  
-  status = JxlDecoderProcessInput(dec);
-  if (status != JXL_DEC_FULL_IMAGE)
+  out->num_threads = num_threads;
+
+  for (i = 0; i < num_threads; i ++)
   {
-    free(pixels);
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+    if ((out->threads[i].in = malloc(num_pixels_per_thread *
+                                     out->channels)) == NULL ||
+        (out->threads[i].out = malloc(num_pixels_per_thread * bpp)) == NULL)
+    {
+      jxl_out_free(out);
+      out->error = 1;
+      return NULL;
+    }
   }
 
+  return out;
+}
+
+
+//
+// jxl_out_row() - Convert a run of decoded pixels and put it into the
+// image.  Called by several decoder threads at once, each with its own
+// buffers, for runs of at most num_pixels_per_thread pixels of a row.
+//
+
+static void
+jxl_out_row(void       *run_opaque,
+            size_t     thread_id,
+            size_t     x,
+            size_t     y,
+            size_t     num_pixels,
+            const void *pixels)
+{
+  jxl_out_t *out = (jxl_out_t *)run_opaque;
+  jxl_thread_t *t = out->threads + thread_id;
+  cf_image_t *img = out->img;
+  int bpp = cfImageGetDepth(img);
+  int channels = out->channels;
+  uint8_t *row = (uint8_t *)pixels;
+
   //
-  // Handle alpha blending with white background
+  // Handle alpha blending with white background, and any color
+  // adjustment, on a copy of the pixels...
   //
-  
-  if (info.alpha_bits > 0)
+
+  if (out->alpha || (out->color && (out->saturation != 100 || out->hue != 0)))
+  {
+    memcpy(t->in, pixels, num_pixels * channels);
+    row = t->in;
+  }
+
+  if (out->alpha)
   {
-    int channels = format.num_channels;
-    size_t pixel_count = img->xsize * img->ysize;
-    for (size_t i = 0; i < pixel_count; i++)
+    for (size_t i = 0; i < num_pixels; i++)
     {
-      uint8_t *pixel = pixels + i * channels;
+      uint8_t *pixel = row + i * channels;
       uint8_t alpha = pixel[channels - 1];
       if (alpha != 255)
       {
@@ -249,95 +437,97 @@ _cfImageReadJPEGXL( cf_image_t      *img,
         pixel[channels - 1] = 255;
       }
     }
+
+    //
+    // The converters want packed gray or RGB pixels, drop the alpha...
+    //
+
+    for (size_t i = 0; i < num_pixels; i++)
+      memmove(row + i * (channels - 1), row + i * channels, channels - 1);
   }
 
-  //
-  // Process each row for colorspace conversion and LUT
-  //
-  
-  int bpp = cfImageGetDepth(img);
-  cf_ib_t *out = (cf_ib_t*)calloc(img->xsize * bpp, sizeof(cf_ib_t));
-  if (!out)
-  {
-    free(pixels);
-    JxlDecoderDestroy(dec);
-    free(jxl_data);
-    fclose(fp);
-    return 1;
+  if (out->color)
+  {                  // RGB(A) Image
+    if (out->saturation != 100 || out->hue != 0)
+    {
+      cfImageRGBAdjust(row, num_pixels, out->saturation, out->hue);
+    }
+
+    switch (img->colorspace)
+    {
+      case CF_IMAGE_WHITE:
+        cfImageRGBToWhite(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_RGB:
+      case CF_IMAGE_RGB_CMYK:
+        cfImageRGBToRGB(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_BLACK:
+        cfImageRGBToBlack(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_CMY:
+        cfImageRGBToCMY(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_CMYK:
+        cfImageRGBToCMYK(row, t->out, num_pixels);
+        break;
+    }
+  } 
+  else
+  {                                              // Grayscale Image
+    switch (img->colorspace)
+    {
+      case CF_IMAGE_WHITE:
+        memcpy(t->out, row, num_pixels);
+        break;
+      case CF_IMAGE_RGB:
+      case CF_IMAGE_RGB_CMYK:
+        cfImageWhiteToRGB(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_BLACK:
+        cfImageWhiteToBlack(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_CMY:
+        cfImageWhiteToCMY(row, t->out, num_pixels);
+        break;
+      case CF_IMAGE_CMYK:
+        cfImageWhiteToCMYK(row, t->out, num_pixels);
+        break;
+    }
   }
 
-  for (int y = 0; y < img->ysize; y++)
+  if (out->lut)
   {
-    uint8_t *row = pixels + y * img->xsize * format.num_channels;
+    cfImageLut(t->out, num_pixels * bpp, out->lut);
+  }
 
-    if (info.num_color_channels == 3)
-    {                  // RGB(A) Image
-      if (saturation != 100 || hue != 0)
-      {
-        cfImageRGBAdjust(row, img->xsize, saturation, hue);
-      }
+  if (_cfImagePutRow(img, (int)x, (int)y, (int)num_pixels, t->out))
+    __atomic_store_n(&out->error, 1, __ATOMIC_RELAXED);
+}
 
-      switch (img->colorspace)
-      {
-        case CF_IMAGE_WHITE:
-          cfImageRGBToWhite(row, out, img->xsize);
-          break;
-        case CF_IMAGE_RGB:
-        case CF_IMAGE_RGB_CMYK:
-          cfImageRGBToRGB(row, out, img->xsize);
-          break;
-        case CF_IMAGE_BLACK:
-          cfImageRGBToBlack(row, out, img->xsize);
-          break;
-        case CF_IMAGE_CMY:
-          cfImageRGBToCMY(row, out, img->xsize);
-          break;
-        case CF_IMAGE_CMYK:
-          cfImageRGBToCMYK(row, out, img->xsize);
-          break;
-      }
-    } 
-    else
-    {                                              // Grayscale Image
-      switch (img->colorspace)
-      {
-        case CF_IMAGE_WHITE:
-          memcpy(out, row, img->xsize);
-          break;
-        case CF_IMAGE_RGB:
-        case CF_IMAGE_RGB_CMYK:
-          cfImageWhiteToRGB(row, out, img->xsize);
-          break;
-        case CF_IMAGE_BLACK:
-          cfImageWhiteToBlack(row, out, img->xsize);
-          break;
-        case CF_IMAGE_CMY:
-          cfImageWhiteToCMY(row, out, img->xsize);
-          break;
-        case CF_IMAGE_CMYK:
-          cfImageWhiteToCMYK(row, out, img->xsize);
-          break;
-      }
-    }
 
-    if (lut)
-    {
-      cfImageLut(out, img->xsize * bpp, lut);
-    }
+//
+// jxl_put_runner() - Keep a runner for the next image, or destroy it if
+// there already is one.
+//
 
-    _cfImagePutRow(img, 0, y, img->xsize, out);
+static void
+jxl_put_runner(void   *runner,
+               size_t threads)
+{
+  pthread_mutex_lock(&jxl_runner_lock);
+
+  if (!jxl_runner)
+  {
+    jxl_runner         = runner;
+    jxl_runner_threads = threads;
+    jxl_runner_pid     = getpid();
+    runner             = NULL;
   }
 
-  //
-  // Cleanup
-  //
-  
-  free(out);
-  free(pixels);
-  JxlDecoderDestroy(dec);
-  free(jxl_data);
-  fclose(fp);
+  pthread_mutex_unlock(&jxl_runner_lock);
 
-  return 0;
+  if (runner)
+    JxlThreadParallelRunnerDestroy(runner);
 }
 #endif // HAVE_LIBJXL
@@ -74,6 +74,7 @@ _cfImageReadJPEG(
 			*volatile out = NULL;	// Output pixels
   jpeg_saved_marker_ptr	marker;		// Pointer to marker data
   int			psjpeg = 0;	// Non-zero if Photoshop CMYK JPEG
+  int			status = 0;	// Status of storing the rows
   static const char	*cspaces[] =
 			{		// JPEG colorspaces...
 			  "JCS_UNKNOWN",
@@ -223,6 +224,42 @@ _cfImageReadJPEG(
     }
   }
 
+  //
+  // If fewer pixels are needed than the image has, let libjpeg scale it
+  // down while decoding, by leaving out the higher DCT coefficients.  This
+  // is much faster than decoding the full image and zooming it down
+  // afterwards.  We only take scale factors which keep the resolution an
+  // integer, so that the size of the image in inches stays the same...
+  //
+
+  if (img->min_size > 0)
+  {
+    unsigned	denom;			// Scale denominator
+
+
+    for (denom = 8; denom > 1; denom /= 2)
+      if (img->xsize / denom >= img->min_size &&
+	  img->ysize / denom >= img->min_size &&
+	  img->xppi % denom == 0 && img->yppi % denom == 0)
+	break;
+
+    if (denom > 1)
+    {
+      DEBUG_printf(("DEBUG: Scaling JPEG image down by 1/%d while "
+		    "decoding\n", denom));
+
+      cinfo.scale_num   = 1;
+      cinfo.scale_denom = denom;
+
+      jpeg_calc_output_dimensions(&cinfo);
+
+      img->xsize = cinfo.output_width;
+      img->ysize = cinfo.output_height;
+      img->xppi  /= denom;
+      img->yppi  /= denom;
+    }
+  }
+
   DEBUG_printf(("DEBUG: JPEG image %dx%dx%d, %dx%d PPI\n",
 		img->xsize, img->ysize, cinfo.output_components,
 		img->xppi, img->yppi));
@@ -252,7 +289,12 @@ _cfImageReadJPEG(
 
   jpeg_start_decompress(&cinfo);
 
-  while (cinfo.output_scanline < cinfo.output_height)
+  //
+  // Stop decoding when a row cannot be stored, a streaming image does
+  // not take more rows once it got closed...
+  //
+
+  while (!status && cinfo.output_scanline < cinfo.output_height)
   {
     jpeg_read_scanlines(&cinfo, (JSAMPROW *)&in, (JDIMENSION)1);
 
@@ -298,7 +340,8 @@ _cfImageReadJPEG(
       if (lut)
         cfImageLut(in, img->xsize * cfImageGetDepth(img), lut);
 
-      _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize, in);
+      status = _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize,
+			      in);
     }
     else if (cinfo.out_color_space == JCS_GRAYSCALE)
     {
@@ -324,7 +367,8 @@ _cfImageReadJPEG(
       if (lut)
         cfImageLut(out, img->xsize * cfImageGetDepth(img), lut);
 
-      _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize, out);
+      status = _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize,
+			      out);
     }
     else if (cinfo.out_color_space == JCS_RGB)
     {
@@ -353,7 +397,8 @@ _cfImageReadJPEG(
       if (lut)
         cfImageLut(out, img->xsize * cfImageGetDepth(img), lut);
 
-      _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize, out);
+      status = _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize,
+			      out);
     }
     else // JCS_CMYK
     {
@@ -381,18 +426,22 @@ _cfImageReadJPEG(
       if (lut)
         cfImageLut(out, img->xsize * cfImageGetDepth(img), lut);
 
-      _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize, out);
+      status = _cfImagePutRow(img, 0, cinfo.output_scanline - 1, img->xsize,
+			      out);
     }
   }
 
   free(in);
   free(out);
 
-  jpeg_finish_decompress(&cinfo);
+  if (status)
+    jpeg_abort_decompress(&cinfo);
+  else
+    jpeg_finish_decompress(&cinfo);
   jpeg_destroy_decompress(&cinfo);
 
   fclose(fp);
 
-  return (0);
+  return (status ? 1 : 0);
 }
 #endif // HAVE_LIBJPEG
@@ -79,7 +79,8 @@ _cfImageReadPNG(
 		yppm;			// Y pixels per meter
   int		bpp;			// Bytes per pixel
   int		pass,			// Current pass
-		passes;			// Number of passes required
+		passes,			// Number of passes required
+		status = 0;		// Status of storing the rows
   cf_ib_t	* volatile in = NULL;	// Input pixels (volatile for setjmp)
   cf_ib_t	*inptr;			// Pointer into pixels
   cf_ib_t	* volatile out = NULL;	// Output pixels (volatile for setjmp)
@@ -292,11 +293,13 @@ _cfImageReadPNG(
   }
 
   //
-  // Read the image, interlacing as needed...
+  // Read the image, interlacing as needed, and stop when a row cannot be
+  // stored, a streaming image does not take more rows once it got
+  // closed...
   //
 
-  for (pass = 1; pass <= passes; pass ++)
-    for (inptr = in, y = 0; y < img->ysize; y ++)
+  for (pass = 1; pass <= passes && !status; pass ++)
+    for (inptr = in, y = 0; y < img->ysize && !status; y ++)
     {
       png_read_row(pp, (png_bytep)inptr, NULL);
 
@@ -357,7 +360,7 @@ _cfImageReadPNG(
 	if (lut)
 	  cfImageLut(out, img->xsize * bpp, lut);
 
-	_cfImagePutRow(img, 0, y, img->xsize, out);
+	status = _cfImagePutRow(img, 0, y, img->xsize, out);
       }
 
       if (passes > 1)
@@ -369,13 +372,14 @@ _cfImageReadPNG(
       }
     }
 
-  png_read_end(pp, info);
+  if (!status)
+    png_read_end(pp, info);
   png_destroy_read_struct(&pp, &info, NULL);
 
   fclose(fp);
   free(in);
   free(out);
 
-  return (0);
+  return (status ? 1 : 0);
 }
 #endif // HAVE_LIBPNG
@@ -20,6 +20,7 @@
 #  include <config.h>
 
 #  include <cupsfilters/image.h>
+#  include <cupsfilters/filter.h>
 #  include <cupsfilters/libcups2-private.h>
 #  include <cups/cups.h>
 #  define DEBUG_printf(x)
@@ -34,6 +35,7 @@
 #  endif // WIN32
 #  include <errno.h>
 #  include <math.h>	
+#  include <pthread.h>
 
 #ifdef HAVE_EXIF
 #	include <libexif/exif-data.h>
@@ -54,6 +56,10 @@
 
 #  define CF_TILE_SIZE		256	// 256x256 pixel tiles
 #  define CF_TILE_MINIMUM	10	// Minimum number of tiles
+#  define CF_TILE_SHARDS	8	// Number of independently locked
+					// parts of the tile cache
+#  define CF_STREAM_ROWS	32	// Rows kept by a streaming image
+#  define CF_IMAGE_MAX_THREADS	16	// Maximum number of decoder threads
 
 
 //
@@ -79,7 +85,7 @@ typedef enum cf_iztype_e		// **** Image zoom type ****
 {
   CF_IZOOM_FAST,			// Use nearest-neighbor sampling
   CF_IZOOM_NORMAL,			// Use bilinear interpolation
-  CF_IZOOM_BEST				// Use bicubic interpolation
+  CF_IZOOM_BEST				// Use bicubic or Lanczos filtering
 } cf_iztype_t;
 
 struct cf_ic_s;
@@ -97,9 +103,51 @@ typedef struct cf_ic_s			// **** Image tile cache ****
   struct cf_ic_s	*prev,		// Previous tile in cache
 			*next;		// Next tile in cache
   cf_itile_t		*tile;		// Tile this is attached to
+  int			pinned;		// Number of users of the pixels, the
+					// tile is not flushed while non-zero
   cf_ib_t		*pixels;	// Pixel data
 } cf_ic_t;
 
+typedef struct cf_ishard_s		// **** Tile cache shard ****
+{
+  pthread_mutex_t	lock;		// Lock for the tiles of the shard
+  unsigned		num_ics;	// Number of cached tiles
+  cf_ic_t		*first,		// First cached tile in shard
+			*last;		// Last cached tile in shard
+} cf_ishard_t;
+
+typedef int (*cf_image_reader_t)(cf_image_t *img, FILE *fp,
+				 cf_icspace_t primary,
+				 cf_icspace_t secondary, int saturation,
+				 int hue, const cf_ib_t *lut);
+					// **** Image file reader ****
+
+typedef struct cf_istream_s		// **** Streaming image source ****
+{
+  cf_image_reader_t	reader;		// Reader decoding the image
+  FILE			*fp;		// Image file
+  int			fd;		// Duplicate descriptor to re-read
+					// the image from the start
+  cf_icspace_t		primary,	// Primary colorspace needed
+			secondary;	// Secondary colorspace
+  int			saturation,	// Color saturation level
+			hue;		// Color hue adjustment
+  cf_ib_t		lut[256],	// RGB gamma/brightness LUT
+			*lutptr;	// LUT or NULL
+  pthread_t		thread;		// Decoder thread
+  pthread_mutex_t	lock;		// Lock for the row window
+  pthread_cond_t	cond;		// Signalled on any state change
+  cf_ib_t		*rows;		// Ring of decoded rows
+  size_t		rowsize;	// Bytes per row
+  int			next,		// Next row the decoder puts
+			low,		// Lowest row the reader may still get
+			ready,		// Image size and colorspace known
+			done,		// Decoder has returned
+			status,		// Status returned by decoder
+			broken,		// Rows did not come top to bottom
+			abort;		// Decoder output is not wanted
+} cf_istream_t;
+
 struct cf_image_s			// **** Image file data ****
 {
   cf_icspace_t		colorspace;	// Colorspace of image
@@ -107,13 +155,31 @@ struct cf_image_s			// **** Image file data ****
 			ysize,		// Height of image in pixels
 			xppi,		// X resolution in pixels-per-inch
 			yppi,		// Y resolution in pixels-per-inch
-			num_ics,	// Number of cached tiles
 			max_ics;	// Maximum number of cached tiles
   cf_itile_t		**tiles;	// Tiles in image
-  cf_ic_t		*first,		// First cached tile in image
-			*last;		// Last cached tile in image
+  cf_ishard_t		shards[CF_TILE_SHARDS];
+					// Tile cache, tiles are spread over
+					// the shards by position
+  pthread_mutex_t	lock;		// Lock for setting up the cache and
+					// for evicting bands
   int			cachefile;	// Tile cache file
   char			cachename[256];	// Tile cache filename
+  off_t			cacheend;	// End of tile cache file
+  cf_filter_data_t	*data;		// Job data with memory budget or NULL
+  size_t		cache_reserved;	// Bytes of the budget reserved for
+					// the tile cache
+  int			nomap;		// Non-zero to use the tile cache
+  cf_ib_t		*map;		// Mapped image data or NULL
+  size_t		map_size,	// Size of the mapping in bytes
+			map_stride;	// Bytes per row in the mapping
+  unsigned long		*map_used,	// Last use of each band of
+					// CF_TILE_SIZE rows, 0 if not resident
+			map_clock;	// Band use counter
+  unsigned		map_resident;	// Number of resident bands
+  cf_istream_t		*stream;	// Streaming source or NULL
+  unsigned		min_size;	// Pixels needed along each edge,
+					// readers may scale the image down
+					// to that, 0 for the full size
 };
 
 struct cf_izoom_s			// **** Image zoom data ****
@@ -145,7 +211,22 @@ struct cf_izoom_s			// **** Image zoom data ****
 			row,		// Current row
 			yflip;		// Y backwards/upside-down
   cf_ib_t		*rows[2],	// Horizontally scaled pixel data
-			*in;		// Unscaled input pixel data
+			*in,		// Unscaled input pixel data
+			*inbuf;		// Buffer of "in", with padding on
+					// each side
+  int			*xoff;		// Input offset for each output byte,
+					// NULL for the unvectorized code
+  unsigned short	*xweight;	// Weight of the next input pixel for
+					// each output byte
+  int			xtaps,		// Filter taps along X for
+					// CF_IZOOM_BEST
+			ytaps,		// Filter taps along Y
+			*hrow;		// Input row in each slot of "hrows"
+  short			*xcoef,		// Filter weights along X, by tap and
+					// output byte
+			*ycoef;		// Filter weights along Y
+  cf_ib_t		*hrows,		// Ring of rows filtered along X
+			**hptrs;	// Rows of the ring in tap order
 };
 
 
@@ -153,10 +234,24 @@ struct cf_izoom_s			// **** Image zoom data ****
 // Prototypes...
 //
 
+extern const char	*_cfImageColorKernel(const char *name);
+extern unsigned		_cfImageFittedSize(cups_page_header_t *header,
+					   float page_width,
+					   float page_length,
+					   int num_options,
+					   cups_option_t *options);
+extern int		_cfImageGetThreads(cf_filter_data_t *data);
 extern int		_cfImagePutCol(cf_image_t *img, int x, int y,
 				       int height, const cf_ib_t *pixels);
 extern int		_cfImagePutRow(cf_image_t *img, int x, int y,
 				       int width, const cf_ib_t *pixels);
+extern int		_cfImageRasterFormat(cups_page_header_t *header,
+					     int generic, int xposition,
+					     int y, int z, int xsize,
+					     int ysize, int yerr0, int yerr1,
+					     cf_ib_t *r0, cf_ib_t *r1,
+					     unsigned char *row);
+extern const char	*_cfImageRasterKernel(const char *name);
 extern int		_cfImageReadJPEG(cf_image_t *img, FILE *fp,
 					 cf_icspace_t primary,
 					 cf_icspace_t secondary,
@@ -174,6 +269,7 @@ extern int		_cfImageReadTIFF(cf_image_t *img, FILE *fp,
 					 const cf_ib_t *lut);
 extern void		_cfImageZoomDelete(cf_izoom_t *z);
 extern void		_cfImageZoomFill(cf_izoom_t *z, int iy);
+extern const char	*_cfImageZoomKernel(const char *name);
 extern cf_izoom_t	*_cfImageZoomNew(cf_image_t *img, int xc0, int yc0,
 					 int xc1, int yc1, int xsize,
 					 int ysize, int rotated,
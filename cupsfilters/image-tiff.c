@@ -10,6 +10,17 @@
 // Contents:
 //
 //   _cfImageReadTIFF() - Read a TIFF image file.
+//   client_close()     - Close a TIFF handle of a decoder thread.
+//   client_map()       - Refuse to map the file of a decoder thread.
+//   client_read()      - Read from the file of a decoder thread.
+//   client_seek()      - Seek in the file of a decoder thread.
+//   client_size()      - Get the size of the file of a decoder thread.
+//   client_unmap()     - Unmap the file of a decoder thread.
+//   client_write()     - Refuse to write from a decoder thread.
+//   rows_decode()      - Decoder thread, decodes strips or rows of tiles.
+//   rows_free()        - Stop the decoder threads and free the buffers.
+//   rows_open()        - Start decoding strips or tiles in parallel.
+//   rows_read()        - Read the next row of the image.
 //
 
 //
@@ -22,6 +33,72 @@
 #  include <tiff.h>	// TIFF image definitions
 #  include <tiffio.h>
 #  include <unistd.h>
+#  include <sys/stat.h>
+
+
+//
+// Local types...
+//
+
+typedef struct tiff_client_s		// **** File of a decoder thread ****
+{
+  int		fd;			// Shared file descriptor
+  toff_t	pos;			// Own file position
+} tiff_client_t;
+
+typedef struct tiff_band_s		// **** Decoded strip or tile row ****
+{
+  int		band;			// Number of strip or row of tiles
+  int		ready;			// Non-zero when decoded
+  int		status;			// 0 on success, -1 on error
+  unsigned char	*data;			// Decoded scanlines
+} tiff_band_t;
+
+typedef struct tiff_rows_s		// **** Scanlines of a TIFF image ****
+{
+  TIFF		*tif;			// TIFF file for sequential reading
+  int		fd;			// File descriptor of TIFF file
+  int		tiled;			// Non-zero for tiled image
+  uint32_t	height,			// Height of image
+		band_rows,		// Rows per strip or tile
+		tile_width;		// Width of tiles
+  tmsize_t	scanwidth,		// Bytes per scanline
+		tile_rowsize,		// Bytes per row of a tile
+		tile_size;		// Bytes per tile
+  int		num_bands,		// Number of strips or rows of tiles
+		num_threads,		// Number of decoder threads, 0 to read
+					// sequentially
+		num_slots;		// Number of bands buffered
+  pthread_t	threads[CF_IMAGE_MAX_THREADS];
+					// Decoder threads
+  pthread_mutex_t lock;			// Lock for the fields below
+  pthread_cond_t cond;			// Signals progress
+  int		next,			// Next band to decode
+		current,		// Band read by rows_read()
+		abort;			// Non-zero to stop the decoders
+  tiff_band_t	*slots;			// Decoded bands, band N is in slot
+					// N % num_slots
+  int		loaded;			// Last band found decoded by
+					// rows_read()
+} tiff_rows_t;
+
+
+//
+// Local functions...
+//
+
+static int	client_close(thandle_t fd);
+static int	client_map(thandle_t fd, void **base, toff_t *size);
+static tmsize_t	client_read(thandle_t fd, void *buf, tmsize_t size);
+static toff_t	client_seek(thandle_t fd, toff_t off, int whence);
+static toff_t	client_size(thandle_t fd);
+static void	client_unmap(thandle_t fd, void *base, toff_t size);
+static tmsize_t	client_write(thandle_t fd, void *buf, tmsize_t size);
+static void	*rows_decode(void *arg);
+static void	rows_free(tiff_rows_t *rows);
+static void	rows_open(tiff_rows_t *rows, cf_image_t *img, TIFF *tif,
+			  int fd);
+static int	rows_read(tiff_rows_t *rows, void *buf, uint32_t row);
 
 
 //
@@ -65,7 +142,8 @@ _cfImageReadTIFF(
 		pstep,			// Pixel step (= bpp or -2 * bpp)
 		scanwidth,		// Width of scanline
 		r, g, b, k,		// Red, green, blue, and black values
-		alpha;			// Image includes alpha?
+		alpha,			// Image includes alpha?
+		status = 0;		// Status of storing the pixels
   cf_ib_t	*in,			// Input buffer
 		*out,			// Output buffer
 		*p,			// Pointer into buffer
@@ -75,6 +153,7 @@ _cfImageReadTIFF(
 		pixel,			// Current pixel
 		zero,			// Zero value (bitmaps)
 		one;			// One value (bitmaps)
+  tiff_rows_t	rows;			// Scanline reader
 
 
   //
@@ -413,6 +492,8 @@ _cfImageReadTIFF(
   DEBUG_printf(("DEBUG: photometric = %d\n", photometric));
   DEBUG_printf(("DEBUG: compression = %d\n", compression));
 
+  rows_open(&rows, img, tif, fileno(fp));
+
   switch (photometric)
   {
     case PHOTOMETRIC_MINISWHITE :
@@ -435,12 +516,13 @@ _cfImageReadTIFF(
 	  //
 
           for (y = ystart, ycount = img->ysize, row = 0;
-               ycount > 0;
+               ycount > 0 && !status;
                ycount --, y += ydir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart, bit = 128;
                    xcount > 0;
                    xcount --, p += pstep)
@@ -461,7 +543,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart, bit = 0xc0;
                    xcount > 0;
                    xcount --, p += pstep)
@@ -482,7 +565,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart, bit = 0xf0;
                    xcount > 0;
                    xcount --, p += pstep)
@@ -502,7 +586,8 @@ _cfImageReadTIFF(
             }
             else if (xdir < 0 || zero || alpha)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               if (alpha)
 	      {
@@ -541,15 +626,15 @@ _cfImageReadTIFF(
         	}
               }
             }
-            else
-              TIFFReadScanline(tif, in, row, 0);
+            else if ((status = rows_read(&rows, in, row)) != 0)
+              break;
 
             if (img->colorspace == CF_IMAGE_WHITE)
 	    {
 	      if (lut)
 	        cfImageLut(in, img->xsize, lut);
 
-              _cfImagePutRow(img, 0, y, img->xsize, in);
+              status = _cfImagePutRow(img, 0, y, img->xsize, in);
 	    }
             else
             {
@@ -575,7 +660,7 @@ _cfImageReadTIFF(
 	      if (lut)
 	        cfImageLut(out, img->xsize * bpp, lut);
 
-              _cfImagePutRow(img, 0, y, img->xsize, out);
+              status = _cfImagePutRow(img, 0, y, img->xsize, out);
 	    }
           }
         }
@@ -586,12 +671,13 @@ _cfImageReadTIFF(
 	  //
 
           for (x = xstart, xcount = img->xsize, row = 0;
-               xcount > 0;
+               xcount > 0 && !status;
                xcount --, x += xdir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart, bit = 128;
                    ycount > 0;
                    ycount --, p += ydir)
@@ -612,7 +698,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart, bit = 0xc0;
                    ycount > 0;
                    ycount --, p += ydir)
@@ -634,7 +721,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart, bit = 0xf0;
                    ycount > 0;
                    ycount --, p += ydir)
@@ -654,7 +742,8 @@ _cfImageReadTIFF(
             }
             else if (ydir < 0 || zero || alpha)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               if (alpha)
 	      {
@@ -693,15 +782,15 @@ _cfImageReadTIFF(
         	}
 	      }
             }
-            else
-              TIFFReadScanline(tif, in, row, 0);
+            else if ((status = rows_read(&rows, in, row)) != 0)
+              break;
 
             if (img->colorspace == CF_IMAGE_WHITE)
 	    {
 	      if (lut)
 	        cfImageLut(in, img->ysize, lut);
 
-              _cfImagePutCol(img, x, 0, img->ysize, in);
+              status = _cfImagePutCol(img, x, 0, img->ysize, in);
 	    }
             else
             {
@@ -727,7 +816,7 @@ _cfImageReadTIFF(
 	      if (lut)
 	        cfImageLut(out, img->ysize * bpp, lut);
 
-              _cfImagePutCol(img, x, 0, img->ysize, out);
+              status = _cfImagePutCol(img, x, 0, img->ysize, out);
 	    }
           }
         }
@@ -736,6 +825,7 @@ _cfImageReadTIFF(
     case PHOTOMETRIC_PALETTE :
 	if (!TIFFGetField(tif, TIFFTAG_COLORMAP, &redcmap, &greencmap, &bluecmap))
 	{
+	  rows_free(&rows);
 	  _TIFFfree(scanline);
 	  free(in);
 	  free(out);
@@ -762,12 +852,13 @@ _cfImageReadTIFF(
 	  //
 
           for (y = ystart, ycount = img->ysize, row = 0;
-               ycount > 0;
+               ycount > 0 && !status;
                ycount --, y += ydir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline,
 	               p = in + xstart * 3, bit = 128;
                    xcount > 0;
@@ -797,7 +888,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline,
 	               p = in + xstart * 3, bit = 0xc0;
                    xcount > 0;
@@ -822,7 +914,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline,
 	               p = in + 3 * xstart, bit = 0xf0;
                    xcount > 0;
@@ -848,7 +941,8 @@ _cfImageReadTIFF(
             }
             else
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               for (xcount = img->xsize, p = in + 3 * xstart, scanptr = scanline;
                    xcount > 0;
@@ -885,7 +979,7 @@ _cfImageReadTIFF(
 	    if (lut)
 	      cfImageLut(out, img->xsize * bpp, lut);
 
-            _cfImagePutRow(img, 0, y, img->xsize, out);
+            status = _cfImagePutRow(img, 0, y, img->xsize, out);
           }
         }
         else
@@ -895,12 +989,13 @@ _cfImageReadTIFF(
 	  //
 
           for (x = xstart, xcount = img->xsize, row = 0;
-               xcount > 0;
+               xcount > 0 && !status;
                xcount --, x += xdir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline,
 	               p = in + 3 * ystart, bit = 128;
                    ycount > 0;
@@ -930,7 +1025,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline,
 	               p = in + 3 * ystart, bit = 0xc0;
                    ycount > 0;
@@ -955,7 +1051,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline,
 	               p = in + 3 * ystart, bit = 0xf0;
                    ycount > 0;
@@ -981,7 +1078,8 @@ _cfImageReadTIFF(
             }
             else
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               for (ycount = img->ysize, p = in + 3 * ystart, scanptr = scanline;
                    ycount > 0;
@@ -1018,7 +1116,7 @@ _cfImageReadTIFF(
 	    if (lut)
 	      cfImageLut(out, img->ysize * bpp, lut);
 
-            _cfImagePutCol(img, x, 0, img->ysize, out);
+            status = _cfImagePutCol(img, x, 0, img->ysize, out);
 	  }
         }
         break;
@@ -1031,12 +1129,13 @@ _cfImageReadTIFF(
 	  //
 
           for (y = ystart, ycount = img->ysize, row = 0;
-               ycount > 0;
+               ycount > 0 && !status;
                ycount --, y += ydir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3, bit = 0xf0;
                    xcount > 0;
                    xcount --, p += pstep)
@@ -1067,7 +1166,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3;
                    xcount > 0;
                    xcount --, p += pstep, scanptr ++)
@@ -1082,7 +1182,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3;
                    xcount > 0;
                    xcount -= 2, p += 2 * pstep, scanptr += 3)
@@ -1106,7 +1207,8 @@ _cfImageReadTIFF(
             }
             else if (xdir < 0 || alpha)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               if (alpha)
 	      {
@@ -1131,8 +1233,8 @@ _cfImageReadTIFF(
         	}
 	      }
             }
-            else
-              TIFFReadScanline(tif, in, row, 0);
+            else if ((status = rows_read(&rows, in, row)) != 0)
+              break;
 
             if ((saturation != 100 || hue != 0) && bpp > 1)
               cfImageRGBAdjust(in, img->xsize, saturation, hue);
@@ -1162,7 +1264,7 @@ _cfImageReadTIFF(
 	    if (lut)
 	      cfImageLut(out, img->xsize * bpp, lut);
 
-            _cfImagePutRow(img, 0, y, img->xsize, out);
+            status = _cfImagePutRow(img, 0, y, img->xsize, out);
           }
         }
         else
@@ -1172,12 +1274,13 @@ _cfImageReadTIFF(
 	  //
 
           for (x = xstart, xcount = img->xsize, row = 0;
-               xcount > 0;
+               xcount > 0 && !status;
                xcount --, x += xdir, row ++)
           {
             if (bits == 1)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart * 3, bit = 0xf0;
                    ycount > 0;
                    ycount --, p += pstep)
@@ -1208,7 +1311,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 2)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart * 3;
                    ycount > 0;
                    ycount --, p += pstep, scanptr ++)
@@ -1223,7 +1327,8 @@ _cfImageReadTIFF(
             }
             else if (bits == 4)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
               for (ycount = img->ysize, scanptr = scanline, p = in + ystart * 3;
                    ycount > 0;
                    ycount -= 2, p += 2 * pstep, scanptr += 3)
@@ -1247,7 +1352,8 @@ _cfImageReadTIFF(
             }
             else if (ydir < 0 || alpha)
             {
-              TIFFReadScanline(tif, scanline, row, 0);
+              if ((status = rows_read(&rows, scanline, row)) != 0)
+                break;
 
               if (alpha)
 	      {
@@ -1272,8 +1378,8 @@ _cfImageReadTIFF(
         	}
 	      }
             }
-            else
-              TIFFReadScanline(tif, in, row, 0);
+            else if ((status = rows_read(&rows, in, row)) != 0)
+              break;
 
             if ((saturation != 100 || hue != 0) && bpp > 1)
               cfImageRGBAdjust(in, img->ysize, saturation, hue);
@@ -1303,7 +1409,7 @@ _cfImageReadTIFF(
 	    if (lut)
 	      cfImageLut(out, img->ysize * bpp, lut);
 
-            _cfImagePutCol(img, x, 0, img->ysize, out);
+            status = _cfImagePutCol(img, x, 0, img->ysize, out);
           }
         }
         break;
@@ -1331,12 +1437,13 @@ _cfImageReadTIFF(
 	    //
 
             for (y = ystart, ycount = img->ysize, row = 0;
-        	 ycount > 0;
+        	 ycount > 0 && !status;
         	 ycount --, y += ydir, row ++)
             {
               if (bits == 1)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3, bit = 0xf0;
                      xcount > 0;
                      xcount --, p += pstep)
@@ -1376,7 +1483,8 @@ _cfImageReadTIFF(
               }
               else if (bits == 2)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3;
                      xcount > 0;
                      xcount --, p += pstep, scanptr ++)
@@ -1422,7 +1530,8 @@ _cfImageReadTIFF(
               }
               else if (bits == 4)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (xcount = img->xsize, scanptr = scanline, p = in + xstart * 3;
                      xcount > 0;
                      xcount --, p += pstep, scanptr += 2)
@@ -1468,12 +1577,14 @@ _cfImageReadTIFF(
               }
               else if (img->colorspace == CF_IMAGE_CMYK)
 	      {
-	        TIFFReadScanline(tif, scanline, row, 0);
-		_cfImagePutRow(img, 0, y, img->xsize, scanline);
+	        if ((status = rows_read(&rows, scanline, row)) != 0)
+	          break;
+		status = _cfImagePutRow(img, 0, y, img->xsize, scanline);
 	      }
 	      else
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
 
         	for (xcount = img->xsize, p = in + xstart * 3, scanptr = scanline;
                      xcount > 0;
@@ -1543,7 +1654,7 @@ _cfImageReadTIFF(
 	      if (lut)
 	        cfImageLut(out, img->xsize * bpp, lut);
 
-              _cfImagePutRow(img, 0, y, img->xsize, out);
+              status = _cfImagePutRow(img, 0, y, img->xsize, out);
             }
           }
           else
@@ -1553,12 +1664,13 @@ _cfImageReadTIFF(
 	    //
 
             for (x = xstart, xcount = img->xsize, row = 0;
-        	 xcount > 0;
+        	 xcount > 0 && !status;
         	 xcount --, x += xdir, row ++)
             {
               if (bits == 1)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (ycount = img->ysize, scanptr = scanline, p = in + xstart * 3, bit = 0xf0;
                      ycount > 0;
                      ycount --, p += pstep)
@@ -1598,7 +1710,8 @@ _cfImageReadTIFF(
               }
               else if (bits == 2)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (ycount = img->ysize, scanptr = scanline, p = in + xstart * 3;
                      ycount > 0;
                      ycount --, p += pstep, scanptr ++)
@@ -1644,7 +1757,8 @@ _cfImageReadTIFF(
               }
               else if (bits == 4)
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
         	for (ycount = img->ysize, scanptr = scanline, p = in + xstart * 3;
                      ycount > 0;
                      ycount --, p += pstep, scanptr += 2)
@@ -1690,12 +1804,14 @@ _cfImageReadTIFF(
               }
               else if (img->colorspace == CF_IMAGE_CMYK)
 	      {
-	        TIFFReadScanline(tif, scanline, row, 0);
-		_cfImagePutCol(img, x, 0, img->ysize, scanline);
+	        if ((status = rows_read(&rows, scanline, row)) != 0)
+	          break;
+		status = _cfImagePutCol(img, x, 0, img->ysize, scanline);
 	      }
               else
               {
-        	TIFFReadScanline(tif, scanline, row, 0);
+        	if ((status = rows_read(&rows, scanline, row)) != 0)
+        	  break;
 
         	for (ycount = img->ysize, p = in + xstart * 3, scanptr = scanline;
                      ycount > 0;
@@ -1765,7 +1881,7 @@ _cfImageReadTIFF(
 	      if (lut)
 	        cfImageLut(out, img->ysize * bpp, lut);
 
-              _cfImagePutCol(img, x, 0, img->ysize, out);
+              status = _cfImagePutCol(img, x, 0, img->ysize, out);
             }
           }
 
@@ -1773,6 +1889,7 @@ _cfImageReadTIFF(
 	}
 
     default :
+	rows_free(&rows);
 	_TIFFfree(scanline);
 	free(in);
 	free(out);
@@ -1783,14 +1900,466 @@ _cfImageReadTIFF(
   }
 
   //
-  // Free temporary buffers, close the TIFF file, and return.
+  // Free temporary buffers, close the TIFF file, and return. We stop
+  // early when rows cannot be read or pixels cannot be stored...
   //
 
+  rows_free(&rows);
   _TIFFfree(scanline);
   free(in);
   free(out);
 
   TIFFClose(tif);
+  return (status ? 1 : 0);
+}
+
+
+//
+// 'client_close()' - Close a TIFF handle of a decoder thread.
+//
+// The decoder threads share the file descriptor of the main TIFF handle
+// but read with pread() at their own position, so they do not disturb
+// each other.
+//
+
+static int				// O - 0 on success
+client_close(thandle_t fd)		// I - Client data
+{
+  (void)fd;
+
+  return (0);
+}
+
+
+//
+// 'client_map()' - Refuse to map the file of a decoder thread.
+//
+
+static int				// O - 0 (not mapped)
+client_map(thandle_t fd,		// I - Client data
+	   void      **base,		// O - Base address
+	   toff_t    *size)		// O - Size of mapping
+{
+  (void)fd;
+  (void)base;
+  (void)size;
+
+  return (0);
+}
+
+
+//
+// 'client_read()' - Read from the file of a decoder thread.
+//
+
+static tmsize_t				// O - Bytes read or -1 on error
+client_read(thandle_t fd,		// I - Client data
+	    void      *buf,		// I - Buffer
+	    tmsize_t  size)		// I - Bytes to read
+{
+  tiff_client_t	*client = (tiff_client_t *)fd;
+					// File of decoder thread
+  ssize_t	bytes;			// Bytes read
+
+
+  if ((bytes = pread(client->fd, buf, (size_t)size, (off_t)client->pos)) > 0)
+    client->pos += bytes;
+
+  return ((tmsize_t)bytes);
+}
+
+
+//
+// 'client_seek()' - Seek in the file of a decoder thread.
+//
+
+static toff_t				// O - New position
+client_seek(thandle_t fd,		// I - Client data
+	    toff_t    off,		// I - Offset
+	    int       whence)		// I - SEEK_SET, SEEK_CUR, or SEEK_END
+{
+  tiff_client_t	*client = (tiff_client_t *)fd;
+					// File of decoder thread
+
+
+  if (whence == SEEK_CUR)
+    client->pos += off;
+  else if (whence == SEEK_END)
+    client->pos = client_size(fd) + off;
+  else
+    client->pos = off;
+
+  return (client->pos);
+}
+
+
+//
+// 'client_size()' - Get the size of the file of a decoder thread.
+//
+
+static toff_t				// O - Size of file
+client_size(thandle_t fd)		// I - Client data
+{
+  struct stat	fileinfo;		// File information
+
+
+  if (fstat(((tiff_client_t *)fd)->fd, &fileinfo))
+    return (0);
+
+  return ((toff_t)fileinfo.st_size);
+}
+
+
+//
+// 'client_unmap()' - Unmap the file of a decoder thread.
+//
+
+static void
+client_unmap(thandle_t fd,		// I - Client data
+	     void      *base,		// I - Base address
+	     toff_t    size)		// I - Size of mapping
+{
+  (void)fd;
+  (void)base;
+  (void)size;
+}
+
+
+//
+// 'client_write()' - Refuse to write from a decoder thread.
+//
+
+static tmsize_t				// O - -1 (error)
+client_write(thandle_t fd,		// I - Client data
+	     void      *buf,		// I - Buffer
+	     tmsize_t  size)		// I - Bytes to write
+{
+  (void)fd;
+  (void)buf;
+  (void)size;
+
+  return (-1);
+}
+
+
+//
+// 'rows_decode()' - Decoder thread, decodes strips or rows of tiles.
+//
+// Every thread has its own TIFF handle, libtiff handles must not be shared
+// between threads.  A thread takes the next band which has a free slot,
+// that is at most num_slots bands ahead of the band read by rows_read().
+//
+
+static void *				// O - Thread exit status
+rows_decode(void *arg)			// I - Scanline reader
+{
+  tiff_rows_t	*rows = (tiff_rows_t *)arg;
+					// Scanline reader
+  tiff_client_t	client;			// Own file position
+  TIFF		*tif;			// Own TIFF handle
+  tiff_band_t	*slot;			// Slot of band
+  unsigned char	*tile = NULL;		// Tile buffer
+  uint32_t	count,			// Rows in band
+		r, tx;			// Looping vars
+  tmsize_t	offset,			// Offset of tile in scanline
+		bytes;			// Bytes to copy per tile row
+  int		band,			// Band to decode
+		status;			// Decoding status
+
+
+  client.fd  = rows->fd;
+  client.pos = 0;
+
+  tif = TIFFClientOpen("", "rm", (thandle_t)&client, client_read,
+		       client_write, client_seek, client_close, client_size,
+		       client_map, client_unmap);
+
+  if (tif && rows->tiled && (tile = _TIFFmalloc(rows->tile_size)) == NULL)
+  {
+    TIFFClose(tif);
+    tif = NULL;
+  }
+
+  pthread_mutex_lock(&rows->lock);
+
+  while (!rows->abort && rows->next < rows->num_bands)
+  {
+    if (rows->next >= rows->current + rows->num_slots)
+    {
+      pthread_cond_wait(&rows->cond, &rows->lock);
+      continue;
+    }
+
+    band        = rows->next ++;
+    slot        = rows->slots + band % rows->num_slots;
+    slot->band  = band;
+    slot->ready = 0;
+
+    pthread_mutex_unlock(&rows->lock);
+
+    count = rows->height - (uint32_t)band * rows->band_rows;
+    if (count > rows->band_rows)
+      count = rows->band_rows;
+
+    status = tif ? 0 : -1;
+
+    if (!tif)
+      ;
+    else if (!rows->tiled)
+    {
+      if (TIFFReadEncodedStrip(tif, (uint32_t)band, slot->data,
+			       (tmsize_t)count * rows->scanwidth) < 0)
+	status = -1;
+    }
+    else
+    {
+      //
+      // Put the tiles of the row side by side, the last tile may stick
+      // out to the right of the image...
+      //
+
+      for (tx = 0, offset = 0; offset < rows->scanwidth;
+	   tx += rows->tile_width, offset += rows->tile_rowsize)
+      {
+	if (TIFFReadEncodedTile(tif,
+				TIFFComputeTile(tif, tx,
+						(uint32_t)band *
+						rows->band_rows, 0, 0),
+				tile, rows->tile_size) < 0)
+	{
+	  status = -1;
+	  break;
+	}
+
+	bytes = rows->scanwidth - offset;
+	if (bytes > rows->tile_rowsize)
+	  bytes = rows->tile_rowsize;
+
+	for (r = 0; r < count; r ++)
+	  memcpy(slot->data + r * rows->scanwidth + offset,
+		 tile + r * rows->tile_rowsize, (size_t)bytes);
+      }
+    }
+
+    pthread_mutex_lock(&rows->lock);
+
+    slot->status = status;
+    slot->ready  = 1;
+
+    pthread_cond_broadcast(&rows->cond);
+  }
+
+  pthread_mutex_unlock(&rows->lock);
+
+  if (tile)
+    _TIFFfree(tile);
+
+  if (tif)
+    TIFFClose(tif);
+
+  return (NULL);
+}
+
+
+//
+// 'rows_free()' - Stop the decoder threads and free the buffers.
+//
+
+static void
+rows_free(tiff_rows_t *rows)		// I - Scanline reader
+{
+  int	i;				// Looping var
+
+
+  if (!rows->num_threads)
+    return;
+
+  pthread_mutex_lock(&rows->lock);
+  rows->abort = 1;
+  pthread_cond_broadcast(&rows->cond);
+  pthread_mutex_unlock(&rows->lock);
+
+  for (i = 0; i < rows->num_threads; i ++)
+    pthread_join(rows->threads[i], NULL);
+
+  for (i = 0; i < rows->num_slots; i ++)
+    free(rows->slots[i].data);
+
+  free(rows->slots);
+  pthread_cond_destroy(&rows->cond);
+  pthread_mutex_destroy(&rows->lock);
+}
+
+
+//
+// 'rows_open()' - Start decoding strips or tiles in parallel.
+//
+// Strips and rows of tiles are compressed independently, so several
+// threads can decode them at the same time (TIFFReadEncodedStrip() and
+// TIFFReadEncodedTile()) while the caller converts the rows already
+// decoded.  Images in a single strip are read with TIFFReadScanline(), as
+// before, and so is everything when there is only one CPU.  Tiled images,
+// which TIFFReadScanline() cannot read, always get a decoder thread.
+//
+
+static void
+rows_open(tiff_rows_t *rows,		// I - Scanline reader
+	  cf_image_t  *img,		// I - Image
+	  TIFF        *tif,		// I - TIFF file
+	  int         fd)		// I - File descriptor of TIFF file
+{
+  int		i;			// Looping var
+  int		threads;		// Number of threads wanted
+
+
+  memset(rows, 0, sizeof(tiff_rows_t));
+
+  rows->tif       = tif;
+  rows->fd        = fd;
+  rows->tiled     = TIFFIsTiled(tif);
+  rows->height    = img->ysize;
+  rows->scanwidth = TIFFScanlineSize(tif);
+
+  if (rows->tiled)
+  {
+    if (!TIFFGetField(tif, TIFFTAG_TILEWIDTH, &rows->tile_width) ||
+	!TIFFGetField(tif, TIFFTAG_TILELENGTH, &rows->band_rows) ||
+	rows->tile_width == 0 || rows->band_rows == 0)
+      return;
+
+    rows->tile_rowsize = TIFFTileRowSize(tif);
+    rows->tile_size    = TIFFTileSize(tif);
+
+    if (rows->tile_rowsize <= 0 || rows->tile_size <= 0)
+      return;
+  }
+  else if (!TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &rows->band_rows) ||
+	   rows->band_rows == 0 || rows->band_rows > rows->height)
+    rows->band_rows = rows->height;
+
+  rows->num_bands = (int)((rows->height + rows->band_rows - 1) /
+			  rows->band_rows);
+  rows->loaded    = -1;
+
+  if (rows->scanwidth <= 0 ||
+      (!rows->tiled &&
+       ((threads = _cfImageGetThreads(img->data)) < 2 ||
+	rows->num_bands < 2)))
+    return;
+
+  if (rows->tiled)
+    threads = _cfImageGetThreads(img->data);
+
+  if (threads > rows->num_bands)
+    threads = rows->num_bands;
+
+  //
+  // Two bands per thread keep every thread busy while the caller is busy
+  // with converting rows...
+  //
+
+  rows->num_slots = 2 * threads;
+  if (rows->num_slots > rows->num_bands)
+    rows->num_slots = rows->num_bands;
+
+  if ((rows->slots = calloc((size_t)rows->num_slots,
+			    sizeof(tiff_band_t))) == NULL)
+    return;
+
+  for (i = 0; i < rows->num_slots; i ++)
+  {
+    rows->slots[i].band = -1;
+
+    if ((rows->slots[i].data = malloc((size_t)rows->band_rows *
+				      (size_t)rows->scanwidth)) == NULL)
+    {
+      while (i > 0)
+	free(rows->slots[-- i].data);
+
+      free(rows->slots);
+      rows->slots = NULL;
+      return;
+    }
+  }
+
+  pthread_mutex_init(&rows->lock, NULL);
+  pthread_cond_init(&rows->cond, NULL);
+
+  for (i = 0; i < threads; i ++)
+  {
+    if (pthread_create(rows->threads + i, NULL, rows_decode, rows))
+      break;
+
+    rows->num_threads ++;
+  }
+
+  if (!rows->num_threads)
+  {
+    for (i = 0; i < rows->num_slots; i ++)
+      free(rows->slots[i].data);
+
+    free(rows->slots);
+    rows->slots = NULL;
+    pthread_cond_destroy(&rows->cond);
+    pthread_mutex_destroy(&rows->lock);
+  }
+
+  DEBUG_printf(("DEBUG: Decoding %d %s with %d threads.\n",
+		rows->num_bands, rows->tiled ? "rows of tiles" : "strips",
+		rows->num_threads));
+}
+
+
+//
+// 'rows_read()' - Read the next row of the image.
+//
+// Rows must be read from top to bottom.
+//
+
+static int				// O - 0 on success, -1 on error
+rows_read(tiff_rows_t *rows,		// I - Scanline reader
+	  void        *buf,		// I - Buffer for scanline
+	  uint32_t    row)		// I - Row number
+{
+  tiff_band_t	*slot;			// Slot of band
+  int		band;			// Band of row
+
+
+  if (!rows->num_threads)
+  {
+    if (rows->tiled)
+      return (-1);
+
+    return (TIFFReadScanline(rows->tif, buf, row, 0) < 0 ? -1 : 0);
+  }
+
+  band = (int)(row / rows->band_rows);
+  slot = rows->slots + band % rows->num_slots;
+
+  if (band != rows->loaded)
+  {
+    pthread_mutex_lock(&rows->lock);
+
+    if (band != rows->current)
+    {
+      rows->current = band;
+      pthread_cond_broadcast(&rows->cond);
+    }
+
+    while (!slot->ready || slot->band != band)
+      pthread_cond_wait(&rows->cond, &rows->lock);
+
+    pthread_mutex_unlock(&rows->lock);
+
+    rows->loaded = band;
+  }
+
+  if (slot->status)
+    return (-1);
+
+  memcpy(buf, slot->data + (row - (uint32_t)band * rows->band_rows) *
+	 (size_t)rows->scanwidth, (size_t)rows->scanwidth);
+
   return (0);
 }
 #endif // HAVE_LIBTIFF
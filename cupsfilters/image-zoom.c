@@ -11,9 +11,26 @@
 //
 //   _cfImageZoomDelete()   - Free a zoom record...
 //   _cfImageZoomFill()     - Fill a zoom record...
+//   _cfImageZoomKernel()   - Select the kernels for scaling rows.
 //   _cfImageZoomNew()      - Allocate a pixel zoom record...
+//   bilinear_avx2()        - Interpolate output bytes using AVX2.
+//   bilinear_c()           - Interpolate output bytes.
+//   bilinear_neon()        - Interpolate output bytes using NEON.
+//   bilinear_sse2()        - Interpolate output bytes using SSE2.
+//   hfilter_avx2()         - Filter output bytes along X using AVX2.
+//   hfilter_c()            - Filter output bytes along X.
+//   nearest_avx2()         - Sample output bytes using AVX2.
+//   nearest_c()            - Sample output bytes.
+//   vfilter_avx2()         - Filter output bytes along Y using AVX2.
+//   vfilter_c()            - Filter output bytes along Y.
+//   vfilter_neon()         - Filter output bytes along Y using NEON.
+//   vfilter_sse2()         - Filter output bytes along Y using SSE2.
+//   zoom_best()            - Fill a zoom record with image data utilizing
+//                            a separable bicubic or Lanczos filter.
 //   zoom_bilinear()        - Fill a zoom record with image data utilizing
 //                            bilinear interpolation.
+//   zoom_filter()          - Compute the filter weights for an output pixel.
+//   zoom_init()            - Pick the fastest kernels the CPU supports.
 //   zoom_nearest()         - Fill a zoom record quickly using nearest-neighbor
 //                            sampling.
 
@@ -22,16 +39,124 @@
 //
 
 #include "image-private.h"
+#include <limits.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define ZOOM_X86 1
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  define ZOOM_NEON 1
+#  include <arm_neon.h>
+#endif // __GNUC__ && __x86_64__
+
+
+//
+// Constants...
+//
+
+#define ZOOM_MAX_TABLE	65535		// Widest output row for the kernels,
+					// they divide by the width in single
+					// precision, which is exact up to this
+					// width, and keep weights in 16 bits
+#define ZOOM_ONE	16384		// 1.0 in filter weights (Q14)
+
+
+//
+// Types...
+//
+
+typedef void (*zoom_bilinear_t)(cf_ib_t *out, const cf_ib_t *in,
+				const int *off, const unsigned short *w,
+				int count, int inincr, int xsize);
+					// Bilinear kernel
+typedef void (*zoom_nearest_t)(cf_ib_t *out, const cf_ib_t *in,
+			       const int *off, int count);
+					// Nearest-neighbor kernel
+typedef void (*zoom_hfilter_t)(cf_ib_t *out, const cf_ib_t *in,
+			       const int *off, const short *coef, int count,
+			       int stride, int taps, int inincr);
+					// Filter kernel along X
+typedef void (*zoom_vfilter_t)(cf_ib_t *out, cf_ib_t * const *rows,
+			       const short *coef, int count, int taps);
+					// Filter kernel along Y
+
+typedef struct zoom_kernel_s		// Row scaling kernels
+{
+  const char		*name;		// Name of kernels
+  zoom_bilinear_t	bilinear;	// Bilinear kernel
+  zoom_nearest_t	nearest;	// Nearest-neighbor kernel
+  zoom_hfilter_t	hfilter;	// Filter kernel along X
+  zoom_vfilter_t	vfilter;	// Filter kernel along Y
+} zoom_kernel_t;
 
 
 //
 // Local functions...
 //
 
+static void	bilinear_c(cf_ib_t *out, const cf_ib_t *in, const int *off,
+			   const unsigned short *w, int count, int inincr,
+			   int xsize);
+static void	hfilter_c(cf_ib_t *out, const cf_ib_t *in, const int *off,
+			  const short *coef, int count, int stride, int taps,
+			  int inincr);
+static void	nearest_c(cf_ib_t *out, const cf_ib_t *in, const int *off,
+			  int count);
+static void	vfilter_c(cf_ib_t *out, cf_ib_t * const *rows,
+			  const short *coef, int count, int taps);
+#ifdef ZOOM_X86
+static void	bilinear_avx2(cf_ib_t *out, const cf_ib_t *in,
+			      const int *off, const unsigned short *w,
+			      int count, int inincr, int xsize);
+static void	bilinear_sse2(cf_ib_t *out, const cf_ib_t *in,
+			      const int *off, const unsigned short *w,
+			      int count, int inincr, int xsize);
+static void	hfilter_avx2(cf_ib_t *out, const cf_ib_t *in,
+			     const int *off, const short *coef, int count,
+			     int stride, int taps, int inincr);
+static void	nearest_avx2(cf_ib_t *out, const cf_ib_t *in,
+			     const int *off, int count);
+static void	vfilter_avx2(cf_ib_t *out, cf_ib_t * const *rows,
+			     const short *coef, int count, int taps);
+static void	vfilter_sse2(cf_ib_t *out, cf_ib_t * const *rows,
+			     const short *coef, int count, int taps);
+#endif // ZOOM_X86
+#ifdef ZOOM_NEON
+static void	bilinear_neon(cf_ib_t *out, const cf_ib_t *in,
+			      const int *off, const unsigned short *w,
+			      int count, int inincr, int xsize);
+static void	vfilter_neon(cf_ib_t *out, cf_ib_t * const *rows,
+			     const short *coef, int count, int taps);
+#endif // ZOOM_NEON
+static void	zoom_best(cf_izoom_t *z, int iy);
 static void	zoom_bilinear(cf_izoom_t *z, int iy);
+static int	zoom_filter(double center, double scale, int taps,
+			    short *coef);
+static void	zoom_init(void);
 static void	zoom_nearest(cf_izoom_t *z, int iy);
 
 
+//
+// Local globals...
+//
+
+static const zoom_kernel_t zoom_kernels[] =
+{					// Kernels, fastest first
+#ifdef ZOOM_X86
+  { "avx2", bilinear_avx2, nearest_avx2, hfilter_avx2, vfilter_avx2 },
+  { "sse2", bilinear_sse2, nearest_c,    hfilter_c,    vfilter_sse2 },
+#endif // ZOOM_X86
+#ifdef ZOOM_NEON
+  { "neon", bilinear_neon, nearest_c,    hfilter_c,    vfilter_neon },
+#endif // ZOOM_NEON
+  { "c",    bilinear_c,    nearest_c,    hfilter_c,    vfilter_c }
+};
+static const zoom_kernel_t *zoom_kernel = zoom_kernels +
+		    sizeof(zoom_kernels) / sizeof(zoom_kernels[0]) - 1;
+					// Kernels in use
+static pthread_once_t	zoom_once = PTHREAD_ONCE_INIT;
+					// Kernel selection
+
+
 //
 // '_cfImageZoomDelete()' - Free a zoom record...
 //
@@ -41,7 +166,14 @@ _cfImageZoomDelete(cf_izoom_t *z)	// I - Zoom record to free
 {
   free(z->rows[0]);
   free(z->rows[1]);
-  free(z->in);
+  free(z->inbuf);
+  free(z->xoff);
+  free(z->xweight);
+  free(z->xcoef);
+  free(z->ycoef);
+  free(z->hrows);
+  free(z->hptrs);
+  free(z->hrow);
   free(z);
 }
 
@@ -50,6 +182,10 @@ _cfImageZoomDelete(cf_izoom_t *z)	// I - Zoom record to free
 // '_cfImageZoomFill()' - Fill a zoom record with image data utilizing bilinear
 //                        interpolation.
 //
+// For CF_IZOOM_FAST and CF_IZOOM_NORMAL "iy" is an input row, scaled along
+// X only; the caller blends adjacent rows along Y.  For CF_IZOOM_BEST "iy"
+// is an output row, which comes out filtered along both axes.
+//
 
 void
 _cfImageZoomFill(cf_izoom_t *z,		// I - Zoom record to fill
@@ -61,6 +197,10 @@ _cfImageZoomFill(cf_izoom_t *z,		// I - Zoom record to fill
         zoom_nearest(z, iy);
 	break;
 
+    case CF_IZOOM_BEST :
+        zoom_best(z, iy);
+	break;
+
     default :
         zoom_bilinear(z, iy);
 	break;
@@ -68,6 +208,46 @@ _cfImageZoomFill(cf_izoom_t *z,		// I - Zoom record to fill
 }
 
 
+//
+// '_cfImageZoomKernel()' - Select the kernels for scaling rows.
+//
+// The fastest kernels the CPU supports are used by default.  Passing the
+// name of other kernels ("avx2", "sse2", "neon" or "c") selects those if
+// the CPU supports them, for testing and benchmarking; NULL just returns
+// the name of the kernels in use.  All kernels give the same output.
+//
+
+const char *				// O - Name of kernels in use
+_cfImageZoomKernel(const char *name)	// I - Name of kernels or NULL
+{
+  const zoom_kernel_t	*k;		// Current kernels
+
+
+  pthread_once(&zoom_once, zoom_init);
+
+  if (name)
+  {
+    for (k = zoom_kernels;
+         k < zoom_kernels + sizeof(zoom_kernels) / sizeof(zoom_kernels[0]);
+	 k ++)
+    {
+#ifdef ZOOM_X86
+      if (k->bilinear == bilinear_avx2 && !__builtin_cpu_supports("avx2"))
+        continue;
+#endif // ZOOM_X86
+
+      if (!strcmp(k->name, name))
+      {
+	__atomic_store_n(&zoom_kernel, k, __ATOMIC_RELEASE);
+	break;
+      }
+    }
+  }
+
+  return (__atomic_load_n(&zoom_kernel, __ATOMIC_ACQUIRE)->name);
+}
+
+
 //
 // '_cfImageZoomNew()' - Allocate a pixel zoom record...
 //
@@ -87,6 +267,18 @@ _cfImageZoomNew(
 {
   cf_izoom_t	*z;			// New zoom record
   int		flip;			// Flip on X axis?
+  int		x,			// Looping var
+		count,			// ...
+		k,			// ...
+		ix,			// Input pixel
+		pos,			// Offset of input pixel
+		pad,			// Pixels of padding on each side
+		xerr0,			// X error counter
+		xerr1;			// ...
+  size_t	j,			// Output byte
+		n;			// Bytes per output row
+  double	xscale,			// Input pixels per output pixel
+		yscale;			// Input rows per output row
 
 
   if (xsize > CF_IMAGE_MAX_WIDTH ||
@@ -199,7 +391,33 @@ _cfImageZoomNew(
     return (NULL);
   }
 
-  if ((z->in = (cf_ib_t *)malloc(z->width * z->depth)) == NULL)
+  //
+  // Filtering looks at up to "xtaps" pixels around the input position,
+  // bilinear interpolation at the next pixel...
+  //
+
+  xscale = (double)z->width / z->xsize;
+  yscale = (double)z->height / z->ysize;
+
+  if (type == CF_IZOOM_BEST)
+  {
+    z->xtaps = (int)ceil(2.0 * (xscale > 1.0 ? 3.0 * xscale : 2.0));
+    z->xtaps = (z->xtaps + 1) & ~1;
+    z->ytaps = (int)ceil(2.0 * (yscale > 1.0 ? 3.0 * yscale : 2.0));
+    z->ytaps = (z->ytaps + 1) & ~1;
+    pad      = z->xtaps + 1;
+  }
+  else
+    pad = 1;
+
+  //
+  // The input buffer gets padding on each side for the neighbors of the
+  // pixels at the edges, and a few bytes more for the 32-bit loads of the
+  // kernels...
+  //
+
+  if ((z->inbuf = (cf_ib_t *)calloc((z->width + 2 * pad) * z->depth + 4,
+                                    1)) == NULL)
   {
     free(z->rows[0]);
     free(z->rows[1]);
@@ -207,10 +425,712 @@ _cfImageZoomNew(
     return (NULL);
   }
 
+  z->in = z->inbuf + pad * z->depth;
+
+  pthread_once(&zoom_once, zoom_init);
+
+  //
+  // For filtering, work out which input pixels go into each output byte
+  // with which weights, in 2.14 fixed point.  Without memory for the
+  // tables, fall back to bilinear interpolation...
+  //
+
+  n = (size_t)z->xsize * z->depth;
+
+  if (type == CF_IZOOM_BEST)
+  {
+    if (z->xsize <= ZOOM_MAX_TABLE &&
+        (z->xoff = (int *)malloc(n * sizeof(int))) != NULL &&
+	(z->xcoef = (short *)malloc(n * z->xtaps * sizeof(short))) != NULL &&
+	(z->ycoef = (short *)malloc((z->xtaps > z->ytaps ? z->xtaps :
+				     z->ytaps) * sizeof(short))) != NULL &&
+	(z->hrows = (cf_ib_t *)malloc(n * z->ytaps)) != NULL &&
+	(z->hptrs = (cf_ib_t **)malloc(z->ytaps * sizeof(cf_ib_t *))) != NULL &&
+	(z->hrow = (int *)malloc(z->ytaps * sizeof(int))) != NULL)
+    {
+      for (x = 0, j = 0; x < (int)z->xsize; x ++)
+      {
+        pos = zoom_filter((x + 0.5) * xscale - 0.5, xscale, z->xtaps,
+			  z->ycoef);
+	if (flip)
+	  pos = z->width - 1 - pos;
+
+        for (count = 0; count < (int)z->depth; count ++, j ++)
+	{
+	  z->xoff[j] = pos * (int)z->depth + count;
+
+	  for (k = 0; k < z->xtaps; k ++)
+	    z->xcoef[k * n + j] = z->ycoef[k];
+	}
+      }
+
+      for (k = 0; k < z->ytaps; k ++)
+        z->hrow[k] = INT_MIN;
+
+      return (z);
+    }
+
+    free(z->xoff);
+    free(z->xcoef);
+    free(z->ycoef);
+    free(z->hrows);
+    free(z->hptrs);
+    z->xoff  = NULL;
+    z->xcoef = NULL;
+    z->ycoef = NULL;
+    z->hrows = NULL;
+    z->hptrs = NULL;
+    z->type  = CF_IZOOM_NORMAL;
+  }
+
+  //
+  // The input position and weights of the output pixels are the same for
+  // all rows, so work them out once here for the row scaling kernels.  If
+  // the tables cannot be made the rows are scaled pixel by pixel...
+  //
+
+  if (z->xsize <= ZOOM_MAX_TABLE &&
+      (z->xoff = (int *)malloc(z->xsize * z->depth * sizeof(int))) != NULL &&
+      (z->xweight = (unsigned short *)malloc(z->xsize * z->depth *
+                                             sizeof(unsigned short))) != NULL)
+  {
+    for (x = z->xsize, xerr0 = z->xsize, xerr1 = 0, ix = 0,
+             pos = z->inincr < 0 ? (z->width - 1) * z->depth : 0, j = 0;
+	 x > 0;
+	 x --)
+    {
+      for (count = 0; count < (int)z->depth; count ++, j ++)
+      {
+        z->xoff[j]    = pos + count;
+	z->xweight[j] = ix < (int)z->xmax ? xerr1 : 0;
+      }
+
+      ix    += z->xstep;
+      pos   += z->instep;
+      xerr0 -= z->xmod;
+      xerr1 += z->xmod;
+
+      if (xerr0 <= 0)
+      {
+	xerr0 += z->xsize;
+	xerr1 -= z->xsize;
+	ix    += z->xincr;
+	pos   += z->inincr;
+      }
+    }
+  }
+  else
+  {
+    free(z->xoff);
+    z->xoff = NULL;
+  }
+
   return (z);
 }
 
 
+//
+// 'bilinear_c()' - Interpolate output bytes.
+//
+// Each output byte is the weighted average of an input byte and the same
+// byte of the next input pixel, "inincr" bytes away; the weights add up
+// to "xsize".
+//
+
+static void
+bilinear_c(cf_ib_t              *out,	// O - Output bytes
+           const cf_ib_t        *in,	// I - Input row
+	   const int            *off,	// I - Input offset of each byte
+	   const unsigned short *w,	// I - Weight of the next pixel
+	   int                  count,	// I - Number of output bytes
+	   int                  inincr,	// I - Offset of next pixel
+	   int                  xsize)	// I - Sum of the weights
+{
+  for (; count > 0; count --, off ++, w ++)
+    *out++ = (in[*off] * (xsize - *w) + in[*off + inincr] * *w) / xsize;
+}
+
+
+#ifdef ZOOM_X86
+//
+// 'bilinear_avx2()' - Interpolate output bytes using AVX2.
+//
+// Eight bytes at a time.  All sums are integers below 2^24, so they are
+// exact in single precision, and so is the truncated quotient for widths
+// up to ZOOM_MAX_TABLE, giving the same result as bilinear_c().
+//
+
+__attribute__((target("avx2")))
+static void
+bilinear_avx2(cf_ib_t              *out,// O - Output bytes
+              const cf_ib_t        *in,	// I - Input row
+	      const int            *off,// I - Input offset of each byte
+	      const unsigned short *w,	// I - Weight of the next pixel
+	      int                  count,
+					// I - Number of output bytes
+	      int                  inincr,
+					// I - Offset of next pixel
+	      int                  xsize)
+					// I - Sum of the weights
+{
+  const __m256	d = _mm256_set1_ps((float)xsize);
+  const __m256i	mask = _mm256_set1_epi32(255),
+		shuffle = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1,
+					   0, 4, 8, 12, -1, -1, -1, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1),
+		permute = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  __m256i	o,			// Input offsets
+		q;			// Quotients
+  __m256	a,			// Input bytes
+		b,			// Bytes of next pixels
+		wf;			// Weights
+
+
+  for (; count >= 8; count -= 8, out += 8, off += 8, w += 8)
+  {
+    o  = _mm256_loadu_si256((const __m256i *)off);
+    a  = _mm256_cvtepi32_ps(_mm256_and_si256(
+	     _mm256_i32gather_epi32((const int *)in, o, 1), mask));
+    b  = _mm256_cvtepi32_ps(_mm256_and_si256(
+	     _mm256_i32gather_epi32((const int *)(in + inincr), o, 1), mask));
+    wf = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(
+	     _mm_loadu_si128((const __m128i *)w)));
+    q  = _mm256_cvttps_epi32(_mm256_div_ps(
+	     _mm256_add_ps(_mm256_mul_ps(a, d),
+			   _mm256_mul_ps(_mm256_sub_ps(b, a), wf)), d));
+    q  = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(q, shuffle),
+				     permute);
+
+    _mm_storel_epi64((__m128i *)out, _mm256_castsi256_si128(q));
+  }
+
+  bilinear_c(out, in, off, w, count, inincr, xsize);
+}
+
+
+//
+// 'bilinear_sse2()' - Interpolate output bytes using SSE2.
+//
+// Four bytes at a time, see bilinear_avx2().  SSE2 has no gather, so the
+// input bytes are loaded one by one.
+//
+
+static void
+bilinear_sse2(cf_ib_t              *out,// O - Output bytes
+              const cf_ib_t        *in,	// I - Input row
+	      const int            *off,// I - Input offset of each byte
+	      const unsigned short *w,	// I - Weight of the next pixel
+	      int                  count,
+					// I - Number of output bytes
+	      int                  inincr,
+					// I - Offset of next pixel
+	      int                  xsize)
+					// I - Sum of the weights
+{
+  const __m128	d = _mm_set1_ps((float)xsize);
+  const cf_ib_t	*next = in + inincr;	// Next input pixels
+  __m128i	q;			// Quotients
+  __m128	a,			// Input bytes
+		b,			// Bytes of next pixels
+		wf;			// Weights
+  int		bytes;			// Output bytes
+
+
+  for (; count >= 4; count -= 4, out += 4, off += 4, w += 4)
+  {
+    a     = _mm_setr_ps(in[off[0]], in[off[1]], in[off[2]], in[off[3]]);
+    b     = _mm_setr_ps(next[off[0]], next[off[1]], next[off[2]],
+			next[off[3]]);
+    wf    = _mm_setr_ps(w[0], w[1], w[2], w[3]);
+    q     = _mm_cvttps_epi32(_mm_div_ps(
+		_mm_add_ps(_mm_mul_ps(a, d),
+			   _mm_mul_ps(_mm_sub_ps(b, a), wf)), d));
+    q     = _mm_packs_epi32(q, q);
+    q     = _mm_packus_epi16(q, q);
+    bytes = _mm_cvtsi128_si32(q);
+
+    memcpy(out, &bytes, 4);
+  }
+
+  bilinear_c(out, in, off, w, count, inincr, xsize);
+}
+#endif // ZOOM_X86
+
+
+#ifdef ZOOM_NEON
+//
+// 'bilinear_neon()' - Interpolate output bytes using NEON.
+//
+// Four bytes at a time, see bilinear_avx2().
+//
+
+static void
+bilinear_neon(cf_ib_t              *out,// O - Output bytes
+              const cf_ib_t        *in,	// I - Input row
+	      const int            *off,// I - Input offset of each byte
+	      const unsigned short *w,	// I - Weight of the next pixel
+	      int                  count,
+					// I - Number of output bytes
+	      int                  inincr,
+					// I - Offset of next pixel
+	      int                  xsize)
+					// I - Sum of the weights
+{
+  const float32x4_t d = vdupq_n_f32((float)xsize);
+  const cf_ib_t	*next = in + inincr;	// Next input pixels
+  float		av[4],			// Input bytes
+		bv[4],			// Bytes of next pixels
+		wv[4];			// Weights
+  float32x4_t	a,			// Input bytes
+		b;			// Bytes of next pixels
+  uint32x4_t	q;			// Quotients
+  uint16x4_t	h;			// Quotients as 16-bit values
+  uint32_t	bytes;			// Output bytes
+  int		i;			// Looping var
+
+
+  for (; count >= 4; count -= 4, out += 4, off += 4, w += 4)
+  {
+    for (i = 0; i < 4; i ++)
+    {
+      av[i] = in[off[i]];
+      bv[i] = next[off[i]];
+      wv[i] = w[i];
+    }
+
+    a     = vld1q_f32(av);
+    b     = vld1q_f32(bv);
+    q     = vcvtq_u32_f32(vdivq_f32(
+		vaddq_f32(vmulq_f32(a, d),
+			  vmulq_f32(vsubq_f32(b, a), vld1q_f32(wv))), d));
+    h     = vmovn_u32(q);
+    bytes = vget_lane_u32(vreinterpret_u32_u8(
+		vmovn_u16(vcombine_u16(h, h))), 0);
+
+    memcpy(out, &bytes, 4);
+  }
+
+  bilinear_c(out, in, off, w, count, inincr, xsize);
+}
+#endif // ZOOM_NEON
+
+
+//
+// 'hfilter_c()' - Filter output bytes along X.
+//
+// Output byte "j" is the sum of "taps" input bytes, starting at "off[j]"
+// and "inincr" bytes apart, weighted by coef[k * stride + j] for tap "k".
+//
+
+static void
+hfilter_c(cf_ib_t       *out,		// O - Output bytes
+          const cf_ib_t *in,		// I - Input row
+	  const int     *off,		// I - Input offset of each byte
+	  const short   *coef,		// I - Weights by tap and byte
+	  int           count,		// I - Number of output bytes
+	  int           stride,		// I - Bytes per row of weights
+	  int           taps,		// I - Number of taps
+	  int           inincr)		// I - Offset of next pixel
+{
+  int		j, k,			// Looping vars
+		acc;			// Weighted sum
+  const cf_ib_t	*p;			// Input byte
+  const short	*c;			// Weight
+
+
+  for (j = 0; j < count; j ++)
+  {
+    for (k = taps, acc = ZOOM_ONE / 2, p = in + off[j], c = coef + j;
+         k > 0;
+	 k --, p += inincr, c += stride)
+      acc += *c * *p;
+
+    out[j] = acc < 0 ? 0 : acc >= 256 * ZOOM_ONE ? 255 : acc / ZOOM_ONE;
+  }
+}
+
+
+#ifdef ZOOM_X86
+//
+// 'hfilter_avx2()' - Filter output bytes along X using AVX2.
+//
+// Eight bytes at a time, with the same fixed-point arithmetic as
+// hfilter_c().
+//
+
+__attribute__((target("avx2")))
+static void
+hfilter_avx2(cf_ib_t       *out,	// O - Output bytes
+             const cf_ib_t *in,		// I - Input row
+	     const int     *off,	// I - Input offset of each byte
+	     const short   *coef,	// I - Weights by tap and byte
+	     int           count,	// I - Number of output bytes
+	     int           stride,	// I - Bytes per row of weights
+	     int           taps,	// I - Number of taps
+	     int           inincr)	// I - Offset of next pixel
+{
+  const __m256i	mask = _mm256_set1_epi32(255),
+		step = _mm256_set1_epi32(inincr),
+		permute = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  __m256i	o,			// Input offsets
+		acc,			// Weighted sums
+		v;			// Input bytes
+  const short	*c;			// Weights
+  int		k;			// Looping var
+
+
+  for (; count >= 8; count -= 8, out += 8, off += 8, coef += 8)
+  {
+    o   = _mm256_loadu_si256((const __m256i *)off);
+    acc = _mm256_set1_epi32(ZOOM_ONE / 2);
+
+    for (k = taps, c = coef; k > 0; k --, c += stride)
+    {
+      v   = _mm256_and_si256(_mm256_i32gather_epi32((const int *)in, o, 1),
+			     mask);
+      acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v,
+			       _mm256_cvtepi16_epi32(
+				   _mm_loadu_si128((const __m128i *)c))));
+      o   = _mm256_add_epi32(o, step);
+    }
+
+    acc = _mm256_srai_epi32(acc, 14);
+    acc = _mm256_packs_epi32(acc, acc);
+    acc = _mm256_packus_epi16(acc, acc);
+    acc = _mm256_permutevar8x32_epi32(acc, permute);
+
+    _mm_storel_epi64((__m128i *)out, _mm256_castsi256_si128(acc));
+  }
+
+  hfilter_c(out, in, off, coef, count, stride, taps, inincr);
+}
+#endif // ZOOM_X86
+
+
+//
+// 'nearest_c()' - Sample output bytes.
+//
+
+static void
+nearest_c(cf_ib_t       *out,		// O - Output bytes
+          const cf_ib_t *in,		// I - Input row
+	  const int     *off,		// I - Input offset of each byte
+	  int           count)		// I - Number of output bytes
+{
+  for (; count > 0; count --)
+    *out++ = in[*off++];
+}
+
+
+#ifdef ZOOM_X86
+//
+// 'nearest_avx2()' - Sample output bytes using AVX2.
+//
+
+__attribute__((target("avx2")))
+static void
+nearest_avx2(cf_ib_t       *out,	// O - Output bytes
+             const cf_ib_t *in,		// I - Input row
+	     const int     *off,	// I - Input offset of each byte
+	     int           count)	// I - Number of output bytes
+{
+  const __m256i	shuffle = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1,
+					   0, 4, 8, 12, -1, -1, -1, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1),
+		permute = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  __m256i	v;			// Input bytes
+
+
+  for (; count >= 8; count -= 8, out += 8, off += 8)
+  {
+    v = _mm256_i32gather_epi32((const int *)in,
+			       _mm256_loadu_si256((const __m256i *)off), 1);
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuffle),
+				    permute);
+
+    _mm_storel_epi64((__m128i *)out, _mm256_castsi256_si128(v));
+  }
+
+  nearest_c(out, in, off, count);
+}
+#endif // ZOOM_X86
+
+
+//
+// 'vfilter_c()' - Filter output bytes along Y.
+//
+// Output byte "i" is the sum of byte "i" of the rows, weighted by the
+// weight of each row.
+//
+
+static void
+vfilter_c(cf_ib_t         *out,		// O - Output bytes
+          cf_ib_t * const *rows,	// I - Rows filtered along X
+	  const short     *coef,	// I - Weight of each row
+	  int             count,	// I - Number of output bytes
+	  int             taps)		// I - Number of rows
+{
+  int	i, k,				// Looping vars
+	acc;				// Weighted sum
+
+
+  for (i = 0; i < count; i ++)
+  {
+    for (k = 0, acc = ZOOM_ONE / 2; k < taps; k ++)
+      acc += coef[k] * rows[k][i];
+
+    out[i] = acc < 0 ? 0 : acc >= 256 * ZOOM_ONE ? 255 : acc / ZOOM_ONE;
+  }
+}
+
+
+#ifdef ZOOM_X86
+//
+// 'vfilter_avx2()' - Filter output bytes along Y using AVX2.
+//
+// Sixteen bytes at a time, two rows per multiply-add of interleaved 16-bit
+// bytes and weights; "taps" is always even.
+//
+
+__attribute__((target("avx2")))
+static void
+vfilter_avx2(cf_ib_t         *out,	// O - Output bytes
+             cf_ib_t * const *rows,	// I - Rows filtered along X
+	     const short     *coef,	// I - Weight of each row
+	     int             count,	// I - Number of output bytes
+	     int             taps)	// I - Number of rows
+{
+  __m256i	lo,			// Weighted sums of bytes 0-3, 8-11
+		hi,			// Weighted sums of bytes 4-7, 12-15
+		a,			// Bytes of first row
+		b,			// Bytes of second row
+		w;			// Weights of both rows
+  int		i, k;			// Looping vars
+
+
+  for (i = 0; i + 16 <= count; i += 16)
+  {
+    lo = hi = _mm256_set1_epi32(ZOOM_ONE / 2);
+
+    for (k = 0; k < taps; k += 2)
+    {
+      a  = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k] +
+								  i)));
+      b  = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k + 1] +
+								  i)));
+      w  = _mm256_set1_epi32((coef[k] & 0xffff) | (coef[k + 1] * 65536));
+      lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b),
+						  w));
+      hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b),
+						  w));
+    }
+
+    a = _mm256_packs_epi32(_mm256_srai_epi32(lo, 14),
+			   _mm256_srai_epi32(hi, 14));
+    a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, a), 0x08);
+
+    _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(a));
+  }
+
+  for (; i < count; i ++)
+  {
+    int acc;				// Weighted sum
+
+    for (k = 0, acc = ZOOM_ONE / 2; k < taps; k ++)
+      acc += coef[k] * rows[k][i];
+
+    out[i] = acc < 0 ? 0 : acc >= 256 * ZOOM_ONE ? 255 : acc / ZOOM_ONE;
+  }
+}
+
+
+//
+// 'vfilter_sse2()' - Filter output bytes along Y using SSE2.
+//
+// Eight bytes at a time, see vfilter_avx2().
+//
+
+static void
+vfilter_sse2(cf_ib_t         *out,	// O - Output bytes
+             cf_ib_t * const *rows,	// I - Rows filtered along X
+	     const short     *coef,	// I - Weight of each row
+	     int             count,	// I - Number of output bytes
+	     int             taps)	// I - Number of rows
+{
+  const __m128i	zero = _mm_setzero_si128();
+  __m128i	lo,			// Weighted sums of bytes 0-3
+		hi,			// Weighted sums of bytes 4-7
+		a,			// Bytes of first row
+		b,			// Bytes of second row
+		w;			// Weights of both rows
+  int		i, k;			// Looping vars
+
+
+  for (i = 0; i + 8 <= count; i += 8)
+  {
+    lo = hi = _mm_set1_epi32(ZOOM_ONE / 2);
+
+    for (k = 0; k < taps; k += 2)
+    {
+      a  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[k] + i)),
+			     zero);
+      b  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[k + 1] +
+							       i)), zero);
+      w  = _mm_set1_epi32((coef[k] & 0xffff) | (coef[k + 1] * 65536));
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+    }
+
+    a = _mm_packs_epi32(_mm_srai_epi32(lo, 14), _mm_srai_epi32(hi, 14));
+    a = _mm_packus_epi16(a, a);
+
+    _mm_storel_epi64((__m128i *)(out + i), a);
+  }
+
+  for (; i < count; i ++)
+  {
+    int acc;				// Weighted sum
+
+    for (k = 0, acc = ZOOM_ONE / 2; k < taps; k ++)
+      acc += coef[k] * rows[k][i];
+
+    out[i] = acc < 0 ? 0 : acc >= 256 * ZOOM_ONE ? 255 : acc / ZOOM_ONE;
+  }
+}
+#endif // ZOOM_X86
+
+
+#ifdef ZOOM_NEON
+//
+// 'vfilter_neon()' - Filter output bytes along Y using NEON.
+//
+// Eight bytes at a time, with the same fixed-point arithmetic as
+// vfilter_c().
+//
+
+static void
+vfilter_neon(cf_ib_t         *out,	// O - Output bytes
+             cf_ib_t * const *rows,	// I - Rows filtered along X
+	     const short     *coef,	// I - Weight of each row
+	     int             count,	// I - Number of output bytes
+	     int             taps)	// I - Number of rows
+{
+  int32x4_t	lo,			// Weighted sums of bytes 0-3
+		hi;			// Weighted sums of bytes 4-7
+  int16x8_t	a;			// Bytes of a row
+  int		i, k;			// Looping vars
+
+
+  for (i = 0; i + 8 <= count; i += 8)
+  {
+    lo = hi = vdupq_n_s32(ZOOM_ONE / 2);
+
+    for (k = 0; k < taps; k ++)
+    {
+      a  = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[k] + i)));
+      lo = vmlal_n_s16(lo, vget_low_s16(a), coef[k]);
+      hi = vmlal_n_s16(hi, vget_high_s16(a), coef[k]);
+    }
+
+    vst1_u8(out + i, vqmovn_u16(vcombine_u16(vqshrun_n_s32(lo, 14),
+					     vqshrun_n_s32(hi, 14))));
+  }
+
+  for (; i < count; i ++)
+  {
+    int acc;				// Weighted sum
+
+    for (k = 0, acc = ZOOM_ONE / 2; k < taps; k ++)
+      acc += coef[k] * rows[k][i];
+
+    out[i] = acc < 0 ? 0 : acc >= 256 * ZOOM_ONE ? 255 : acc / ZOOM_ONE;
+  }
+}
+#endif // ZOOM_NEON
+
+
+//
+// 'zoom_best()' - Fill a zoom record with image data utilizing a separable
+//                 bicubic or Lanczos filter.
+//
+// Input rows are filtered along X once, into a ring holding the rows the
+// filter along Y needs for the current output row.  Output rows are
+// expected to come mostly in order, so that each input row is filtered
+// along X only once.
+//
+
+static void
+zoom_best(cf_izoom_t *z,		// I - Zoom record to fill
+          int        oy)		// I - Output row
+{
+  int		first,			// First input row
+		t,			// Input row of tap
+		iy,			// Input row to read
+		k,			// Looping var
+		slot,			// Slot in ring
+		pad;			// Pixels of padding on each side
+  size_t	n;			// Bytes per output row
+  double	yscale;			// Input rows per output row
+
+
+  if (oy < 0)
+    oy = 0;
+  else if (oy >= (int)z->ysize)
+    oy = z->ysize - 1;
+  if (z->yflip)
+    oy = z->ysize - 1 - oy;
+
+  yscale = (double)z->height / z->ysize;
+  first  = zoom_filter((oy + 0.5) * yscale - 0.5, yscale, z->ytaps,
+		       z->ycoef);
+  n      = (size_t)z->xsize * z->depth;
+  pad    = z->xtaps + 1;
+
+  for (k = 0; k < z->ytaps; k ++)
+  {
+    t    = first + k;
+    slot = t % z->ytaps;
+    if (slot < 0)
+      slot += z->ytaps;
+
+    z->hptrs[k] = z->hrows + slot * n;
+
+    if (z->hrow[slot] == t)
+      continue;
+
+    //
+    // Read the row, repeat the edge pixels into the padding, and filter
+    // it along X...
+    //
+
+    iy = t < 0 ? 0 : t >= (int)z->height ? (int)z->height - 1 : t;
+
+    if (z->rotated)
+      cfImageGetCol(z->img, z->xorig - iy, z->yorig, z->width, z->in);
+    else
+      cfImageGetRow(z->img, z->xorig, z->yorig + iy, z->width, z->in);
+
+    for (iy = 1; iy <= pad; iy ++)
+    {
+      memcpy(z->in - iy * z->depth, z->in, z->depth);
+      memcpy(z->in + (z->width - 1 + iy) * z->depth,
+             z->in + (z->width - 1) * z->depth, z->depth);
+    }
+
+    (*zoom_kernel->hfilter)(z->hptrs[k], z->in, z->xoff, z->xcoef, n, n,
+			    z->xtaps, z->inincr);
+
+    z->hrow[slot] = t;
+  }
+
+  z->row ^= 1;
+
+  (*zoom_kernel->vfilter)(z->rows[z->row], z->hptrs, z->ycoef, n, z->ytaps);
+}
+
+
 //
 // 'zoom_bilinear()' - Fill a zoom record with image data utilizing bilinear
 //                     interpolation.
@@ -258,6 +1178,22 @@ zoom_bilinear(cf_izoom_t   *z,		// I - Zoom record to fill
   else
     cfImageGetRow(z->img, z->xorig, z->yorig + iy, z->width, z->in);
 
+  //
+  // Repeat the edge pixels into the padding, where the last output pixel
+  // finds its neighbor when the input area ends before the image...
+  //
+
+  memcpy(z->in - z_depth, z->in, z_depth);
+  memcpy(z->in + z->width * z_depth, z->in + (z->width - 1) * z_depth,
+         z_depth);
+
+  if (z->xoff)
+  {
+    (*zoom_kernel->bilinear)(z->rows[z->row], z->in, z->xoff, z->xweight,
+			     z_xsize * z_depth, z_inincr, z_xsize);
+    return;
+  }
+
   if (z_inincr < 0)
     inptr = z->in + (z->width - 1) * z_depth;
   else
@@ -294,6 +1230,95 @@ zoom_bilinear(cf_izoom_t   *z,		// I - Zoom record to fill
 }
 
 
+//
+// 'zoom_filter()' - Compute the filter weights for an output pixel.
+//
+// Enlargements use a Catmull-Rom bicubic filter, which stays sharp
+// without much ringing.  Reductions use a Lanczos-3 filter stretched by
+// the scale factor, so that it averages over all input pixels the output
+// pixel covers and fine detail does not alias.  The weights are rounded
+// to 2.14 fixed point, with their sum exactly ZOOM_ONE.
+//
+
+static int				// O - First input pixel
+zoom_filter(double center,		// I - Input position of output pixel
+            double scale,		// I - Input pixels per output pixel
+	    int    taps,		// I - Number of weights
+	    short  *coef)		// O - Weights
+{
+  int		first,			// First input pixel
+		k,			// Looping var
+		pass,			// Summing or scaling the weights
+		kmax = 0,		// Tap with the largest weight
+		sum = 0;		// Sum of fixed-point weights
+  double	w,			// Weight
+		t,			// Distance from center
+		total = 0.0;		// Sum of weights
+
+
+  if (scale > 1.0)
+    first = (int)floor(center - 3.0 * scale) + 1;
+  else
+    first = (int)floor(center - 2.0) + 1;
+
+  for (pass = 0; pass < 2; pass ++)
+    for (k = 0; k < taps; k ++)
+    {
+      t = fabs(first + k - center);
+
+      if (scale > 1.0)
+      {
+	t /= scale;
+
+	if (t < 1e-9)
+	  w = 1.0;
+	else if (t < 3.0)
+	  w = 3.0 * sin(M_PI * t) * sin(M_PI * t / 3.0) / (M_PI * M_PI * t * t);
+	else
+	  w = 0.0;
+      }
+      else if (t < 1.0)
+	w = (1.5 * t - 2.5) * t * t + 1.0;
+      else if (t < 2.0)
+	w = ((-0.5 * t + 2.5) * t - 4.0) * t + 2.0;
+      else
+	w = 0.0;
+
+      if (pass == 0)
+      {
+        total += w;
+	continue;
+      }
+
+      coef[k] = (short)lrint(w / total * ZOOM_ONE);
+      sum     += coef[k];
+
+      if (coef[k] > coef[kmax])
+	kmax = k;
+    }
+
+  coef[kmax] += ZOOM_ONE - sum;
+
+  return (first);
+}
+
+
+//
+// 'zoom_init()' - Pick the fastest kernels the CPU supports.
+//
+
+static void
+zoom_init(void)
+{
+#ifdef ZOOM_X86
+  if (!__builtin_cpu_supports("avx2"))
+    zoom_kernel = zoom_kernels + 1;
+  else
+#endif // ZOOM_X86
+  zoom_kernel = zoom_kernels;
+}
+
+
 //
 // 'zoom_nearest()' - Fill a zoom record quickly using nearest-neighbor
 //                    sampling.
@@ -338,6 +1363,13 @@ zoom_nearest(cf_izoom_t   *z,		// I - Zoom record to fill
   else
     cfImageGetRow(z->img, z->xorig, z->yorig + iy, z->width, z->in);
 
+  if (z->xoff)
+  {
+    (*zoom_kernel->nearest)(z->rows[z->row], z->in, z->xoff,
+			    z_xsize * z_depth);
+    return;
+  }
+
   if (z_inincr < 0)
     inptr = z->in + (z->width - 1) * z_depth;
   else
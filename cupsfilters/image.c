@@ -10,6 +10,8 @@
 // Contents:
 //
 //   cfImageClose()         - Close an image file.
+//   _cfImageFittedSize()   - Get the number of pixels needed along the
+//                            edges of an image fitted to the page.
 //   cfImageGetCol()        - Get a column of pixels from an image.
 //   cfImageGetColorSpace() - Get the image colorspace.
 //   cfImageGetDepth()      - Get the number of bytes per pixel.
@@ -18,18 +20,46 @@
 //   cfImageGetWidth()      - Get the width of an image.
 //   cfImageGetXPPI()       - Get the horizontal resolution of an image.
 //   cfImageGetYPPI()       - Get the vertical resolution of an image.
+//   _cfImageGetThreads()   - Get the number of threads to work on an image
+//                            with.
 //   cfImageOpen()          - Open an image file and read it into memory.
+//   cfImageOpenFP()        - Open an image file and read it into memory.
+//   cfImageOpenFPWithBudget() - Open an image file, taking the tile
+//                            cache from the job's memory budget.
+//   cfImageOpenFPStreaming() - Open an image file for decoding rows on
+//                            demand.
+//   cfImageOpenFPScaled()  - Open an image file, allowing it to be
+//                            scaled down while decoding.
 //   _cfImagePutCol()       - Put a column of pixels to an image.
 //   _cfImagePutRow()       - Put a row of pixels to an image.
 //   cfImageSetMaxTiles()   - Set the maximum number of tiles to cache.
 //   cfImageCrop()          - Crop an image.
-//   flush_tile()           - Flush the least-recently-used tile in the cache.
-//   get_tile()             - Get a cached tile.
+//   flush_tile()           - Flush the least-recently-used tile of a shard.
+//   get_row()              - Get a row of the mapped image.
+//   get_tile()             - Get and pin a cached tile.
+//   init_cache()           - Initialize the image cache.
+//   map_image()            - Map the whole image into memory.
+//   open_image()           - Open an image file.
+//   release_tile()         - Unpin a cached tile.
+//   stream_break()         - Mark a streaming image as not streamable.
+//   stream_decode()        - Decoder thread of a streaming image.
+//   stream_free()          - Stop the decoder of a streaming image and
+//                            free it.
+//   stream_get_row()       - Get a row from a streaming image.
+//   stream_open()          - Start decoding an image in the background.
+//   stream_put_row()       - Put a decoded row into a streaming image.
+//   stream_rewind()        - Turn a streaming image into a regular one.
 //   _cfImageReadEXIF()     - to read exif metadata of images
 //   trim_spaces()          - helper function to extract results from string 
 //                            returned by exif library functions
-//   find_bytes()           - creates character array from image file, to make
-//                            use in exif library functions
+//   exif_get()             - Get a TIFF integer in the byte order of the
+//                            file.
+//   exif_jpeg()            - Find the EXIF block of a JPEG file.
+//   exif_png()             - Find the EXIF block of a PNG file.
+//   exif_put()             - Put a 32-bit TIFF integer in the byte order of
+//                            the file.
+//   exif_tiff()            - Extract the resolution tags of a TIFF file.
+//   find_exif()            - Find the EXIF data of an image file.
 
 
 //
@@ -39,6 +69,9 @@
 
 #include "image-private.h"
 #include "config.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
 
 #ifdef HAVE_LIBJXL
 #include <jxl/decode.h>
@@ -50,11 +83,36 @@
 // Local functions...
 //
 
-static int	flush_tile(cf_image_t *img);
-static cf_ib_t	*get_tile(cf_image_t *img, int x, int y);
+static cf_ic_t	*flush_tile(cf_image_t *img, cf_ishard_t *shard);
+static cf_ib_t	*get_row(cf_image_t *img, int y);
+static cf_ib_t	*get_tile(cf_image_t *img, int x, int y, int dirty);
+static void	init_cache(cf_image_t *img);
+static int	map_image(cf_image_t *img);
+static cf_image_t *open_image(FILE *fp, cf_icspace_t primary,
+			      cf_icspace_t secondary, int saturation, int hue,
+			      const cf_ib_t *lut, cf_filter_data_t *data,
+			      int streaming, unsigned min_size);
+static void	release_tile(cf_image_t *img, int x, int y);
+static int	stream_break(cf_image_t *img);
+static void	*stream_decode(void *arg);
+static void	stream_free(cf_image_t *img);
+static int	stream_get_row(cf_image_t *img, int x, int y, int width,
+			       cf_ib_t *pixels);
+static int	stream_open(cf_image_t *img, FILE *fp, cf_image_reader_t reader,
+			    cf_icspace_t primary, cf_icspace_t secondary,
+			    int saturation, int hue, const cf_ib_t *lut);
+static int	stream_put_row(cf_image_t *img, int x, int y, int width,
+			       const cf_ib_t *pixels);
+static int	stream_rewind(cf_image_t *img);
 #ifdef HAVE_EXIF
 static void trim_spaces(char *buf);
-static unsigned char *find_bytes(FILE *fp, long int *size);
+static unsigned	exif_get(const unsigned char *p, int bytes, int big);
+static unsigned char *exif_jpeg(FILE *fp, size_t *size);
+static unsigned char *exif_png(FILE *fp, size_t *size);
+static void	exif_put(unsigned char *p, unsigned value, int big);
+static unsigned char *exif_tiff(FILE *fp, const unsigned char *header,
+			        size_t *size);
+static unsigned char *find_exif(FILE *fp, size_t *size);
 #endif // HAVE_EXIF
 
 //
@@ -66,8 +124,25 @@ cfImageClose(cf_image_t *img)		// I - Image to close
 {
   cf_ic_t	*current,		// Current cached tile
 		*next;			// Next cached tile
+  int		i;			// Looping var
 
 
+  //
+  // Stop decoding (if streaming)...
+  //
+
+  if (img->stream != NULL)
+    stream_free(img);
+
+  //
+  // Unmap the image (if mapped)...
+  //
+
+  if (img->map != NULL)
+    munmap(img->map, img->map_size);
+
+  free(img->map_used);
+
   //
   // Wipe the tile cache file (if any)...
   //
@@ -86,14 +161,22 @@ cfImageClose(cf_image_t *img)		// I - Image to close
 
   DEBUG_puts("Freeing memory...");
 
-  for (current = img->first, next = NULL; current != NULL; current = next)
+  for (i = 0; i < CF_TILE_SHARDS; i ++)
   {
-    DEBUG_printf(("Freeing cache (%p, next = %p)...\n", current, next));
+    for (current = img->shards[i].first, next = NULL; current != NULL;
+         current = next)
+    {
+      DEBUG_printf(("Freeing cache (%p, next = %p)...\n", current, next));
+
+      next = current->next;
+      free(current);
+    }
 
-    next = current->next;
-    free(current);
+    pthread_mutex_destroy(&img->shards[i].lock);
   }
 
+  pthread_mutex_destroy(&img->lock);
+
   //
   // Free the rest of memory...
   //
@@ -109,10 +192,76 @@ cfImageClose(cf_image_t *img)		// I - Image to close
     free(img->tiles);
   }
 
+  if (img->data)
+    cfFilterMemoryRelease(img->data, img->cache_reserved);
+
   free(img);
 }
 
 
+//
+// '_cfImageFittedSize()' - Get the number of pixels needed along the edges
+//                          of an image fitted to the page.
+//
+// This follows the choice of the scaling method in cfFilterImageToRaster().
+// With fit and fill no edge of the image gets longer than the longer edge
+// of the page, and the "none" method of print-scaling=auto only prints
+// images which are smaller than the page.  The other methods print at a
+// given resolution or across several pages, there we need all pixels.
+// Pass the result as "min_size" to cfImageOpenFPScaled().
+//
+
+unsigned				// O - Pixels needed, 0 for all
+_cfImageFittedSize(
+    cups_page_header_t *header,		// I - Page header with resolution
+    float              page_width,	// I - Page width in points
+    float              page_length,	// I - Page length in points
+    int                num_options,	// I - Number of options
+    cups_option_t      *options)	// I - Options
+{
+  const char	*val;			// Option value
+  float		length,			// Longer edge of the page in points
+		res;			// Higher device resolution
+
+
+  if ((val = cupsGetOption("print-scaling", num_options, options)) != NULL)
+  {
+    if (!strcasecmp(val, "none"))
+      return (0);
+  }
+  else if (cupsGetOption("ppi", num_options, options) != NULL)
+    return (0);
+  else if ((val = cupsGetOption("scaling", num_options, options)) != NULL)
+  {
+    if (atoi(val) > 100)
+      return (0);
+  }
+  else if (((val = cupsGetOption("fit-to-page", num_options, options)) !=
+	    NULL) ||
+	   ((val = cupsGetOption("fitplot", num_options, options)) != NULL))
+  {
+    if (strcasecmp(val, "yes") && strcasecmp(val, "on") &&
+	strcasecmp(val, "true"))
+      return (0);
+  }
+  else if ((val = cupsGetOption("natural-scaling", num_options, options)) !=
+	   NULL && atoi(val) != 0)
+    return (0);
+  else if (cupsGetOption("fill", num_options, options) == NULL &&
+	   cupsGetOption("crop-to-fit", num_options, options) != NULL)
+    return (0);
+
+  length = page_width > page_length ? page_width : page_length;
+  res    = header->HWResolution[0] > header->HWResolution[1] ?
+	   header->HWResolution[0] : header->HWResolution[1];
+
+  if (length <= 0.0 || res <= 0.0)
+    return (0);
+
+  return ((unsigned)(length * res / 72.0 + 0.5));
+}
+
+
 //
 // 'cfImageGetCol()' - Get a column of pixels from an image.
 //
@@ -126,7 +275,8 @@ cfImageGetCol(cf_image_t   *img,	// I - Image
 {
   int			bpp,		// Bytes per pixel
 			twidth,		// Tile width
-			count;		// Number of pixels to get
+			count,		// Number of pixels to get
+			release;	// Row of tile to release
   const cf_ib_t		*ib;		// Pointer into tile
 
 
@@ -148,14 +298,26 @@ cfImageGetCol(cf_image_t   *img,	// I - Image
   bpp    = cfImageGetDepth(img);
   twidth = bpp * (CF_TILE_SIZE - 1);
 
+  if (img->stream != NULL && stream_rewind(img))
+    return (-1);
+
+  if ((ib = get_row(img, y)) != NULL)
+  {
+    for (; height > 0; height --, pixels += bpp)
+      memcpy(pixels, get_row(img, y ++) + (size_t)x * bpp, bpp);
+
+    return (0);
+  }
+
   while (height > 0)
   {
-    ib = get_tile(img, x, y);
+    ib = get_tile(img, x, y, 0);
 
     if (ib == NULL)
       return (-1);
 
-    count = CF_TILE_SIZE - (y & (CF_TILE_SIZE - 1));
+    release = y;
+    count   = CF_TILE_SIZE - (y & (CF_TILE_SIZE - 1));
     if (count > height)
       count = height;
 
@@ -174,6 +336,8 @@ cfImageGetCol(cf_image_t   *img,	// I - Image
             *pixels++ = *ib++;
             break;
       }
+
+    release_tile(img, x, release);
   }
 
   return (0);
@@ -249,9 +413,24 @@ cfImageGetRow(cf_image_t   *img,	// I - Image
 
   bpp = img->colorspace < 0 ? -img->colorspace : img->colorspace;
 
+  if (img->stream != NULL)
+  {
+    if (!stream_get_row(img, x, y, width, pixels))
+      return (0);
+
+    if (stream_rewind(img))
+      return (-1);
+  }
+
+  if ((ib = get_row(img, y)) != NULL)
+  {
+    memcpy(pixels, ib + (size_t)x * bpp, (size_t)width * bpp);
+    return (0);
+  }
+
   while (width > 0)
   {
-    ib = get_tile(img, x, y);
+    ib = get_tile(img, x, y, 0);
 
     if (ib == NULL)
       return (-1);
@@ -260,6 +439,7 @@ cfImageGetRow(cf_image_t   *img,	// I - Image
     if (count > width)
       count = width;
     memcpy(pixels, ib, count * bpp);
+    release_tile(img, x, y);
     pixels += count * bpp;
     x      += count;
     width  -= count;
@@ -302,6 +482,38 @@ cfImageGetYPPI(cf_image_t *img)		// I - Image
 }
 
 
+//
+// '_cfImageGetThreads()' - Get the number of threads to work on an image
+//                          with.
+//
+// This is the "image-threads" option of the job if given, otherwise the
+// number of online CPUs, at most CF_IMAGE_MAX_THREADS.
+//
+
+int					// O - Number of threads
+_cfImageGetThreads(
+    cf_filter_data_t *data)		// I - Job data or NULL
+{
+  const char	*val;			// Option value
+  long		threads;		// Number of threads
+
+
+  if (data &&
+      (val = cupsGetOption("image-threads", data->num_options,
+			   data->options)) != NULL)
+    threads = atoi(val);
+  else
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (threads < 1)
+    threads = 1;
+  else if (threads > CF_IMAGE_MAX_THREADS)
+    threads = CF_IMAGE_MAX_THREADS;
+
+  return ((int)threads);
+}
+
+
 //
 // 'cfImageOpen()' - Open an image file and read it into memory.
 //
@@ -343,94 +555,100 @@ cfImageOpenFP(
     int             hue,		// I - Color hue adjustment
     const cf_ib_t   *lut)		// I - RGB gamma/brightness LUT
 {
-  unsigned char	header[16],		// First 16 bytes of file
-		header2[16];		// Bytes 2048-2064 (PhotoCD)
-  cf_image_t	*img;			// New image buffer
-  int		status;			// Status of load...
-
-
-  DEBUG_printf(("cfImageOpen2(%p, %d, %d, %d, %d, %p)\n",
-        	fp, primary, secondary, saturation, hue, lut));
-
-  //
-  // Figure out the file type...
-  //
-
-  if (fp == NULL)
-    return (NULL);
+  return (cfImageOpenFPWithBudget(fp, primary, secondary, saturation, hue,
+				  lut, NULL));
+}
 
-  if (fread(header, 1, sizeof(header), fp) == 0)
-  {
-    fclose(fp);
-    return (NULL);
-  }
 
-  fseek(fp, 2048, SEEK_SET);
-  memset(header2, 0, sizeof(header2));
-  if (fread(header2, 1, sizeof(header2), fp) == 0 && ferror(fp))
-    DEBUG_printf(("Error reading file!"));
-  fseek(fp, 0, SEEK_SET);
+//
+// 'cfImageOpenFPWithBudget()' - Open an image file and read it into
+//                               memory, taking the tile cache from the
+//                               memory budget of the job (see
+//                               cfFilterMemoryReserve()).
+//
 
-  //
-  // Allocate memory...
-  //
+cf_image_t *				// O - New image
+cfImageOpenFPWithBudget(
+    FILE            *fp,		// I - File pointer of image
+    cf_icspace_t    primary,		// I - Primary colorspace needed
+    cf_icspace_t    secondary,		// I - Secondary colorspace if primary
+                                        //     no good
+    int             saturation,		// I - Color saturation level
+    int             hue,		// I - Color hue adjustment
+    const cf_ib_t   *lut,		// I - RGB gamma/brightness LUT
+    cf_filter_data_t *data)		// I - Job data with memory budget or
+					//     NULL
+{
+  return (open_image(fp, primary, secondary, saturation, hue, lut, data,
+		     0, 0));
+}
 
-  img = calloc(1, sizeof(cf_image_t));
 
-  if (img == NULL)
-  {
-    fclose(fp);
-    return (NULL);
-  }
+//
+// 'cfImageOpenFPStreaming()' - Open an image file for decoding rows on
+//                              demand.
+//
+// The image is decoded in a background thread which stays only a few rows
+// ahead of cfImageGetRow(), so reading the image once from top to bottom
+// needs memory for a few rows instead of the whole image.  Any other
+// access (going back up, cfImageGetCol(), cfImageCrop() of a region
+// above the last row read) decodes the image again into the regular
+// cache and continues from there, so every access works, only slower.
+// Formats which are not decoded top to bottom are read completely right
+// away.  A streaming image must be read by one thread only, which is why
+// cfFilterImageToRaster() only streams when it renders on a single thread;
+// set the "image-threads" option to 1 to trade its speed for memory.
+//
 
-  //
-  // Load the image as appropriate...
-  //
+cf_image_t *				// O - New image
+cfImageOpenFPStreaming(
+    FILE            *fp,		// I - File pointer of image
+    cf_icspace_t    primary,		// I - Primary colorspace needed
+    cf_icspace_t    secondary,		// I - Secondary colorspace if primary
+                                        //     no good
+    int             saturation,		// I - Color saturation level
+    int             hue,		// I - Color hue adjustment
+    const cf_ib_t   *lut,		// I - RGB gamma/brightness LUT
+    cf_filter_data_t *data)		// I - Job data with memory budget or
+					//     NULL
+{
+  return (open_image(fp, primary, secondary, saturation, hue, lut, data,
+		     1, 0));
+}
 
-  img->cachefile = -1;
-  img->max_ics   = CF_TILE_MINIMUM;
-  img->xppi      = 200;
-  img->yppi      = 200;
 
-#ifdef HAVE_LIBPNG
-  if (!memcmp(header, "\211PNG", 4))
-    status = _cfImageReadPNG(img, fp, primary, secondary, saturation, hue,
-			     lut);
-  else
-#endif // HAVE_LIBPNG
-#ifdef HAVE_LIBJPEG
-  if (!memcmp(header, "\377\330\377", 3) &&	// Start-of-Image
-      header[3] >= 0xe0 && header[3] <= 0xef)	// APPn
-    status = _cfImageReadJPEG(img, fp, primary, secondary, saturation, hue,
-			      lut);
-  else
-#endif // HAVE_LIBJPEG
-#ifdef HAVE_LIBTIFF
-  if (!memcmp(header, "MM\000\052", 4) ||
-      !memcmp(header, "II\052\000", 4))
-    status = _cfImageReadTIFF(img, fp, primary, secondary, saturation, hue,
-			      lut);
-  else
-#endif // HAVE_LIBTIFF
-#ifdef HAVE_LIBJXL
-  if (_cfIsJPEGXL(header, sizeof(header)))
-    status = _cfImageReadJPEGXL(img, fp, primary, secondary, saturation, hue, 
-	    			lut);
-  else
-#endif // HAVE_LIBJXL
-	  
-  {
-    fclose(fp);
-    status = -1;
-  }
+//
+// 'cfImageOpenFPScaled()' - Open an image file, allowing it to be scaled
+//                           down while decoding.
+//
+// The caller tells how many pixels it needs at least along each edge of
+// the image, for example the size of the longer edge of the page in
+// device pixels when the image gets fitted to the page.  Formats which
+// can decode a smaller image cheaply (JPEG) return an image which is
+// smaller by a power of two, but not smaller than "min_size" along any
+// edge.  The resolution of the image is scaled down by the same factor,
+// so that the image keeps its size in inches.  Pass 0 to get the full
+// image.
+//
 
-  if (status)
-  {
-    cfImageClose(img);
-    return (NULL);
-  }
-  else
-    return (img);
+cf_image_t *				// O - New image
+cfImageOpenFPScaled(
+    FILE            *fp,		// I - File pointer of image
+    cf_icspace_t    primary,		// I - Primary colorspace needed
+    cf_icspace_t    secondary,		// I - Secondary colorspace if primary
+                                        //     no good
+    int             saturation,		// I - Color saturation level
+    int             hue,		// I - Color hue adjustment
+    const cf_ib_t   *lut,		// I - RGB gamma/brightness LUT
+    cf_filter_data_t *data,		// I - Job data with memory budget or
+					//     NULL
+    int             streaming,		// I - Decode rows on demand (see
+					//     cfImageOpenFPStreaming())?
+    unsigned        min_size)		// I - Pixels needed along each edge,
+					//     0 for the full image
+{
+  return (open_image(fp, primary, secondary, saturation, hue, lut, data,
+		     streaming, min_size));
 }
 
 
@@ -448,9 +666,8 @@ _cfImagePutCol(
 {
   int		bpp,			// Bytes per pixel
 		twidth,			// Width of tile
-		count;			// Number of pixels to put
-  int		tilex,			// Column within tile
-		tiley;			// Row within tile
+		count,			// Number of pixels to put
+		release;		// Row of tile to release
   cf_ib_t	*ib;			// Pointer to pixels in tile
 
 
@@ -471,20 +688,27 @@ _cfImagePutCol(
 
   bpp    = cfImageGetDepth(img);
   twidth = bpp * (CF_TILE_SIZE - 1);
-  tilex  = x / CF_TILE_SIZE;
-  tiley  = y / CF_TILE_SIZE;
+
+  if (img->stream != NULL)
+    return (stream_break(img));
+
+  if ((ib = get_row(img, y)) != NULL)
+  {
+    for (; height > 0; height --, pixels += bpp)
+      memcpy(get_row(img, y ++) + (size_t)x * bpp, pixels, bpp);
+
+    return (0);
+  }
 
   while (height > 0)
   {
-    ib = get_tile(img, x, y);
+    ib = get_tile(img, x, y, 1);
 
     if (ib == NULL)
       return (-1);
 
-    img->tiles[tiley][tilex].dirty = 1;
-    tiley ++;
-
-    count = CF_TILE_SIZE - (y & (CF_TILE_SIZE - 1));
+    release = y;
+    count   = CF_TILE_SIZE - (y & (CF_TILE_SIZE - 1));
     if (count > height)
       count = height;
 
@@ -503,6 +727,8 @@ _cfImagePutCol(
             *ib++ = *pixels++;
             break;
       }
+
+    release_tile(img, x, release);
   }
 
   return (0);
@@ -523,8 +749,6 @@ _cfImagePutRow(
 {
   int		bpp,			// Bytes per pixel
 		count;			// Number of pixels to put
-  int		tilex,			// Column within tile
-		tiley;			// Row within tile
   cf_ib_t	*ib;			// Pointer to pixels in tile
 
 
@@ -543,27 +767,32 @@ _cfImagePutRow(
   if (width < 1)
     return (-1);
 
-  bpp   = img->colorspace < 0 ? -img->colorspace : img->colorspace;
-  tilex = x / CF_TILE_SIZE;
-  tiley = y / CF_TILE_SIZE;
+  bpp = img->colorspace < 0 ? -img->colorspace : img->colorspace;
+
+  if (img->stream != NULL)
+    return (stream_put_row(img, x, y, width, pixels));
+
+  if ((ib = get_row(img, y)) != NULL)
+  {
+    memcpy(ib + (size_t)x * bpp, pixels, (size_t)width * bpp);
+    return (0);
+  }
 
   while (width > 0)
   {
-    ib = get_tile(img, x, y);
+    ib = get_tile(img, x, y, 1);
 
     if (ib == NULL)
       return (-1);
 
-    img->tiles[tiley][tilex].dirty = 1;
-
     count = CF_TILE_SIZE - (x & (CF_TILE_SIZE - 1));
     if (count > width)
       count = width;
     memcpy(ib, pixels, count * bpp);
+    release_tile(img, x, y);
     pixels += count * bpp;
     x      += count;
     width  -= count;
-    tilex  ++;
   }
 
   return (0);
@@ -585,6 +814,7 @@ cfImageSetMaxTiles(
   int	cache_size,			// Size of tile cache in bytes
 	min_tiles,			// Minimum number of tiles to cache
 	max_size;			// Maximum cache size in bytes
+  size_t tile_size;			// Size of a cached tile in bytes
   char	*cache_env,			// Cache size environment variable
 	cache_units[255];		// Cache size units
 
@@ -632,6 +862,27 @@ cfImageSetMaxTiles(
   if (max_tiles < min_tiles)
     max_tiles = min_tiles;
 
+  //
+  // Take the cache from the job's memory budget, shrinking it when the
+  // budget is tight, the tiles which do not fit go to the swap file.
+  // Streaming images only take the cache when they get re-read...
+  //
+
+  if (img->data && img->stream == NULL)
+  {
+    tile_size = sizeof(cf_ic_t) +
+                CF_TILE_SIZE * CF_TILE_SIZE * cfImageGetDepth(img);
+
+    cfFilterMemoryRelease(img->data, img->cache_reserved);
+    img->cache_reserved = cfFilterMemoryReserve(img->data,
+						(size_t)min_tiles * tile_size,
+						(size_t)max_tiles * tile_size);
+    if (img->cache_reserved > 0)
+      max_tiles = (int)(img->cache_reserved / tile_size);
+    else
+      max_tiles = min_tiles;
+  }
+
   img->max_ics = max_tiles;
 
   DEBUG_printf(("max_ics=%d...\n", img->max_ics));
@@ -654,16 +905,17 @@ cfImageCrop(cf_image_t* img,
   cf_image_t* temp = calloc(1, sizeof(cf_image_t));
   cf_ib_t *pixels = (cf_ib_t*)malloc(img->xsize * cfImageGetDepth(img));
 
-  temp->cachefile = -1;
+  init_cache(temp);
   temp->max_ics = img->max_ics;
   temp->colorspace = img->colorspace;
   temp->xppi = img->xppi;
   temp->yppi = img->yppi;
-  temp->num_ics = 0;
-  temp->first = temp->last = NULL;
   temp->tiles = NULL;
   temp->xsize = width;
   temp->ysize = height;
+  temp->data = img->data;
+  if (temp->data)
+    cfImageSetMaxTiles(temp, 0);
 
   for (int i = posh; i < min(cfImageGetHeight(img), posh + height); i ++)
   {
@@ -678,159 +930,323 @@ cfImageCrop(cf_image_t* img,
 
 
 //
-// 'flush_tile()' - Flush the least-recently-used tile in the cache.
+// 'flush_tile()' - Flush the least-recently-used tile of a shard.
+//
+// The shard must be locked.  Pinned tiles are skipped, NULL is returned
+// when all tiles of the shard are pinned.
 //
 
-static int
-flush_tile(cf_image_t *img)		// I - Image
+static cf_ic_t *			// O - Cache entry to reuse or NULL
+flush_tile(cf_image_t  *img,		// I - Image
+           cf_ishard_t *shard)		// I - Shard of the tile cache
 {
   int		bpp;			// Bytes per pixel
+  size_t	tile_size;		// Bytes per tile
+  cf_ic_t	*ic;			// Cache entry to flush
   cf_itile_t	*tile;			// Pointer to tile
 
 
-  if(img == NULL || img->first == NULL || img->first->tile == NULL)
-    return (-1);
+  if (img == NULL || shard == NULL)
+    return (NULL);
 
-  bpp = cfImageGetDepth(img);
+  for (ic = shard->first; ic != NULL; ic = ic->next)
+    if (ic->tile != NULL && !__atomic_load_n(&ic->pinned, __ATOMIC_ACQUIRE))
+      break;
+
+  if (ic == NULL)
+    return (NULL);
 
-  tile = img->first->tile;
+  bpp       = cfImageGetDepth(img);
+  tile_size = (size_t)bpp * CF_TILE_SIZE * CF_TILE_SIZE;
+  tile      = ic->tile;
 
   if (!tile->dirty)
   {
     tile->ic = NULL;
-    return (0);
+    ic->tile = NULL;
+    return (ic);
   }
 
-  if (img->cachefile < 0)
+  if (__atomic_load_n(&img->cachefile, __ATOMIC_ACQUIRE) < 0)
   {
-    if ((img->cachefile = cupsCreateTempFd(NULL, NULL, img->cachename,
-                                     sizeof(img->cachename))) < 0)
+    pthread_mutex_lock(&img->lock);
+    if (img->cachefile < 0)
     {
-      tile->ic    = NULL;
-      tile->dirty = 0;
-      return (0);
-    }
+      int fd = cupsCreateTempFd(NULL, NULL, img->cachename,
+				sizeof(img->cachename));
+					// Swap file
 
-    DEBUG_printf(("Created swap file \"%s\"...\n", img->cachename));
-  }
+      if (fd >= 0)
+      {
+        DEBUG_printf(("Created swap file \"%s\"...\n", img->cachename));
+      }
 
-  if (tile->pos >= 0)
-  {
-    if (lseek(img->cachefile, tile->pos, SEEK_SET) != tile->pos)
-    {
-      tile->ic    = NULL;
-      tile->dirty = 0;
-      return (0);
+      __atomic_store_n(&img->cachefile, fd, __ATOMIC_RELEASE);
     }
-  }
-  else
-  {
-    if ((tile->pos = lseek(img->cachefile, 0, SEEK_END)) < 0)
+    pthread_mutex_unlock(&img->lock);
+
+    if (img->cachefile < 0)
     {
       tile->ic    = NULL;
       tile->dirty = 0;
-      return (0);
+      ic->tile    = NULL;
+      return (ic);
     }
   }
 
-  if (write(img->cachefile, tile->ic->pixels,
-	    bpp * CF_TILE_SIZE * CF_TILE_SIZE) == -1)
+  //
+  // Tiles get their place at the end of the swap file on their first
+  // flush, shards write independently with pwrite()...
+  //
+
+  if (tile->pos < 0)
+    tile->pos = __atomic_fetch_add(&img->cacheend, (off_t)tile_size,
+				   __ATOMIC_RELAXED);
+
+  if (pwrite(img->cachefile, ic->pixels, tile_size, tile->pos) == -1)
     DEBUG_printf(("Error writing cache tile!"));
 
   tile->ic    = NULL;
   tile->dirty = 0;
-  return (0);
+  ic->tile    = NULL;
+  return (ic);
 }
 
 
 //
-// 'get_tile()' - Get a cached tile.
+// 'get_row()' - Get a row of the mapped image.
+//
+// Returns NULL when the image uses the tile cache instead.  For images
+// larger than the cache the mapping is backed by a sparse swap file and
+// the kernel does the paging; bands of CF_TILE_SIZE rows are then evicted
+// least-recently-used with madvise() once more of them are resident than
+// the cache size (RIP_MAX_CACHE or the memory budget) allows.
+//
+// Rows can be got from several threads at once.  The band bookkeeping
+// uses atomics and only eviction takes the image lock; a race there can
+// at worst evict a band too early, which costs a page fault but never
+// data, as the pages of a shared file mapping survive MADV_DONTNEED.
 //
 
-static cf_ib_t *			// O - Pointer to tile or NULL
-get_tile(cf_image_t *img,		// I - Image
-         int          x,		// I - Column in image
-         int          y)		// I - Row in image
+static cf_ib_t *			// O - Pointer to row or NULL
+get_row(cf_image_t *img,		// I - Image
+        int        y)			// I - Row in image
 {
-  int		bpp,			// Bytes per pixel
-		tilex,			// Column within tile
-		tiley,			// Row within tile
-		xtiles,			// Number of tiles horizontally
-		ytiles;			// Number of tiles vertically
-  cf_ic_t	*ic;			// Cache pointer
-  cf_itile_t	*tile;			// Tile pointer
-
-
-  if (img->tiles == NULL)
+  cf_ib_t	*map;			// Mapped image
+  unsigned	band,			// Band of the row
+		bands,			// Number of bands
+		i,			// Looping var
+		lru;			// Least-recently-used band
+  unsigned long	used,			// Last use of this band
+		last,			// Last use of another band
+		lru_used;		// Last use of LRU band
+  size_t	band_size,		// Bytes per band
+		max_bands,		// Maximum number of resident bands
+		start,			// Start of band to evict
+		end;			// End of band to evict
+  long		page_size;		// Size of a memory page
+
+
+  if ((map = __atomic_load_n(&img->map, __ATOMIC_ACQUIRE)) == NULL)
   {
-    xtiles = (img->xsize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
-    ytiles = (img->ysize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
-
-   /*
-    * We check the image validity (f.e. whether xsize and ysize are
-    * greater than 0) during opening the file, but it happens several
-    * functions before and reader can miss it. Add the check for stressing
-    * out such cases are not accepted, which adds readability and fixes
-    * false positives of coverity programs.
-    */
-    if (xtiles <= 0 || ytiles <= 0)
+    if (__atomic_load_n(&img->nomap, __ATOMIC_ACQUIRE))
       return (NULL);
 
-    DEBUG_printf(("Creating tile array (%dx%d)\n", xtiles, ytiles));
-
-    if ((img->tiles = calloc(ytiles, sizeof(cf_itile_t *))) == NULL)
-      return (NULL);
+    pthread_mutex_lock(&img->lock);
+    if (img->map == NULL && !img->nomap &&
+        (img->tiles != NULL || map_image(img)))
+      __atomic_store_n(&img->nomap, 1, __ATOMIC_RELEASE);
+    map = img->map;
+    pthread_mutex_unlock(&img->lock);
 
-    if ((tile = calloc(ytiles, xtiles * sizeof(cf_itile_t))) == NULL)
+    if (map == NULL)
       return (NULL);
-
-    for (tiley = 0; tiley < ytiles; tiley ++)
-    {
-      img->tiles[tiley] = tile;
-      for (tilex = xtiles; tilex > 0; tilex --, tile ++)
-        tile->pos = -1;
-    }
   }
 
-  bpp   = cfImageGetDepth(img);
-  tilex = x / CF_TILE_SIZE;
-  tiley = y / CF_TILE_SIZE;
-  tile  = img->tiles[tiley] + tilex;
-  x     &= (CF_TILE_SIZE - 1);
-  y     &= (CF_TILE_SIZE - 1);
+  if (img->map_used == NULL)
+    return (map + (size_t)y * img->map_stride);
 
-  if ((ic = tile->ic) == NULL)
+  band = (unsigned)y / CF_TILE_SIZE;
+  used = __atomic_add_fetch(&img->map_clock, 1, __ATOMIC_RELAXED);
+
+  if (!__atomic_exchange_n(&img->map_used[band], used, __ATOMIC_RELAXED))
   {
-    if (img->num_ics < img->max_ics)
+    bands     = (img->ysize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
+    band_size = CF_TILE_SIZE * img->map_stride;
+    max_bands = (size_t)img->max_ics * CF_TILE_SIZE * CF_TILE_SIZE *
+                cfImageGetDepth(img) / band_size;
+    if (max_bands < 2)
+      max_bands = 2;
+
+    if (__atomic_add_fetch(&img->map_resident, 1, __ATOMIC_RELAXED) >
+        max_bands)
     {
-      if ((ic = calloc(1, sizeof(cf_ic_t) +
-                       bpp * CF_TILE_SIZE * CF_TILE_SIZE)) == NULL)
-      {
-        if (img->num_ics == 0)
-	  return (NULL);
+      page_size = sysconf(_SC_PAGESIZE);
 
-        flush_tile(img);
-	ic = img->first;
-      }
-      else
+      pthread_mutex_lock(&img->lock);
+
+      while (__atomic_load_n(&img->map_resident, __ATOMIC_RELAXED) >
+             max_bands)
       {
-	ic->pixels = ((cf_ib_t *)ic) + sizeof(cf_ic_t);
+	for (i = 0, lru = band, lru_used = used; i < bands; i ++)
+	  if ((last = __atomic_load_n(&img->map_used[i], __ATOMIC_RELAXED)) &&
+	      last < lru_used)
+	  {
+	    lru      = i;
+	    lru_used = last;
+	  }
+
+	if (lru == band)
+	  break;			// Only newer bands are resident
+
+	if (!__atomic_compare_exchange_n(&img->map_used[lru], &lru_used, 0,
+					 0, __ATOMIC_RELAXED,
+					 __ATOMIC_RELAXED))
+	  continue;			// Used again meanwhile, look again
+
+	DEBUG_printf(("Evicting image band %u...\n", lru));
+
+	//
+	// Drop the pages of the band from our address space, the page cache
+	// writes them back to the swap file when memory gets tight. Partial
+	// pages at the band boundaries stay mapped...
+	//
+
+	start = (lru * band_size + page_size - 1) / page_size * page_size;
+	end   = min((lru + 1) * band_size, img->map_size) / page_size *
+		page_size;
+
+	if (end > start)
+	  madvise(map + start, end - start, MADV_DONTNEED);
+
+	__atomic_sub_fetch(&img->map_resident, 1, __ATOMIC_RELAXED);
+      }
+
+      pthread_mutex_unlock(&img->lock);
+    }
+  }
+
+  return (map + (size_t)y * img->map_stride);
+}
+
 
-	img->num_ics ++;
+//
+// 'get_tile()' - Get and pin a cached tile.
+//
+// The tile stays in the cache until it is unpinned with release_tile().
+// Tiles are spread over CF_TILE_SHARDS shards, each with its own lock
+// and LRU list, so that threads working on different parts of the image
+// rarely wait for each other.
+//
 
-	DEBUG_printf(("Allocated cache tile %d (%p)...\n", img->num_ics, ic));
+static cf_ib_t *			// O - Pointer to tile or NULL
+get_tile(cf_image_t *img,		// I - Image
+         int          x,		// I - Column in image
+         int          y,		// I - Row in image
+	 int          dirty)		// I - Non-zero if the tile gets written
+{
+  int		bpp,			// Bytes per pixel
+		tilex,			// Column within tile
+		tiley,			// Row within tile
+		xtiles,			// Number of tiles horizontally
+		ytiles;			// Number of tiles vertically
+  unsigned	max_ics;		// Maximum number of tiles in shard
+  cf_ic_t	*ic;			// Cache pointer
+  cf_itile_t	*tile,			// Tile pointer
+		**tiles;		// Tile array
+  cf_ishard_t	*shard;			// Shard of the tile
+
+
+  if ((tiles = __atomic_load_n(&img->tiles, __ATOMIC_ACQUIRE)) == NULL)
+  {
+    pthread_mutex_lock(&img->lock);
+
+    if ((tiles = img->tiles) == NULL)
+    {
+      xtiles = (img->xsize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
+      ytiles = (img->ysize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
+
+     /*
+      * We check the image validity (f.e. whether xsize and ysize are
+      * greater than 0) during opening the file, but it happens several
+      * functions before and reader can miss it. Add the check for stressing
+      * out such cases are not accepted, which adds readability and fixes
+      * false positives of coverity programs.
+      */
+      if (xtiles <= 0 || ytiles <= 0 ||
+          (tiles = calloc(ytiles, sizeof(cf_itile_t *))) == NULL)
+      {
+        pthread_mutex_unlock(&img->lock);
+	return (NULL);
+      }
+
+      DEBUG_printf(("Creating tile array (%dx%d)\n", xtiles, ytiles));
+
+      if ((tile = calloc(ytiles, xtiles * sizeof(cf_itile_t))) == NULL)
+      {
+        free(tiles);
+        pthread_mutex_unlock(&img->lock);
+	return (NULL);
       }
+
+      for (tiley = 0; tiley < ytiles; tiley ++)
+      {
+	tiles[tiley] = tile;
+	for (tilex = xtiles; tilex > 0; tilex --, tile ++)
+	  tile->pos = -1;
+      }
+
+      __atomic_store_n(&img->tiles, tiles, __ATOMIC_RELEASE);
     }
-    else
+
+    pthread_mutex_unlock(&img->lock);
+  }
+
+  bpp     = cfImageGetDepth(img);
+  tilex   = x / CF_TILE_SIZE;
+  tiley   = y / CF_TILE_SIZE;
+  tile    = tiles[tiley] + tilex;
+  shard   = img->shards + (tilex + tiley) % CF_TILE_SHARDS;
+  max_ics = (img->max_ics + CF_TILE_SHARDS - 1) / CF_TILE_SHARDS;
+  x       &= (CF_TILE_SIZE - 1);
+  y       &= (CF_TILE_SIZE - 1);
+
+  pthread_mutex_lock(&shard->lock);
+
+  if ((ic = tile->ic) == NULL)
+  {
+    if (shard->num_ics >= max_ics)
     {
-      DEBUG_printf(("Flushing old cache tile (%p)...\n", img->first));
+      DEBUG_printf(("Flushing old cache tile (%p)...\n", shard->first));
+
+      ic = flush_tile(img, shard);
+    }
+
+    //
+    // Grow the shard when it is not full yet or when all of its tiles are
+    // pinned by other threads...
+    //
 
-      int res = flush_tile(img);
-      if(res)
+    if (ic == NULL)
+    {
+      if ((ic = calloc(1, sizeof(cf_ic_t) +
+                       bpp * CF_TILE_SIZE * CF_TILE_SIZE)) == NULL)
       {
-        return NULL;
+        if (shard->num_ics == 0 || (ic = flush_tile(img, shard)) == NULL)
+	{
+	  pthread_mutex_unlock(&shard->lock);
+	  return (NULL);
+	}
+      }
+      else
+      {
+	ic->pixels = ((cf_ib_t *)ic) + sizeof(cf_ic_t);
+
+	shard->num_ics ++;
+
+	DEBUG_printf(("Allocated cache tile %d (%p)...\n", shard->num_ics,
+		      ic));
       }
-      ic = img->first;
     }
 
     ic->tile = tile;
@@ -841,9 +1257,8 @@ get_tile(cf_image_t *img,		// I - Image
       DEBUG_printf(("Loading cache tile from file position " CUPS_LLFMT "...\n",
                     CUPS_LLCAST tile->pos));
 
-      lseek(img->cachefile, tile->pos, SEEK_SET);
-      if (read(img->cachefile, ic->pixels,
-	       bpp * CF_TILE_SIZE * CF_TILE_SIZE) == -1)
+      if (pread(img->cachefile, ic->pixels,
+		bpp * CF_TILE_SIZE * CF_TILE_SIZE, tile->pos) == -1)
 	DEBUG_printf(("Error reading cache tile!"));
     }
     else
@@ -854,19 +1269,12 @@ get_tile(cf_image_t *img,		// I - Image
     }
   }
 
-  if (ic == img->first)
-  {
-    if (ic->next != NULL)
-      ic->next->prev = NULL;
+  if (dirty)
+    tile->dirty = 1;
 
-    img->first = ic->next;
-    ic->next   = NULL;
-    ic->prev   = NULL;
-  }
-  else if (img->first == NULL)
-    img->first = ic;
+  __atomic_add_fetch(&ic->pinned, 1, __ATOMIC_ACQUIRE);
 
-  if (ic != img->last)
+  if (ic != shard->last)
   {
     //
     // Remove the cache entry from the list...
@@ -874,6 +1282,8 @@ get_tile(cf_image_t *img,		// I - Image
 
     if (ic->prev != NULL)
       ic->prev->next = ic->next;
+    else if (ic == shard->first)
+      shard->first = ic->next;
     if (ic->next != NULL)
       ic->next->prev = ic->prev;
 
@@ -881,19 +1291,574 @@ get_tile(cf_image_t *img,		// I - Image
     // And add it to the end...
     //
 
-    if (img->last != NULL)
-      img->last->next = ic;
+    if (shard->last != NULL)
+      shard->last->next = ic;
+    else
+      shard->first = ic;
 
-    ic->prev  = img->last;
-    img->last = ic;
+    ic->prev    = shard->last;
+    ic->next    = NULL;
+    shard->last = ic;
   }
 
-  ic->next = NULL;
+  pthread_mutex_unlock(&shard->lock);
 
   return (ic->pixels + bpp * (y * CF_TILE_SIZE + x));
 }
 
 
+//
+// 'init_cache()' - Initialize the image cache.
+//
+
+static void
+init_cache(cf_image_t *img)		// I - Image
+{
+  int	i;				// Looping var
+
+
+  img->cachefile = -1;
+
+  pthread_mutex_init(&img->lock, NULL);
+  for (i = 0; i < CF_TILE_SHARDS; i ++)
+    pthread_mutex_init(&img->shards[i].lock, NULL);
+}
+
+
+//
+// 'map_image()' - Map the whole image into memory.
+//
+// The image lock must be held.  The image is stored row by row so that
+// getting and putting pixels is plain pointer arithmetic.  Setting the
+// RIP_CACHE_MODE environment variable to "tiles" selects the classic tile
+// cache instead.
+//
+
+static int				// O - 0 on success, -1 on error
+map_image(cf_image_t *img)		// I - Image
+{
+  int		bpp;			// Bytes per pixel
+  cf_ib_t	*map;			// Mapped image
+  unsigned	bands;			// Number of bands
+  size_t	cache_size;		// Size of the tile cache in bytes
+  const char	*mode;			// Cache mode
+
+
+  if ((mode = getenv("RIP_CACHE_MODE")) != NULL && strcasecmp(mode, "mmap"))
+    return (-1);
+
+  bpp = cfImageGetDepth(img);
+
+  if (img->xsize == 0 || img->ysize == 0 || bpp < 1 ||
+      (size_t)img->ysize > SIZE_MAX / img->xsize / bpp)
+    return (-1);
+
+  img->map_stride = (size_t)img->xsize * bpp;
+  img->map_size   = img->map_stride * img->ysize;
+  cache_size      = (size_t)img->max_ics * CF_TILE_SIZE * CF_TILE_SIZE * bpp;
+
+  if (img->map_size <= cache_size)
+  {
+    //
+    // The image fits into the cache, use anonymous memory which only gets
+    // backed by pages where the image is written to...
+    //
+
+    if ((map = mmap(NULL, img->map_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+		    0)) == MAP_FAILED)
+      return (-1);
+
+    __atomic_store_n(&img->map, map, __ATOMIC_RELEASE);
+
+    DEBUG_printf(("Mapped %u bytes of memory for the image...\n",
+                  (unsigned)img->map_size));
+
+    return (0);
+  }
+
+  //
+  // Otherwise map a sparse swap file and track which bands are resident...
+  //
+
+  bands = (img->ysize + CF_TILE_SIZE - 1) / CF_TILE_SIZE;
+
+  if ((img->map_used = calloc(bands, sizeof(unsigned long))) == NULL)
+    return (-1);
+
+  if ((img->cachefile = cupsCreateTempFd(NULL, NULL, img->cachename,
+					 sizeof(img->cachename))) < 0)
+    goto error;
+
+  if (ftruncate(img->cachefile, (off_t)img->map_size))
+    goto error;
+
+  if ((map = mmap(NULL, img->map_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED, img->cachefile, 0)) == MAP_FAILED)
+    goto error;
+
+  __atomic_store_n(&img->map, map, __ATOMIC_RELEASE);
+
+  DEBUG_printf(("Mapped swap file \"%s\" for the image...\n",
+                img->cachename));
+
+  return (0);
+
+  error:
+
+  free(img->map_used);
+  img->map_used = NULL;
+
+  if (img->cachefile >= 0)
+  {
+    close(img->cachefile);
+    unlink(img->cachename);
+    img->cachefile = -1;
+  }
+
+  return (-1);
+}
+
+
+//
+// 'open_image()' - Open an image file.
+//
+
+static cf_image_t *			// O - New image
+open_image(
+    FILE             *fp,		// I - File pointer of image
+    cf_icspace_t     primary,		// I - Primary colorspace needed
+    cf_icspace_t     secondary,		// I - Secondary colorspace if primary
+                                        //     no good
+    int              saturation,	// I - Color saturation level
+    int              hue,		// I - Color hue adjustment
+    const cf_ib_t    *lut,		// I - RGB gamma/brightness LUT
+    cf_filter_data_t *data,		// I - Job data with memory budget or
+					//     NULL
+    int              streaming,		// I - Decode rows on demand?
+    unsigned         min_size)		// I - Pixels needed along each edge
+					//     or 0
+{
+  unsigned char	header[16],		// First 16 bytes of file
+		header2[16];		// Bytes 2048-2064 (PhotoCD)
+  cf_image_t	*img;			// New image buffer
+  cf_image_reader_t reader = NULL;	// Reader for the file format
+  int		status;			// Status of load...
+
+
+  DEBUG_printf(("cfImageOpen2(%p, %d, %d, %d, %d, %p)\n",
+        	fp, primary, secondary, saturation, hue, lut));
+
+  //
+  // Figure out the file type...
+  //
+
+  if (fp == NULL)
+    return (NULL);
+
+  if (fread(header, 1, sizeof(header), fp) == 0)
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  fseek(fp, 2048, SEEK_SET);
+  memset(header2, 0, sizeof(header2));
+  if (fread(header2, 1, sizeof(header2), fp) == 0 && ferror(fp))
+    DEBUG_printf(("Error reading file!"));
+  fseek(fp, 0, SEEK_SET);
+
+#ifdef HAVE_LIBPNG
+  if (!memcmp(header, "\211PNG", 4))
+    reader = _cfImageReadPNG;
+  else
+#endif // HAVE_LIBPNG
+#ifdef HAVE_LIBJPEG
+  if (!memcmp(header, "\377\330\377", 3) &&	// Start-of-Image
+      header[3] >= 0xe0 && header[3] <= 0xef)	// APPn
+    reader = _cfImageReadJPEG;
+  else
+#endif // HAVE_LIBJPEG
+#ifdef HAVE_LIBTIFF
+  if (!memcmp(header, "MM\000\052", 4) ||
+      !memcmp(header, "II\052\000", 4))
+  {
+    reader    = _cfImageReadTIFF;
+    streaming = 0;			// Rows may come bottom-up or as
+					// columns
+  }
+  else
+#endif // HAVE_LIBTIFF
+#ifdef HAVE_LIBJXL
+  if (_cfIsJPEGXL(header, sizeof(header)))
+  {
+    reader    = _cfImageReadJPEGXL;
+    streaming = 0;			// Decoder threads put rows in any
+					// order
+  }
+  else
+#endif // HAVE_LIBJXL
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  //
+  // Allocate memory...
+  //
+
+  img = calloc(1, sizeof(cf_image_t));
+
+  if (img == NULL)
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  //
+  // Load the image as appropriate...
+  //
+
+  init_cache(img);
+  img->max_ics   = CF_TILE_MINIMUM;
+  img->xppi      = 200;
+  img->yppi      = 200;
+  img->data      = data;
+  img->min_size  = min_size;
+
+  if (!streaming ||
+      (status = stream_open(img, fp, reader, primary, secondary, saturation,
+			    hue, lut)) > 0)
+    status = (*reader)(img, fp, primary, secondary, saturation, hue, lut);
+
+  if (status)
+  {
+    cfImageClose(img);
+    return (NULL);
+  }
+  else
+    return (img);
+}
+
+
+//
+// 'release_tile()' - Unpin a cached tile.
+//
+
+static void
+release_tile(cf_image_t *img,		// I - Image
+             int        x,		// I - Column in image
+	     int        y)		// I - Row in image
+{
+  cf_itile_t	*tile;			// Tile pointer
+
+
+  tile = img->tiles[y / CF_TILE_SIZE] + x / CF_TILE_SIZE;
+
+  __atomic_sub_fetch(&tile->ic->pinned, 1, __ATOMIC_RELEASE);
+}
+
+
+//
+// 'stream_break()' - Mark a streaming image as not streamable.
+//
+// Called by the decoder when it does not put full rows from top to
+// bottom.  The reader then decodes the image again into the cache.
+//
+
+static int				// O - -1 (pixels not stored)
+stream_break(cf_image_t *img)		// I - Image
+{
+  cf_istream_t	*st = img->stream;	// Streaming source
+
+
+  pthread_mutex_lock(&st->lock);
+  st->ready  = 1;
+  st->broken = 1;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  return (-1);
+}
+
+
+//
+// 'stream_decode()' - Decoder thread of a streaming image.
+//
+
+static void *				// O - Thread exit status
+stream_decode(void *arg)		// I - Image
+{
+  cf_image_t	*img = (cf_image_t *)arg;
+					// Image
+  cf_istream_t	*st = img->stream;	// Streaming source
+  int		status;			// Status of decoder
+
+
+  status = (*st->reader)(img, st->fp, st->primary, st->secondary,
+			 st->saturation, st->hue, st->lutptr);
+
+  pthread_mutex_lock(&st->lock);
+  st->done   = 1;
+  st->status = status;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  return (NULL);
+}
+
+
+//
+// 'stream_free()' - Stop the decoder of a streaming image and free it.
+//
+// Once the "abort" field of the stream is set the decoder cannot store
+// rows anymore, the readers then stop decoding instead of running to the
+// end of the image.
+//
+
+static void
+stream_free(cf_image_t *img)		// I - Image
+{
+  cf_istream_t	*st = img->stream;	// Streaming source
+
+
+  pthread_mutex_lock(&st->lock);
+  st->abort = 1;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  pthread_join(st->thread, NULL);
+
+  img->stream = NULL;
+
+  if (st->fd >= 0)
+    close(st->fd);
+
+  pthread_cond_destroy(&st->cond);
+  pthread_mutex_destroy(&st->lock);
+  free(st->rows);
+  free(st);
+}
+
+
+//
+// 'stream_get_row()' - Get a row from a streaming image.
+//
+// Waits until the decoder has got to the row.  Rows up to half the
+// window above the requested one stay available, everything above may be
+// dropped.
+//
+
+static int				// O - 0 on success, -1 if the row is
+					//     gone and the image must be
+					//     re-read
+stream_get_row(cf_image_t *img,		// I - Image
+               int        x,		// I - Start column
+	       int        y,		// I - Row
+	       int        width,	// I - Width of row
+	       cf_ib_t    *pixels)	// O - Pixel data
+{
+  cf_istream_t	*st = img->stream;	// Streaming source
+  int		status = -1;		// Return value
+
+
+  pthread_mutex_lock(&st->lock);
+
+  if (y - CF_STREAM_ROWS / 2 > st->low)
+  {
+    st->low = y - CF_STREAM_ROWS / 2;
+    pthread_cond_broadcast(&st->cond);
+  }
+
+  while (y >= st->next && !st->done && !st->broken)
+    pthread_cond_wait(&st->cond, &st->lock);
+
+  if (!st->broken && y < st->next && y >= st->next - CF_STREAM_ROWS)
+  {
+    memcpy(pixels, st->rows + (size_t)(y % CF_STREAM_ROWS) * st->rowsize +
+	   (size_t)x * cfImageGetDepth(img), (size_t)width *
+	   cfImageGetDepth(img));
+    status = 0;
+  }
+
+  pthread_mutex_unlock(&st->lock);
+
+  return (status);
+}
+
+
+//
+// 'stream_open()' - Start decoding an image in the background.
+//
+// Returns once the decoder has found out size and colorspace of the image.
+//
+
+static int				// O - 0 on success, -1 if the image
+					//     could not be read, 1 if the
+					//     image cannot be streamed
+stream_open(cf_image_t        *img,	// I - Image
+            FILE              *fp,	// I - Image file
+	    cf_image_reader_t reader,	// I - Reader for the file format
+	    cf_icspace_t      primary,	// I - Primary colorspace needed
+	    cf_icspace_t      secondary,// I - Secondary colorspace
+	    int               saturation,
+					// I - Color saturation level
+	    int               hue,	// I - Color hue adjustment
+	    const cf_ib_t     *lut)	// I - RGB gamma/brightness LUT
+{
+  cf_istream_t	*st;			// Streaming source
+  int		status;			// Return value
+
+
+  if ((st = calloc(1, sizeof(cf_istream_t))) == NULL)
+    return (1);
+
+  if ((st->fd = dup(fileno(fp))) < 0)
+  {
+    free(st);
+    return (1);
+  }
+
+  st->reader     = reader;
+  st->fp         = fp;
+  st->primary    = primary;
+  st->secondary  = secondary;
+  st->saturation = saturation;
+  st->hue        = hue;
+
+  if (lut)
+  {
+    memcpy(st->lut, lut, sizeof(st->lut));
+    st->lutptr = st->lut;
+  }
+
+  pthread_mutex_init(&st->lock, NULL);
+  pthread_cond_init(&st->cond, NULL);
+
+  img->stream = st;
+
+  if (pthread_create(&st->thread, NULL, stream_decode, img))
+  {
+    img->stream = NULL;
+    close(st->fd);
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
+    free(st);
+    return (1);
+  }
+
+  pthread_mutex_lock(&st->lock);
+  while (!st->ready && !st->done)
+    pthread_cond_wait(&st->cond, &st->lock);
+  status = (st->done && st->status) ? -1 : 0;
+  pthread_mutex_unlock(&st->lock);
+
+  return (status);
+}
+
+
+//
+// 'stream_put_row()' - Put a decoded row into a streaming image.
+//
+// Waits while the window is full, so the decoder runs in step with the
+// reader of the image.
+//
+
+static int				// O - -1 on error, 0 on success
+stream_put_row(cf_image_t    *img,	// I - Image
+               int           x,		// I - Start column
+	       int           y,		// I - Row
+	       int           width,	// I - Row width
+	       const cf_ib_t *pixels)	// I - Pixel data
+{
+  cf_istream_t	*st = img->stream;	// Streaming source
+
+
+  if (x != 0 || width != img->xsize || y != st->next)
+    return (stream_break(img));
+
+  pthread_mutex_lock(&st->lock);
+
+  if (st->rows == NULL && !st->abort && !st->broken)
+  {
+    st->rowsize = (size_t)img->xsize * cfImageGetDepth(img);
+    if ((st->rows = malloc(CF_STREAM_ROWS * st->rowsize)) == NULL)
+      st->broken = 1;
+  }
+
+  if (!st->ready)
+  {
+    st->ready = 1;
+    pthread_cond_broadcast(&st->cond);
+  }
+
+  while (st->next - st->low >= CF_STREAM_ROWS && !st->abort && !st->broken)
+    pthread_cond_wait(&st->cond, &st->lock);
+
+  if (st->abort || st->broken)
+  {
+    pthread_mutex_unlock(&st->lock);
+    return (-1);
+  }
+
+  memcpy(st->rows + (size_t)(y % CF_STREAM_ROWS) * st->rowsize, pixels,
+	 st->rowsize);
+  st->next ++;
+
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  return (0);
+}
+
+
+//
+// 'stream_rewind()' - Turn a streaming image into a regular one.
+//
+// The decoder is stopped and the image is decoded again from the start
+// of the file into the cache.
+//
+
+static int				// O - 0 on success, -1 on error
+stream_rewind(cf_image_t *img)		// I - Image
+{
+  cf_istream_t	*st = img->stream;	// Streaming source
+  FILE		*fp = NULL;		// Image file
+  int		status = -1;		// Status of decoder
+
+
+  DEBUG_puts("Re-reading streaming image...");
+
+  pthread_mutex_lock(&st->lock);
+  st->abort = 1;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  pthread_join(st->thread, NULL);
+
+  img->stream = NULL;
+  img->xppi   = 200;			// Defaults as in open_image()
+  img->yppi   = 200;
+
+  if (lseek(st->fd, 0, SEEK_SET) == 0 && (fp = fdopen(st->fd, "rb")) != NULL)
+  {
+    st->fd = -1;
+    status = (*st->reader)(img, fp, st->primary, st->secondary,
+			   st->saturation, st->hue, st->lutptr);
+  }
+
+  if (st->fd >= 0)
+    close(st->fd);
+
+  pthread_cond_destroy(&st->cond);
+  pthread_mutex_destroy(&st->lock);
+  free(st->rows);
+  free(st);
+
+  return (status);
+}
+
+
 #ifdef HAVE_EXIF
 //
 // Helper function required by EXIF read function
@@ -912,34 +1877,277 @@ static void trim_spaces(char *buf)
 
 
 //
-// Helper function to extract bytes from image files
+// 'exif_get()' - Get a TIFF integer in the byte order of the file.
 //
 
-static unsigned char *
-find_bytes(FILE *fp,
-	   long int *size)
+static unsigned				// O - Value
+exif_get(const unsigned char *p,	// I - Bytes
+         int                 bytes,	// I - 2 or 4
+	 int                 big)	// I - Big-endian?
 {
-  unsigned char *buf;
+  if (bytes == 2)
+    return (big ? (unsigned)((p[0] << 8) | p[1]) :
+		  (unsigned)((p[1] << 8) | p[0]));
+  else
+    return (big ? ((unsigned)p[0] << 24) | ((unsigned)p[1] << 16) |
+		  ((unsigned)p[2] << 8) | p[3] :
+		  ((unsigned)p[3] << 24) | ((unsigned)p[2] << 16) |
+		  ((unsigned)p[1] << 8) | p[0]);
+}
 
-  long int originalOffset = ftell(fp);
-  fseek(fp, 0L, SEEK_END);
 
-  // calculating the size of the file
-  long int res = ftell(fp);
+//
+// 'exif_jpeg()' - Find the EXIF block of a JPEG file.
+//
+// Skips from marker to marker up to the start of the image data and reads
+// only the APP1 segment with the EXIF data, which is 64k at most.
+//
+
+static unsigned char *			// O - EXIF block or NULL
+exif_jpeg(FILE   *fp,			// I - Image file after SOI
+          size_t *size)			// O - Size of EXIF block
+{
+  int		marker;			// Marker code
+  unsigned char	length[2];		// Segment length
+  size_t	bytes;			// Bytes in segment
+  unsigned char	*buf;			// EXIF block
 
-  buf = (unsigned char *)malloc(res * sizeof(unsigned char) + 1);
-  fseek(fp, 0, SEEK_SET);
 
-  if (fread(buf, 1, res, fp) < res)
+  for (;;)
   {
-    free(buf);
-    buf = NULL;
-    *size = 0;
+    if (getc(fp) != 0xff)
+      return (NULL);
+
+    while ((marker = getc(fp)) == 0xff);	// Skip fill bytes
+
+    if (marker == EOF || marker == 0xd9 || marker == 0xda)
+      return (NULL);			// EOF, EOI or SOS
+
+    if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+      continue;				// TEM or RSTn, no length
+
+    if (fread(length, 1, 2, fp) != 2 ||
+        (bytes = ((size_t)length[0] << 8) | length[1]) < 2)
+      return (NULL);
+
+    bytes -= 2;
+
+    if (marker == 0xe1 && bytes > 6)
+    {
+      if ((buf = malloc(bytes)) == NULL)
+	return (NULL);
+
+      if (fread(buf, 1, bytes, fp) == bytes && !memcmp(buf, "Exif\0\0", 6))
+      {
+	*size = bytes;
+	return (buf);
+      }
+
+      free(buf);
+      continue;				// XMP or other APP1 data
+    }
+
+    if (fseek(fp, (long)bytes, SEEK_CUR))
+      return (NULL);
+  }
+}
+
+
+//
+// 'exif_png()' - Find the EXIF block of a PNG file.
+//
+// Skips from chunk to chunk and reads only the eXIf chunk, which has the
+// TIFF data without the "Exif" header libexif wants.
+//
+
+static unsigned char *			// O - EXIF block or NULL
+exif_png(FILE   *fp,			// I - Image file after signature
+         size_t *size)			// O - Size of EXIF block
+{
+  unsigned char	chunk[8];		// Chunk length and type
+  unsigned	length;			// Chunk length
+  unsigned char	*buf;			// EXIF block
+
+
+  while (fread(chunk, 1, 8, fp) == 8 && memcmp(chunk + 4, "IEND", 4))
+  {
+    length = exif_get(chunk, 4, 1);
+
+    if (!memcmp(chunk + 4, "eXIf", 4))
+    {
+      if (length < 8 || length > 0x100000 ||
+          (buf = malloc(length + 6)) == NULL)
+	return (NULL);
+
+      memcpy(buf, "Exif\0\0", 6);
+
+      if (fread(buf + 6, 1, length, fp) != length)
+      {
+	free(buf);
+	return (NULL);
+      }
+
+      *size = length + 6;
+      return (buf);
+    }
+
+    if (length > 0x7fffffff || fseek(fp, (long)length + 4, SEEK_CUR))
+      return (NULL);			// Skip data and CRC
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'exif_put()' - Put a 32-bit TIFF integer in the byte order of the file.
+//
+
+static void
+exif_put(unsigned char *p,		// I - Bytes
+         unsigned      value,		// I - Value
+	 int           big)		// I - Big-endian?
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < 4; i ++, value >>= 8)
+    p[big ? 3 - i : i] = value & 255;
+}
+
+
+//
+// 'exif_tiff()' - Extract the resolution tags of a TIFF file.
+//
+// A TIFF file is a big EXIF block, with offsets from the start of the
+// file.  Only the first IFD and the values of the resolution tags are
+// read, and put together into a small TIFF structure for libexif.
+//
+
+static unsigned char *			// O - EXIF block or NULL
+exif_tiff(FILE                *fp,	// I - Image file
+          const unsigned char *header,	// I - First 8 bytes of file
+	  size_t              *size)	// O - Size of EXIF block
+{
+  int		big = header[0] == 'M';	// Big-endian file?
+  unsigned	count,			// Number of entries in IFD
+		num_entries = 0,	// Number of entries kept
+		tag,			// Tag of entry
+		type,			// Type of entry
+		values,			// Number of values of entry
+		offset,			// Offset of value
+		next;			// Next free offset in block
+  unsigned char	entry[12],		// IFD entry
+		entries[3][12],		// Resolution entries
+		*buf,			// EXIF block
+		*ptr;			// Pointer into EXIF block
+
+
+  if (fseek(fp, (long)exif_get(header + 4, 4, big), SEEK_SET) ||
+      fread(entry, 1, 2, fp) != 2)
+    return (NULL);
+
+  for (count = exif_get(entry, 2, big); count > 0; count --)
+  {
+    if (fread(entry, 1, 12, fp) != 12)
+      return (NULL);
+
+    tag    = exif_get(entry, 2, big);
+    type   = exif_get(entry + 2, 2, big);
+    values = exif_get(entry + 4, 4, big);
+
+    if (((tag == 282 || tag == 283) && type == 5 && values == 1) ||
+        (tag == 296 && type == 3 && values == 1))
+    {					// X/YResolution, ResolutionUnit
+      memcpy(entries[num_entries ++], entry, 12);
+      if (num_entries == 3)
+	break;
+    }
   }
-  else
-    *size = res + 1;
 
-  fseek(fp, originalOffset, SEEK_SET);
+  if (num_entries == 0)
+    return (NULL);
+
+  //
+  // "Exif" header, TIFF header, IFD with the entries, and 8 bytes for each
+  // rational...
+  //
+
+  *size = 6 + 8 + 2 + 12 * num_entries + 4 + 8 * num_entries;
+
+  if ((buf = calloc(1, *size)) == NULL)
+    return (NULL);
+
+  memcpy(buf, "Exif\0\0", 6);
+  memcpy(buf + 6, header, 4);
+  exif_put(buf + 10, 8, big);
+  buf[14 + (big ? 0 : 1)] = 0;
+  buf[14 + (big ? 1 : 0)] = num_entries;
+
+  next = 8 + 2 + 12 * num_entries + 4;
+
+  for (count = 0, ptr = buf + 16; count < num_entries; count ++, ptr += 12)
+  {
+    memcpy(ptr, entries[count], 12);
+
+    if (exif_get(ptr + 2, 2, big) == 5)
+    {
+      offset = exif_get(ptr + 8, 4, big);
+
+      if (fseek(fp, (long)offset, SEEK_SET) ||
+          fread(buf + 6 + next, 1, 8, fp) != 8)
+      {
+	free(buf);
+	return (NULL);
+      }
+
+      exif_put(ptr + 8, next, big);
+      next += 8;
+    }
+  }
+
+  return (buf);
+}
+
+
+//
+// 'find_exif()' - Find the EXIF data of an image file.
+//
+// Walks the markers of a JPEG file, the chunks of a PNG file, or the
+// first IFD of a TIFF file, reading only the structures on the way and
+// the EXIF data itself.  The returned block starts with the "Exif" header
+// as libexif wants it.  The file position is restored.
+//
+
+static unsigned char *			// O - EXIF block or NULL
+find_exif(FILE   *fp,			// I - Image file
+          size_t *size)			// O - Size of EXIF block
+{
+  long		pos;			// Original file position
+  unsigned char	header[8],		// First bytes of file
+		*buf = NULL;		// EXIF block
+
+
+  *size = 0;
+
+  if ((pos = ftell(fp)) < 0)
+    return (NULL);
+
+  if (!fseek(fp, 0, SEEK_SET) && fread(header, 1, 8, fp) == 8)
+  {
+    if (!memcmp(header, "\377\330", 2))
+    {
+      fseek(fp, 2, SEEK_SET);
+      buf = exif_jpeg(fp, size);
+    }
+    else if (!memcmp(header, "\211PNG\r\n\032\n", 8))
+      buf = exif_png(fp, size);
+    else if (!memcmp(header, "MM\000\052", 4) ||
+	     !memcmp(header, "II\052\000", 4))
+      buf = exif_tiff(fp, header, size);
+  }
+
+  fseek(fp, pos, SEEK_SET);
 
   return (buf);
 }
@@ -959,13 +2167,13 @@ _cfImageReadEXIF(cf_image_t *img,
     return -1;
   }
 
-  long int bufSize = 0;
+  size_t bufSize = 0;
 
-  unsigned char *buf = find_bytes(fp, &bufSize);
+  unsigned char *buf = find_exif(fp, &bufSize);
 
   ExifData *ed = NULL;
 
-  if (buf == NULL || bufSize <= 0 ||
+  if (buf == NULL || bufSize == 0 ||
       (ed = exif_data_new_from_data(buf, bufSize)) == NULL)
   {
     if (buf)
@@ -974,6 +2182,12 @@ _cfImageReadEXIF(cf_image_t *img,
     return (2);
   }
 
+  //
+  // libexif has copied what it needs...
+  //
+
+  free(buf);
+
   ExifIfd ifd = EXIF_IFD_0;
   ExifTag tagX = EXIF_TAG_X_RESOLUTION;
   ExifTag tagY = EXIF_TAG_Y_RESOLUTION;
@@ -984,12 +2198,36 @@ _cfImageReadEXIF(cf_image_t *img,
 
   if (entryX == NULL || entryY == NULL)
   {
-    if (buf)
-      free(buf);
+    exif_data_unref(ed);
     DEBUG_printf(("DEBUG: No EXIF data found"));
     return (2);
   }
 
+  //
+  // The resolution is in pixels per inch unless the unit says otherwise,
+  // without a unit it is just the aspect ratio...
+  //
+
+  double scale = 1.0;
+  ExifEntry *entryUnit = exif_content_get_entry(ed->ifd[ifd],
+						EXIF_TAG_RESOLUTION_UNIT);
+
+  if (entryUnit && entryUnit->format == EXIF_FORMAT_SHORT &&
+      entryUnit->size >= 2)
+  {
+    ExifShort unit = exif_get_short(entryUnit->data,
+				    exif_data_get_byte_order(ed));
+
+    if (unit == 3)
+      scale = 2.54;
+    else if (unit != 2)
+    {
+      exif_data_unref(ed);
+      DEBUG_printf(("DEBUG: No EXIF resolution unit"));
+      return (2);
+    }
+  }
+
   if (entryX)
   {
     char buf1[1024];
@@ -1002,11 +2240,11 @@ _cfImageReadEXIF(cf_image_t *img,
     {
       int xRes;
       sscanf(buf1, "%d", &xRes);
-      img->xppi = xRes;
+      img->xppi = xRes * scale;
     }
     else
     {
-      free(buf);
+      exif_data_unref(ed);
       return (2);
     }
   }
@@ -1022,15 +2260,15 @@ _cfImageReadEXIF(cf_image_t *img,
     {
       int yRes;
       sscanf(buf2, "%d", &yRes);
-      img->yppi = yRes;
+      img->yppi = yRes * scale;
     }
     else{
-      free(buf);
+      exif_data_unref(ed);
       return (2);
     }
   }
 
-  free(buf);
+  exif_data_unref(ed);
   return (1);
 }
 #endif // HAVE_EXIF
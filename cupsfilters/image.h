@@ -52,6 +52,9 @@ typedef struct cf_image_s cf_image_t; // **** Image file data ****
 struct cf_izoom_s;
 typedef struct cf_izoom_s cf_izoom_t; // **** Image zoom data ****
 
+struct cf_filter_data_s;	      // Job and printer data, see
+				      // <cupsfilters/filter.h>
+
 
 //
 // Prototypes...
@@ -90,6 +93,26 @@ extern cf_image_t	*cfImageOpenFP(FILE *fp,
 				       cf_icspace_t secondary,
 				       int saturation, int hue,
 				       const cf_ib_t *lut);
+extern cf_image_t	*cfImageOpenFPWithBudget(FILE *fp,
+						 cf_icspace_t primary,
+						 cf_icspace_t secondary,
+						 int saturation, int hue,
+						 const cf_ib_t *lut,
+						 struct cf_filter_data_s *data);
+extern cf_image_t	*cfImageOpenFPStreaming(FILE *fp,
+						cf_icspace_t primary,
+						cf_icspace_t secondary,
+						int saturation, int hue,
+						const cf_ib_t *lut,
+						struct cf_filter_data_s *data);
+extern cf_image_t	*cfImageOpenFPScaled(FILE *fp,
+					     cf_icspace_t primary,
+					     cf_icspace_t secondary,
+					     int saturation, int hue,
+					     const cf_ib_t *lut,
+					     struct cf_filter_data_s *data,
+					     int streaming,
+					     unsigned min_size);
 extern void		cfImageRGBAdjust(cf_ib_t *pixels, int count,
 					 int saturation, int hue);
 extern void		cfImageRGBToBlack(const cf_ib_t *in,
@@ -26,6 +26,7 @@
 #include <math.h>
 #include <ctype.h>
 #include <errno.h>
+#include <zlib.h>
 
 #define N_OBJECT_ALLOC 100
 #define LINEBUFSIZE 1024
@@ -87,10 +88,17 @@ typedef struct imagetopdf_doc_s         // **** Document information ****
   cf_image_t	*img;			// Image to print
   int		colorspace;		// Output colorspace
   cf_ib_t	*row;			// Current row
+  cf_ib_t	*prevrow;		// Previous row (PNG predictors)
+  unsigned char	*filtrow;		// Filtered row (PNG predictors)
+  z_stream	zs;			// Compressor of image data
   float		gammaval;		// Gamma correction value
   float		brightness;		// Gamma correction value
   char		linebuf[LINEBUFSIZE];
   FILE		*outputfp;
+  int		jpegfd;			// JPEG file to embed as is or -1
+  int		jpegwidth,		// Width of JPEG image
+		jpegheight,		// Height of JPEG image
+		jpegcomps;		// Color components of JPEG image
 } imagetopdf_doc_t;
 
 
@@ -104,7 +112,7 @@ static void	out_hex(imagetopdf_doc_t *doc, cf_ib_t *, int, int);
 #ifdef OUT_AS_ASCII85
 static void	out_ascii85(imagetopdf_doc_t *doc, cf_ib_t *, int, int);
 #else
-static void	out_bin(imagetopdf_doc_t *doc, cf_ib_t *, int, int);
+static int	out_flate(imagetopdf_doc_t *doc, cf_ib_t *, int, int);
 #endif
 #endif
 static void	out_pdf(imagetopdf_doc_t *doc, const char *str);
@@ -121,6 +129,8 @@ static int	out_page_object(imagetopdf_doc_t *doc, int pageObj,
 			      int contentsObj, int imgObj);
 static int	out_page_contents(imagetopdf_doc_t *doc, int contentsObj);
 static int	out_image(imagetopdf_doc_t *doc, int imgObj);
+static int	jpeg_check(imagetopdf_doc_t *doc, FILE *fp);
+static int	out_jpeg(imagetopdf_doc_t *doc, int imgObj);
 
 static void
 set_offset(imagetopdf_doc_t *doc,
@@ -491,6 +501,9 @@ out_image(imagetopdf_doc_t *doc,
   int lengthObj;
   int length;
 
+  if (doc->jpegfd >= 0)
+    return (out_jpeg(doc, imgObj));
+
   set_offset(doc, imgObj);
   if ((lengthObj = new_obj(doc)) < 0)
     return (-1);
@@ -502,6 +515,8 @@ out_image(imagetopdf_doc_t *doc,
 #else
 #ifdef OUT_AS_ASCII85
     "/Filter /ASCII85Decode "
+#else
+    "/Filter /FlateDecode "
 #endif
 #endif
     , imgObj, lengthObj);
@@ -510,6 +525,13 @@ out_image(imagetopdf_doc_t *doc,
     "/Width %d /Height %d /BitsPerComponent 8 ",
     doc->xc1 - doc->xc0 + 1, doc->yc1 - doc->yc0 + 1);
   out_pdf(doc, doc->linebuf);
+#if !defined(OUT_AS_HEX) && !defined(OUT_AS_ASCII85)
+  snprintf(doc->linebuf, LINEBUFSIZE,
+    "/DecodeParms << /Predictor 15 /Colors %d /BitsPerComponent 8 "
+    "/Columns %d >> ",
+    abs(doc->colorspace), doc->xc1 - doc->xc0 + 1);
+  out_pdf(doc, doc->linebuf);
+#endif
 
   switch (doc->colorspace)
   {
@@ -548,19 +570,35 @@ out_image(imagetopdf_doc_t *doc,
     if (out_offset > 0)
       memcpy(doc->row, doc->row + out_length - out_offset, out_offset);
   }
-#else
+#elif defined(OUT_AS_HEX)
   for (y = doc->yc0; y <= doc->yc1; y ++)
   {
     cfImageGetRow(doc->img, doc->xc0, y, doc->xc1 - doc->xc0 + 1, doc->row);
 
     out_length = (doc->xc1 - doc->xc0 + 1) * abs(doc->colorspace);
 
-#ifdef OUT_AS_HEX
     out_hex(doc, doc->row, out_length, y == doc->yc1);
+  }
 #else
-    out_bin(doc, doc->row, out_length, y == doc->yc1);
-#endif
+  // Compress row by row, the first row is predicted from a row of zeros
+  out_length = (doc->xc1 - doc->xc0 + 1) * abs(doc->colorspace);
+  memset(doc->prevrow, 0, out_length);
+  memset(&doc->zs, 0, sizeof(doc->zs));
+  if (deflateInit(&doc->zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+    return (-1);
+
+  for (y = doc->yc0; y <= doc->yc1; y ++)
+  {
+    cfImageGetRow(doc->img, doc->xc0, y, doc->xc1 - doc->xc0 + 1, doc->row);
+
+    if (out_flate(doc, doc->row, out_length, y == doc->yc1) < 0)
+    {
+      deflateEnd(&doc->zs);
+      return (-1);
+    }
   }
+
+  deflateEnd(&doc->zs);
 #endif
   length = doc->currentOffset - startOffset;
   out_pdf(doc, "\nendstream\nendobj\n");
@@ -574,6 +612,128 @@ out_image(imagetopdf_doc_t *doc,
 }
 
 
+//
+// 'out_jpeg()' - Embed the JPEG file as is as image object.
+//
+
+static int
+out_jpeg(imagetopdf_doc_t *doc,
+	 int imgObj)
+{
+  char		buf[65536];		// Copy buffer
+  ssize_t	bytes;			// Bytes read
+  off_t		pos;			// Position in JPEG file
+  int		startOffset;
+  int		lengthObj;
+  int		length;
+
+  set_offset(doc, imgObj);
+  if ((lengthObj = new_obj(doc)) < 0)
+    return (-1);
+  snprintf(doc->linebuf, LINEBUFSIZE,
+    "%d 0 obj << /Length %d 0 R /Type /XObject "
+    "/Subtype /Image /Name /Im /Filter /DCTDecode "
+    "/Width %d /Height %d /BitsPerComponent 8 /ColorSpace %s ",
+    imgObj, lengthObj, doc->jpegwidth, doc->jpegheight,
+    doc->jpegcomps == 1 ? "/DeviceGray" : "/DeviceRGB");
+  out_pdf(doc, doc->linebuf);
+  if ((doc->jpegwidth / doc->xprint) < 100.0)
+    out_pdf(doc, "/Interpolate true ");
+
+  out_pdf(doc, ">>\n");
+  out_pdf(doc, "stream\n");
+  startOffset = doc->currentOffset;
+
+  //
+  // Read with pread(), the image decoder may still use the file
+  // position...
+  //
+
+  for (pos = 0; (bytes = pread(doc->jpegfd, buf, sizeof(buf), pos)) > 0;
+       pos += bytes)
+  {
+    if (fwrite(buf, 1, bytes, doc->outputfp) != (size_t)bytes)
+      return (-1);
+    doc->currentOffset += bytes;
+  }
+
+  length = doc->currentOffset - startOffset;
+  out_pdf(doc, "\nendstream\nendobj\n");
+
+  // out length object
+  set_offset(doc, lengthObj);
+  snprintf(doc->linebuf, LINEBUFSIZE,
+    "%d 0 obj %d endobj\n", lengthObj, length);
+  out_pdf(doc, doc->linebuf);
+  return (0);
+}
+
+
+//
+// 'jpeg_check()' - See whether the input file is a JPEG file which can be
+//                  embedded as is.
+//
+// We take 8-bit baseline, extended and progressive Huffman-coded JPEG
+// files with 1 (gray) or 3 (YCbCr or RGB) components, which every PDF 1.3
+// consumer can decode.  On success doc->jpegfd is a duplicate of the
+// file descriptor of "fp".
+//
+
+static int				// O - 1 if embeddable, 0 otherwise
+jpeg_check(imagetopdf_doc_t *doc,	// I - Document information
+	   FILE             *fp)	// I - Input file
+{
+  unsigned char	buf[10];		// Marker segment header
+  off_t		pos;			// Position in file
+  int		fd = fileno(fp);	// File descriptor of input file
+
+
+  if (pread(fd, buf, 2, 0) != 2 || buf[0] != 0xff || buf[1] != 0xd8)
+    return (0);
+
+  pos = 2;
+
+  while (pread(fd, buf, 4, pos) == 4)
+  {
+    if (buf[0] != 0xff)
+      return (0);
+
+    if (buf[1] == 0xff)
+    {
+      pos ++;				// Fill byte
+      continue;
+    }
+
+    if (buf[1] == 0xc0 || buf[1] == 0xc1 || buf[1] == 0xc2)
+    {
+      // SOF0/1/2: length, precision, height, width, components
+      if (pread(fd, buf, 10, pos) != 10 || buf[4] != 8)
+	return (0);
+
+      doc->jpegheight = (buf[5] << 8) | buf[6];
+      doc->jpegwidth  = (buf[7] << 8) | buf[8];
+      doc->jpegcomps  = buf[9];
+
+      if (doc->jpegwidth == 0 || doc->jpegheight == 0 ||
+	  (doc->jpegcomps != 1 && doc->jpegcomps != 3) ||
+	  (doc->jpegfd = dup(fd)) < 0)
+	return (0);
+
+      return (1);
+    }
+
+    if ((buf[1] >= 0xc3 && buf[1] <= 0xcf && buf[1] != 0xc4 &&
+	 buf[1] != 0xc8 && buf[1] != 0xcc) || buf[1] == 0xda ||
+	buf[1] == 0xd9)
+      return (0);			// Lossless, arithmetic, or no SOF
+
+    pos += 2 + ((buf[2] << 8) | buf[3]);
+  }
+
+  return (0);
+}
+
+
 //
 // 'cfFilterImageToPDF()' - Filter function to convert many common image file
 //                          formats into PDF
@@ -656,6 +816,9 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
   doc.gammaval = 1.0;
   doc.brightness = 1.0;
   doc.row = NULL;
+  doc.prevrow = NULL;
+  doc.filtrow = NULL;
+  doc.jpegfd = -1;
 
   //
   // Open the input data stream specified by the inputfd ...
@@ -919,8 +1082,31 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
 
   doc.colorspace = doc.Color ? CF_IMAGE_RGB_CMYK : CF_IMAGE_WHITE;
 
-  doc.img = cfImageOpenFP(fp, doc.colorspace, CF_IMAGE_WHITE, sat, hue,
-			  NULL);
+  //
+  // A JPEG file which gets printed on a single page without color
+  // adjustments can be embedded as is, the PDF consumer decodes it
+  // (DCTDecode), we only need the image for the layout then...
+  //
+
+  if (sat == 100 && hue == 0 && jpeg_check(&doc, fp) && log)
+    log(ld, CF_LOGLEVEL_DEBUG,
+	"cfFilterImageToPDF: JPEG image %dx%d with %d components.",
+	doc.jpegwidth, doc.jpegheight, doc.jpegcomps);
+
+  //
+  // Every page takes its part of the image once from top to bottom, with
+  // one page no row gets read twice, so decode rows on demand.  An image
+  // fitted to the page does not need more pixels than the printer can
+  // put on the page, let the decoder scale it down if it can.  When the
+  // JPEG file gets embedded no row is read, the decoder stops after its
+  // first few rows and quits when the image gets closed...
+  //
+
+  doc.img = cfImageOpenFPScaled(fp, doc.colorspace, CF_IMAGE_WHITE, sat, hue,
+				NULL, data, 1,
+				_cfImageFittedSize(&h, doc.PageWidth,
+						   doc.PageLength, num_options,
+						   options));
   if (doc.img != NULL)
   {
     int margin_defined = 0;
@@ -1156,6 +1342,15 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
       if (doc.PageBottom < 0) doc.PageBottom = 0;
       if (doc.PageLeft < 0) doc.PageLeft = 0;
     }
+
+    if (doc.img && doc.jpegfd >= 0 &&
+	(cfImageGetWidth(doc.img) != (unsigned)w ||
+	 cfImageGetHeight(doc.img) != (unsigned)h))
+    {
+      // Cropped, we cannot embed the JPEG data as is
+      close(doc.jpegfd);
+      doc.jpegfd = -1;
+    }
   }
 
   if (!inputseekable)
@@ -1165,6 +1360,8 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
   {
     if (log) log(ld, CF_LOGLEVEL_ERROR,
 		 "cfFilterImageToPDF: Unable to open image file for printing!");
+    if (doc.jpegfd >= 0)
+      close(doc.jpegfd);
     fclose(doc.outputfp);
     close(outputfd);
     return (1);
@@ -1395,6 +1592,26 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
 	       "cfFilterImageToPDF: xpages = %dx%.2fin, ypages = %dx%.2fin",
 	       doc.xpages, doc.xprint, doc.ypages, doc.yprint);
 
+  //
+  // Embed the original JPEG data if every page shows the whole image in
+  // the colorspace of the JPEG file...
+  //
+
+  if (doc.jpegfd >= 0)
+  {
+    if (doc.xpages == 1 && doc.ypages == 1 &&
+	doc.colorspace == (doc.jpegcomps == 1 ? CF_IMAGE_WHITE : CF_IMAGE_RGB))
+    {
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "cfFilterImageToPDF: Embedding JPEG image as is.");
+    }
+    else
+    {
+      close(doc.jpegfd);
+      doc.jpegfd = -1;
+    }
+  }
+
   //
   // Update the page size for custom sizes...
   //
@@ -1589,6 +1806,10 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
   //
 
   doc.row = malloc(cfImageGetWidth(doc.img) * abs(doc.colorspace) + 3);
+  doc.prevrow = malloc(cfImageGetWidth(doc.img) * abs(doc.colorspace));
+  doc.filtrow = malloc(cfImageGetWidth(doc.img) * abs(doc.colorspace) + 1);
+  if (!doc.row || !doc.prevrow || !doc.filtrow)
+    goto out_of_memory;
 
   if (log)
   {
@@ -1893,7 +2114,11 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
   //
 
   cfImageClose(doc.img);
+  if (doc.jpegfd >= 0)
+    close(doc.jpegfd);
   free(doc.row);
+  free(doc.prevrow);
+  free(doc.filtrow);
   free(doc.pageObjects);
   fclose(doc.outputfp);
   close(outputfd);
@@ -1905,7 +2130,11 @@ cfFilterImageToPDF(int inputfd,         // I - File descriptor input stream
 	       "cfFilterImageToPDF: Cannot allocate any more memory.");
   free_all_obj(&doc);
   cfImageClose(doc.img);
+  if (doc.jpegfd >= 0)
+    close(doc.jpegfd);
   free(doc.row);
+  free(doc.prevrow);
+  free(doc.filtrow);
   free(doc.pageObjects);
   fclose(doc.outputfp);
   close(outputfd);
@@ -2040,26 +2269,111 @@ out_ascii85(imagetopdf_doc_t *doc,
 
 
 //
-// 'out_bin()' - Print binary data as binary.
+// 'out_flate()' - Print a row of binary data Flate-compressed, with the PNG
+//                 predictor which suits the row best.
+//
+// The predictor is chosen with the usual heuristic of libpng, the smallest
+// sum of the filtered bytes taken as signed values.
 //
 
-static void
-out_bin(imagetopdf_doc_t *doc,
-	cf_ib_t   *data,		// I - Data to print
-	int       length,		// I - Number of bytes to print
-	int       last_line)		// I - Last line of raster data?
+static int				// O - 0 on success, -1 on error
+out_flate(imagetopdf_doc_t *doc,
+	  cf_ib_t   *data,		// I - Data to print
+	  int       length,		// I - Number of bytes to print
+	  int       last_line)		// I - Last line of raster data?
 {
-  while (length > 0)
+  int		bpp = abs(doc->colorspace);
+					// Bytes per pixel
+  cf_ib_t	*prev = doc->prevrow;	// Previous row
+  unsigned char	*out = doc->filtrow;	// Filtered row
+  unsigned char	zbuf[16384];		// Compressed data
+  unsigned long	sums[5] = { 0, 0, 0, 0, 0 };
+					// Sums of filtered bytes
+  int		i,			// Looping var
+		best,			// Best predictor
+		a, b, c,		// Left, upper, and upper left bytes
+		p, pa, pb, pc;		// Paeth predictor values
+  size_t	bytes;			// Bytes to write
+
+
+  for (i = 0; i < length; i ++)
   {
-    putc_pdf(doc, *data);
-    data ++;
-    length --;
+    a = i >= bpp ? data[i - bpp] : 0;
+    b = prev[i];
+    c = i >= bpp ? prev[i - bpp] : 0;
+
+    p  = a + b - c;
+    pa = abs(p - a);
+    pb = abs(p - b);
+    pc = abs(p - c);
+    p  = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+    sums[0] += abs((signed char)data[i]);
+    sums[1] += abs((signed char)(data[i] - a));
+    sums[2] += abs((signed char)(data[i] - b));
+    sums[3] += abs((signed char)(data[i] - ((a + b) >> 1)));
+    sums[4] += abs((signed char)(data[i] - p));
   }
 
-  if (last_line)
+  for (best = 0, i = 1; i < 5; i ++)
+    if (sums[i] < sums[best])
+      best = i;
+
+  out[0] = best;
+
+  for (i = 0; i < length; i ++)
   {
-    putc_pdf(doc, '\n');
+    a = i >= bpp ? data[i - bpp] : 0;
+    b = prev[i];
+    c = i >= bpp ? prev[i - bpp] : 0;
+
+    switch (best)
+    {
+      case 0 :				// None
+          out[i + 1] = data[i];
+	  break;
+      case 1 :				// Sub
+          out[i + 1] = data[i] - a;
+	  break;
+      case 2 :				// Up
+          out[i + 1] = data[i] - b;
+	  break;
+      case 3 :				// Average
+          out[i + 1] = data[i] - ((a + b) >> 1);
+	  break;
+      default :				// Paeth
+	  p  = a + b - c;
+	  pa = abs(p - a);
+	  pb = abs(p - b);
+	  pc = abs(p - c);
+	  out[i + 1] = data[i] - ((pa <= pb && pa <= pc) ? a :
+				  (pb <= pc) ? b : c);
+	  break;
+    }
+  }
+
+  memcpy(prev, data, length);
+
+  doc->zs.next_in  = out;
+  doc->zs.avail_in = length + 1;
+
+  do
+  {
+    doc->zs.next_out  = zbuf;
+    doc->zs.avail_out = sizeof(zbuf);
+
+    if (deflate(&doc->zs, last_line ? Z_FINISH : Z_NO_FLUSH) ==
+	Z_STREAM_ERROR)
+      return (-1);
+
+    bytes = sizeof(zbuf) - doc->zs.avail_out;
+    if (bytes > 0 && fwrite(zbuf, 1, bytes, doc->outputfp) != bytes)
+      return (-1);
+    doc->currentOffset += bytes;
   }
+  while (doc->zs.avail_out == 0);
+
+  return (0);
 }
 #endif
 #endif
@@ -10,9 +10,24 @@
 // Contents:
 //
 //   cfFilterImageToRaster() - The image conversion filter function
+//   _cfImageRasterFormat() - Format a row of raster data for testing.
+//   _cfImageRasterKernel() - Select the row kernels.
 //   blank_line()    - Clear a line buffer to the blank value...
+//   cache_finish()  - Finish recording a page in the raster cache.
+//   cache_free()    - Remove the raster cache.
+//   cache_replay()  - Write a page from the raster cache.
+//   cache_start()   - Start recording a page in the raster cache.
+//   chunky8_c()     - Interpolate 8-bit raster data.
+//   chunky8_neon()  - Interpolate 8-bit raster data using NEON.
+//   chunky8_sse2()  - Interpolate 8-bit raster data using SSE2.
+//   dither1_c()     - Dither a color plane to 1 bit.
+//   dither1_neon()  - Dither a color plane to 1 bit using NEON.
+//   dither1_ssse3() - Dither a color plane to 1 bit using SSSE3.
+//   find_format()   - Find the row kernel for a page.
+//   format_chunky() - Convert image data to chunky 8-bit colors.
 //   format_cmy()    - Convert image data to CMY.
 //   format_cmyk()   - Convert image data to CMYK.
+//   format_dither1() - Convert image data to a 1-bit gray or color plane.
 //   format_k()      - Convert image data to black.
 //   format_kcmy()   - Convert image data to KCMY.
 //   format_kcmycm() - Convert image data to KCMYcm.
@@ -20,8 +35,14 @@
 //   format_w()      - Convert image data to luminance.
 //   format_ymc()    - Convert image data to YMC.
 //   format_ymck()   - Convert image data to YMCK.
+//   kernel_init()   - Pick the fastest row kernels the CPU supports.
 //   make_lut()      - Make a lookup table given gamma and brightness values.
+//   make_pixels()   - Make the on/off-pixel lookup tables.
 //   raster_cb()     - Validate the page header.
+//   render_image()  - Render and write the image data of a page.
+//   render_rows()   - Render rows of the image data of a page.
+//   render_thread() - Render bands of a page.
+//   write_pixels()  - Write raster data, recording it in the raster cache.
 //
 
 //
@@ -38,6 +59,14 @@
 #include <math.h>
 #include <signal.h>
 #include <string.h>
+#include <zlib.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define FORMAT_X86 1
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  define FORMAT_NEON 1
+#  include <arm_neon.h>
+#endif // __GNUC__ && __x86_64__
 
 
 //
@@ -62,17 +91,98 @@ typedef struct                  // **** Document information ****¨
         PageLength;     	// Total page length
   cf_ib_t OnPixels[256],	// On-pixel LUT
 	    OffPixels[256];	// Off-pixel LUT
+  int	Format;			// Row kernel for the pages in "formats"
   cf_logfunc_t logfunc;         // Logging function, NULL for no
 				// logging
   void  *logdata;               // User data for logging function, can
 				// be NULL
 } imagetoraster_doc_t;
 
+typedef struct				// **** Band rendering state ****
+{
+  imagetoraster_doc_t	*doc;		// Document information
+  cups_page_header_t	*header;	// Page header
+  int			plane,		// Current color plane
+			num_bands,	// Number of bands on the page
+			num_slots,	// Number of band buffers
+			next,		// Next band to render
+			written,	// Number of bands written
+			abort;		// Non-zero to stop rendering
+  int			*done;		// Band in each buffer, -1 for none
+  unsigned char		*buffer;	// Band buffers
+  size_t		slot_size;	// Bytes per band buffer
+  pthread_mutex_t	lock;		// Lock for the band state
+  pthread_cond_t	cond;		// Signalled when a band is rendered
+					// or written
+} imagetoraster_bands_t;
+
+typedef struct				// **** Band rendering thread ****
+{
+  imagetoraster_bands_t	*bands;		// Band rendering state
+  cf_izoom_t		*z;		// Zoom record of the thread
+  pthread_t		thread;		// Thread
+} imagetoraster_worker_t;
+
+typedef struct				// **** Raster cache for copies ****
+{
+  int			fd;		// Cache file, -1 if not created
+  char			filename[1024];	// Cache filename
+  z_stream		zs;		// Compressor of the recorded page
+  int			recording,	// Non-zero while recording a page
+			failed,		// Non-zero if the cache is unusable
+			num_pages;	// Number of recorded pages
+  off_t			*pages;		// Offsets of the pages in the file,
+					// and of the end of the last page
+  size_t		skip;		// Bytes of the page already written
+					// from the cache before it failed
+} imagetoraster_cache_t;
+
+typedef void (*imagetoraster_format_func_t)(imagetoraster_doc_t *doc,
+					    cups_page_header_t *header,
+					    unsigned char *row, int y, int z,
+					    int xsize, int ysize, int yerr0,
+					    int yerr1, cf_ib_t *r0,
+					    cf_ib_t *r1);
+					// Row format kernel
+
+typedef struct				// **** Row kernel of a page format ****
+{
+  int			cspace,		// Color space, -1 for any
+			order,		// Color order, -1 for any
+			bits;		// Bits per color, 0 for any
+  imagetoraster_format_func_t format;	// Row kernel
+  int			stride;		// Bytes per pixel of the image data
+  signed char		planes[4];	// Image channel of each plane, 3 for
+					// black from all three, -1 for none
+} imagetoraster_format_t;
+
+typedef void (*imagetoraster_chunky8_t)(cf_ib_t *out, const cf_ib_t *r0,
+					const cf_ib_t *r1, int count,
+					int yerr0, int yerr1, int ysize);
+					// 8-bit interpolation kernel
+typedef void (*imagetoraster_dither1_t)(cf_ib_t *out, const cf_ib_t *in,
+					const cf_ib_t *dither, int count,
+					int stride, int channel);
+					// 1-bit dither kernel
+
+typedef struct				// **** SIMD row kernels ****
+{
+  const char		*name;		// Name of kernels
+  imagetoraster_chunky8_t chunky8;	// 8-bit interpolation kernel
+  imagetoraster_dither1_t dither1;	// 1-bit dither kernel
+} imagetoraster_kernel_t;
+
 
 //
 // Constants...
 //
 
+#define BAND_ROWS	32		// Rows of raster data per band
+#define FORMAT_MAX_SIZE	65535		// Tallest image for the SIMD 8-bit
+					// kernels, they divide in single
+					// precision, which is exact up to this
+					// height
+
 int	Floyd16x16[16][16] =		// Traditional Floyd ordered dither
 	{
 	  { 0,   128, 32,  160, 8,   136, 40,  168,
@@ -133,6 +243,37 @@ int	Floyd4x4[4][4] =
 //
 
 static void	blank_line(cups_page_header_t *header, unsigned char *row);
+static void	cache_finish(imagetoraster_cache_t *cache);
+static void	cache_free(imagetoraster_cache_t *cache);
+static int	cache_replay(imagetoraster_cache_t *cache, int page,
+			     cf_raster_t *ras);
+static void	cache_start(imagetoraster_cache_t *cache, int bits);
+static void	chunky8_c(cf_ib_t *out, const cf_ib_t *r0, const cf_ib_t *r1,
+			  int count, int yerr0, int yerr1, int ysize);
+static void	dither1_c(cf_ib_t *out, const cf_ib_t *in,
+			  const cf_ib_t *dither, int count, int stride,
+			  int channel);
+#ifdef FORMAT_X86
+static void	chunky8_sse2(cf_ib_t *out, const cf_ib_t *r0,
+			     const cf_ib_t *r1, int count, int yerr0,
+			     int yerr1, int ysize);
+static void	dither1_ssse3(cf_ib_t *out, const cf_ib_t *in,
+			      const cf_ib_t *dither, int count, int stride,
+			      int channel);
+#endif // FORMAT_X86
+#ifdef FORMAT_NEON
+static void	chunky8_neon(cf_ib_t *out, const cf_ib_t *r0,
+			     const cf_ib_t *r1, int count, int yerr0,
+			     int yerr1, int ysize);
+static void	dither1_neon(cf_ib_t *out, const cf_ib_t *in,
+			     const cf_ib_t *dither, int count, int stride,
+			     int channel);
+#endif // FORMAT_NEON
+static int	find_format(cups_page_header_t *header, int first);
+static void	format_chunky(imagetoraster_doc_t *doc,
+			      cups_page_header_t *header, unsigned char *row,
+			      int y, int z, int xsize, int ysize, int yerr0,
+			      int yerr1, cf_ib_t *r0, cf_ib_t *r1);
 static void	format_cmy(imagetoraster_doc_t *doc,
 			   cups_page_header_t *header, unsigned char *row,
 			   int y, int z, int xsize, int ysize, int yerr0,
@@ -141,6 +282,11 @@ static void	format_cmyk(imagetoraster_doc_t *doc,
 			    cups_page_header_t *header, unsigned char *row,
 			    int y, int z, int xsize, int ysize, int yerr0,
 			    int yerr1, cf_ib_t *r0, cf_ib_t *r1);
+static void	format_dither1(imagetoraster_doc_t *doc,
+			       cups_page_header_t *header,
+			       unsigned char *row, int y, int z, int xsize,
+			       int ysize, int yerr0, int yerr1, cf_ib_t *r0,
+			       cf_ib_t *r1);
 static void	format_K(imagetoraster_doc_t *doc,
 			 cups_page_header_t *header, unsigned char *row,
 			 int y, int z, int xsize, int ysize, int yerr0,
@@ -170,7 +316,115 @@ static void	format_ymck(imagetoraster_doc_t *doc,
 			    cups_page_header_t *header, unsigned char *row,
 			    int y, int z, int xsize, int ysize, int yerr0,
 			    int yerr1, cf_ib_t *r0, cf_ib_t *r1);
+static void	kernel_init(void);
 static void	make_lut(cf_ib_t *, int, float, float);
+static void	make_pixels(imagetoraster_doc_t *doc, int bits);
+static int	render_image(imagetoraster_doc_t *doc,
+			     cups_page_header_t *header, cf_raster_t *ras,
+			     imagetoraster_cache_t *cache,
+			     cf_izoom_t **zooms, int num_zooms, int plane,
+			     unsigned char *row,
+			     cf_filter_iscanceledfunc_t iscanceled,
+			     void *icd);
+static void	render_rows(imagetoraster_doc_t *doc,
+			    cups_page_header_t *header, cf_izoom_t *z,
+			    int plane, int first, int count, int *last_iy,
+			    unsigned char *rows);
+static void	*render_thread(void *arg);
+static unsigned	write_pixels(cf_raster_t *ras, imagetoraster_cache_t *cache,
+			     unsigned char *pixels, unsigned len);
+
+
+//
+// Local globals...
+//
+
+static const imagetoraster_format_t formats[] =
+{					// Row kernels by color space, order
+					// and bits, the first match is used
+  { CUPS_CSPACE_W,        -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_SW,       -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_K,        -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_WHITE,    -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_GOLD,     -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_SILVER,   -1, 1, format_dither1, 1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_W,        -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_SW,       -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_K,        -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_WHITE,    -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_GOLD,     -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_SILVER,   -1, 8, format_chunky,  1, { 0, -1, -1, -1 } },
+  { CUPS_CSPACE_RGB,      CUPS_ORDER_CHUNKED, 8, format_chunky, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_SRGB,     CUPS_ORDER_CHUNKED, 8, format_chunky, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_ADOBERGB, CUPS_ORDER_CHUNKED, 8, format_chunky, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_CMY,      CUPS_ORDER_CHUNKED, 8, format_chunky, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_CMYK,     CUPS_ORDER_CHUNKED, 8, format_chunky, 4,
+    { 0, 1, 2, 3 } },
+  { CUPS_CSPACE_RGB,      CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_SRGB,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_ADOBERGB, CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_CMY,      CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_YMC,      CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 2, 1, 0, -1 } },
+  { CUPS_CSPACE_RGBA,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_RGBW,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, -1 } },
+  { CUPS_CSPACE_CMYK,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 0, 1, 2, 3 } },
+  { CUPS_CSPACE_KCMY,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 3, 0, 1, 2 } },
+  { CUPS_CSPACE_YMCK,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 2, 1, 0, 3 } },
+  { CUPS_CSPACE_GMCK,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 2, 1, 0, 3 } },
+  { CUPS_CSPACE_GMCS,     CUPS_ORDER_PLANAR, 1, format_dither1, 3,
+    { 2, 1, 0, 3 } },
+  { CUPS_CSPACE_W,        -1, 0, format_w,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_SW,       -1, 0, format_w,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_RGB,      -1, 0, format_RGB,     0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_SRGB,     -1, 0, format_RGB,     0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_ADOBERGB, -1, 0, format_RGB,     0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_RGBA,     -1, 0, format_rgba,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_RGBW,     -1, 0, format_rgba,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_K,        -1, 0, format_K,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_WHITE,    -1, 0, format_K,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_GOLD,     -1, 0, format_K,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_SILVER,   -1, 0, format_K,       0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_CMY,      -1, 0, format_cmy,     0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_YMC,      -1, 0, format_ymc,     0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_CMYK,     -1, 0, format_cmyk,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_YMCK,     -1, 0, format_ymck,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_GMCK,     -1, 0, format_ymck,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_GMCS,     -1, 0, format_ymck,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_KCMYcm,   -1, 1, format_kcmycm,  0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_KCMYcm,   -1, 0, format_kcmy,    0, { -1, -1, -1, -1 } },
+  { CUPS_CSPACE_KCMY,     -1, 0, format_kcmy,    0, { -1, -1, -1, -1 } },
+  { -1,                   -1, 0, format_RGB,     0, { -1, -1, -1, -1 } }
+};
+static const imagetoraster_kernel_t kernels[] =
+{					// SIMD row kernels, fastest first
+#ifdef FORMAT_X86
+  { "ssse3", chunky8_sse2, dither1_ssse3 },
+  { "sse2",  chunky8_sse2, dither1_c },
+#endif // FORMAT_X86
+#ifdef FORMAT_NEON
+  { "neon",  chunky8_neon, dither1_neon },
+#endif // FORMAT_NEON
+  { "c",     chunky8_c,    dither1_c }
+};
+static const imagetoraster_kernel_t *kernel = kernels;
+					// Kernels in use
+static pthread_once_t	kernel_once = PTHREAD_ONCE_INIT;
+					// Kernel selection
 
 
 //
@@ -210,7 +464,9 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   int			xc0, yc0,	// Corners of the page in image coords
 			xc1, yc1;
   cups_cspace_t         cspace = -1;    // CUPS color space
-  cups_raster_t		*ras;		// Raster stream
+  cf_raster_t		*ras;		// Raster stream
+  imagetoraster_cache_t	cache;		// Pages of the first copy
+  int			replay;		// Status of replaying a page
   cups_page_header_t	header;		// Page header
   int			num_options = 0;// Number of print options
   cups_option_t		*options = NULL;// Print options
@@ -221,19 +477,21 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   float			b;		// Brightness factor
   float			zoom;		// Zoom facter
   int			xppi, yppi;	// Pixels-per-inch
+  unsigned		min_size;	// Pixels needed along image edges
   int			hue, sat;	// Hue and saturation adjustment
-  cf_izoom_t		*z;		// Image zoom buffer
+  cf_izoom_t		*z,		// Image zoom buffer
+			*zooms[CF_IMAGE_MAX_THREADS];
+					// Zoom buffers of rendering threads
+  int			num_zooms,	// Number of zoom buffers
+			threads,	// Number of rendering threads
+			zxsize,		// Width of zoomed image
+			zysize,		// Height of zoomed image
+			status;		// Status of rendering
   cf_iztype_t		zoom_type;	// Image zoom type
   int			primary,	// Primary image colorspace
 			secondary;	// Secondary image colorspace
-  cf_ib_t		*row,		// Current row
-			*r0,		// Top row
-			*r1;		// Bottom row
-  int			y,		// Current Y coordinate on page
-			iy,		// Current Y coordinate in image
-			last_iy,	// Previous Y coordinate in image
-			yerr0,		// Top Y error value
-			yerr1;		// Bottom Y error value
+  cf_ib_t		*row;		// Current row
+  int			y;		// Current Y coordinate on page
   cf_ib_t		lut[256];	// Gamma/brightness LUT
   int			plane,		// Current color plane
 			num_planes;	// Number of color planes
@@ -760,12 +1018,36 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   if (log) log(ld, CF_LOGLEVEL_INFO,
 	       "cfFilterImageToRaster: Loading print file.");
 
+  //
+  // A single copy reads the image once from top to bottom unless it gets
+  // rotated or spread over several pages, decode it on demand then, the
+  // image library falls back to decoding it completely when needed.
+  // Rendering the page in bands on several threads reads the image out of
+  // order though, and the decoder only keeps a few rows ahead of a single
+  // reader, so the image is only decoded on demand with "image-threads=1"
+  // or on a single CPU; more threads buy their speed with the memory of
+  // the whole image.
+  // An image which gets fitted to the page never needs more pixels than
+  // the page has, let the decoder scale it down if it can...
+  //
+
+  threads  = _cfImageGetThreads(data);
+  min_size = _cfImageFittedSize(&header, doc.PageWidth, doc.PageLength,
+				num_options, options);
+
+  if (log && min_size)
+    log(ld, CF_LOGLEVEL_DEBUG,
+	"cfFilterImageToRaster: Image needs %u pixels per edge at most.",
+	min_size);
+
   if (header.cupsColorSpace == CUPS_CSPACE_CIEXYZ ||
       header.cupsColorSpace == CUPS_CSPACE_CIELab ||
       header.cupsColorSpace >= CUPS_CSPACE_ICC1)
-    img = cfImageOpenFP(fp, primary, secondary, sat, hue, NULL);
+    img = cfImageOpenFPScaled(fp, primary, secondary, sat, hue, NULL, data,
+			      doc.Copies == 1 && threads < 2, min_size);
   else
-    img = cfImageOpenFP(fp, primary, secondary, sat, hue, lut);
+    img = cfImageOpenFPScaled(fp, primary, secondary, sat, hue, lut, data,
+			      doc.Copies == 1 && threads < 2, min_size);
 
   if (img != NULL)
   {
@@ -1541,10 +1823,27 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   else
     num_planes = 1;
 
-  if (header.cupsBitsPerColor >= 8)
-    zoom_type = CF_IZOOM_NORMAL;
-  else
+  //
+  // Scale with a bicubic/Lanczos filter for print-quality=high, which
+  // costs more than bilinear interpolation, and sample the nearest pixel
+  // when the output gets dithered down to less than 8 bits anyway.  Only
+  // PWG and Apple Raster define cupsInteger[8] as the print quality, in
+  // CUPS Raster it belongs to the driver, so check the job options too...
+  //
+
+  if ((val = cupsGetOption("print-quality", num_options, options)) == NULL &&
+      (val = cupsGetOption("PrintQuality", num_options, options)) == NULL)
+    val = cupsGetOption("Quality", num_options, options);
+
+  if (header.cupsBitsPerColor < 8)
     zoom_type = CF_IZOOM_FAST;
+  else if (((outformat == CF_FILTER_OUT_FORMAT_PWG_RASTER ||
+	     outformat == CF_FILTER_OUT_FORMAT_APPLE_RASTER) &&
+	    header.cupsInteger[8] == IPP_QUALITY_HIGH) ||
+	   (val && (atoi(val) == IPP_QUALITY_HIGH || !strcasecmp(val, "high"))))
+    zoom_type = CF_IZOOM_BEST;
+  else
+    zoom_type = CF_IZOOM_NORMAL;
 
   //
   // See if we need to collate, and if so how we need to do it...
@@ -1582,28 +1881,14 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   // Create the dithering lookup tables...
   //
 
-  doc.OnPixels[0]    = 0x00;
-  doc.OnPixels[255]  = 0xff;
-  doc.OffPixels[0]   = 0x00;
-  doc.OffPixels[255] = 0xff;
+  make_pixels(&doc, header.cupsBitsPerColor);
 
-  switch (header.cupsBitsPerColor)
-  {
-    case 2 :
-        for (i = 1; i < 255; i ++)
-        {
-          doc.OnPixels[i]  = 0x55 * (i / 85 + 1);
-          doc.OffPixels[i] = 0x55 * (i / 64);
-        }
-        break;
-    case 4 :
-        for (i = 1; i < 255; i ++)
-        {
-          doc.OnPixels[i]  = 17 * (i / 17 + 1);
-          doc.OffPixels[i] = 17 * (i / 16);
-        }
-        break;
-  }
+  //
+  // Pick the row kernel for the page format once, instead of going through
+  // the color space, order and bits for every row...
+  //
+
+  doc.Format = find_format(&header, 0);
 
   //
   // Output the pages...
@@ -1627,10 +1912,23 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 	"cfFilterImageToRaster: cupsColorSpace = %d", header.cupsColorSpace);
     log(ld, CF_LOGLEVEL_DEBUG,
 	"cfFilterImageToRaster: img->colorspace = %d", img->colorspace);
+    log(ld, CF_LOGLEVEL_DEBUG,
+	"cfFilterImageToRaster: Row kernel %d, using %s kernels.",
+	doc.Format, kernel->name);
   }
 
   row = malloc(2 * header.cupsBytesPerLine);
-  ras = cupsRasterOpen(outputfd, CUPS_RASTER_WRITE);
+  ras = cfRasterOpen(outputfd, CUPS_RASTER_WRITE);
+
+  //
+  // All copies of a page are the same, so the pages of the first copy get
+  // recorded compressed in a cache file and are only written again for
+  // the other copies...
+  //
+
+  memset(&cache, 0, sizeof(cache));
+  cache.fd     = -1;
+  cache.failed = doc.Copies < 2;
 
   for (i = 0, page = 1; i < doc.Copies; i ++)
     for (xpage = 0; xpage < xpages; xpage ++)
@@ -1643,8 +1941,44 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 	  goto canceled;
 	}
 
-	if (log) log(ld, CF_LOGLEVEL_INFO,
-		     "cfFilterImageToRaster: Formatting page %d.", page);
+	if (i > 0 && !cache.failed && cache.num_pages == xpages * ypages)
+	{
+	  if (log) log(ld, CF_LOGLEVEL_INFO,
+		       "cfFilterImageToRaster: Copying page %d from page %d.",
+		       page, xpage * ypages + ypage + 1);
+
+	  cfRasterWriteHeader(ras, &header);
+
+	  if ((replay = cache_replay(&cache, xpage * ypages + ypage,
+				     ras)) < 0)
+	  {
+	    if (log) log(ld, CF_LOGLEVEL_ERROR,
+			 "cfFilterImageToRaster: Unable to send raster data.");
+	    cache_free(&cache);
+	    cfImageClose(img);
+	    return (1);
+	  }
+	  else if (replay == 0)
+	    continue;
+
+	  //
+	  // The cache could not be read, format the rest of the page and
+	  // all further pages again...
+	  //
+
+	  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		       "cfFilterImageToRaster: Unable to read page %d from the "
+		       "raster cache, formatting it again.", page);
+
+	  cache_free(&cache);
+	}
+	else
+	{
+	  if (log) log(ld, CF_LOGLEVEL_INFO,
+		       "cfFilterImageToRaster: Formatting page %d.", page);
+
+	  cfRasterWriteHeader(ras, &header);
+	}
 
 	if (doc.Orientation & 1)
 	{
@@ -1667,7 +2001,8 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 	  ytemp = header.HWResolution[1] * yprint;
 	}
 
-        cupsRasterWriteHeader(ras, &header);
+	if (i == 0)
+	  cache_start(&cache, header.cupsBitsPerColor);
 
         for (plane = 0; plane < num_planes; plane ++)
 	{
@@ -1675,10 +2010,10 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 	  // Initialize the image "zoom" engine...
 	  //
 
-	  z = _cfImageZoomNew(img, xc0, yc0, xc1, yc1,
-			      (doc.Flip ? -1 : 1) *
-			      (doc.Orientation > 1 ? -1 : 1) * xtemp,
-			      (doc.Orientation > 1 ? -1 : 1) * ytemp,
+	  zxsize = (doc.Flip ? -1 : 1) * (doc.Orientation > 1 ? -1 : 1) * xtemp;
+	  zysize = (doc.Orientation > 1 ? -1 : 1) * ytemp;
+
+	  z = _cfImageZoomNew(img, xc0, yc0, xc1, yc1, zxsize, zysize,
 			      doc.Orientation & 1, zoom_type);
 	  if (z == NULL) continue;
 
@@ -1700,129 +2035,63 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 
 	    for (; y > 0; y --)
 	    {
-	      if (cupsRasterWritePixels(ras, row, header.cupsBytesPerLine) <
+	      if (write_pixels(ras, &cache, row, header.cupsBytesPerLine) <
 	              header.cupsBytesPerLine)
 	      {
 		if (log)
 		  log(ld, CF_LOGLEVEL_ERROR, "cfFilterImageToRaster: Unable to send raster data.");
 		_cfImageZoomDelete(z);
 		cfImageClose(img);
+		cache_free(&cache);
 		return (1);
 	      }
             }
 	  }
 
 	  //
-	  // Then write image data...
+	  // Then write image data, in bands rendered by several threads for
+	  // pages with more than one band, each thread zooming the image on
+	  // its own...
 	  //
 
-	  for (y = z->ysize, yerr0 = 0, yerr1 = z->ysize, iy = 0, last_iy = -2;
-               y > 0;
-               y --)
-	  {
-	    if (iy != last_iy)
-	    {
-	      if (zoom_type != CF_IZOOM_FAST && (iy - last_iy) > 1)
-        	_cfImageZoomFill(z, iy);
-
-              _cfImageZoomFill(z, iy + z->yincr);
+	  zooms[0] = z;
 
-              last_iy = iy;
-	    }
+	  for (num_zooms = 1;
+	       num_zooms < threads &&
+		   num_zooms * BAND_ROWS < (int)z->ysize;
+	       num_zooms ++)
+	    if ((zooms[num_zooms] = _cfImageZoomNew(img, xc0, yc0, xc1, yc1,
+						    zxsize, zysize,
+						    doc.Orientation & 1,
+						    z->type)) == NULL)
+	      break;
 
-	    //
-	    // Format this line of raster data for the printer...
-	    //
+	  if (log && num_zooms > 1)
+	    log(ld, CF_LOGLEVEL_DEBUG,
+		"cfFilterImageToRaster: Rendering with %d threads.",
+		num_zooms);
 
-    	    blank_line(&header, row);
+	  status = render_image(&doc, &header, ras, &cache, zooms, num_zooms,
+				plane, row, iscanceled, icd);
 
-            r0 = z->rows[z->row];
-            r1 = z->rows[1 - z->row];
+	  while (num_zooms > 1)
+	    _cfImageZoomDelete(zooms[-- num_zooms]);
 
-            switch (header.cupsColorSpace)
-	    {
-	      case CUPS_CSPACE_W :
-	      case CUPS_CSPACE_SW :
-		  format_w(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		           yerr0, yerr1, r0, r1);
-		  break;
-              default :
-	      case CUPS_CSPACE_RGB :
-	      case CUPS_CSPACE_SRGB :
-	      case CUPS_CSPACE_ADOBERGB :
-	          format_RGB(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_RGBA :
-	      case CUPS_CSPACE_RGBW :
-	          format_rgba(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_K :
-	      case CUPS_CSPACE_WHITE :
-	      case CUPS_CSPACE_GOLD :
-	      case CUPS_CSPACE_SILVER :
-	          format_K(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		           yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_CMY :
-	          format_cmy(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_YMC :
-	          format_ymc(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		             yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_CMYK :
-	          format_cmyk(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_YMCK :
-	      case CUPS_CSPACE_GMCK :
-	      case CUPS_CSPACE_GMCS :
-	          format_ymck(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	      case CUPS_CSPACE_KCMYcm :
-	          if (header.cupsBitsPerColor == 1)
-		  {
-	            format_kcmycm(&doc, &header, row, y, plane, z->xsize,
-				  z->ysize, yerr0, yerr1, r0, r1);
-		    break;
-		  }
-	      case CUPS_CSPACE_KCMY :
-	          format_kcmy(&doc, &header, row, y, plane, z->xsize, z->ysize,
-		              yerr0, yerr1, r0, r1);
-		  break;
-	    }
-
-	    //
-	    // Write the raster data ...
-	    //
-
-	    if (cupsRasterWritePixels(ras, row, header.cupsBytesPerLine) <
-	                              header.cupsBytesPerLine)
-	    {
-	      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-			   "cfFilterImageToRaster: Unable to send raster data.");
-	      cfImageClose(img);
-	      _cfImageZoomDelete(z);
-	      return (1);
-	    }
-
-	    //
-	    // Compute the next scanline in the image...
-	    //
-
-	    iy    += z->ystep;
-	    yerr0 += z->ymod;
-	    yerr1 -= z->ymod;
-	    if (yerr1 <= 0)
-	    {
-              yerr0 -= z->ysize;
-              yerr1 += z->ysize;
-              iy    += z->yincr;
-	    }
+	  if (status < 0)
+	  {
+	    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+			 "cfFilterImageToRaster: Job canceled");
+	    _cfImageZoomDelete(z);
+	    goto canceled;
+	  }
+	  else if (status > 0)
+	  {
+	    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+			 "cfFilterImageToRaster: Unable to send raster data.");
+	    cfImageClose(img);
+	    _cfImageZoomDelete(z);
+	    cache_free(&cache);
+	    return (1);
 	  }
 
 	  //
@@ -1843,13 +2112,14 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 
 	    for (; y > 0; y --)
 	    {
-	      if (cupsRasterWritePixels(ras, row, header.cupsBytesPerLine) <
+	      if (write_pixels(ras, &cache, row, header.cupsBytesPerLine) <
 	              header.cupsBytesPerLine)
 	      {
 		if (log) log(ld, CF_LOGLEVEL_ERROR,
 			     "cfFilterImageToRaster: Unable to send raster data.");
 		cfImageClose(img);
 		_cfImageZoomDelete(z);
+		cache_free(&cache);
 		return (1);
 	      }
             }
@@ -1861,6 +2131,8 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 
           _cfImageZoomDelete(z);
         }
+
+	cache_finish(&cache);
       }
 
   //
@@ -1868,8 +2140,9 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
   //
 
  canceled:
+  cache_free(&cache);
   free(row);
-  cupsRasterClose(ras);
+  cfRasterClose(ras);
   cfImageClose(img);
   close(outputfd);
 
@@ -1877,6 +2150,98 @@ cfFilterImageToRaster(int inputfd,         // I - File descriptor input stream
 }
 
 
+//
+// '_cfImageRasterFormat()' - Format a row of raster data for testing.
+//
+// Formats a blank row with the row kernel cfFilterImageToRaster() picks
+// for the page, or with the generic format_*() function of the color space
+// if "generic" is set, skipping the table entries for format_chunky() and
+// format_dither1().  Without "row" only the row kernel is looked up, and
+// a NULL "header" returns the number of row kernels in the table.
+//
+
+int					// O - Index of the row kernel
+_cfImageRasterFormat(
+    cups_page_header_t *header,		// I - Page header
+    int                generic,		// I - Use the generic function?
+    int                xposition,	// I - Horizontal position on page
+    int                y,		// I - Current row
+    int                z,		// I - Current plane
+    int                xsize,		// I - Width of image data
+    int                ysize,		// I - Height of image data
+    int                yerr0,		// I - Top Y error
+    int                yerr1,		// I - Bottom Y error
+    cf_ib_t            *r0,		// I - Primary image data
+    cf_ib_t            *r1,		// I - Image data for interpolation
+    unsigned char      *row)		// O - Raster data
+{
+  imagetoraster_doc_t	doc;		// Document information
+
+
+  if (!header)
+    return ((int)(sizeof(formats) / sizeof(formats[0])));
+
+  memset(&doc, 0, sizeof(doc));
+  doc.XPosition = xposition;
+
+  doc.Format    = find_format(header, 0);
+
+  while (generic && (formats[doc.Format].format == format_chunky ||
+		     formats[doc.Format].format == format_dither1))
+    doc.Format = find_format(header, doc.Format + 1);
+
+  if (row)
+  {
+    make_pixels(&doc, header->cupsBitsPerColor);
+    blank_line(header, row);
+
+    (formats[doc.Format].format)(&doc, header, row, y, z, xsize, ysize,
+				 yerr0, yerr1, r0, r1);
+  }
+
+  return (doc.Format);
+}
+
+
+//
+// '_cfImageRasterKernel()' - Select the row kernels.
+//
+// The fastest kernels the CPU supports are used by default.  Passing the
+// name of other kernels ("ssse3", "sse2", "neon" or "c") selects those if
+// the CPU supports them, for testing; NULL just returns the name of the
+// kernels in use.  All kernels give the same output.
+//
+
+const char *				// O - Name of kernels in use
+_cfImageRasterKernel(const char *name)	// I - Name of kernels or NULL
+{
+  const imagetoraster_kernel_t	*k;	// Current kernels
+
+
+  pthread_once(&kernel_once, kernel_init);
+
+  if (name)
+  {
+    for (k = kernels; k < kernels + sizeof(kernels) / sizeof(kernels[0]);
+         k ++)
+    {
+#ifdef FORMAT_X86
+      if (k->dither1 == dither1_ssse3 && !__builtin_cpu_supports("ssse3"))
+        continue;
+#endif // FORMAT_X86
+
+      if (!strcmp(k->name, name))
+      {
+        kernel = k;
+	break;
+      }
+    }
+  }
+
+  return (kernel->name);
+}
+
+
 //
 // 'blank_line()' - Clear a line buffer to the blank value...
 //
@@ -1927,25 +2292,637 @@ blank_line(cups_page_header_t *header,	// I - Page header
 	}
         break;
 
-    case CUPS_CSPACE_K :
-    case CUPS_CSPACE_CMY :
-    case CUPS_CSPACE_CMYK :
-    case CUPS_CSPACE_YMC :
-    case CUPS_CSPACE_YMCK :
-    case CUPS_CSPACE_KCMY :
-    case CUPS_CSPACE_KCMYcm :
-    case CUPS_CSPACE_GMCK :
-    case CUPS_CSPACE_GMCS :
-    case CUPS_CSPACE_WHITE :
-    case CUPS_CSPACE_GOLD :
-    case CUPS_CSPACE_SILVER :
-        memset(row, 0, count);
-	break;
+    case CUPS_CSPACE_K :
+    case CUPS_CSPACE_CMY :
+    case CUPS_CSPACE_CMYK :
+    case CUPS_CSPACE_YMC :
+    case CUPS_CSPACE_YMCK :
+    case CUPS_CSPACE_KCMY :
+    case CUPS_CSPACE_KCMYcm :
+    case CUPS_CSPACE_GMCK :
+    case CUPS_CSPACE_GMCS :
+    case CUPS_CSPACE_WHITE :
+    case CUPS_CSPACE_GOLD :
+    case CUPS_CSPACE_SILVER :
+        memset(row, 0, count);
+	break;
+
+    default :
+        memset(row, 255, count);
+	break;
+  }
+}
+
+
+//
+// 'cache_finish()' - Finish recording a page in the raster cache.
+//
+
+static void
+cache_finish(imagetoraster_cache_t *cache)
+					// I - Raster cache
+{
+  unsigned char	zbuf[16384];		// Compressed data
+  size_t	bytes;			// Bytes to write
+  int		zstatus;		// Status of compressor
+
+
+  if (!cache->recording)
+    return;
+
+  cache->recording = 0;
+
+  do
+  {
+    cache->zs.next_out  = zbuf;
+    cache->zs.avail_out = sizeof(zbuf);
+
+    zstatus = deflate(&cache->zs, Z_FINISH);
+    bytes   = sizeof(zbuf) - cache->zs.avail_out;
+
+    if (zstatus == Z_STREAM_ERROR ||
+	(bytes > 0 && write(cache->fd, zbuf, bytes) != (ssize_t)bytes))
+    {
+      cache->failed = 1;
+      break;
+    }
+
+    cache->pages[cache->num_pages + 1] += bytes;
+  }
+  while (zstatus != Z_STREAM_END);
+
+  deflateEnd(&cache->zs);
+
+  if (!cache->failed)
+    cache->num_pages ++;
+}
+
+
+//
+// 'cache_free()' - Remove the raster cache.
+//
+
+static void
+cache_free(imagetoraster_cache_t *cache)// I - Raster cache
+{
+  if (cache->recording)
+  {
+    deflateEnd(&cache->zs);
+    cache->recording = 0;
+  }
+
+  if (cache->fd >= 0)
+  {
+    close(cache->fd);
+    unlink(cache->filename);
+    cache->fd = -1;
+  }
+
+  free(cache->pages);
+  cache->pages  = NULL;
+  cache->failed = 1;
+}
+
+
+//
+// 'cache_replay()' - Write a page from the raster cache.
+//
+// If the cache cannot be read the number of bytes of the page which were
+// already written is kept in "cache->skip", so that write_pixels() drops
+// them when the page gets formatted again.
+//
+
+static int				// O - 0 on success, 1 if the cache
+					//     is unusable, -1 on write error
+cache_replay(imagetoraster_cache_t *cache,
+					// I - Raster cache
+	     int                   page,// I - Page of first copy, from 0
+	     cf_raster_t           *ras)// I - Raster stream
+{
+  z_stream	zs;			// Decompressor
+  unsigned char	zbuf[16384],		// Compressed data
+		buffer[65536];		// Raster data
+  off_t		pos = cache->pages[page];
+					// Position in cache file
+  ssize_t	bytes;			// Bytes read
+  unsigned	len;			// Bytes of raster data
+  int		zstatus = Z_OK;		// Status of decompressor
+
+
+  cache->skip = 0;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK)
+    return (1);
+
+  while (zstatus != Z_STREAM_END && pos < cache->pages[page + 1])
+  {
+    bytes = cache->pages[page + 1] - pos;
+    if (bytes > (ssize_t)sizeof(zbuf))
+      bytes = sizeof(zbuf);
+
+    if ((bytes = pread(cache->fd, zbuf, bytes, pos)) <= 0)
+      break;
+
+    pos         += bytes;
+    zs.next_in  = zbuf;
+    zs.avail_in = bytes;
+
+    do
+    {
+      zs.next_out  = buffer;
+      zs.avail_out = sizeof(buffer);
+
+      zstatus = inflate(&zs, Z_NO_FLUSH);
+      len     = sizeof(buffer) - zs.avail_out;
+
+      if (zstatus != Z_OK && zstatus != Z_STREAM_END)
+	break;
+
+      if (len > 0 && cfRasterWritePixels(ras, buffer, len) < len)
+      {
+	inflateEnd(&zs);
+	return (-1);
+      }
+
+      cache->skip += len;
+    }
+    while (zs.avail_out == 0 && zstatus != Z_STREAM_END);
+
+    if (zstatus != Z_OK && zstatus != Z_STREAM_END)
+      break;
+  }
+
+  inflateEnd(&zs);
+
+  if (zstatus != Z_STREAM_END)
+    return (1);
+
+  cache->skip = 0;
+
+  return (0);
+}
+
+
+//
+// 'cache_start()' - Start recording a page in the raster cache.
+//
+// Once anything goes wrong the cache stays unusable, and all copies get
+// rendered.
+//
+
+static void
+cache_start(imagetoraster_cache_t *cache,
+					// I - Raster cache
+	    int                   bits)	// I - Bits per color of the page
+{
+  off_t	*pages;				// New page offsets
+
+
+  if (cache->failed)
+    return;
+
+  if (cache->fd < 0 &&
+      (cache->fd = cupsCreateTempFd(NULL, NULL, cache->filename,
+				    sizeof(cache->filename))) < 0)
+  {
+    cache->failed = 1;
+    return;
+  }
+
+  if ((pages = realloc(cache->pages,
+		       (cache->num_pages + 2) * sizeof(off_t))) == NULL)
+  {
+    cache->failed = 1;
+    return;
+  }
+
+  cache->pages = pages;
+  if (cache->num_pages == 0)
+    pages[0] = 0;
+  pages[cache->num_pages + 1] = pages[cache->num_pages];
+
+  //
+  // Dithered pages are mostly runs and shrink a lot with run-length
+  // coding, contone pages hardly compress and are stored as they are, as
+  // compressing them costs more time than rendering them again...
+  //
+
+  memset(&cache->zs, 0, sizeof(cache->zs));
+  if (deflateInit2(&cache->zs, bits < 8 ? Z_BEST_SPEED : Z_NO_COMPRESSION,
+		   Z_DEFLATED, 15, 8, Z_RLE) != Z_OK)
+  {
+    cache->failed = 1;
+    return;
+  }
+
+  cache->recording = 1;
+}
+
+
+//
+// 'chunky8_c()' - Interpolate 8-bit raster data.
+//
+
+static void
+chunky8_c(cf_ib_t       *out,		// O - Raster data
+	  const cf_ib_t *r0,		// I - Primary image data
+	  const cf_ib_t *r1,		// I - Image data for interpolation
+	  int           count,		// I - Number of bytes
+	  int           yerr0,		// I - Top Y error
+	  int           yerr1,		// I - Bottom Y error
+	  int           ysize)		// I - Height of image data
+{
+  for (; count > 0; count --, r0 ++, r1 ++)
+  {
+    if (*r0 == *r1)
+      *out++ = *r0;
+    else
+      *out++ = (*r0 * yerr0 + *r1 * yerr1) / ysize;
+  }
+}
+
+
+#ifdef FORMAT_NEON
+//
+// 'chunky8_neon()' - Interpolate 8-bit raster data using NEON.
+//
+// The same as chunky8_c(), the sum of the weighted bytes stays below 2^24
+// for images up to FORMAT_MAX_SIZE rows and is exact in single precision,
+// and so is the quotient after truncation.
+//
+
+static void
+chunky8_neon(cf_ib_t       *out,	// O - Raster data
+	     const cf_ib_t *r0,		// I - Primary image data
+	     const cf_ib_t *r1,		// I - Image data for interpolation
+	     int           count,	// I - Number of bytes
+	     int           yerr0,	// I - Top Y error
+	     int           yerr1,	// I - Bottom Y error
+	     int           ysize)	// I - Height of image data
+{
+  float32x4_t	e0 = vdupq_n_f32((float)yerr0),
+		e1 = vdupq_n_f32((float)yerr1),
+		ys = vdupq_n_f32((float)ysize);
+					// Weights and divisor
+  uint8x16_t	a, b;			// Input bytes
+  uint16x8_t	a16, b16;		// Input bytes as words
+  uint32x4_t	a32[4], b32[4],		// Input bytes as longs
+		q[4];			// Output bytes as longs
+  int		i;			// Looping var
+
+
+  for (; count >= 16; count -= 16, r0 += 16, r1 += 16, out += 16)
+  {
+    a = vld1q_u8(r0);
+    b = vld1q_u8(r1);
+
+    for (i = 0; i < 2; i ++)
+    {
+      a16            = vmovl_u8(i ? vget_high_u8(a) : vget_low_u8(a));
+      b16            = vmovl_u8(i ? vget_high_u8(b) : vget_low_u8(b));
+      a32[2 * i]     = vmovl_u16(vget_low_u16(a16));
+      a32[2 * i + 1] = vmovl_u16(vget_high_u16(a16));
+      b32[2 * i]     = vmovl_u16(vget_low_u16(b16));
+      b32[2 * i + 1] = vmovl_u16(vget_high_u16(b16));
+    }
+
+    for (i = 0; i < 4; i ++)
+      q[i] = vcvtq_u32_f32(
+		 vdivq_f32(vaddq_f32(vmulq_f32(vcvtq_f32_u32(a32[i]), e0),
+				     vmulq_f32(vcvtq_f32_u32(b32[i]), e1)),
+			   ys));
+
+    vst1q_u8(out, vcombine_u8(vmovn_u16(vcombine_u16(vmovn_u32(q[0]),
+						     vmovn_u32(q[1]))),
+			      vmovn_u16(vcombine_u16(vmovn_u32(q[2]),
+						     vmovn_u32(q[3])))));
+  }
+
+  chunky8_c(out, r0, r1, count, yerr0, yerr1, ysize);
+}
+#endif // FORMAT_NEON
+
+
+#ifdef FORMAT_X86
+//
+// 'chunky8_sse2()' - Interpolate 8-bit raster data using SSE2.
+//
+// The same as chunky8_c(), the sum of the weighted bytes stays below 2^24
+// for images up to FORMAT_MAX_SIZE rows and is exact in single precision,
+// and so is the quotient after truncation.
+//
+
+static void
+chunky8_sse2(cf_ib_t       *out,	// O - Raster data
+	     const cf_ib_t *r0,		// I - Primary image data
+	     const cf_ib_t *r1,		// I - Image data for interpolation
+	     int           count,	// I - Number of bytes
+	     int           yerr0,	// I - Top Y error
+	     int           yerr1,	// I - Bottom Y error
+	     int           ysize)	// I - Height of image data
+{
+  __m128	e0 = _mm_set1_ps((float)yerr0),
+		e1 = _mm_set1_ps((float)yerr1),
+		ys = _mm_set1_ps((float)ysize);
+					// Weights and divisor
+  __m128i	zero = _mm_setzero_si128(),
+		a, b,			// Input bytes
+		a16, b16,		// Input bytes as words
+		a32[4], b32[4],		// Input bytes as longs
+		q[4];			// Output bytes as longs
+  int		i;			// Looping var
+
+
+  for (; count >= 16; count -= 16, r0 += 16, r1 += 16, out += 16)
+  {
+    a = _mm_loadu_si128((const __m128i *)r0);
+    b = _mm_loadu_si128((const __m128i *)r1);
+
+    for (i = 0; i < 2; i ++)
+    {
+      a16            = i ? _mm_unpackhi_epi8(a, zero) :
+			   _mm_unpacklo_epi8(a, zero);
+      b16            = i ? _mm_unpackhi_epi8(b, zero) :
+			   _mm_unpacklo_epi8(b, zero);
+      a32[2 * i]     = _mm_unpacklo_epi16(a16, zero);
+      a32[2 * i + 1] = _mm_unpackhi_epi16(a16, zero);
+      b32[2 * i]     = _mm_unpacklo_epi16(b16, zero);
+      b32[2 * i + 1] = _mm_unpackhi_epi16(b16, zero);
+    }
+
+    for (i = 0; i < 4; i ++)
+      q[i] = _mm_cvttps_epi32(
+		 _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a32[i]), e0),
+				       _mm_mul_ps(_mm_cvtepi32_ps(b32[i]), e1)),
+			    ys));
+
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+				      _mm_packs_epi32(q[2], q[3])));
+  }
+
+  chunky8_c(out, r0, r1, count, yerr0, yerr1, ysize);
+}
+#endif // FORMAT_X86
+
+
+//
+// 'dither1_c()' - Dither a color plane to 1 bit.
+//
+// "count" is a multiple of 8, the bits are XOR'd into whole bytes of the
+// raster data.  "channel" is the color of the plane in the image data, or 3
+// for black where all three colors are set.
+//
+
+static void
+dither1_c(cf_ib_t       *out,		// IO - Raster data
+	  const cf_ib_t *in,		// I - Image data
+	  const cf_ib_t *dither,	// I - Dither values of the first 16
+					//     pixels, and 16 more
+	  int           count,		// I - Number of pixels
+	  int           stride,		// I - Bytes per pixel of image data
+	  int           channel)	// I - Color of the plane
+{
+  int		x, i;			// Looping vars
+  unsigned	bits;			// Bits of the output byte
+  cf_ib_t	d;			// Dither value
+
+
+  if (channel < 3)
+  {
+    for (in += channel, x = 0; x < count; x += 8, out ++)
+    {
+      for (i = 0, bits = 0; i < 8; i ++, in += stride)
+	bits = (bits << 1) | (*in > dither[(x + i) & 15]);
+
+      *out ^= bits;
+    }
+  }
+  else
+  {
+    for (x = 0; x < count; x += 8, out ++)
+    {
+      for (i = 0, bits = 0; i < 8; i ++, in += 3)
+      {
+	d    = dither[(x + i) & 15];
+	bits = (bits << 1) | (in[0] > d && in[1] > d && in[2] > d);
+      }
+
+      *out ^= bits;
+    }
+  }
+}
+
+
+#ifdef FORMAT_NEON
+//
+// 'dither1_neon()' - Dither a color plane to 1 bit using NEON.
+//
+
+static void
+dither1_neon(cf_ib_t       *out,	// IO - Raster data
+	     const cf_ib_t *in,		// I - Image data
+	     const cf_ib_t *dither,	// I - Dither values of the first 16
+					//     pixels, and 16 more
+	     int           count,	// I - Number of pixels
+	     int           stride,	// I - Bytes per pixel of image data
+	     int           channel)	// I - Color of the plane
+{
+  static const uint8_t weights[16] =	// Bit of each pixel in its byte
+  {
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+  };
+  uint8x16_t	d = vld1q_u8(dither),	// Dither values
+		w = vld1q_u8(weights),	// Bits of the pixels
+		on;			// Pixels that get set
+  uint8x16x3_t	v;			// Colors of 16 pixels
+
+
+  for (; count >= 16; count -= 16, in += 16 * stride, out += 2)
+  {
+    if (stride == 1)
+      on = vcgtq_u8(vld1q_u8(in), d);
+    else
+    {
+      v = vld3q_u8(in);
+
+      if (channel < 3)
+        on = vcgtq_u8(v.val[channel], d);
+      else
+        on = vandq_u8(vandq_u8(vcgtq_u8(v.val[0], d), vcgtq_u8(v.val[1], d)),
+		      vcgtq_u8(v.val[2], d));
+    }
+
+    on     = vandq_u8(on, w);
+    out[0] ^= vaddv_u8(vget_low_u8(on));
+    out[1] ^= vaddv_u8(vget_high_u8(on));
+  }
+
+  if (count > 0)
+    dither1_c(out, in, dither, count, stride, channel);
+}
+#endif // FORMAT_NEON
+
+
+#ifdef FORMAT_X86
+//
+// 'dither1_ssse3()' - Dither a color plane to 1 bit using SSSE3.
+//
+
+__attribute__((target("ssse3")))
+static void
+dither1_ssse3(cf_ib_t       *out,	// IO - Raster data
+	      const cf_ib_t *in,	// I - Image data
+	      const cf_ib_t *dither,	// I - Dither values of the first 16
+					//     pixels, and 16 more
+	      int           count,	// I - Number of pixels
+	      int           stride,	// I - Bytes per pixel of image data
+	      int           channel)	// I - Color of the plane
+{
+  signed char	gather[3][3][16];	// Shuffles picking each color of 16
+					// pixels from 48 bytes of image data
+  __m128i	d = _mm_loadu_si128((const __m128i *)dither),
+					// Dither values
+		rev = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+				    15, 14, 13, 12, 11, 10, 9, 8),
+					// First pixel of each byte to the top
+		v[3],			// Image data of 16 pixels
+		off;			// Pixels that stay clear
+  int		i,			// Looping var
+		first, last;		// Colors to check
+  unsigned	bits;			// Bits of 16 pixels
+
+
+  if (channel < 3)
+    first = last = channel;
+  else
+  {
+    first = 0;
+    last  = 2;
+  }
+
+  memset(gather, 0x80, sizeof(gather));
+  for (i = 0; i < 48; i ++)
+    gather[i % 3][i / 16][i / 3] = i % 16;
+
+  for (; count >= 16; count -= 16, in += 16 * stride, out += 2)
+  {
+    if (stride == 1)
+      off = _mm_cmpeq_epi8(_mm_max_epu8(_mm_loadu_si128((const __m128i *)in),
+					d), d);
+    else
+    {
+      v[0] = _mm_loadu_si128((const __m128i *)in);
+      v[1] = _mm_loadu_si128((const __m128i *)(in + 16));
+      v[2] = _mm_loadu_si128((const __m128i *)(in + 32));
+      off  = _mm_setzero_si128();
+
+      for (i = first; i <= last; i ++)
+      {
+        __m128i c = _mm_or_si128(
+		      _mm_or_si128(
+			_mm_shuffle_epi8(v[0],
+					 _mm_loadu_si128((__m128i *)gather[i][0])),
+			_mm_shuffle_epi8(v[1],
+					 _mm_loadu_si128((__m128i *)gather[i][1]))),
+		      _mm_shuffle_epi8(v[2],
+				       _mm_loadu_si128((__m128i *)gather[i][2])));
+
+        off = _mm_or_si128(off, _mm_cmpeq_epi8(_mm_max_epu8(c, d), d));
+      }
+    }
+
+    bits   = ~_mm_movemask_epi8(_mm_shuffle_epi8(off, rev));
+    out[0] ^= bits & 255;
+    out[1] ^= (bits >> 8) & 255;
+  }
+
+  if (count > 0)
+    dither1_c(out, in, dither, count, stride, channel);
+}
+#endif // FORMAT_X86
+
+
+//
+// 'find_format()' - Find the row kernel for a page.
+//
+
+static int				// O - Index in "formats"
+find_format(cups_page_header_t *header,	// I - Page header
+	    int                first)	// I - First entry to look at
+{
+  int	i;				// Looping var
+
+
+  pthread_once(&kernel_once, kernel_init);
+
+  for (i = first; i < (int)(sizeof(formats) / sizeof(formats[0])) - 1; i ++)
+    if ((formats[i].cspace == -1 ||
+	 formats[i].cspace == (int)header->cupsColorSpace) &&
+	(formats[i].order == -1 ||
+	 formats[i].order == (int)header->cupsColorOrder) &&
+	(formats[i].bits == 0 ||
+	 formats[i].bits == (int)header->cupsBitsPerColor))
+      break;
+
+  return (i);
+}
+
+
+//
+// 'format_chunky()' - Convert image data to chunky 8-bit colors.
+//
+// Used when the raster data has the colors of the image data in the same
+// order, and for one color with any order.
+//
+
+static void
+format_chunky(imagetoraster_doc_t *doc,	// I - Document information
+	      cups_page_header_t  *header,
+					// I - Page header
+	      unsigned char       *row,	// IO - Bitmap data for device
+	      int                 y,	// I - Current row
+	      int                 z,	// I - Current plane
+	      int                 xsize,// I - Width of image data
+	      int                 ysize,// I - Height of image data
+	      int                 yerr0,// I - Top Y error
+	      int                 yerr1,// I - Bottom Y error
+	      cf_ib_t             *r0,	// I - Primary image data
+	      cf_ib_t             *r1)	// I - Image data for interpolation
+{
+  cf_ib_t	*ptr;			// Pointer into row
+  int		bitoffset,		// Current offset in line
+		count;			// Number of bytes
+
 
+  (void)y;
+  (void)z;
+
+  switch (doc->XPosition)
+  {
+    case -1 :
+        bitoffset = 0;
+	break;
     default :
-        memset(row, 255, count);
+        bitoffset = header->cupsBitsPerPixel *
+	  ((header->cupsWidth - xsize) / 2);
+	break;
+    case 1 :
+        bitoffset = header->cupsBitsPerPixel * (header->cupsWidth - xsize);
 	break;
   }
+
+  ptr   = row + bitoffset / 8;
+  count = xsize * formats[doc->Format].stride;
+
+  if (r0 == r1)
+    memcpy(ptr, r0, count);		// Already filtered along Y
+  else if (ysize <= FORMAT_MAX_SIZE)
+    (kernel->chunky8)(ptr, r0, r1, count, yerr0, yerr1, ysize);
+  else
+    chunky8_c(ptr, r0, r1, count, yerr0, yerr1, ysize);
 }
 
 
@@ -2870,6 +3847,117 @@ format_cmyk(imagetoraster_doc_t *doc,
 }
 
 
+//
+// 'format_dither1()' - Convert image data to a 1-bit gray or color plane.
+//
+// Whole bytes of the plane go to the SIMD kernels, only the pixels before
+// the first and after the last byte boundary are done here.
+//
+
+static void
+format_dither1(imagetoraster_doc_t *doc,// I - Document information
+	       cups_page_header_t  *header,
+					// I - Page header
+	       unsigned char       *row,// IO - Bitmap data for device
+	       int                 y,	// I - Current row
+	       int                 z,	// I - Current plane
+	       int                 xsize,
+					// I - Width of image data
+	       int                 ysize,
+					// I - Height of image data
+	       int                 yerr0,
+					// I - Top Y error
+	       int                 yerr1,
+					// I - Bottom Y error
+	       cf_ib_t             *r0,	// I - Primary image data
+	       cf_ib_t             *r1)	// I - Image data for interpolation
+{
+  const imagetoraster_format_t *f = formats + doc->Format;
+					// Format of the page
+  cf_ib_t	*ptr,			// Pointer into row
+		*pixel,			// Pointer into image data
+		bitmask,		// Current mask for pixel
+		d,			// Dither value
+		dither[32];		// Dither values from the first pixel
+  int		bitoffset,		// Current offset in line
+		channel = f->planes[z],	// Color of the plane
+		count,			// Pixels in whole bytes
+		x;			// Current X coordinate in image data
+
+
+  (void)ysize;
+  (void)yerr0;
+  (void)yerr1;
+  (void)r1;
+
+  if (channel < 0)
+    return;				// Nothing to print in this plane
+
+  switch (doc->XPosition)
+  {
+    case -1 :
+        bitoffset = 0;
+	break;
+    default :
+        bitoffset = header->cupsBitsPerPixel *
+	  ((header->cupsWidth - xsize) / 2);
+	break;
+    case 1 :
+        bitoffset = header->cupsBitsPerPixel * (header->cupsWidth - xsize);
+	break;
+  }
+
+  ptr     = row + bitoffset / 8;
+  bitmask = 0x80 >> (bitoffset & 7);
+
+  //
+  // The dither row from the first pixel on, twice, so that the kernels can
+  // start at any pixel.  With one color full pixels always print, as in
+  // format_w() and format_K()...
+  //
+
+  for (x = 0; x < 32; x ++)
+  {
+    d = Floyd16x16[y & 15][(xsize - x) & 15];
+
+    if (f->stride == 1 && d == 255)
+      dither[x] = 254;
+    else
+      dither[x] = d;
+  }
+
+  for (x = 0; x < xsize;)
+  {
+    if (bitmask == 0x80 && (count = (xsize - x) & ~7) > 0)
+    {
+      (kernel->dither1)(ptr, r0 + x * f->stride, dither + (x & 15), count,
+			f->stride, channel);
+
+      x   += count;
+      ptr += count / 8;
+      continue;
+    }
+
+    pixel = r0 + x * f->stride;
+    d     = dither[x & 15];
+
+    if (channel < 3 ? pixel[channel] > d :
+		      (pixel[0] > d && pixel[1] > d && pixel[2] > d))
+      *ptr ^= bitmask;
+
+    x ++;
+
+    if (bitmask > 1)
+      bitmask >>= 1;
+    else
+    {
+      bitmask = 0x80;
+      ptr ++;
+    }
+  }
+}
+
+
 //
 // 'format_K()' - Convert image data to black.
 //
@@ -5396,6 +6484,22 @@ format_ymck(imagetoraster_doc_t *doc,
 }
 
 
+//
+// 'kernel_init()' - Pick the fastest row kernels the CPU supports.
+//
+
+static void
+kernel_init(void)
+{
+#ifdef FORMAT_X86
+  if (!__builtin_cpu_supports("ssse3"))
+    kernel = kernels + 1;
+  else
+#endif // FORMAT_X86
+  kernel = kernels;
+}
+
+
 //
 // 'make_lut()' - Make a lookup table given gamma and brightness values.
 //
@@ -5428,3 +6532,424 @@ make_lut(cf_ib_t    *lut,		// I - Lookup table
       *lut++ = v;
   }
 }
+
+
+//
+// 'make_pixels()' - Make the on/off-pixel lookup tables.
+//
+
+static void
+make_pixels(imagetoraster_doc_t *doc,	// I - Document information
+	    int                 bits)	// I - Bits per color
+{
+  int	i;				// Looping var
+
+
+  doc->OnPixels[0]    = 0x00;
+  doc->OnPixels[255]  = 0xff;
+  doc->OffPixels[0]   = 0x00;
+  doc->OffPixels[255] = 0xff;
+
+  switch (bits)
+  {
+    case 2 :
+        for (i = 1; i < 255; i ++)
+        {
+          doc->OnPixels[i]  = 0x55 * (i / 85 + 1);
+          doc->OffPixels[i] = 0x55 * (i / 64);
+        }
+        break;
+    case 4 :
+        for (i = 1; i < 255; i ++)
+        {
+          doc->OnPixels[i]  = 17 * (i / 17 + 1);
+          doc->OffPixels[i] = 17 * (i / 16);
+        }
+        break;
+  }
+}
+
+
+//
+// 'render_image()' - Render and write the image data of a page.
+//
+// With more than one zoom record the rows are rendered in bands of
+// BAND_ROWS rows, each thread taking the next band with its own zoom
+// record, while this thread writes the bands in order.  A few more band
+// buffers than threads keep the threads busy while a band waits to be
+// written.  Each band buffer has a spare row at the end, the format
+// functions may write past the end of a row like "row" allows for.
+// With one zoom record this thread renders the bands itself, into a
+// single band buffer, or row by row into "row" if there is no memory.
+//
+
+static int				// O - 0 on success, 1 on write error,
+					//     -1 if canceled
+render_image(
+    imagetoraster_doc_t        *doc,	// I - Document information
+    cups_page_header_t         *header,	// I - Page header
+    cf_raster_t                *ras,	// I - Raster stream
+    imagetoraster_cache_t      *cache,	// I - Raster cache
+    cf_izoom_t                 **zooms,	// I - Zoom records, one per thread
+    int                        num_zooms,
+					// I - Number of zoom records
+    int                        plane,	// I - Current color plane
+    unsigned char              *row,	// I - Row buffer
+    cf_filter_iscanceledfunc_t iscanceled,
+					// I - Function to check for a canceled
+					//     job or NULL
+    void                       *icd)	// I - Data for "iscanceled"
+{
+  imagetoraster_bands_t	bands;		// Band rendering state
+  imagetoraster_worker_t workers[CF_IMAGE_MAX_THREADS];
+					// Rendering threads
+  int			num_workers = 0,// Number of rendering threads
+			band,		// Current band
+			first,		// First row of band
+			count,		// Rows in band
+			last_iy = -2,	// Last image row filled in the zoom
+					// record by this thread
+			status = 0;	// Return value
+  unsigned char		*rows;		// Rows of band
+  size_t		bpl = header->cupsBytesPerLine;
+					// Bytes per row
+
+
+  memset(&bands, 0, sizeof(bands));
+
+  bands.doc       = doc;
+  bands.header    = header;
+  bands.plane     = plane;
+  bands.num_bands = (zooms[0]->ysize + BAND_ROWS - 1) / BAND_ROWS;
+  bands.num_slots = 2 * num_zooms;
+  bands.slot_size = (BAND_ROWS + 1) * bpl;
+
+  if (num_zooms > 1 &&
+      (bands.buffer = malloc(bands.num_slots * bands.slot_size)) != NULL &&
+      (bands.done = malloc(bands.num_slots * sizeof(int))) != NULL)
+  {
+    pthread_mutex_init(&bands.lock, NULL);
+    pthread_cond_init(&bands.cond, NULL);
+
+    for (band = 0; band < bands.num_slots; band ++)
+      bands.done[band] = -1;
+
+    for (; num_workers < num_zooms; num_workers ++)
+    {
+      workers[num_workers].bands = &bands;
+      workers[num_workers].z     = zooms[num_workers];
+
+      if (pthread_create(&workers[num_workers].thread, NULL, render_thread,
+			 workers + num_workers))
+	break;
+    }
+
+    if (num_workers == 0)
+    {
+      pthread_cond_destroy(&bands.cond);
+      pthread_mutex_destroy(&bands.lock);
+    }
+  }
+
+  if (num_workers == 0)
+  {
+    //
+    // Render on this thread, a band at a time if there is memory for it...
+    //
+
+    if (!bands.buffer)
+      bands.buffer = malloc(bands.slot_size);
+
+    for (first = 0; first < (int)zooms[0]->ysize && !status; first += count)
+    {
+      if (bands.buffer)
+      {
+	rows  = bands.buffer;
+	count = BAND_ROWS;
+      }
+      else
+      {
+	rows  = row;
+	count = 1;
+      }
+
+      if (count > (int)zooms[0]->ysize - first)
+	count = zooms[0]->ysize - first;
+
+      render_rows(doc, header, zooms[0], plane, first, count, &last_iy,
+		  rows);
+
+      for (; count > 0 && !status; count --, rows += bpl, first ++)
+	if (write_pixels(ras, cache, rows, bpl) < bpl)
+	  status = 1;
+
+      if (!status && iscanceled && iscanceled(icd))
+	status = -1;
+    }
+
+    free(bands.buffer);
+    free(bands.done);
+
+    return (status);
+  }
+
+  //
+  // Write the bands as they get done...
+  //
+
+  for (band = 0; band < bands.num_bands && !status; band ++)
+  {
+    pthread_mutex_lock(&bands.lock);
+    while (bands.done[band % bands.num_slots] != band)
+      pthread_cond_wait(&bands.cond, &bands.lock);
+    pthread_mutex_unlock(&bands.lock);
+
+    rows  = bands.buffer + (band % bands.num_slots) * bands.slot_size;
+    count = zooms[0]->ysize - band * BAND_ROWS;
+    if (count > BAND_ROWS)
+      count = BAND_ROWS;
+
+    for (; count > 0 && !status; count --, rows += bpl)
+      if (write_pixels(ras, cache, rows, bpl) < bpl)
+	status = 1;
+
+    if (!status && iscanceled && iscanceled(icd))
+      status = -1;
+
+    pthread_mutex_lock(&bands.lock);
+    bands.written = band + 1;
+    pthread_cond_broadcast(&bands.cond);
+    pthread_mutex_unlock(&bands.lock);
+  }
+
+  //
+  // Stop the threads...
+  //
+
+  pthread_mutex_lock(&bands.lock);
+  bands.abort = 1;
+  pthread_cond_broadcast(&bands.cond);
+  pthread_mutex_unlock(&bands.lock);
+
+  while (num_workers > 0)
+    pthread_join(workers[-- num_workers].thread, NULL);
+
+  pthread_cond_destroy(&bands.cond);
+  pthread_mutex_destroy(&bands.lock);
+
+  free(bands.buffer);
+  free(bands.done);
+
+  return (status);
+}
+
+
+//
+// 'render_rows()' - Render rows of the image data of a page.
+//
+// The rows may start anywhere on the page, the input row and Y errors of
+// the first row are worked out from the Y step and remainder of the zoom
+// record, the same as stepping there row by row.  "last_iy" tells which
+// image row the zoom record got filled with last, -2 if unknown, so that
+// rendering the rows of a page in several calls does not fill the zoom
+// record again for the first row of each call.
+//
+
+static void
+render_rows(imagetoraster_doc_t *doc,	// I - Document information
+	    cups_page_header_t  *header,// I - Page header
+	    cf_izoom_t          *z,	// I - Zoom record
+	    int                 plane,	// I - Current color plane
+	    int                 first,	// I - First row
+	    int                 count,	// I - Number of rows
+	    int                 *last_iy,
+					// IO - Previous Y coordinate in image
+	    unsigned char       *rows)	// O - Raster data
+{
+  cf_ib_t	*r0,			// Top row
+		*r1;			// Bottom row
+  int		y,			// Current Y coordinate on page
+		iy,			// Current Y coordinate in image
+		yerr0,			// Top Y error value
+		yerr1;			// Bottom Y error value
+  long long	err;			// Y error accumulated up to first row
+
+
+  err   = (long long)first * z->ymod;
+  yerr0 = (int)(err % z->ysize);
+  yerr1 = z->ysize - yerr0;
+  iy    = first * z->ystep + (int)(err / z->ysize) * z->yincr;
+
+  for (y = z->ysize - first;
+       count > 0;
+       y --, count --, rows += header->cupsBytesPerLine)
+  {
+    if (z->type == CF_IZOOM_BEST)
+      _cfImageZoomFill(z, z->ysize - y);
+    else if (iy != *last_iy)
+    {
+      if (z->type != CF_IZOOM_FAST && (iy - *last_iy) > 1)
+	_cfImageZoomFill(z, iy);
+
+      _cfImageZoomFill(z, iy + z->yincr);
+
+      *last_iy = iy;
+    }
+
+    //
+    // Format this line of raster data for the printer...
+    //
+
+    blank_line(header, rows);
+
+    r0 = z->rows[z->row];
+    if (z->type == CF_IZOOM_BEST)
+      r1 = r0;				// Already filtered along Y
+    else
+      r1 = z->rows[1 - z->row];
+
+    (formats[doc->Format].format)(doc, header, rows, y, plane, z->xsize,
+				  z->ysize, yerr0, yerr1, r0, r1);
+
+    //
+    // Compute the next scanline in the image...
+    //
+
+    iy    += z->ystep;
+    yerr0 += z->ymod;
+    yerr1 -= z->ymod;
+    if (yerr1 <= 0)
+    {
+      yerr0 -= z->ysize;
+      yerr1 += z->ysize;
+      iy    += z->yincr;
+    }
+  }
+}
+
+
+//
+// 'render_thread()' - Render bands of a page.
+//
+// Takes the next band as long as there is a free band buffer for it.
+//
+
+static void *				// O - Thread exit status (unused)
+render_thread(void *arg)		// I - Rendering thread
+{
+  imagetoraster_worker_t *w = (imagetoraster_worker_t *)arg;
+					// Rendering thread
+  imagetoraster_bands_t	*bands = w->bands;
+					// Band rendering state
+  int			band,		// Current band
+			count,		// Rows in band
+			last_iy;	// Last image row filled in the zoom
+					// record
+
+
+  pthread_mutex_lock(&bands->lock);
+
+  for (;;)
+  {
+    while (!bands->abort && bands->next < bands->num_bands &&
+	   bands->next >= bands->written + bands->num_slots)
+      pthread_cond_wait(&bands->cond, &bands->lock);
+
+    if (bands->abort || bands->next >= bands->num_bands)
+      break;
+
+    band = bands->next ++;
+
+    pthread_mutex_unlock(&bands->lock);
+
+    count = w->z->ysize - band * BAND_ROWS;
+    if (count > BAND_ROWS)
+      count = BAND_ROWS;
+
+    // The bands of a thread are not adjacent, fill the zoom record anew
+    last_iy = -2;
+
+    render_rows(bands->doc, bands->header, w->z, bands->plane,
+		band * BAND_ROWS, count, &last_iy,
+		bands->buffer + (band % bands->num_slots) * bands->slot_size);
+
+    pthread_mutex_lock(&bands->lock);
+    bands->done[band % bands->num_slots] = band;
+    pthread_cond_broadcast(&bands->cond);
+  }
+
+  pthread_mutex_unlock(&bands->lock);
+
+  return (NULL);
+}
+
+
+//
+// 'write_pixels()' - Write raster data, recording it in the raster cache.
+//
+// The bytes which cache_replay() already wrote before the cache failed
+// are dropped.
+//
+
+static unsigned				// O - Number of bytes written
+write_pixels(cf_raster_t           *ras,// I - Raster stream
+	     imagetoraster_cache_t *cache,
+					// I - Raster cache
+	     unsigned char         *pixels,
+					// I - Raster data
+	     unsigned              len)	// I - Number of bytes
+{
+  unsigned char	zbuf[16384];		// Compressed data
+  size_t	bytes;			// Bytes to write
+  unsigned	skip;			// Bytes already written
+
+
+  if (cache->skip >= len)
+  {
+    cache->skip -= len;
+    return (len);
+  }
+  else if (cache->skip > 0)
+  {
+    skip        = (unsigned)cache->skip;
+    cache->skip = 0;
+
+    return (skip + cfRasterWritePixels(ras, pixels + skip, len - skip));
+  }
+
+  if (cache->recording)
+  {
+    cache->zs.next_in  = pixels;
+    cache->zs.avail_in = len;
+
+    do
+    {
+      cache->zs.next_out  = zbuf;
+      cache->zs.avail_out = sizeof(zbuf);
+
+      if (deflate(&cache->zs, Z_NO_FLUSH) == Z_STREAM_ERROR)
+      {
+	cache->failed = 1;
+	break;
+      }
+
+      bytes = sizeof(zbuf) - cache->zs.avail_out;
+      if (bytes > 0 && write(cache->fd, zbuf, bytes) != (ssize_t)bytes)
+      {
+	cache->failed = 1;
+	break;
+      }
+
+      cache->pages[cache->num_pages + 1] += bytes;
+    }
+    while (cache->zs.avail_out == 0);
+
+    if (cache->failed)
+    {
+      deflateEnd(&cache->zs);
+      cache->recording = 0;
+    }
+  }
+
+  return (cfRasterWritePixels(ras, pixels, len));
+}
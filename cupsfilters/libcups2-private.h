@@ -61,6 +61,7 @@
 #    define cups_afree_cb_t       cups_afree_func_t
 #    define cups_array_cb_t       cups_array_func_t
 #    define cups_page_header_t    cups_page_header2_t
+#    define ipp_io_cb_t           ipp_iocb_t
 
 //   For some functions' parameters in libcups3 size_t is used while
 //   int was used in libcups2. We use this type in such a case.
@@ -189,6 +189,7 @@ mutool_spawn(const char *filename,
   int i;
   int numargs;
   int pid, mutoolpid, errpid;
+  cf_filter_cancel_watch_t *cancelwatch = NULL;
   cups_file_t *logfp;
   cf_loglevel_t log_level;
   char *msg;
@@ -305,6 +306,9 @@ mutool_spawn(const char *filename,
   if (log) log(ld, CF_LOGLEVEL_DEBUG,
 	       "cfFilterMuPDFToPWG: Started mutool (PID %d)", mutoolpid);
 
+  // Kill mutool right away when the job gets canceled
+  cancelwatch = cfFilterCancelWatchPid(iscanceled, icd, mutoolpid);
+
   close(errfds[1]);
 
   if ((errpid = fork()) == 0)
@@ -415,6 +419,7 @@ mutool_spawn(const char *filename,
   }
 
 out:
+  cfFilterCancelUnwatch(cancelwatch);
   free(mutoolargv);
   return (status);
 }
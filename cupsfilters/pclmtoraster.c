@@ -48,7 +48,9 @@ typedef struct pclmtoraster_data_s
   unsigned int bytesPerLine;	// bytes per line in output
   char colorspace[32]; 		// Colourspace string(Use fixed-size string)
   int pixel_count;		// Accumulated pixel byte count for bitmap
-  unsigned char *bitmap;	// Accumulated image bitmap data
+  unsigned char *bitmap;	// Accumulated image bitmap data, from
+				// cfFilterMemoryAlloc()
+  cf_filter_data_t *filter_data; // Job data, for the memory budget
 } pclmtoraster_data_t;
 
 //
@@ -73,6 +75,7 @@ init_pclmtoraster_data_t(pclmtoraster_data_t *data)	// I - pclm data to initiali
   strncpy(data->colorspace, "\0", sizeof(data->colorspace));
   data->pixel_count = 0;
   data->bitmap = NULL;
+  data->filter_data = NULL;
 }
 
 // function pointer for color space conversion
@@ -118,6 +121,7 @@ parse_opts(cf_filter_data_t *data,			// I - Job and Print data
   cups_cspace_t         cspace = (cups_cspace_t)(-1);
 
   pclmtoraster_data->outformat = outformat;
+  pclmtoraster_data->filter_data = data;
 
   //
   // CUPS option list
@@ -858,12 +862,14 @@ process_image(pdfio_dict_t *dict, 		// I - dictionary where images are there
 
     data->header.cupsHeight += height;
 
-    // Allocate memory for the bitmap data
-    if (data->pixel_count == 0)
-      data->bitmap = (unsigned char *)malloc(bufsize);
-    else
-      data->bitmap = (unsigned char *)realloc(data->bitmap,
-                                              data->pixel_count + bufsize);
+    // Allocate memory for the bitmap data, in a temporary file if the
+    // job's memory budget is exhausted
+    unsigned char *bitmap =
+      (unsigned char *)cfFilterMemoryRealloc(data->filter_data, data->bitmap,
+					     data->pixel_count + bufsize);
+    if (!bitmap)
+      return (false);
+    data->bitmap = bitmap;
 
     memcpy(data->bitmap + data->pixel_count, buffer, bufsize);
     data->pixel_count += bufsize;
@@ -882,7 +888,7 @@ process_image(pdfio_dict_t *dict, 		// I - dictionary where images are there
 //
 
 static int				  // O - Exit status
-out_page(cups_raster_t*	 raster, 	// I - Raster stream
+out_page(cf_raster_t*	 raster, 	// I - Raster stream
 	 pdfio_obj_t* 	 page,		// I - PDFio Page Object
 	 int		 pgno,		// I - Page number
 	 cf_logfunc_t    log,		// I - Log function
@@ -1049,7 +1055,7 @@ out_page(cups_raster_t*	 raster, 	// I - Raster stream
   if (data->header.cupsColorOrder == CUPS_ORDER_BANDED)
     data->header.cupsBytesPerLine *= data->header.cupsNumColors;
 
-  if (!cupsRasterWriteHeader(raster, &(data->header)))
+  if (!cfRasterWriteHeader(raster, &(data->header)))
   {
     if (log) log(ld, CF_LOGLEVEL_ERROR,
 		 "cfFilterPCLmToRaster: Can't write page %d header", pgno + 1);
@@ -1081,12 +1087,22 @@ out_page(cups_raster_t*	 raster, 	// I - Raster stream
   // Rotate Bitmap
   if (rotate)
   {
-    unsigned char *bitmap2 = (unsigned char *) malloc(data->pixel_count);
+    unsigned char *bitmap2 =
+      (unsigned char *)cfFilterMemoryAlloc(filter_data, data->pixel_count);
+    if (!bitmap2)
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterPCLmToRaster: Unable to allocate rotated bitmap");
+      cfFilterMemoryFree(data->bitmap);
+      data->bitmap = NULL;
+      data->pixel_count = 0;
+      return (1);
+    }
     bitmap2 = rotate_bitmap(data->bitmap, bitmap2, rotate,
 			    data->header.cupsHeight,
 			    data->header.cupsWidth, data->rowsize,
 			    data->colorspace, log, ld);
-    free(data->bitmap);
+    cfFilterMemoryFree(data->bitmap);
     data->bitmap = bitmap2;
   }
 
@@ -1108,7 +1124,7 @@ out_page(cups_raster_t*	 raster, 	// I - Raster stream
 	{
           dp = convert->convertline(bp, line, lineBuf, h - 1, plane + band,
 				    data, convert->convertcspace);
-          cupsRasterWritePixels(raster, dp, data->bytesPerLine);
+          cfRasterWritePixels(raster, dp, data->bytesPerLine);
         }
         bp -= data->rowsize;
       }
@@ -1125,7 +1141,7 @@ out_page(cups_raster_t*	 raster, 	// I - Raster stream
 	{
           dp = convert->convertline(bp, line, lineBuf, h, plane + band,
 				    data, convert->convertcspace);
-          cupsRasterWritePixels(raster, dp, data->bytesPerLine);
+          cfRasterWritePixels(raster, dp, data->bytesPerLine);
         }
         bp += data->rowsize;
       }
@@ -1133,7 +1149,7 @@ out_page(cups_raster_t*	 raster, 	// I - Raster stream
   }
   free(lineBuf);
   free(line);
-  free(data->bitmap);
+  cfFilterMemoryFree(data->bitmap);
   data->bitmap = NULL;
   data->pixel_count = 0;
 
@@ -1163,7 +1179,7 @@ cfFilterPCLmToRaster(int inputfd,         // I - File descriptor input stream
   int			bytes;			// Bytes copied
   int			npages = 0;
   pdfio_file_t		*pdf = NULL;
-  cups_raster_t		*raster;
+  cf_raster_t		*raster;
   pclmtoraster_data_t	pclmtoraster_data;
   pclm_conversion_function_t convert;
   cf_logfunc_t		log = data->logfunc;
@@ -1252,7 +1268,7 @@ cfFilterPCLmToRaster(int inputfd,         // I - File descriptor input stream
   else
     pclmtoraster_data.nbands = 1;
 
-  if ((raster = cupsRasterOpen(outputfd,
+  if ((raster = cfRasterOpen(outputfd,
 			       (pclmtoraster_data.outformat ==
 				  CF_FILTER_OUT_FORMAT_CUPS_RASTER ?
 				  CUPS_RASTER_WRITE :
@@ -1296,7 +1312,7 @@ cfFilterPCLmToRaster(int inputfd,         // I - File descriptor input stream
       break;
   }
 
-  cupsRasterClose(raster);
+  cfRasterClose(raster);
   pdfioFileClose(pdf);
   unlink(tempfile);
   return (0);
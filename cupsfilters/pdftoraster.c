@@ -1837,9 +1837,13 @@ write_page_image(cups_raster_t *raster,			// I - Cups raster output data struct
     // ---- PARENT ----
     int wstatus;
     pid_t wpid;
+    cf_filter_cancel_watch_t *cancelwatch;
 
     int ret = 65536; // Default to error
 
+    // Kill pdftoppm right away when the job gets canceled
+    cancelwatch = cfFilterCancelWatchPid(iscanceled, icd, pid);
+
     while (pid > 0)
     {
       if ((wpid = wait(&wstatus)) < 0)
@@ -1878,6 +1882,8 @@ write_page_image(cups_raster_t *raster,			// I - Cups raster output data struct
         pid = -1;
       }
     }
+
+    cfFilterCancelUnwatch(cancelwatch);
   }
 
   if (ret != 0)
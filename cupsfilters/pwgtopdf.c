@@ -25,6 +25,7 @@
 #include <cups/cups.h>
 #include <cups/raster.h>
 #include <cupsfilters/filter.h>
+#include <cupsfilters/raster.h>
 #include <cupsfilters/colormanager.h>
 #include <cupsfilters/image.h>
 #include <cupsfilters/ipp.h>
@@ -112,6 +113,8 @@ typedef struct pwgtopdf_doc_s                  // **** Document information ****
                                                // supporting stop on cancel
   void                 *iscanceleddata;        // User data for is-canceled
 					       // function, can be NULL
+  cf_filter_data_t     *data;                  // Job data, for the memory
+					       // budget
 } pwgtopdf_doc_t;
 
 // PDF info structure
@@ -203,7 +206,7 @@ init_pdf_info(struct pdf_info *info)
 
   info->page_dict = NULL;
   info->page = NULL;
-  info->page_data = strdup("");
+  info->page_data = NULL;
   info->page_data_size = 0;
   info->color_space = CUPS_CSPACE_K;
   info->page_width = 0.0;
@@ -260,7 +263,7 @@ void free_pdf_info(struct pdf_info *info)
 
   if (info->page_data)
   {
-    free(info->page_data);
+    cfFilterMemoryFree(info->page_data);
     info->page_data = NULL;
   }
 }
@@ -1187,6 +1190,10 @@ finish_page(struct pdf_info *info,
 		    		    info->width, info->height,
 				    info->render_intent,
 				    info->color_space, info->bpc, doc);
+
+    // The page image is in the PDF now, give its memory back
+    cfFilterMemoryFree(info->page_data);
+    info->page_data = NULL;
     if (!image)
     {
       if (doc->logfunc) doc->logfunc(doc->logdata, CF_LOGLEVEL_DEBUG,
@@ -1524,9 +1531,17 @@ add_pdf_page(struct pdf_info *info,
   
   if (info->outformat == CF_FILTER_OUT_FORMAT_PDF) 
   {
+    // Page bitmap, in a temporary file if the job's memory budget is
+    // exhausted
+    cfFilterMemoryFree(info->page_data);
     info->page_data_size = info->line_bytes * info->height;
-    info->page_data = malloc(info->page_data_size);
-    memset(info->page_data, 0, info->page_data_size);
+    info->page_data = cfFilterMemoryAlloc(doc->data, info->page_data_size);
+    if (!info->page_data)
+    {
+      if (doc->logfunc) doc->logfunc(doc->logdata, CF_LOGLEVEL_ERROR,
+				     "cfFilterPWGToPDF: Unable to allocate page bitmap");
+      return (1);
+    }
   } 
   else if (info->outformat == CF_FILTER_OUT_FORMAT_PCLM) 
   {
@@ -1592,7 +1607,7 @@ pdf_set_line(struct pdf_info *info,
 }
 
 static int
-convert_raster(cups_raster_t *ras,
+convert_raster(cf_raster_t *ras,
                unsigned width,
                unsigned height,
                int bpp,
@@ -1617,12 +1632,12 @@ convert_raster(cups_raster_t *ras,
   while (cur_line < height) 
   {
     // Read raster data...
-    cupsRasterReadPixels(ras, PixelBuffer, bpl);
+    cfRasterReadPixels(ras, PixelBuffer, bpl);
 
 #if !ARCH_IS_BIG_ENDIAN
     if (info->bpc == 16) 
     {
-      // Swap byte pairs for endianess (cupsRasterReadPixels() switches
+      // Swap byte pairs for endianess (cfRasterReadPixels() switches
       // from Big Endian back to the system's Endian)
       for (i = bpl, ptr = PixelBuffer; i > 0; i -= 2, ptr += 2) 
       {
@@ -1687,7 +1702,7 @@ cfFilterPWGToPDF(int inputfd,  // I - File descriptor input stream
   cf_cm_calibration_t	cm_calibrate;   // Status of CUPS color management
 					// ("on" or "off")
   struct pdf_info pdf;
-  cups_raster_t		*ras;		// Raster stream for printing
+  cf_raster_t		*ras;		// Raster stream for printing
   cups_page_header_t	header;		// Page header from file
   ipp_t *printer_attrs = data->printer_attrs; // Printer attributes from
 					// printer data
@@ -1754,6 +1769,8 @@ cfFilterPWGToPDF(int inputfd,  // I - File descriptor input stream
   // Job-is-canceled function
   doc.iscanceledfunc = iscanceled;
   doc.iscanceleddata = icd;
+  // Memory budget
+  doc.data = data;
 
   // support the CUPS "cm-calibration" option
   cm_calibrate = cfCmGetCupsColorCalibrateMode(data);
@@ -1773,7 +1790,7 @@ cfFilterPWGToPDF(int inputfd,  // I - File descriptor input stream
   }
 
   // Transform
-  ras = cupsRasterOpen(inputfd, CUPS_RASTER_READ);
+  ras = cfRasterOpen(inputfd, CUPS_RASTER_READ);
 
   // Process pages as needed...
   Page = 0;
@@ -1953,7 +1970,7 @@ cfFilterPWGToPDF(int inputfd,  // I - File descriptor input stream
     }
   }
 
-  while (cupsRasterReadHeader(ras, &header))
+  while (cfRasterReadHeader(ras, &header))
   {
     if (iscanceled && iscanceled(icd))
     {
@@ -2056,13 +2073,13 @@ cfFilterPWGToPDF(int inputfd,  // I - File descriptor input stream
   if (doc.colorProfile != NULL)
     cmsCloseProfile(doc.colorProfile);
 
-  cupsRasterClose(ras);
+  cfRasterClose(ras);
   fclose(outputfp);
 
   return (Page == 0);
 
 error:
-  cupsRasterClose(ras);
+  cfRasterClose(ras);
   fclose(outputfp);
 
   return (ret);
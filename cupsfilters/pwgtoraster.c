@@ -1098,7 +1098,7 @@ get_cms_color_space_type(cmsColorSpaceSignature cs)
 
 
 // select convertLine function
-static int select_convert_func(cups_raster_t *raster,
+static int select_convert_func(cf_raster_t *raster,
 			       pwgtoraster_doc_t* doc,
 			       conversion_function_t *convert)
 {
@@ -1288,8 +1288,8 @@ static int select_convert_func(cups_raster_t *raster,
 static bool
 out_page(pwgtoraster_doc_t *doc,
 	 int pageNo,
-	 cups_raster_t *inras,
-	 cups_raster_t *outras,
+	 cf_raster_t *inras,
+	 cf_raster_t *outras,
 	 conversion_function_t *convert)
 {
   int i, j;
@@ -1330,7 +1330,7 @@ out_page(pwgtoraster_doc_t *doc,
     return (false);
   }
 
-  if (!cupsRasterReadHeader(inras, &(doc->inheader)))
+  if (!cfRasterReadHeader(inras, &(doc->inheader)))
   {
     // Done
     log(ld, CF_LOGLEVEL_DEBUG,
@@ -1481,7 +1481,7 @@ out_page(pwgtoraster_doc_t *doc,
   if (doc->outheader.cupsColorOrder == CUPS_ORDER_BANDED)
     doc->outheader.cupsBytesPerLine *= doc->outheader.cupsNumColors;
 
-  if (!cupsRasterWriteHeader(outras, &(doc->outheader)))
+  if (!cfRasterWriteHeader(outras, &(doc->outheader)))
   {
     if (log) log(ld,CF_LOGLEVEL_ERROR,
 		 "cfFilterPWGToRaster: Can't write page %d header", pageNo);
@@ -1847,7 +1847,7 @@ out_page(pwgtoraster_doc_t *doc,
 	if (yin < doc->inheader.cupsHeight)
 	{
 	  // Read input pixel line
-	  if (cupsRasterReadPixels(inras, line,
+	  if (cfRasterReadPixels(inras, line,
 				   doc->inheader.cupsBytesPerLine) !=
 	      doc->inheader.cupsBytesPerLine)
 	  {
@@ -1885,7 +1885,7 @@ out_page(pwgtoraster_doc_t *doc,
 	      if (yin < doc->inheader.cupsHeight)
 	      {
 		// Read input pixel line
-		if (cupsRasterReadPixels(inras, line,
+		if (cfRasterReadPixels(inras, line,
 					 doc->inheader.cupsBytesPerLine) !=
 		    doc->inheader.cupsBytesPerLine)
 		{
@@ -2210,7 +2210,7 @@ out_page(pwgtoraster_doc_t *doc,
 	dp = convertLine(bp, lineBuf, y - doc->bitmapoffset[1],
 			 plane + band, doc->outheader.cupsWidth,
 			 doc->bytesPerLine, doc, convert->convertCSpace);
-	cupsRasterWritePixels(outras, dp, doc->bytesPerLine);
+	cfRasterWritePixels(outras, dp, doc->bytesPerLine);
       }
 
       // Clean up from pre-conversion
@@ -2223,7 +2223,7 @@ out_page(pwgtoraster_doc_t *doc,
 
   // Read remaining input pixel lines
   for (; yin < doc->inheader.cupsHeight; yin ++)
-    if (cupsRasterReadPixels(inras, line,
+    if (cfRasterReadPixels(inras, line,
 			     doc->inheader.cupsBytesPerLine) !=
 	doc->inheader.cupsBytesPerLine)
     {
@@ -2359,7 +2359,7 @@ cfFilterPWGToRaster(int inputfd,        // I - File descriptor input stream
   pwgtoraster_doc_t          doc;
   int                        i;
   const char		     *val;
-  cups_raster_t              *inras = NULL,
+  cf_raster_t                *inras = NULL,
                              *outras = NULL;
   conversion_function_t      convert;
   cf_logfunc_t               log = data->logfunc;
@@ -2397,7 +2397,7 @@ cfFilterPWGToRaster(int inputfd,        // I - File descriptor input stream
   // Open the input data stream specified by inputfd ...
   //
   
-  if ((inras = cupsRasterOpen(inputfd, CUPS_RASTER_READ)) == NULL)
+  if ((inras = cfRasterOpen(inputfd, CUPS_RASTER_READ)) == NULL)
   {
     if (!iscanceled || !iscanceled(icd))
     {
@@ -2523,7 +2523,7 @@ cfFilterPWGToRaster(int inputfd,        // I - File descriptor input stream
   // Open output raster stream
   //
 
-  if ((outras = cupsRasterOpen(outputfd, (outformat ==
+  if ((outras = cfRasterOpen(outputfd, (outformat ==
 					  CF_FILTER_OUT_FORMAT_CUPS_RASTER ?
 					  CUPS_RASTER_WRITE :
 					  (outformat ==
@@ -2635,10 +2635,10 @@ cfFilterPWGToRaster(int inputfd,        // I - File descriptor input stream
   //
 
   if (inras)
-    cupsRasterClose(inras);
+    cfRasterClose(inras);
   close(inputfd);
   if (outras)
-    cupsRasterClose(outras);
+    cfRasterClose(outras);
   close(outputfd);
 
   //
@@ -12,6 +12,16 @@
 //   cfRasterPrepareHeader()    - Prepare a Raster header for a job
 //   cfRasterSetColorSpace()    - Find best color space for print-color-mode
 //                                and print-quality setting
+//   cfRasterOpen()             - Open a raster stream, passing pages as
+//                                shared memory frames if possible
+//   cfRasterClose()            - Close a raster stream
+//   cfRasterIsFramed()         - Does the raster stream use frames?
+//   cfRasterReadHeader()       - Read the header of the next page
+//   cfRasterReadPixels()       - Read pixel data of the current page
+//   cfRasterReadPixelsInPlace() - Access pixel data without copying
+//   cfRasterWriteHeader()      - Start a new page
+//   cfRasterWritePixels()      - Write pixel data of the current page
+//   cfRasterFrameSocketPair()  - Create a connection for raster frames
 //
 
 //
@@ -30,6 +40,68 @@
 #include <cupsfilters/libcups2-private.h>
 #include <cups/pwg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+
+//
+// Constants...
+//
+
+#define RASTER_FRAME_MAGIC	0x63665246 // "cfRF", frame message
+#define RASTER_FRAME_MAX_IN_FLIGHT 2	// Pages sent but not yet released
+					// by the reader
+#define RASTER_FRAME_MAX_SIZE	(16 * 1024 * 1024)
+					// Largest page passed as a shared
+					// memory frame, the pixels of larger
+					// pages get streamed as through a pipe
+
+
+//
+// Types...
+//
+
+struct cf_raster_s			// Raster stream
+{
+  cups_raster_t	*ras;			// CUPS raster stream if not framed
+  cups_raster_mode_t mode;		// Mode of the stream
+  int		fd,			// File descriptor
+		reading,		// Reading stream?
+		framed,			// Pages passed as frames?
+		memfd,			// Shared memory of current page
+		stream,			// Socket streaming the pixels of the
+					// current page if it is too large for
+					// a frame, -1 otherwise
+		in_flight,		// Frames not yet released by reader
+		page,			// Holding a page frame?
+		error;			// Error sending frames?
+  cups_page_header_t header;		// Header of current page
+  unsigned char	*pixels;		// Pixels of current page
+  size_t	size,			// Size of current page
+		pos;			// Read/write position in page
+};
+
+typedef struct raster_frame_msg_s	// Frame message, the shared memory
+					// file descriptor is attached
+{
+  uint32_t	magic;			// RASTER_FRAME_MAGIC
+  uint32_t	streamed;		// Attached is a stream socket which
+					// delivers the pixels instead
+  cups_page_header_t header;		// Page header
+  uint64_t	size;			// Size of the shared memory
+} raster_frame_msg_t;
+
+typedef struct raster_mem_s		// Memory for passing a page header
+					// through libcups
+{
+  unsigned char	data[4096];		// Raster data
+  size_t	len,			// Bytes written
+		pos;			// Bytes read
+} raster_mem_t;
 
 //
 // Local functions
@@ -37,6 +109,16 @@
 
 static int raster_base_header(cups_page_header_t *h, cf_filter_data_t *data,
 			      int pwg_raster);
+static void raster_frame_release(cf_raster_t *r);
+static int raster_frame_send(cf_raster_t *r);
+static int raster_header_normalize(cups_raster_mode_t mode,
+				   cups_page_header_t *h,
+				   cups_page_header_t *out);
+static int raster_is_frame_socket(int fd);
+static ssize_t raster_mem_read(void *ctx, unsigned char *buffer,
+			       size_t length);
+static ssize_t raster_mem_write(void *ctx, unsigned char *buffer,
+				size_t length);
 
 //
 // '_strlcpy()' - Safely copy two strings.
@@ -832,6 +914,375 @@ cfRasterSetColorSpace(cups_page_header_t *h,   // I  - Raster header
   return (0);
 }
 
+//
+// 'cfRasterOpen()' - Open a raster stream for reading or writing. If
+//                    the file descriptor is a raster frame socket
+//                    (see cfRasterFrameSocketPair()), whole pages are
+//                    passed as shared memory frames, otherwise this
+//                    is a thin wrapper around cupsRasterOpen().
+//
+
+cf_raster_t *				// O - Raster stream or NULL on error
+cfRasterOpen(int fd,			// I - File descriptor
+	     cups_raster_mode_t mode)	// I - Mode, as for cupsRasterOpen()
+{
+  cf_raster_t	*r;			// Raster stream
+
+
+  if ((r = calloc(1, sizeof(cf_raster_t))) == NULL)
+    return (NULL);
+
+  r->fd      = fd;
+  r->mode    = mode;
+  r->memfd   = -1;
+  r->stream  = -1;
+  r->reading = (mode == CUPS_RASTER_READ);
+  r->framed  = raster_is_frame_socket(fd);
+
+  if (!r->framed && (r->ras = cupsRasterOpen(fd, mode)) == NULL)
+  {
+    free(r);
+    return (NULL);
+  }
+
+  return (r);
+}
+
+
+//
+// 'cfRasterClose()' - Close a raster stream, sending out the last page
+//                     frame. The file descriptor is not closed.
+//
+
+void
+cfRasterClose(cf_raster_t *r)		// I - Raster stream
+{
+  if (!r)
+    return;
+
+  if (r->ras)
+    cupsRasterClose(r->ras);
+  else if (r->reading)
+    raster_frame_release(r);
+  else
+    raster_frame_send(r);
+
+  free(r);
+}
+
+
+//
+// 'cfRasterIsFramed()' - Return whether the raster stream passes the
+//                        pages as shared memory frames.
+//
+
+int					// O - 1 if framed, 0 otherwise
+cfRasterIsFramed(cf_raster_t *r)	// I - Raster stream
+{
+  return (r && r->framed);
+}
+
+
+//
+// 'cfRasterReadHeader()' - Read the header of the next page.
+//
+
+int					// O - 1 on success, 0 on EOF/error
+cfRasterReadHeader(cf_raster_t *r,	// I - Raster stream
+		   cups_page_header_t *h) // O - Page header
+{
+  raster_frame_msg_t	msg;		// Frame message
+  struct msghdr		mh;		// Message with file descriptor
+  struct iovec		iov;		// Data part of message
+  struct cmsghdr	*cmsg;		// Control part of message
+  union
+  {
+    char		buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr	align;
+  }			control;	// Buffer for control part
+  ssize_t		n;		// Bytes received
+  int			memfd = -1;	// Shared memory of the page
+  void			*pixels;	// Mapped page
+
+
+  if (!r || !r->reading)
+    return (0);
+
+  if (r->ras)
+    return (cupsRasterReadHeader(r->ras, h) ? 1 : 0);
+
+  // Give the frame of the previous page back to the writer
+  raster_frame_release(r);
+
+  memset(&mh, 0, sizeof(mh));
+  iov.iov_base       = &msg;
+  iov.iov_len        = sizeof(msg);
+  mh.msg_iov         = &iov;
+  mh.msg_iovlen      = 1;
+  mh.msg_control     = control.buf;
+  mh.msg_controllen  = sizeof(control.buf);
+
+  while ((n = recvmsg(r->fd, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+
+  for (cmsg = CMSG_FIRSTHDR(&mh); n > 0 && cmsg;
+       cmsg = CMSG_NXTHDR(&mh, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+      memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (n != sizeof(msg) || msg.magic != RASTER_FRAME_MAGIC || memfd < 0 ||
+      msg.size < (uint64_t)msg.header.cupsBytesPerLine *
+		 msg.header.cupsHeight)
+  {
+    // EOF or garbage
+    if (memfd >= 0)
+      close(memfd);
+    return (0);
+  }
+
+  if (msg.streamed)
+    r->stream = memfd;
+  else if (msg.size > 0)
+  {
+    pixels = mmap(NULL, (size_t)msg.size, PROT_READ, MAP_SHARED, memfd, 0);
+    close(memfd);
+    if (pixels == MAP_FAILED)
+      return (0);
+    r->pixels = pixels;
+  }
+  else
+    close(memfd);
+
+  r->header = msg.header;
+  r->size   = (size_t)msg.size;
+  r->pos    = 0;
+  r->page   = 1;
+  *h        = msg.header;
+
+  return (1);
+}
+
+
+//
+// 'cfRasterReadPixels()' - Read pixel data of the current page.
+//
+
+unsigned				// O - Bytes read, 0 on EOF/error
+cfRasterReadPixels(cf_raster_t *r,	// I - Raster stream
+		   unsigned char *p,	// O - Pixel buffer
+		   unsigned len)	// I - Bytes to read
+{
+  const unsigned char	*src;		// Pixels in the frame
+  unsigned		done = 0;	// Bytes received
+  ssize_t		n;
+
+
+  if (r && r->ras)
+    return ((unsigned)cupsRasterReadPixels(r->ras, p, len));
+
+  if (r && r->reading && r->stream >= 0)
+  {
+    // Page too large for a frame, receive the pixels
+    if (len > r->size - r->pos)
+      return (0);
+
+    while (done < len)
+    {
+      if ((n = recv(r->stream, p + done, len - done, MSG_WAITALL)) > 0)
+	done += (unsigned)n;
+      else if (n == 0 || errno != EINTR)
+	return (0);
+    }
+
+    r->pos += len;
+
+    return (len);
+  }
+
+  if ((src = cfRasterReadPixelsInPlace(r, len)) == NULL)
+    return (0);
+
+  memcpy(p, src, len);
+
+  return (len);
+}
+
+
+//
+// 'cfRasterReadPixelsInPlace()' - Return a pointer to the next len
+//                                 bytes of pixel data of the current
+//                                 page without copying them, NULL if
+//                                 the stream is not framed, the page
+//                                 is too large for a frame, or at the
+//                                 end of the page. The data is valid
+//                                 until the next header is read.
+//
+
+const unsigned char *			// O - Pixel data or NULL
+cfRasterReadPixelsInPlace(cf_raster_t *r, // I - Raster stream
+			  unsigned len)	// I - Bytes to read
+{
+  const unsigned char	*src;		// Pixels in the frame
+
+
+  if (!r || !r->framed || !r->reading || !r->pixels ||
+      len > r->size - r->pos)
+    return (NULL);
+
+  src     = r->pixels + r->pos;
+  r->pos += len;
+
+  return (src);
+}
+
+
+//
+// 'cfRasterWriteHeader()' - Start a new page. In a framed stream the
+//                           previous page gets sent and a shared
+//                           memory frame for the new page created.
+//                           Pages larger than RASTER_FRAME_MAX_SIZE
+//                           are sent right away and their pixels get
+//                           streamed, so memory stays bounded. The
+//                           header is normalized by libcups as when
+//                           written to a pipe.
+//
+
+int					// O - 1 on success, 0 on error
+cfRasterWriteHeader(cf_raster_t *r,	// I - Raster stream
+		    cups_page_header_t *h) // I - Page header
+{
+  size_t	size;			// Size of the page
+  int		sv[2];			// Stream socket for a large page
+
+
+  if (!r || r->reading)
+    return (0);
+
+  if (r->ras)
+    return (cupsRasterWriteHeader(r->ras, h) ? 1 : 0);
+
+  if (raster_frame_send(r) ||
+      !raster_header_normalize(r->mode, h, &r->header))
+    return (0);
+
+  h    = &r->header;
+  size = (size_t)h->cupsBytesPerLine * h->cupsHeight;
+
+  if (size > RASTER_FRAME_MAX_SIZE)
+  {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+      return (0);
+
+    // The reader gets the header with its end of the socket now,
+    // raster_frame_send() only closes our end after the last pixels
+    r->memfd  = sv[0];
+    r->stream = sv[1];
+    r->size   = size;
+    r->pos    = 0;
+
+    return (raster_frame_send(r) ? 0 : 1);
+  }
+
+#ifdef HAVE_MEMFD_CREATE
+  if ((r->memfd = memfd_create("cf-raster-frame", MFD_CLOEXEC)) < 0)
+#endif // HAVE_MEMFD_CREATE
+    return (0);
+
+  if (size > 0)
+  {
+    void *pixels;
+
+    if (ftruncate(r->memfd, (off_t)size) < 0 ||
+	(pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       r->memfd, 0)) == MAP_FAILED)
+    {
+      close(r->memfd);
+      r->memfd = -1;
+      return (0);
+    }
+    r->pixels = pixels;
+  }
+
+  r->header = *h;
+  r->size   = size;
+  r->pos    = 0;
+
+  return (1);
+}
+
+
+//
+// 'cfRasterWritePixels()' - Write pixel data of the current page.
+//
+
+unsigned				// O - Bytes written, 0 on error
+cfRasterWritePixels(cf_raster_t *r,	// I - Raster stream
+		    unsigned char *p,	// I - Pixel data
+		    unsigned len)	// I - Bytes to write
+{
+  if (!r || r->reading)
+    return (0);
+
+  if (r->ras)
+    return ((unsigned)cupsRasterWritePixels(r->ras, p, len));
+
+  if (r->stream >= 0)
+  {
+    // Page too large for a frame, stream the pixels
+    unsigned	done = 0;		// Bytes sent
+    ssize_t	n;
+
+    if (len > r->size - r->pos)
+      return (0);
+
+    while (done < len)
+    {
+      if ((n = send(r->stream, p + done, len - done, MSG_NOSIGNAL)) > 0)
+	done += (unsigned)n;
+      else if (n == 0 || errno != EINTR)
+      {
+	r->error = 1;
+	return (0);
+      }
+    }
+
+    r->pos += len;
+
+    return (len);
+  }
+
+  if (!r->pixels || len > r->size - r->pos)
+    return (0);
+
+  memcpy(r->pixels + r->pos, p, len);
+  r->pos += len;
+
+  return (len);
+}
+
+
+//
+// 'cfRasterFrameSocketPair()' - Create a connection for passing raster
+//                               pages as shared memory frames, to be
+//                               used instead of a pipe between a
+//                               raster-writing and a raster-reading
+//                               filter function.
+//
+
+int					// O - 0 on success, -1 on error
+cfRasterFrameSocketPair(int fds[2])	// O - Read and write end
+{
+#ifdef HAVE_MEMFD_CREATE
+  return (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds));
+#else
+  (void)fds;
+
+  errno = ENOSYS;
+  return (-1);
+#endif // HAVE_MEMFD_CREATE
+}
+
+
 
 static int                                 // O - -1 on error, 0 on success
 raster_base_header(cups_page_header_t *h,  // O - Raster header
@@ -1916,3 +2367,237 @@ raster_base_header(cups_page_header_t *h,  // O - Raster header
 
   return (0);
 }
+
+
+//
+// 'raster_frame_release()' - Unmap the frame of the current page of a
+//                            reading raster stream and tell the
+//                            writer that we are done with it.
+//
+
+static void
+raster_frame_release(cf_raster_t *r)	// I - Raster stream
+{
+  char	ack = 'A';			// Acknowledgement
+
+
+  if (!r->page)
+    return;
+
+  if (r->pixels)
+    munmap(r->pixels, r->size);
+
+  if (r->stream >= 0)
+    close(r->stream);
+
+  r->pixels = NULL;
+  r->stream = -1;
+  r->size   = 0;
+  r->page   = 0;
+
+  while (send(r->fd, &ack, 1, MSG_NOSIGNAL) < 0 && errno == EINTR);
+}
+
+
+//
+// 'raster_frame_send()' - Send the frame of the current page of a
+//                         writing raster stream to the reader, waiting
+//                         for the reader to release older frames
+//                         first, so that only a few pages are in
+//                         memory at once. A streamed page is sent
+//                         with its header, so here its stream only
+//                         gets closed.
+//
+
+static int				// O - 0 on success, -1 on error
+raster_frame_send(cf_raster_t *r)	// I - Raster stream
+{
+  raster_frame_msg_t	msg;		// Frame message
+  struct msghdr		mh;		// Message with file descriptor
+  struct iovec		iov;		// Data part of message
+  struct cmsghdr	*cmsg;		// Control part of message
+  union
+  {
+    char		buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr	align;
+  }			control;	// Buffer for control part
+  char			ack;		// Acknowledgement
+  ssize_t		n;
+  int			ret = 0;
+
+
+  if (r->stream >= 0 && r->memfd < 0)
+  {
+    close(r->stream);
+    r->stream = -1;
+  }
+
+  if (r->memfd < 0 || r->error)
+    return (r->error ? -1 : 0);
+
+  if (r->pixels)
+    munmap(r->pixels, r->size);
+  r->pixels = NULL;
+
+  while (r->in_flight >= RASTER_FRAME_MAX_IN_FLIGHT)
+  {
+    if ((n = recv(r->fd, &ack, 1, 0)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    r->in_flight --;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.magic    = RASTER_FRAME_MAGIC;
+  msg.streamed = (r->stream >= 0);
+  msg.header   = r->header;
+  msg.size     = r->size;
+
+  memset(&mh, 0, sizeof(mh));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base       = &msg;
+  iov.iov_len        = sizeof(msg);
+  mh.msg_iov         = &iov;
+  mh.msg_iovlen      = 1;
+  mh.msg_control     = control.buf;
+  mh.msg_controllen  = sizeof(control.buf);
+  cmsg               = CMSG_FIRSTHDR(&mh);
+  cmsg->cmsg_level   = SOL_SOCKET;
+  cmsg->cmsg_type    = SCM_RIGHTS;
+  cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &r->memfd, sizeof(int));
+
+  while ((n = sendmsg(r->fd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+
+  if (n < 0)
+  {
+    r->error = 1;
+    ret      = -1;
+  }
+  else
+    r->in_flight ++;
+
+  close(r->memfd);
+  r->memfd = -1;
+
+  return (ret);
+}
+
+
+//
+// 'raster_header_normalize()' - Pass a page header through libcups as
+//                               if it was written to a pipe and read
+//                               back, so that a framed page carries the
+//                               same header as a page in a raster file.
+//
+
+static int				// O - 1 on success, 0 on error
+raster_header_normalize(
+    cups_raster_mode_t mode,		// I - Mode of the writing stream
+    cups_page_header_t *h,		// I - Page header to write
+    cups_page_header_t *out)		// O - Page header as read back
+{
+  raster_mem_t	mem;			// Raster data
+  cups_raster_t	*ras;			// Raster stream
+  int		ret;
+
+
+  memset(&mem, 0, sizeof(mem));
+
+  if ((ras = cupsRasterOpenIO(raster_mem_write, &mem, mode)) == NULL)
+    return (0);
+
+  ret = cupsRasterWriteHeader(ras, h);
+  cupsRasterClose(ras);
+
+  if (!ret ||
+      (ras = cupsRasterOpenIO(raster_mem_read, &mem,
+				 CUPS_RASTER_READ)) == NULL)
+    return (0);
+
+  ret = cupsRasterReadHeader(ras, out);
+  cupsRasterClose(ras);
+
+  return (ret ? 1 : 0);
+}
+
+
+//
+// 'raster_is_frame_socket()' - Check whether a file descriptor is a
+//                              raster frame socket.
+//
+
+static int				// O - 1 if frame socket, 0 otherwise
+raster_is_frame_socket(int fd)		// I - File descriptor
+{
+#ifdef HAVE_MEMFD_CREATE
+  int		type = 0;		// Socket type
+  socklen_t	len = sizeof(type);	// Length of option value
+  struct stat	st;			// File information
+
+
+  if (fstat(fd, &st) || !S_ISSOCK(st.st_mode) ||
+      getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) ||
+      type != SOCK_SEQPACKET)
+    return (0);
+
+#  ifdef SO_DOMAIN
+  len = sizeof(type);
+  if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &type, &len) || type != AF_UNIX)
+    return (0);
+#  endif // SO_DOMAIN
+
+  return (1);
+#else
+  (void)fd;
+
+  return (0);
+#endif // HAVE_MEMFD_CREATE
+}
+
+
+//
+// 'raster_mem_read()' - Read raster data from memory.
+//
+
+static ssize_t				// O - Bytes read
+raster_mem_read(void          *ctx,	// I - Raster data
+		unsigned char *buffer,	// O - Buffer
+		size_t        length)	// I - Bytes to read
+{
+  raster_mem_t	*mem = (raster_mem_t *)ctx;
+					// Raster data
+
+
+  if (length > mem->len - mem->pos)
+    length = mem->len - mem->pos;
+
+  memcpy(buffer, mem->data + mem->pos, length);
+  mem->pos += length;
+
+  return ((ssize_t)length);
+}
+
+
+//
+// 'raster_mem_write()' - Write raster data to memory.
+//
+
+static ssize_t				// O - Bytes written, -1 if full
+raster_mem_write(void          *ctx,	// I - Raster data
+		 unsigned char *buffer,	// I - Data
+		 size_t        length)	// I - Bytes to write
+{
+  raster_mem_t	*mem = (raster_mem_t *)ctx;
+					// Raster data
+
+
+  if (length > sizeof(mem->data) - mem->len)
+    return (-1);
+
+  memcpy(mem->data + mem->len, buffer, length);
+  mem->len += length;
+
+  return ((ssize_t)length);
+}
@@ -45,6 +45,15 @@ extern "C" {
 #endif
 
 
+//
+// Types...
+//
+
+typedef struct cf_raster_s cf_raster_t;	// Raster stream, passing pages
+					// as shared memory frames between
+					// filter functions where possible
+
+
 //
 // Prototypes...
 //
@@ -63,6 +72,20 @@ extern int              cfRasterSetColorSpace(cups_page_header_t *h,
 					      const char *color_mode,
 					      cups_cspace_t *cspace,
 					      int *high_depth);
+extern cf_raster_t      *cfRasterOpen(int fd, cups_raster_mode_t mode);
+extern void             cfRasterClose(cf_raster_t *r);
+extern int              cfRasterIsFramed(cf_raster_t *r);
+extern int              cfRasterReadHeader(cf_raster_t *r,
+					   cups_page_header_t *h);
+extern unsigned         cfRasterReadPixels(cf_raster_t *r, unsigned char *p,
+					   unsigned len);
+extern const unsigned char *cfRasterReadPixelsInPlace(cf_raster_t *r,
+						      unsigned len);
+extern int              cfRasterWriteHeader(cf_raster_t *r,
+					    cups_page_header_t *h);
+extern unsigned         cfRasterWritePixels(cf_raster_t *r, unsigned char *p,
+					    unsigned len);
+extern int              cfRasterFrameSocketPair(int fds[2]);
 
 #  ifdef __cplusplus
 }
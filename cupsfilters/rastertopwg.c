@@ -34,8 +34,8 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 		    void *parameters)    // I - Filter-specific parameters
                                          //     (unused)
 {
-  cups_raster_t		*inras;		// Input raster stream
-  cups_raster_t         *outras;	// Output raster stream
+  cf_raster_t		*inras;		// Input raster stream
+  cf_raster_t           *outras;	// Output raster stream
   cups_page_header_t	inheader,	// Input raster page header
 			outheader;	// Output raster page header
   unsigned		y;		// Current line
@@ -73,9 +73,9 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
   if (val)
   {
     if (strcasestr(val, "pwg") || strcasestr(val, "pclm"))
-      outras = cupsRasterOpen(outputfd, CUPS_RASTER_WRITE_PWG);
+      outras = cfRasterOpen(outputfd, CUPS_RASTER_WRITE_PWG);
     else if (strcasestr(val, "urf"))
-      outras = cupsRasterOpen(outputfd, CUPS_RASTER_WRITE_APPLE);
+      outras = cfRasterOpen(outputfd, CUPS_RASTER_WRITE_APPLE);
     else
     {
       if (log) log(ld, CF_LOGLEVEL_ERROR,
@@ -91,14 +91,14 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
     if (log) log(ld, CF_LOGLEVEL_WARN,
 		 "cfFilterRasterToPWG: Output format not specified, defaulting to PWG Raster.");
     
-    outras = cupsRasterOpen(outputfd, CUPS_RASTER_WRITE_PWG);
+    outras = cfRasterOpen(outputfd, CUPS_RASTER_WRITE_PWG);
   }
 
   num_options = cfJoinJobOptionsAndAttrs(data, num_options, &options);
 
-  inras  = cupsRasterOpen(inputfd, CUPS_RASTER_READ);
+  inras  = cfRasterOpen(inputfd, CUPS_RASTER_READ);
 
-  while (cupsRasterReadHeader(inras, &inheader))
+  while (cfRasterReadHeader(inras, &inheader))
   {
     if (iscanceled && iscanceled(icd))
     {
@@ -515,7 +515,7 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 					// ImageBoxBottom
     }
 
-    if (!cupsRasterWriteHeader(outras, &outheader))
+    if (!cfRasterWriteHeader(outras, &outheader))
     {
       if (log) log(ld, CF_LOGLEVEL_ERROR,
 		   "cfFilterRasterToPWG: Error sending raster data.");
@@ -539,7 +539,7 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 
     memset(line, white, linesize);
     for (y = page_top; y > 0; y --)
-      if (!cupsRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
+      if (!cfRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
       {
 	if (log) log(ld, CF_LOGLEVEL_ERROR,
 		     "cfFilterRasterToPWG: Error sending raster data.");
@@ -552,7 +552,7 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 
     for (y = inheader.cupsHeight; y > 0; y --)
     {
-      if (cupsRasterReadPixels(inras, line + lineoffset,
+      if (cfRasterReadPixels(inras, line + lineoffset,
 			       inheader.cupsBytesPerLine) !=
 	  inheader.cupsBytesPerLine)
       {
@@ -565,7 +565,7 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 	goto fail;
       }
 
-      if (!cupsRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
+      if (!cfRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
       {
 	if (log) log(ld, CF_LOGLEVEL_ERROR,
 		     "cfFilterRasterToPWG: Error sending raster data.");
@@ -579,7 +579,7 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 
     memset(line, white, linesize);
     for (y = page_bottom; y > 0; y --)
-      if (!cupsRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
+      if (!cfRasterWritePixels(outras, line, outheader.cupsBytesPerLine))
       {
 	if (log) log(ld, CF_LOGLEVEL_ERROR,
 		     "cfFilterRasterToPWG: Error sending raster data.");
@@ -596,10 +596,10 @@ cfFilterRasterToPWG(int inputfd,         // I - File descriptor input stream
 
  fail:
 
-  cupsRasterClose(inras);
+  cfRasterClose(inras);
   close(inputfd);
 
-  cupsRasterClose(outras);
+  cfRasterClose(outras);
   close(outputfd);
 
   cupsFreeOptions(num_options, options);
@@ -0,0 +1,279 @@
+//
+// Colorspace conversion test and benchmark program for libcupsfilters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()          - Main entry...
+//   bench_convert() - Time converting a page worth of pixels.
+//   test_convert()  - Compare the SIMD converters with the C code.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "image-private.h"
+#include <stdio.h>
+#include <time.h>
+
+
+//
+// Types...
+//
+
+typedef void (*convert_t)(const cf_ib_t *in, cf_ib_t *out, int count);
+					// Public converter
+
+typedef struct convert_s		// Converter to test
+{
+  const char	*name;			// Name of converter
+  convert_t	convert;		// Converter
+  int		inbpp,			// Input bytes per pixel
+		outbpp;			// Output bytes per pixel
+} convert_test_t;
+
+
+//
+// Local globals...
+//
+
+static const char * const kernels[] =	// SIMD converters
+{
+  "avx2",
+  "neon"
+};
+static const convert_test_t converts[] =// Converters to test
+{
+  { "CMYKToBlack", cfImageCMYKToBlack, 4, 1 },
+  { "CMYKToCMY",   cfImageCMYKToCMY,   4, 3 },
+  { "CMYKToRGB",   cfImageCMYKToRGB,   4, 3 },
+  { "CMYKToWhite", cfImageCMYKToWhite, 4, 1 },
+  { "RGBToBlack",  cfImageRGBToBlack,  3, 1 },
+  { "RGBToCMY",    cfImageRGBToCMY,    3, 3 },
+  { "RGBToCMYK",   cfImageRGBToCMYK,   3, 4 },
+  { "RGBToWhite",  cfImageRGBToWhite,  3, 1 }
+};
+
+
+//
+// Local functions...
+//
+
+static double	bench_convert(const convert_test_t *c, int runs);
+static int	test_convert(const convert_test_t *c, const char *kernel);
+
+
+//
+// 'main()' - Main entry...
+//
+// Usage: testcolorspace [runs]
+//
+// Checks that all SIMD converters the CPU supports give the same output
+// as the C code.  With a number of runs given it also reports the speed
+// of each for a Letter size page at 600 DPI.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		runs,			// Benchmark runs
+		status = 0;		// Exit status
+  size_t	i, k;			// Looping vars
+  double	ref,			// Time of C code
+		secs;			// Time of SIMD code
+  const char	*best;			// Default converters
+
+
+  runs = argc > 1 ? atoi(argv[1]) : 0;
+  best = _cfImageColorKernel(NULL);
+
+  cfImageSetRasterColorSpace(CUPS_CSPACE_RGB);
+
+  for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+  {
+    if (strcmp(_cfImageColorKernel(kernels[k]), kernels[k]))
+      continue;
+
+    for (i = 0; i < sizeof(converts) / sizeof(converts[0]); i ++)
+    {
+      status |= test_convert(converts + i, kernels[k]);
+
+      if (runs > 0)
+      {
+	_cfImageColorKernel("c");
+	ref = bench_convert(converts + i, runs);
+
+	_cfImageColorKernel(kernels[k]);
+	secs = bench_convert(converts + i, runs);
+
+	printf("%s, %s converters: %.1f Mpixels/s (%.2fx)\n",
+	       converts[i].name, kernels[k], secs, secs / ref);
+      }
+    }
+  }
+
+  _cfImageColorKernel(best);
+
+  return (status);
+}
+
+
+//
+// 'bench_convert()' - Time converting a page worth of pixels.
+//
+
+static double				// O - Mpixels per second
+bench_convert(const convert_test_t *c,	// I - Converter
+	      int                  runs)// I - Number of runs
+{
+  cf_ib_t		*in,		// Input row
+			*out;		// Output row
+  struct timespec	start,		// Start time
+			end;		// End time
+  double		best = 0.0,	// Best time
+			secs;		// Time of run
+  int			run,		// Current run
+			x, y;		// Looping vars
+
+
+  in  = malloc(5100 * 4);
+  out = malloc(5100 * 4);
+
+  for (x = 0; x < 5100 * 4; x ++)
+    in[x] = (x * 7 + x / 13) & 255;
+
+  for (run = 0; run < runs; run ++)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (y = 0; y < 6600; y ++)
+      (*c->convert)(in, out, 5100);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+    if (run == 0 || secs < best)
+      best = secs;
+  }
+
+  free(in);
+  free(out);
+
+  return (best > 0.0 ? 1e-6 * 5100 * 6600 / best : 0.0);
+}
+
+
+//
+// 'test_convert()' - Compare the SIMD converters with the C code.
+//
+// RGB converters are checked with every RGB color, CMYK converters with
+// random colors and all combinations of 0, 1, 127, 254 and 255.  Rows of
+// all lengths up to 67 pixels check the pixels left over after the SIMD
+// blocks, and converters that don't grow the pixels are also checked in
+// place.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_convert(const convert_test_t *c,	// I - Converter
+             const char           *kernel)
+					// I - SIMD converters to test
+{
+  static const cf_ib_t edges[] = { 0, 1, 127, 254, 255 };
+					// Edge values of CMYK colors
+  cf_ib_t	*in,			// Input pixels
+		*ref,			// Output of C code
+		*out;			// Output of SIMD code
+  int		count,			// Number of pixels
+		x, len,			// Looping vars
+		inplace,		// Convert in place?
+		status = 0;		// Test status
+  unsigned	seed = 1;		// Random colors
+
+
+  count = 1 << 24;
+  in    = malloc((size_t)count * 4);
+  ref   = malloc((size_t)count * 4);
+  out   = malloc((size_t)count * 4);
+
+  if (c->inbpp == 3)
+  {
+    for (x = 0; x < count; x ++)
+    {
+      in[3 * x + 0] = x >> 16;
+      in[3 * x + 1] = x >> 8;
+      in[3 * x + 2] = x;
+    }
+  }
+  else
+  {
+    count = 1 << 20;
+
+    for (x = 0; x < 625; x ++)
+    {
+      in[4 * x + 0] = edges[x % 5];
+      in[4 * x + 1] = edges[x / 5 % 5];
+      in[4 * x + 2] = edges[x / 25 % 5];
+      in[4 * x + 3] = edges[x / 125];
+    }
+
+    for (x = 4 * 625; x < count * 4; x ++)
+    {
+      seed   = seed * 1103515245 + 12345;
+      in[x] = seed >> 24;
+    }
+  }
+
+  _cfImageColorKernel("c");
+  (*c->convert)(in, ref, count);
+
+  _cfImageColorKernel(kernel);
+  (*c->convert)(in, out, count);
+
+  if (memcmp(ref, out, (size_t)count * c->outbpp))
+  {
+    for (x = 0; x < count * c->outbpp && ref[x] == out[x]; x ++);
+
+    printf("%s, %s converters: FAIL (pixel %d color %d is %d, not %d)\n",
+           c->name, kernel, x / c->outbpp, x % c->outbpp, out[x], ref[x]);
+    status = 1;
+  }
+
+  for (inplace = 0; inplace < 2 && !status; inplace ++)
+  {
+    if (inplace && c->outbpp > c->inbpp)
+      break;
+
+    for (len = 0; len < 68 && !status; len ++)
+    {
+      _cfImageColorKernel("c");
+      memset(ref, 0xaa, 68 * 4);
+      memcpy(ref, in, (size_t)len * c->inbpp);
+      (*c->convert)(inplace ? ref : in, ref, len);
+
+      _cfImageColorKernel(kernel);
+      memset(out, 0xaa, 68 * 4);
+      memcpy(out, in, (size_t)len * c->inbpp);
+      (*c->convert)(inplace ? out : in, out, len);
+
+      if (memcmp(ref, out, 68 * 4))
+      {
+	printf("%s, %s converters: FAIL (%d pixels%s)\n", c->name, kernel,
+	       len, inplace ? " in place" : "");
+	status = 1;
+      }
+    }
+  }
+
+  if (!status)
+    printf("%s, %s converters: PASS\n", c->name, kernel);
+
+  free(in);
+  free(ref);
+  free(out);
+
+  return (status);
+}
@@ -2,12 +2,19 @@
 #include <ctype.h>
 #include <errno.h>
 #include <cupsfilters/filter.h>
+#include <cupsfilters/raster.h>
 #include <cups/cups.h>
 #include <cups/array.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #  if CUPS_VERSION_MAJOR < 3 /* CUPS 2.x and older */
 /* Functions changed in libcups3 */
@@ -228,7 +235,8 @@ test_wrapper(
 	char* outputMIME,
     	char* inputFile, 
 	char* outputFile, 
-	cups_array_t *filter_chain) 
+	cups_array_t *filter_chain,
+	cf_filter_stats_t *stats)	// I - Per-stage statistics or NULL
 {
   int	        inputfd;		// Print file descriptor
   int 		outputfd;		// File Descriptor for Output File
@@ -319,6 +327,8 @@ test_wrapper(
   filter_data.side_pipe[0] = 4;        // CUPS uses file descriptor 4 for
   filter_data.side_pipe[1] = 4;        // the side channel
   filter_data.extension = NULL;
+  if (stats)
+    cfFilterDataAddExt(&filter_data, CF_FILTER_STATS_EXT, stats);
   filter_data.logfunc = cfCUPSLogFunc;  // Logging scheme of CUPS
   filter_data.logdata = NULL;
   filter_data.iscanceledfunc = cfCUPSIsCanceledFunc; // Job-is-canceled
@@ -1118,7 +1128,8 @@ load_legacy_attributes(
 int 
 run_test(
     char * test_case, 
-    char * currentFile)
+    char * currentFile,
+    cf_filter_stats_t *stats)
 {
  
   cups_array_t *filter_chain = NULL;
@@ -1263,26 +1274,744 @@ run_test(
                        inputContentType, outputContentType,
                        inputFileName,    // Fixed variable name
                        outputFileName,   // Fixed variable name
-                       filter_chain);
+                       filter_chain, stats);
 
 }
 
+/*
+ * Benchmark mode
+ *
+ * With "--benchmark N" every test case is run N times, each run in its
+ * own child process, and a JSON report with pages/minute, MB/s, latency
+ * percentiles and the peak RSS of the whole process tree is written to
+ * stdout, so that results can be archived and compared across releases.
+ *
+ * The input file column of a test case can also name a synthetic
+ * document generator instead of a file:
+ *
+ *   @text:lines=N[,width=N]              Long plain text
+ *   @pdf:pages=N                         PDF with many text pages
+ *   @image:width=N,height=N              Huge RGB PNG image
+ *   @pwg:pages=N[,resolution=N]          A4 sRGB PWG Raster
+ *
+ * The document is generated into a temporary file once per test case.
+ */
+
+typedef struct bench_result_s		// Result of a benchmark run
+{
+  double	seconds;		// Wall-clock time of the run
+  int		pages;			// Pages reported by the filters
+  int		status;			// Exit status of the run
+} bench_result_t;
+
+
+/*
+ * 'bench_time()' - Return the monotonic time in seconds.
+ */
+
+static double				// O - Time in seconds
+bench_time(void)
+{
+  struct timespec ts;			// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/*
+ * 'bench_compare()' - Compare two run times for qsort().
+ */
+
+static int				// O - Result of comparison
+bench_compare(const void *a,		// I - First time
+              const void *b)		// I - Second time
+{
+  double da = *((const double *)a),	// First time
+	 db = *((const double *)b);	// Second time
+
+
+  return (da < db ? -1 : da > db ? 1 : 0);
+}
+
+
+/*
+ * 'bench_percentile()' - Nearest-rank percentile of sorted run times.
+ */
+
+static double				// O - Percentile value
+bench_percentile(const double *times,	// I - Sorted run times
+                 int          num_times,// I - Number of run times
+		 int          pct)	// I - Percentile (0-100)
+{
+  int	rank;				// Nearest rank
+
+
+  if (num_times < 1)
+    return (0.0);
+
+  rank = (pct * num_times + 99) / 100;
+  if (rank < 1)
+    rank = 1;
+
+  return (times[rank - 1]);
+}
+
+
+/*
+ * 'json_string()' - Write a JSON string literal.
+ */
+
+static void
+json_string(FILE       *fp,		// I - Output file
+            const char *s)		// I - String
+{
+  putc('\"', fp);
+  for (; *s; s ++)
+  {
+    if (*s == '\"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < ' ')
+      fprintf(fp, "\\u%04x", (unsigned char)*s);
+    else
+      putc(*s, fp);
+  }
+  putc('\"', fp);
+}
+
+
+/*
+ * 'gen_param()' - Get an integer parameter of a generator spec.
+ */
+
+static long				// O - Value
+gen_param(const char *params,		// I - "name=value,..." list
+          const char *name,		// I - Parameter name
+	  long       defval)		// I - Default value
+{
+  const char	*ptr;			// Pointer into list
+  size_t	namelen = strlen(name);	// Length of name
+  long		val;			// Value
+
+
+  for (ptr = params; ptr && *ptr; ptr = strchr(ptr, ','), ptr = ptr ? ptr + 1 : NULL)
+    if (!strncmp(ptr, name, namelen) && ptr[namelen] == '=')
+    {
+      if ((val = strtol(ptr + namelen + 1, NULL, 10)) > 0)
+        return (val);
+      break;
+    }
+
+  return (defval);
+}
+
+
+/*
+ * 'gen_text()' - Generate a long plain text document.
+ */
+
+static int				// O - 0 on success
+gen_text(FILE *fp,			// I - Output file
+         long lines,			// I - Number of lines
+	 long width)			// I - Maximum line length
+{
+  static const char * const words[] =	// Words to use
+  {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua"
+  };
+  long		i, col;			// Looping vars
+  unsigned	w = 0;			// Current word
+  size_t	len;			// Word length
+
+
+  for (i = 0; i < lines; i ++)
+  {
+    for (col = 0;;)
+    {
+      len = strlen(words[(w >> 16) % 19]);
+      if (col + (long)len + 1 > width)
+        break;
+      fprintf(fp, col ? " %s" : "%s", words[(w >> 16) % 19]);
+      col += (long)len + (col ? 1 : 0);
+      w = w * 1103515245 + 12345;
+    }
+    putc('\n', fp);
+  }
+
+  return (ferror(fp));
+}
+
+
+/*
+ * 'gen_pdf()' - Generate a PDF document with many pages.
+ */
+
+static int				// O - 0 on success
+gen_pdf(FILE *fp,			// I - Output file
+        long pages)			// I - Number of pages
+{
+  long		i, j;			// Looping vars
+  long		num_objs = 3 + 2 * pages;// Number of objects
+  long		*offsets;		// Object offsets
+  long		xref;			// Offset of xref table
+  char		content[4096];		// Page content stream
+  int		len;			// Length of content stream
+
+
+  if ((offsets = calloc((size_t)num_objs + 1, sizeof(long))) == NULL)
+    return (-1);
+
+  fputs("%PDF-1.4\n", fp);
+
+  offsets[1] = ftell(fp);
+  fputs("1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n", fp);
+
+  offsets[2] = ftell(fp);
+  fputs("2 0 obj\n<< /Type /Pages /Kids [", fp);
+  for (i = 0; i < pages; i ++)
+    fprintf(fp, " %ld 0 R", 4 + 2 * i);
+  fprintf(fp, " ] /Count %ld >>\nendobj\n", pages);
+
+  offsets[3] = ftell(fp);
+  fputs("3 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\n"
+        "endobj\n", fp);
+
+  for (i = 0; i < pages; i ++)
+  {
+    len = snprintf(content, sizeof(content),
+		   "BT /F1 24 Tf 72 760 Td (Page %ld of %ld) Tj ET\n"
+		   "BT /F1 10 Tf 72 730 Td 12 TL\n", i + 1, pages);
+    for (j = 0; j < 50 && len < (int)sizeof(content) - 80; j ++)
+      len += snprintf(content + len, sizeof(content) - (size_t)len,
+		      "(Synthetic benchmark line %ld on page %ld) '\n",
+		      j + 1, i + 1);
+    len += snprintf(content + len, sizeof(content) - (size_t)len, "ET\n");
+
+    offsets[4 + 2 * i] = ftell(fp);
+    fprintf(fp, "%ld 0 obj\n<< /Type /Page /Parent 2 0 R "
+	    "/MediaBox [0 0 595 842] /Resources << /Font << /F1 3 0 R >> >> "
+	    "/Contents %ld 0 R >>\nendobj\n", 4 + 2 * i, 5 + 2 * i);
+
+    offsets[5 + 2 * i] = ftell(fp);
+    fprintf(fp, "%ld 0 obj\n<< /Length %d >>\nstream\n%sendstream\nendobj\n",
+	    5 + 2 * i, len, content);
+  }
+
+  xref = ftell(fp);
+  fprintf(fp, "xref\n0 %ld\n0000000000 65535 f \n", num_objs);
+  for (i = 1; i < num_objs; i ++)
+    fprintf(fp, "%010ld 00000 n \n", offsets[i]);
+  fprintf(fp, "trailer\n<< /Size %ld /Root 1 0 R >>\nstartxref\n%ld\n%%%%EOF\n",
+	  num_objs, xref);
+
+  free(offsets);
+
+  return (ferror(fp));
+}
+
+
+/*
+ * 'png_put32()' - Store a big-endian 32-bit value.
+ */
+
+static void
+png_put32(unsigned char *p,		// I - Buffer
+          unsigned long v)		// I - Value
+{
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+
+/*
+ * 'png_chunk()' - Write a PNG chunk.
+ */
+
+static void
+png_chunk(FILE                *fp,	// I - Output file
+          const char          *type,	// I - Chunk type
+	  const unsigned char *data,	// I - Chunk data
+	  size_t              len)	// I - Length of data
+{
+  unsigned char	buf[4];			// Length/CRC buffer
+  uLong		crc;			// Chunk CRC
+
+
+  png_put32(buf, len);
+  fwrite(buf, 1, 4, fp);
+  fwrite(type, 1, 4, fp);
+  fwrite(data, 1, len, fp);
+
+  crc = crc32(0, (const Bytef *)type, 4);
+  if (len > 0)
+    crc = crc32(crc, data, (uInt)len);	// crc32() resets on NULL data
+  png_put32(buf, crc);
+  fwrite(buf, 1, 4, fp);
+}
+
+
+/*
+ * 'gen_png()' - Generate a huge RGB PNG image.
+ *
+ * The image data is deflated without compression, row by row, so that
+ * decoding cost is dominated by the image filters rather than by
+ * inflate.
+ */
+
+static int				// O - 0 on success
+gen_png(FILE *fp,			// I - Output file
+        long width,			// I - Width in pixels
+	long height)			// I - Height in pixels
+{
+  unsigned char	*row,			// Filtered row of the image
+		*chunk;			// IDAT chunk buffer
+  z_stream	strm;			// Deflate stream
+  unsigned char	ihdr[13];		// IHDR chunk
+  long		x, y;			// Looping vars
+  unsigned char	*p;			// Pointer into row
+  int		ret = Z_OK;		// Deflate status
+
+
+  memset(&strm, 0, sizeof(strm));
+
+  row   = malloc((size_t)width * 3 + 1);
+  chunk = malloc(65536);
+
+  if (!row || !chunk || deflateInit(&strm, Z_NO_COMPRESSION) != Z_OK)
+  {
+    free(row);
+    free(chunk);
+    return (-1);
+  }
+
+  fwrite("\211PNG\r\n\032\n", 1, 8, fp);
+
+  png_put32(ihdr, (unsigned long)width);
+  png_put32(ihdr + 4, (unsigned long)height);
+  ihdr[8]  = 8;				// Bit depth
+  ihdr[9]  = 2;				// RGB
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+  png_chunk(fp, "IHDR", ihdr, 13);
+
+  strm.next_out  = chunk;
+  strm.avail_out = 65536;
+
+  for (y = 0; y <= height && ret == Z_OK; y ++)
+  {
+    if (y < height)
+    {
+      p    = row;
+      *p++ = 0;				// Filter type "None"
+
+      for (x = 0; x < width; x ++)
+      {
+	*p++ = (unsigned char)(x * 255 / width);
+	*p++ = (unsigned char)(y * 255 / height);
+	*p++ = (unsigned char)((x ^ y) & 255);
+      }
+
+      strm.next_in  = row;
+      strm.avail_in = (uInt)(p - row);
+    }
+
+    // Write out an IDAT chunk whenever the buffer is full, and the rest
+    // after the last row
+    do
+    {
+      ret = deflate(&strm, y < height ? Z_NO_FLUSH : Z_FINISH);
+
+      if (strm.avail_out == 0 || ret == Z_STREAM_END)
+      {
+	png_chunk(fp, "IDAT", chunk, 65536 - strm.avail_out);
+	strm.next_out  = chunk;
+	strm.avail_out = 65536;
+      }
+    }
+    while (ret == Z_OK && (strm.avail_in > 0 || y == height));
+  }
+
+  png_chunk(fp, "IEND", NULL, 0);
+
+  deflateEnd(&strm);
+  free(row);
+  free(chunk);
+
+  return (ret != Z_STREAM_END || ferror(fp));
+}
+
+
+/*
+ * 'gen_pwg()' - Generate a multi-page A4 sRGB PWG Raster document.
+ */
+
+static int				// O - 0 on success
+gen_pwg(int  fd,			// I - Output file descriptor
+        long pages,			// I - Number of pages
+	long resolution)		// I - Resolution in DPI
+{
+  cf_raster_t		*ras;		// Raster stream
+  cups_page_header_t	header;		// Page header
+  unsigned char		*line;		// Line buffer
+  unsigned		x, y;		// Looping vars
+  long			page;		// Current page
+  int			ret = 0;	// Return value
+
+
+  if ((ras = cfRasterOpen(fd, CUPS_RASTER_WRITE_PWG)) == NULL)
+    return (-1);
+
+  memset(&header, 0, sizeof(header));
+  strncpy(header.MediaType, "stationery", sizeof(header.MediaType) - 1);
+  strncpy(header.cupsPageSizeName, "iso_a4_210x297mm",
+	  sizeof(header.cupsPageSizeName) - 1);
+  header.HWResolution[0]  = (unsigned)resolution;
+  header.HWResolution[1]  = (unsigned)resolution;
+  header.PageSize[0]      = 595;
+  header.PageSize[1]      = 842;
+  header.NumCopies        = 1;
+  header.cupsWidth        = (unsigned)(595 * resolution / 72);
+  header.cupsHeight       = (unsigned)(842 * resolution / 72);
+  header.cupsBitsPerColor = 8;
+  header.cupsBitsPerPixel = 24;
+  header.cupsBytesPerLine = 3 * header.cupsWidth;
+  header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+  header.cupsColorSpace   = CUPS_CSPACE_SRGB;
+  header.cupsNumColors    = 3;
+
+  if ((line = malloc(header.cupsBytesPerLine)) == NULL)
+  {
+    cfRasterClose(ras);
+    return (-1);
+  }
+
+  for (page = 0; page < pages && !ret; page ++)
+  {
+    if (!cfRasterWriteHeader(ras, &header))
+    {
+      ret = -1;
+      break;
+    }
+
+    for (y = 0; y < header.cupsHeight; y ++)
+    {
+      // White page with a diagonal band and some text-like noise...
+      memset(line, 255, header.cupsBytesPerLine);
+      for (x = 0; x < header.cupsWidth; x ++)
+        if ((x + y + (unsigned)page * 64) % 512 < 32 ||
+	    ((y / 16) % 3 == 0 && ((x * 7 + y) % 11) < 4))
+	{
+	  line[3 * x]     = (unsigned char)(x & 255);
+	  line[3 * x + 1] = (unsigned char)(y & 255);
+	  line[3 * x + 2] = (unsigned char)(page * 40);
+	}
+
+      if (cfRasterWritePixels(ras, line, header.cupsBytesPerLine) <
+	  header.cupsBytesPerLine)
+      {
+        ret = -1;
+	break;
+      }
+    }
+  }
+
+  free(line);
+  cfRasterClose(ras);
+
+  return (ret);
+}
+
+
+/*
+ * 'generate_input()' - Create a synthetic input document from a generator
+ *                      spec like "@pdf:pages=500".
+ */
+
+static int				// O - 0 on success
+generate_input(const char *spec,	// I - Generator spec
+               char       *filename,	// O - Temporary file name
+	       size_t     filenamesize)	// I - Size of file name buffer
+{
+  const char	*params;		// Parameters
+  int		fd;			// Temporary file
+  FILE		*fp = NULL;		// Temporary file stream
+  int		ret;			// Return value
+
+
+  if ((params = strchr(spec, ':')) != NULL)
+    params ++;
+
+  if ((fd = cupsCreateTempFd(NULL, NULL, filename, (int)filenamesize)) < 0)
+  {
+    fprintf(stderr, "ERROR: Unable to create temporary file: %s\n",
+	    strerror(errno));
+    return (-1);
+  }
+
+  if (strncmp(spec, "@pwg", 4) && (fp = fdopen(fd, "w")) == NULL)
+  {
+    close(fd);
+    unlink(filename);
+    return (-1);
+  }
+
+  if (!strncmp(spec, "@text", 5))
+    ret = gen_text(fp, gen_param(params, "lines", 10000),
+		   gen_param(params, "width", 80));
+  else if (!strncmp(spec, "@pdf", 4))
+    ret = gen_pdf(fp, gen_param(params, "pages", 100));
+  else if (!strncmp(spec, "@image", 6))
+    ret = gen_png(fp, gen_param(params, "width", 4000),
+		  gen_param(params, "height", 4000));
+  else if (!strncmp(spec, "@pwg", 4))
+    ret = gen_pwg(fd, gen_param(params, "pages", 10),
+		  gen_param(params, "resolution", 300));
+  else
+  {
+    fprintf(stderr, "ERROR: Unknown document generator \"%s\"\n", spec);
+    ret = -1;
+  }
+
+  if (fp)
+  {
+    if (fclose(fp))
+      ret = -1;
+  }
+  else
+    close(fd);
+
+  if (ret)
+    unlink(filename);
+
+  return (ret);
+}
+
+
+/*
+ * 'run_benchmark()' - Run a test case repeatedly and report timings as a
+ *                     JSON object.
+ */
+
+static int				// O - Number of failed runs
+run_benchmark(const char *test_case,	// I - Test case line
+              char       *program,	// I - Program name
+	      int        runs,		// I - Number of runs
+	      int        test_case_no,	// I - Test case number
+	      const char *input_spec,	// I - Input file or generator spec
+	      FILE       *json)		// I - JSON output
+{
+  char		*copy,			// Copy of test case
+		*fields[4] = { NULL },	// Input/output file and types
+		*ptr;			// Pointer into copy
+  int		i;			// Looping var
+  bench_result_t *results;		// Results of all runs
+  double	*times,			// Sorted times of successful runs
+		total = 0.0;		// Total time of successful runs
+  int		num_times = 0,		// Number of successful runs
+		failures = 0,		// Number of failed runs
+		pages = 0;		// Pages per run
+  long		max_rss = 0;		// Peak RSS of all runs in kB
+  struct stat	st;			// File information
+  long long	in_bytes = 0,		// Size of input
+		out_bytes = 0;		// Size of output
+
+
+  copy = strdup(test_case);
+  for (i = 0, ptr = copy; i < 4 && ptr; i ++)
+  {
+    fields[i] = remove_white_space(strsep(&ptr, "\t"));
+  }
+
+  if (!fields[3])
+  {
+    fprintf(stderr, "ERROR: Test case %d is incomplete\n", test_case_no);
+    free(copy);
+    return (runs);
+  }
+
+  if (!stat(fields[0], &st))
+    in_bytes = (long long)st.st_size;
+
+  results = calloc((size_t)runs, sizeof(bench_result_t));
+  times   = calloc((size_t)runs, sizeof(double));
+
+  if (!results || !times)
+  {
+    fprintf(stderr, "ERROR: Out of memory for test case %d\n", test_case_no);
+    free(results);
+    free(times);
+    free(copy);
+    return (runs);
+  }
+
+  for (i = 0; i < runs; i ++)
+  {
+    int			pfd[2];		// Pipe for the page count
+    pid_t		pid;		// Child process
+    int			status;		// Child exit status
+    struct rusage	usage;		// Resource usage of child tree
+    double		start;		// Start time
+
+
+    // Outputs are opened in append mode, start every run from scratch
+    unlink(fields[2]);
+
+    if (pipe(pfd))
+    {
+      failures ++;
+      continue;
+    }
+
+    start = bench_time();
+
+    if ((pid = fork()) == 0)
+    {
+      cf_filter_stats_t	stats = { 0, NULL };
+					// Statistics of the filters
+      char		*tc = strdup(test_case);
+					// Test case to run
+      int		j,		// Looping var
+			p = 0,		// Pages
+			devnull;	// /dev/null
+
+
+      close(pfd[0]);
+
+      if ((devnull = open("/dev/null", O_WRONLY)) >= 0)
+      {
+        dup2(devnull, 2);
+	close(devnull);
+      }
+
+      status = run_test(tc, program, &stats);
+
+      for (j = 0; j < stats.num_stages; j ++)
+        if (stats.stages[j].pages > p)
+	  p = stats.stages[j].pages;
+
+      if (write(pfd[1], &p, sizeof(p)) != sizeof(p))
+        status = 1;
+
+      _exit(status ? 1 : 0);
+    }
+    else if (pid < 0)
+    {
+      close(pfd[0]);
+      close(pfd[1]);
+      failures ++;
+      continue;
+    }
+
+    close(pfd[1]);
+
+    if (read(pfd[0], &results[i].pages, sizeof(int)) != sizeof(int))
+      results[i].pages = 0;
+    close(pfd[0]);
+
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR);
+
+    results[i].seconds = bench_time() - start;
+    results[i].status  = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    // ru_maxrss of a reaped child covers its own reaped children too...
+    if (usage.ru_maxrss > max_rss)
+      max_rss = usage.ru_maxrss;
+
+    if (results[i].status)
+      failures ++;
+    else
+    {
+      times[num_times ++] = results[i].seconds;
+      total += results[i].seconds;
+      if (results[i].pages > pages)
+        pages = results[i].pages;
+    }
+
+    fprintf(stderr, "Benchmark %d: Run %d of %d %s in %.3f seconds\n",
+	    test_case_no, i + 1, runs, results[i].status ? "failed" : "done",
+	    results[i].seconds);
+  }
+
+  if (!stat(fields[2], &st))
+    out_bytes = (long long)st.st_size;
+
+  qsort(times, (size_t)num_times, sizeof(double), bench_compare);
+
+  fprintf(json, "    {\"case\": %d, \"input\": ", test_case_no);
+  json_string(json, input_spec);
+  fputs(", \"input_type\": ", json);
+  json_string(json, fields[1]);
+  fputs(", \"output_type\": ", json);
+  json_string(json, fields[3]);
+  fprintf(json, ", \"runs\": %d, \"failures\": %d, \"pages\": %d, "
+	  "\"input_bytes\": %lld, \"output_bytes\": %lld,\n", runs, failures,
+	  pages, in_bytes, out_bytes);
+  fprintf(json, "     \"pages_per_minute\": %.2f, \"input_mb_per_second\": %.3f, "
+	  "\"output_mb_per_second\": %.3f,\n",
+	  total > 0.0 ? 60.0 * pages * num_times / total : 0.0,
+	  total > 0.0 ? in_bytes * num_times / total / 1000000.0 : 0.0,
+	  total > 0.0 ? out_bytes * num_times / total / 1000000.0 : 0.0);
+  fprintf(json, "     \"latency_seconds\": {\"min\": %.6f, \"mean\": %.6f, "
+	  "\"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f},\n",
+	  num_times ? times[0] : 0.0, num_times ? total / num_times : 0.0,
+	  bench_percentile(times, num_times, 50),
+	  bench_percentile(times, num_times, 95),
+	  bench_percentile(times, num_times, 99),
+	  num_times ? times[num_times - 1] : 0.0);
+  fprintf(json, "     \"peak_rss_kb\": %ld}", max_rss);
+
+  free(results);
+  free(times);
+  free(copy);
+
+  return (failures);
+}
+
+
 int main(int  argc,				// I - Number of command-line args
      char *argv[])			        // I - Command-line arguments{
 {
-  char *file_name; // File Name of Input Test File
+  char *file_name = NULL; // File Name of Input Test File
   FILE *fp;            // File Pointer
   char *line = NULL;   // Input Stream
   size_t len = 0;      // Length of Input Stream
   ssize_t read;
+  int runs = 0;        // Number of benchmark runs, 0 for normal tests
+  int num_reported = 0; // Number of benchmark results written
+  int i;
+
+  // set file_name (test.txt) and options from argv... 
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "--benchmark") && i + 1 < argc)
+    {
+      if ((runs = atoi(argv[++ i])) < 1)
+      {
+        fprintf(stderr, "Bad number of benchmark runs \"%s\".\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (argv[i][0] == '-')
+    {
+      fprintf(stderr, "Usage: %s [--benchmark RUNS] test-cases-file\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    else
+      file_name = argv[i];
+  }
 
-  // set file_name (test.txt) from argv... 
-  if (argc < 2)
+  if (!file_name)
   {
     fprintf(stderr, "No input test file provided.\n");
     return EXIT_FAILURE;
   }
-  file_name = argv[1];
   fp = fopen(file_name, "r");
   if (!fp)
   {
@@ -1295,6 +2024,9 @@ int main(int  argc,				// I - Number of command-line args
   // Counts the number of test case which failed...
   int fail_cnt = 0;
 
+  if (runs)
+    printf("{\"benchmark\": [\n");
+
   while ((read = getline(&line, &len, fp)) != -1)
   {
     if (read <= 1)
@@ -1307,13 +2039,53 @@ int main(int  argc,				// I - Number of command-line args
     if (line[read - 1] == '\n')
       line[read - 1] = '\0';
 
-    char *test_case = strdup(line);
+    char *test_case;
+    char generated[1024] = "";
+    char input_spec[1024];
+
+    // Synthetic input documents ("@pdf:pages=500" etc.) are generated into
+    // a temporary file which replaces the first column...
+    strncpy(input_spec, line, sizeof(input_spec) - 1);
+    input_spec[sizeof(input_spec) - 1] = '\0';
+    input_spec[strcspn(input_spec, "\t")] = '\0';
+    memmove(input_spec, remove_white_space(input_spec),
+            strlen(remove_white_space(input_spec)) + 1);
+
+    if (input_spec[0] == '@')
+    {
+      const char *rest = line + strcspn(line, "\t");
+
+      if (generate_input(input_spec, generated, sizeof(generated)))
+      {
+        fprintf(stderr, "Test Status %d: Failed\n", test_case_no);
+        fail_cnt++;
+        test_case_no++;
+        continue;
+      }
+
+      if ((test_case = malloc(strlen(generated) + strlen(rest) + 1)) != NULL)
+        sprintf(test_case, "%s%s", generated, rest);
+    }
+    else
+      test_case = strdup(line);
+
     if (!test_case)
       continue;
 
     long pos = ftell(fp);
 
-    int testResult = run_test(test_case, argv[0]);
+    int testResult;
+
+    if (runs)
+    {
+      if (num_reported++)
+        printf(",\n");
+      testResult = run_benchmark(test_case, argv[0], runs, test_case_no,
+                                 input_spec, stdout);
+      fflush(stdout);
+    }
+    else
+      testResult = run_test(test_case, argv[0], NULL);
 
     // restoring stream state in case filters modified descriptor
     clearerr(fp);
@@ -1327,10 +2099,16 @@ int main(int  argc,				// I - Number of command-line args
       fail_cnt++;
     }
 
+    if (generated[0])
+      unlink(generated);
+
     free(test_case);
     test_case_no++;
   }
 
+  if (runs)
+    printf("\n]}\n");
+
   free(line);
   fclose(fp);
 
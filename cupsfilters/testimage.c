@@ -9,19 +9,53 @@
 //
 // Contents:
 //
-//   main() - Main entry...
+//   main()        - Main entry...
+//   check_row()   - Check a row of the test image.
+//   test_map()    - Check that the swap file mapping keeps to its budget.
+//   test_stream() - Check that closing a streaming image stops its decoder.
+//   write_png()   - Write a test image.
 //
 
 //
 // Include necessary headers...
 //
 
-#include "image.h"
+#include "image-private.h"
+#include <fcntl.h>
+#include <stdio.h>
+#ifdef HAVE_LIBPNG
+#  include <png.h>
+#endif // HAVE_LIBPNG
+
+
+//
+// Constants...
+//
+
+#define TEST_WIDTH	2560		// Width of the test image
+#define TEST_BANDS	8		// Bands of CF_TILE_SIZE rows in the
+					// test image
+
+
+//
+// Local functions...
+//
+
+static int	check_row(cf_image_t *img, int y, cf_ib_t *row);
+static int	test_map(const char *filename);
+static int	test_stream(const char *filename);
+static int	write_png(const char *filename);
 
 
 //
 // 'main()' - Main entry...
 //
+// Usage: testimage [filename.ext filename.[ppm|pgm]]
+//
+// Without arguments the image cache and streaming images get checked with
+// a generated image, otherwise the image file is converted to a PPM or PGM
+// file.
+//
 
 int					// O - Exit status
 main(int  argc,				// I - Number of command-line arguments
@@ -34,12 +68,34 @@ main(int  argc,				// I - Number of command-line arguments
   int			y,		// Current line
 			width,		// Width of image
 			height,		// Height of image
-			depth;		// Depth of image
+			depth,		// Depth of image
+			status = 0;	// Exit status
+  char			filename[256];	// Test image file
+
+
+  if (argc == 1)
+  {
+    snprintf(filename, sizeof(filename), "%s/testimage-%d.png",
+	     getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
 
+    if (write_png(filename))
+    {
+      unlink(filename);
+      puts("Unable to write test image, skipped.");
+      return (77);
+    }
+
+    status |= test_map(filename);
+    status |= test_stream(filename);
+
+    unlink(filename);
+
+    return (status);
+  }
 
   if (argc != 3)
   {
-    puts("Usage: testimage filename.ext filename.[ppm|pgm]");
+    puts("Usage: testimage [filename.ext filename.[ppm|pgm]]");
     return (1);
   }
 
@@ -85,3 +141,240 @@ main(int  argc,				// I - Number of command-line arguments
 
   return (0);
 }
+
+
+//
+// 'check_row()' - Check a row of the test image.
+//
+
+static int				// O - 0 if right, 1 if wrong
+check_row(cf_image_t *img,		// I - Image
+	  int        y,			// I - Row
+	  cf_ib_t    *row)		// I - Row buffer
+{
+  int	x;				// Looping var
+
+
+  if (cfImageGetRow(img, 0, y, TEST_WIDTH, row))
+    return (1);
+
+  for (x = 0; x < TEST_WIDTH; x ++)
+    if (row[x] != (cf_ib_t)(x + 3 * y))
+      return (1);
+
+  return (0);
+}
+
+
+//
+// 'test_map()' - Check that the swap file mapping keeps to its budget.
+//
+// The whole image gets resident with a large budget except for one band,
+// the budget then shrinks to the minimum and getting that band has to
+// evict all others but one.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_map(const char *filename)		// I - Test image
+{
+  cf_image_t	*img;			// Image
+  cf_ib_t	*row;			// Row buffer
+  unsigned	max_bands;		// Bands allowed to be resident
+  int		band,			// Current band
+		status = 0;		// Return value
+
+
+  fputs("Mapped image, shrinking budget: ", stdout);
+
+  //
+  // Limit the cache to less than the image, so it gets a swap file...
+  //
+
+  setenv("RIP_MAX_CACHE", "1m", 1);
+  img = cfImageOpen(filename, CF_IMAGE_WHITE, CF_IMAGE_WHITE, 100, 0, NULL);
+  unsetenv("RIP_MAX_CACHE");
+
+  if (img == NULL || (row = malloc(TEST_WIDTH)) == NULL)
+  {
+    puts("FAIL (unable to open image)");
+    if (img)
+      cfImageClose(img);
+    return (1);
+  }
+
+  if (check_row(img, 0, row) || img->map_used == NULL)
+  {
+    puts("FAIL (image not mapped to a swap file)");
+    status = 1;
+  }
+  else
+  {
+    cfImageSetMaxTiles(img, 1000);
+
+    for (band = 0; band < TEST_BANDS - 3 && !status; band ++)
+      status = check_row(img, band * CF_TILE_SIZE, row);
+
+    cfImageSetMaxTiles(img, 1);
+
+    max_bands = img->max_ics * CF_TILE_SIZE / TEST_WIDTH;
+    if (max_bands < 2)
+      max_bands = 2;
+
+    if (!status)
+      status = check_row(img, (TEST_BANDS - 3) * CF_TILE_SIZE, row);
+
+    if (status)
+      puts("FAIL (wrong pixels)");
+    else if (img->map_resident > max_bands)
+    {
+      printf("FAIL (%u bands resident, %u allowed)\n", img->map_resident,
+             max_bands);
+      status = 1;
+    }
+    else
+    {
+      for (band = 0; band < TEST_BANDS && !status; band ++)
+        status = check_row(img, band * CF_TILE_SIZE + CF_TILE_SIZE - 1, row);
+
+      puts(status ? "FAIL (wrong pixels after eviction)" : "PASS");
+    }
+  }
+
+  free(row);
+  cfImageClose(img);
+
+  return (status);
+}
+
+
+//
+// 'test_stream()' - Check that closing a streaming image stops its decoder.
+//
+// We keep a duplicate of the file descriptor of the image, it shares the
+// file offset, so after closing the image it tells how far the decoder
+// has read the file.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_stream(const char *filename)	// I - Test image
+{
+  int		fd,			// Image file
+		dupfd;			// Duplicate of the image file
+  FILE		*fp;			// Image file
+  cf_image_t	*img;			// Streaming image
+  cf_ib_t	*row;			// Row of the image
+  off_t		size,			// Size of the image file
+		offset;			// Offset where the decoder stopped
+  int		y,			// Current row
+		status = 0;		// Return value
+
+
+  fputs("Streaming, close after 10 rows: ", stdout);
+
+  if ((fd = open(filename, O_RDONLY)) < 0 || (dupfd = dup(fd)) < 0 ||
+      (fp = fdopen(fd, "rb")) == NULL)
+  {
+    printf("FAIL (%s)\n", strerror(errno));
+    return (1);
+  }
+
+  if ((img = cfImageOpenFPStreaming(fp, CF_IMAGE_WHITE, CF_IMAGE_WHITE, 100,
+                                    0, NULL, NULL)) == NULL)
+  {
+    puts("FAIL (unable to open image)");
+    close(dupfd);
+    return (1);
+  }
+
+  if ((row = malloc((size_t)cfImageGetWidth(img) *
+                    cfImageGetDepth(img))) == NULL)
+    status = 1;
+
+  for (y = 0; y < 10 && !status; y ++)
+    status = cfImageGetRow(img, 0, y, cfImageGetWidth(img), row) != 0;
+
+  free(row);
+  cfImageClose(img);
+
+  offset = lseek(dupfd, 0, SEEK_CUR);
+  size   = lseek(dupfd, 0, SEEK_END);
+
+  close(dupfd);
+
+  if (status)
+    puts("FAIL (unable to read rows)");
+  else if (offset > size / 2)
+  {
+    printf("FAIL (decoder read %ld of %ld bytes)\n", (long)offset,
+           (long)size);
+    status = 1;
+  }
+  else
+    puts("PASS");
+
+  return (status);
+}
+
+
+//
+// 'write_png()' - Write a test image.
+//
+// A gray image with a pattern that differs from row to row, larger than
+// the minimum tile cache so it gets mapped to a swap file.
+//
+
+static int				// O - 0 on success, -1 on error
+write_png(const char *filename)		// I - File to write
+{
+#ifdef HAVE_LIBPNG
+  FILE		*fp;			// PNG file
+  png_structp	pp;			// PNG write pointer
+  png_infop	info;			// PNG info pointer
+  png_byte	row[TEST_WIDTH];	// Row of the image
+  int		x, y;			// Looping vars
+
+
+  if ((fp = fopen(filename, "wb")) == NULL)
+    return (-1);
+
+  if ((pp = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+                                    NULL)) == NULL ||
+      (info = png_create_info_struct(pp)) == NULL)
+  {
+    png_destroy_write_struct(&pp, NULL);
+    fclose(fp);
+    return (-1);
+  }
+
+  if (setjmp(png_jmpbuf(pp)))
+  {
+    png_destroy_write_struct(&pp, &info);
+    fclose(fp);
+    return (-1);
+  }
+
+  png_init_io(pp, fp);
+  png_set_IHDR(pp, info, TEST_WIDTH, TEST_BANDS * CF_TILE_SIZE, 8,
+               PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+	       PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(pp, info);
+
+  for (y = 0; y < TEST_BANDS * CF_TILE_SIZE; y ++)
+  {
+    for (x = 0; x < TEST_WIDTH; x ++)
+      row[x] = (png_byte)(x + 3 * y);
+
+    png_write_row(pp, row);
+  }
+
+  png_write_end(pp, info);
+  png_destroy_write_struct(&pp, &info);
+
+  return (fclose(fp) ? -1 : 0);
+
+#else
+  (void)filename;
+
+  return (-1);
+#endif // HAVE_LIBPNG
+}
@@ -0,0 +1,340 @@
+//
+// Row kernel test program for libcupsfilters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()          - Main entry...
+//   make_header()   - Make the page header of a raster format.
+//   test_format()   - Compare the row kernels of a raster format with the
+//                     generic code.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "image-private.h"
+#include <stdio.h>
+
+
+//
+// Local globals...
+//
+
+static const char * const kernels[] =	// Row kernels
+{
+  "ssse3",
+  "sse2",
+  "neon",
+  "c"
+};
+static const cups_cspace_t cspaces[] =	// Color spaces to test
+{
+  CUPS_CSPACE_W,
+  CUPS_CSPACE_SW,
+  CUPS_CSPACE_K,
+  CUPS_CSPACE_WHITE,
+  CUPS_CSPACE_GOLD,
+  CUPS_CSPACE_SILVER,
+  CUPS_CSPACE_RGB,
+  CUPS_CSPACE_SRGB,
+  CUPS_CSPACE_ADOBERGB,
+  CUPS_CSPACE_RGBA,
+  CUPS_CSPACE_RGBW,
+  CUPS_CSPACE_CMY,
+  CUPS_CSPACE_YMC,
+  CUPS_CSPACE_CMYK,
+  CUPS_CSPACE_YMCK,
+  CUPS_CSPACE_KCMY,
+  CUPS_CSPACE_KCMYcm,
+  CUPS_CSPACE_GMCK,
+  CUPS_CSPACE_GMCS,
+  CUPS_CSPACE_CIEXYZ			// Not in the table, uses the default
+};
+static const int	bits[] =	// Bits per color to test
+{
+  1, 2, 4, 8, 16
+};
+static const int	widths[] =	// Widths of image data to test
+{
+  1, 7, 8, 9, 15, 16, 17, 31, 33, 101
+};
+
+
+//
+// Local functions...
+//
+
+static void	make_header(cups_page_header_t *header, cups_cspace_t cspace,
+			    cups_order_t order, int bits, int width);
+static int	test_format(cups_page_header_t *header, const char *kernel,
+			    const cf_ib_t *pixels);
+
+
+//
+// 'main()' - Main entry...
+//
+// Checks that the row kernel picked for each raster format gives the same
+// output as the generic code with all row kernels the CPU supports, and
+// that every row kernel in the table gets picked for some format.
+//
+
+int					// O - Exit status
+main(void)
+{
+  cups_page_header_t header;		// Page header
+  cf_ib_t	*pixels;		// Image data
+  char		*picked;		// Row kernels picked
+  int		num_formats,		// Number of row kernels in the table
+		format,			// Row kernel
+		order,			// Color order
+		status = 0,		// Exit status
+		kstatus;		// Status of kernels
+  size_t	c, b, k;		// Looping vars
+  const char	*best;			// Default row kernels
+  unsigned	seed = 1;		// Random colors
+
+
+  //
+  // Two rows of image data with random colors, more of them black or
+  // white, as the dither kernels treat those specially...
+  //
+
+  if ((pixels = malloc(2 * 4 * 256)) == NULL)
+  {
+    perror("testimagetoraster");
+    return (1);
+  }
+
+  for (c = 0; c < 2 * 4 * 256; c ++)
+  {
+    seed = seed * 1103515245 + 12345;
+
+    switch (seed >> 29)
+    {
+      case 0 :
+          pixels[c] = 0;
+	  break;
+      case 1 :
+          pixels[c] = 255;
+	  break;
+      default :
+          pixels[c] = seed >> 21;
+	  break;
+    }
+  }
+
+  //
+  // Compare the kernels for each format...
+  //
+
+  best        = _cfImageRasterKernel(NULL);
+  num_formats = _cfImageRasterFormat(NULL, 0, 0, 0, 0, 0, 0, 0, 0, NULL,
+				     NULL, NULL);
+  picked      = calloc(num_formats, 1);
+
+  for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+  {
+    if (strcmp(_cfImageRasterKernel(kernels[k]), kernels[k]))
+      continue;
+
+    kstatus = 0;
+
+    for (c = 0; c < sizeof(cspaces) / sizeof(cspaces[0]); c ++)
+      for (order = CUPS_ORDER_CHUNKED; order <= CUPS_ORDER_PLANAR; order ++)
+	for (b = 0; b < sizeof(bits) / sizeof(bits[0]); b ++)
+	{
+	  make_header(&header, cspaces[c], (cups_order_t)order, bits[b], 1);
+
+	  format = _cfImageRasterFormat(&header, 0, 0, 0, 0, 0, 0, 0, 0, NULL,
+					NULL, NULL);
+	  if (picked)
+	    picked[format] = 1;
+
+	  kstatus |= test_format(&header, kernels[k], pixels);
+	}
+
+    if (!kstatus)
+      printf("%s row kernels: PASS\n", kernels[k]);
+
+    status |= kstatus;
+  }
+
+  _cfImageRasterKernel(best);
+
+  //
+  // Check that no row kernel in the table is hidden by the ones before...
+  //
+
+  fputs("Row kernel table: ", stdout);
+
+  for (format = 0; picked && format < num_formats; format ++)
+    if (!picked[format])
+      break;
+
+  if (!picked || format < num_formats)
+  {
+    printf("FAIL (row kernel %d is never picked)\n", format);
+    status = 1;
+  }
+  else
+    puts("PASS");
+
+  free(picked);
+  free(pixels);
+
+  return (status);
+}
+
+
+//
+// 'make_header()' - Make the page header of a raster format.
+//
+// The bits per pixel follow what CUPS uses, 3 colors take the space of 4
+// when chunked with less than 8 bits, and 1-bit KCMYcm has 6 colors in a
+// byte.
+//
+
+static void
+make_header(cups_page_header_t *header,	// O - Page header
+	    cups_cspace_t      cspace,	// I - Color space
+	    cups_order_t       order,	// I - Color order
+	    int                bits,	// I - Bits per color
+	    int                width)	// I - Width of the page
+{
+  int	colors;				// Number of colors
+
+
+  switch (cspace)
+  {
+    case CUPS_CSPACE_W :
+    case CUPS_CSPACE_SW :
+    case CUPS_CSPACE_K :
+    case CUPS_CSPACE_WHITE :
+    case CUPS_CSPACE_GOLD :
+    case CUPS_CSPACE_SILVER :
+        colors = 1;
+	break;
+
+    case CUPS_CSPACE_RGBA :
+    case CUPS_CSPACE_RGBW :
+    case CUPS_CSPACE_CMYK :
+    case CUPS_CSPACE_YMCK :
+    case CUPS_CSPACE_KCMY :
+    case CUPS_CSPACE_GMCK :
+    case CUPS_CSPACE_GMCS :
+        colors = 4;
+	break;
+
+    case CUPS_CSPACE_KCMYcm :
+        colors = bits == 1 ? 6 : 4;
+	break;
+
+    default :
+        colors = 3;
+	break;
+  }
+
+  memset(header, 0, sizeof(cups_page_header_t));
+
+  header->cupsWidth        = width;
+  header->cupsHeight       = 1;
+  header->cupsColorSpace   = cspace;
+  header->cupsColorOrder   = order;
+  header->cupsBitsPerColor = bits;
+  header->cupsNumColors    = colors;
+
+  if (order != CUPS_ORDER_CHUNKED)
+    header->cupsBitsPerPixel = bits;
+  else if (colors == 6)
+    header->cupsBitsPerPixel = 8;
+  else if (colors == 3 && bits < 8)
+    header->cupsBitsPerPixel = 4 * bits;
+  else
+    header->cupsBitsPerPixel = colors * bits;
+
+  header->cupsBytesPerLine = (width * header->cupsBitsPerPixel + 7) / 8;
+
+  if (order == CUPS_ORDER_BANDED)
+    header->cupsBytesPerLine *= colors;
+}
+
+
+//
+// 'test_format()' - Compare the row kernels of a raster format with the
+//                   generic code.
+//
+// Formats rows of odd and even widths at the left, center and right of
+// the page, for every row of the dither matrix, with rows interpolated
+// along Y and rows already filtered, and with image data too tall for the
+// SIMD interpolation.
+//
+
+static int				// O - 0 on success, 1 on failure
+test_format(cups_page_header_t *header,	// I - Page header of format
+	    const char         *kernel,	// I - Row kernels to test
+	    const cf_ib_t      *pixels)	// I - Image data, two rows
+{
+  static const int ysizes[] = { 3, 1000, 16777215 };
+					// Heights of image data
+  cups_page_header_t page;		// Page header of a row
+  unsigned char	ref[2048],		// Output of generic code
+		out[2048];		// Output of row kernel
+  cf_ib_t	*r0 = (cf_ib_t *)pixels,// Primary image data
+		*r1 = (cf_ib_t *)pixels + 4 * 256;
+					// Image data for interpolation
+  int		w, xpos, y, z, ys,	// Looping vars
+		planes,			// Number of planes
+		yerr0,			// Top Y error
+		filtered,		// Rows already filtered along Y?
+		format;			// Row kernel
+
+
+  planes = header->cupsColorOrder == CUPS_ORDER_PLANAR ?
+	   (int)header->cupsNumColors : 1;
+
+  for (w = 0; w < (int)(sizeof(widths) / sizeof(widths[0])); w ++)
+  {
+    make_header(&page, header->cupsColorSpace, header->cupsColorOrder,
+		header->cupsBitsPerColor, widths[w] + 13);
+
+    for (xpos = -1; xpos <= 1; xpos ++)
+      for (y = 0; y < 16; y ++)
+	for (z = 0; z < planes; z ++)
+	  for (ys = 0; ys < (int)(sizeof(ysizes) / sizeof(ysizes[0])); ys ++)
+	    for (filtered = 0; filtered < 2; filtered ++)
+	    {
+	      yerr0 = (y * 7919) % ysizes[ys];
+
+	      memset(ref, 0xaa, sizeof(ref));
+	      memset(out, 0xaa, sizeof(out));
+
+	      _cfImageRasterFormat(&page, 1, xpos, y, z, widths[w],
+				   ysizes[ys], yerr0, ysizes[ys] - yerr0,
+				   r0, filtered ? r0 : r1, ref);
+	      format = _cfImageRasterFormat(&page, 0, xpos, y, z, widths[w],
+					    ysizes[ys], yerr0,
+					    ysizes[ys] - yerr0, r0,
+					    filtered ? r0 : r1, out);
+
+	      if (memcmp(ref, out, page.cupsBytesPerLine))
+	      {
+		for (y = 0; ref[y] == out[y]; y ++);
+
+		printf("%s row kernels: FAIL (color space %d, order %d, %d "
+		       "bits, row kernel %d, width %d, position %d, plane %d, "
+		       "height %d%s: byte %d is 0x%02x, not 0x%02x)\n",
+		       kernel, header->cupsColorSpace, header->cupsColorOrder,
+		       header->cupsBitsPerColor, format, widths[w], xpos, z,
+		       ysizes[ys], filtered ? ", filtered" : "", y, out[y],
+		       ref[y]);
+		return (1);
+	      }
+	    }
+  }
+
+  return (0);
+}
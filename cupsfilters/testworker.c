@@ -0,0 +1,446 @@
+//
+// Filter worker test program for libcupsfilters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()          - Main entry...
+//   copy_filter()   - Copy the input to the output.
+//   job_canceled()  - Cancel a job after a delay.
+//   run_job()       - Run a job through the worker and check its output.
+//   run_thread()    - Run a job through the worker in a thread.
+//   serve_thread()  - Run the worker.
+//   test_log()      - Collect the log messages of a job.
+//   test_time()     - Return the monotonic time in seconds.
+//   wait_filter()   - Wait for the job to be canceled.
+//   worker_done()   - Tell whether the worker should shut down.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <config.h>
+#include <cupsfilters/filter.h>
+#include <cupsfilters/libcups2-private.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//
+// Types...
+//
+
+typedef struct test_job_s		// Job sent to the worker
+{
+  const char	*filter;		// Filter in the worker
+  const char	*input;			// Input data
+  double	cancel;			// Seconds until cancel, 0 for never
+  double	start;			// Start time of the job
+  int		status;			// Exit status of the job
+  char		output[1024],		// Output data
+		log[1024];		// Log messages of the job
+} test_job_t;
+
+
+//
+// Local globals...
+//
+
+static char		socket_path[256];
+					// Socket of the worker
+static volatile int	shutdown_worker = 0;
+					// Shut down the worker?
+
+
+//
+// Local functions...
+//
+
+static int	copy_filter(int inputfd, int outputfd, int inputseekable,
+			    cf_filter_data_t *data, void *parameters);
+static int	job_canceled(void *data);
+static int	run_job(test_job_t *job);
+static void	*run_thread(void *data);
+static void	*serve_thread(void *data);
+static double	test_time(void);
+static void	test_log(void *data, cf_loglevel_t level, const char *message,
+			 ...);
+static int	wait_filter(int inputfd, int outputfd, int inputseekable,
+			    cf_filter_data_t *data, void *parameters);
+static int	worker_done(void *data);
+
+
+//
+// 'main()' - Main entry...
+//
+// Starts a worker in a thread and checks that a job gets filtered by it,
+// that a canceled job stops, and that two jobs which both fork a filter
+// chain in the worker each collect their own filter processes.
+//
+
+int					// O - Exit status
+main(void)
+{
+  cf_filter_filter_in_chain_t copy =	// Filter of the chain
+  {
+    copy_filter, NULL, (char *)"copy"
+  };
+  cups_array_t	*chain;			// Filter chain run by the worker
+  cf_filter_worker_filter_t filters[3];	// Filters offered by the worker
+  pthread_t	server,			// Worker thread
+		threads[2];		// Threads of concurrent jobs
+  test_job_t	job,			// Job
+		jobs[2];		// Concurrent jobs
+  int		i,			// Looping var
+		status = 0;		// Exit status
+
+
+  snprintf(socket_path, sizeof(socket_path), "%s/testworker-%d.sock",
+           getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+
+  chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+  cupsArrayAdd(chain, &copy);
+  cupsArrayAdd(chain, &copy);
+
+  filters[0].name       = "copy";
+  filters[0].function   = copy_filter;
+  filters[0].parameters = NULL;
+  filters[1].name       = "wait";
+  filters[1].function   = wait_filter;
+  filters[1].parameters = NULL;
+  filters[2].name       = "chain";
+  filters[2].function   = cfFilterChain;
+  filters[2].parameters = chain;
+
+  if (pthread_create(&server, NULL, serve_thread, filters))
+  {
+    perror("pthread_create");
+    return (1);
+  }
+
+  for (i = 0; i < 500 && access(socket_path, F_OK); i ++)
+    usleep(10000);
+
+  //
+  // A job gets filtered and its log messages come back...
+  //
+
+  memset(&job, 0, sizeof(job));
+  job.filter = "copy";
+  job.input  = "Hello worker";
+
+  fputs("Filter job: ", stdout);
+  if (run_job(&job) || job.status || strcmp(job.output, job.input) ||
+      !strstr(job.log, "copy: 12 bytes"))
+  {
+    printf("FAIL (status %d, output \"%s\", log \"%s\")\n", job.status,
+           job.output, job.log);
+    status = 1;
+  }
+  else
+    puts("PASS");
+
+  //
+  // A canceled job stops and reports failure...
+  //
+
+  memset(&job, 0, sizeof(job));
+  job.filter = "wait";
+  job.input  = "";
+  job.cancel = 0.2;
+
+  fputs("Canceled job: ", stdout);
+  if (run_job(&job) || !job.status || !strstr(job.log, "wait: canceled") ||
+      test_time() - job.start > 5.0)
+  {
+    printf("FAIL (status %d, %.1f seconds, log \"%s\")\n", job.status,
+           test_time() - job.start, job.log);
+    status = 1;
+  }
+  else
+    puts("PASS");
+
+  //
+  // Two jobs fork filter chains in the worker at the same time...
+  //
+
+  fflush(stdout);
+
+  memset(jobs, 0, sizeof(jobs));
+  for (i = 0; i < 2; i ++)
+  {
+    jobs[i].filter = "chain";
+    jobs[i].input  = i ? "Second chain" : "First chain";
+    jobs[i].status = -1;
+    pthread_create(threads + i, NULL, run_thread, jobs + i);
+  }
+
+  for (i = 0; i < 2; i ++)
+    pthread_join(threads[i], NULL);
+
+  fputs("Concurrent chains: ", stdout);
+  if (jobs[0].status || strcmp(jobs[0].output, jobs[0].input) ||
+      jobs[1].status || strcmp(jobs[1].output, jobs[1].input))
+  {
+    printf("FAIL (status %d/%d, output \"%s\"/\"%s\")\n", jobs[0].status,
+           jobs[1].status, jobs[0].output, jobs[1].output);
+    status = 1;
+  }
+  else
+    puts("PASS");
+
+  //
+  // Shut down the worker...
+  //
+
+  shutdown_worker = 1;
+  pthread_join(server, NULL);
+  cupsArrayDelete(chain);
+
+  return (status);
+}
+
+
+//
+// 'copy_filter()' - Copy the input to the output.
+//
+
+static int				// O - Exit status
+copy_filter(int              inputfd,	// I - Input file
+	    int              outputfd,	// I - Output file
+	    int              inputseekable,
+					// I - Input seekable?
+	    cf_filter_data_t *data,	// I - Job data
+	    void             *parameters)
+					// I - Filter parameters
+{
+  char		buffer[1024];		// Copy buffer
+  ssize_t	bytes,			// Bytes read
+		total = 0;		// Total bytes copied
+
+
+  (void)inputseekable;
+  (void)parameters;
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (write(outputfd, buffer, (size_t)bytes) != bytes)
+      break;
+    total += bytes;
+  }
+
+  if (data->logfunc)
+    (data->logfunc)(data->logdata, CF_LOGLEVEL_INFO, "copy: %d bytes",
+                    (int)total);
+
+  close(inputfd);
+  close(outputfd);
+
+  return (bytes != 0);
+}
+
+
+//
+// 'job_canceled()' - Cancel a job after a delay.
+//
+
+static int				// O - 1 if canceled, 0 otherwise
+job_canceled(void *data)		// I - Job
+{
+  test_job_t	*job = (test_job_t *)data;
+
+
+  return (job->cancel > 0.0 && test_time() - job->start >= job->cancel);
+}
+
+
+//
+// 'run_job()' - Run a job through the worker and check its output.
+//
+
+static int				// O - 0 on success, -1 on error
+run_job(test_job_t *job)		// I - Job
+{
+  cf_filter_worker_t	params;		// Worker parameters
+  cf_filter_data_t	data;		// Job data
+  char			infile[256];	// Input file
+  int			infd,		// Input of the job
+			outpipe[2];	// Output of the job
+  ssize_t		bytes,		// Bytes read
+			total = 0;	// Total bytes read
+
+
+  snprintf(infile, sizeof(infile), "%s/testworker-%d-XXXXXX",
+           getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+
+  if ((infd = mkstemp(infile)) < 0)
+    return (-1);
+
+  unlink(infile);
+
+  if (write(infd, job->input, strlen(job->input)) < 0 ||
+      lseek(infd, 0, SEEK_SET) < 0 || pipe(outpipe))
+  {
+    close(infd);
+    return (-1);
+  }
+
+  memset(&params, 0, sizeof(params));
+  params.socket_path = socket_path;
+  params.filter      = job->filter;
+
+  memset(&data, 0, sizeof(data));
+  data.copies         = 1;
+  data.logfunc        = test_log;
+  data.logdata        = job;
+  data.iscanceledfunc = job_canceled;
+  data.iscanceleddata = job;
+
+  //
+  // The output fits into the pipe, so read it after the job...
+  //
+
+  job->start  = test_time();
+  job->status = cfFilterWorker(infd, outpipe[1], 1, &data, &params);
+
+  while ((bytes = read(outpipe[0], job->output + total,
+                       sizeof(job->output) - 1 - (size_t)total)) > 0)
+    total += bytes;
+
+  job->output[total] = '\0';
+  close(outpipe[0]);
+
+  return (0);
+}
+
+
+//
+// 'run_thread()' - Run a job through the worker in a thread.
+//
+
+static void *				// O - Thread exit status
+run_thread(void *data)			// I - Job
+{
+  run_job((test_job_t *)data);
+
+  return (NULL);
+}
+
+
+//
+// 'serve_thread()' - Run the worker.
+//
+
+static void *				// O - Thread exit status
+serve_thread(void *data)		// I - Filters
+{
+  cfFilterWorkerServe(socket_path, (cf_filter_worker_filter_t *)data, 3, 0,
+                      NULL, NULL, worker_done, NULL);
+
+  return (NULL);
+}
+
+
+//
+// 'test_log()' - Collect the log messages of a job.
+//
+
+static void
+test_log(void          *data,		// I - Job
+	 cf_loglevel_t level,		// I - Log level
+	 const char    *message,	// I - Printf-style message
+	 ...)				// I - Arguments
+{
+  test_job_t	*job = (test_job_t *)data;
+  size_t	len = strlen(job->log);	// Length of the log so far
+  va_list	arg;			// Arguments
+
+
+  (void)level;
+
+  if (len + 2 >= sizeof(job->log))
+    return;
+
+  va_start(arg, message);
+  vsnprintf(job->log + len, sizeof(job->log) - len - 1, message, arg);
+  va_end(arg);
+
+  strcat(job->log, "\n");
+}
+
+
+//
+// 'test_time()' - Return the monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+test_time(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+
+//
+// 'wait_filter()' - Wait for the job to be canceled.
+//
+
+static int				// O - Exit status
+wait_filter(int              inputfd,	// I - Input file
+	    int              outputfd,	// I - Output file
+	    int              inputseekable,
+					// I - Input seekable?
+	    cf_filter_data_t *data,	// I - Job data
+	    void             *parameters)
+					// I - Filter parameters
+{
+  int	i;				// Looping var
+
+
+  (void)inputseekable;
+  (void)parameters;
+
+  close(inputfd);
+  close(outputfd);
+
+  for (i = 0; i < 1000; i ++)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (data->logfunc)
+	(data->logfunc)(data->logdata, CF_LOGLEVEL_INFO, "wait: canceled");
+      return (1);
+    }
+
+    usleep(10000);
+  }
+
+  return (0);
+}
+
+
+//
+// 'worker_done()' - Tell whether the worker should shut down.
+//
+
+static int				// O - 1 to shut down, 0 otherwise
+worker_done(void *data)			// I - Unused
+{
+  (void)data;
+
+  return (shutdown_worker);
+}
@@ -0,0 +1,574 @@
+//
+// Image zoom test and benchmark program for libcupsfilters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   main()        - Main entry...
+//   bench_zoom()  - Time scaling all rows of an image.
+//   test_golden() - Compare scaled rows with rows of the old zoom code.
+//   test_zoom()   - Compare the row scaling kernels with the pixel by pixel
+//                   or C code.
+//   write_png()   - Write a test image.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "image-private.h"
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+
+
+//
+// Local globals...
+//
+
+static const char * const kernels[] =	// Row scaling kernels
+{
+  "c",
+  "sse2",
+  "avx2",
+  "neon"
+};
+
+
+//
+// Local functions...
+//
+
+static double	bench_zoom(cf_image_t *img, int xsize, int ysize,
+			   cf_iztype_t type, int reference, int runs);
+static int	test_golden(cf_image_t *img, cf_icspace_t space);
+static int	test_zoom(cf_image_t *img, int xsize, int ysize, int rotated,
+			  cf_iztype_t type);
+static int	write_png(const char *filename, int width, int height);
+
+
+//
+// 'main()' - Main entry...
+//
+// Usage: testzoom [runs]
+//
+// Checks that all row scaling kernels the CPU supports give the same
+// output as the pixel by pixel code, or for filtering as the C kernels,
+// and that all of them still give the output of the old zoom code.
+// With a number of runs given it also reports the speed of each kernel
+// for a typical photo job, scaling a 1600 pixel wide image to 600 DPI on
+// Letter size paper.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  static const cf_icspace_t spaces[] =	// Colorspaces to test
+  {
+    CF_IMAGE_WHITE,
+    CF_IMAGE_RGB,
+    CF_IMAGE_CMYK
+  };
+  static const int sizes[][2] =		// Output sizes to test
+  {
+    { 1,     1 },
+    { 7,     5 },
+    { 333,   211 },
+    { 640,   480 },
+    { 1598,  1198 },
+    { -1598, -1198 },
+    { 1601,  1201 },
+    { -1601, 1201 },
+    { 1601,  -1201 },
+    { 5100,  3829 },
+    { -4477, -3001 }
+  };
+  char		filename[256];		// Test image file
+  cf_image_t	*img;			// Test image
+  int		runs,			// Benchmark runs
+		status = 0;		// Exit status
+  size_t	i, j, k;		// Looping vars
+  double	ref,			// Time of pixel by pixel code
+		secs;			// Time of kernels
+  const char	*best;			// Default kernels
+
+
+  runs = argc > 1 ? atoi(argv[1]) : 0;
+
+  snprintf(filename, sizeof(filename), "%s/testzoom-%d.png",
+           getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+
+  if (write_png(filename, 1600, 1200))
+  {
+    perror(filename);
+    return (1);
+  }
+
+  best = _cfImageZoomKernel(NULL);
+
+  for (i = 0; i < sizeof(spaces) / sizeof(spaces[0]); i ++)
+  {
+    if ((img = cfImageOpen(filename, spaces[i], CF_IMAGE_WHITE, 100, 0,
+                           NULL)) == NULL)
+    {
+      unlink(filename);
+      puts("Unable to open test image, skipped.");
+      return (77);
+    }
+
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+    {
+      if (strcmp(_cfImageZoomKernel(kernels[k]), kernels[k]))
+        continue;
+
+      status |= test_golden(img, spaces[i]);
+
+      for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j ++)
+      {
+        status |= test_zoom(img, sizes[j][0], sizes[j][1], 0,
+			    CF_IZOOM_FAST);
+        status |= test_zoom(img, sizes[j][0], sizes[j][1], 0,
+			    CF_IZOOM_NORMAL);
+        status |= test_zoom(img, sizes[j][0], sizes[j][1], 1,
+			    CF_IZOOM_NORMAL);
+        status |= test_zoom(img, sizes[j][0], sizes[j][1], 0,
+			    CF_IZOOM_BEST);
+        status |= test_zoom(img, sizes[j][0], sizes[j][1], 1,
+			    CF_IZOOM_BEST);
+      }
+
+      printf("%s, %d bytes per pixel, %s kernels: %s\n",
+             i == 0 ? "Gray" : i == 1 ? "RGB" : "CMYK", cfImageGetDepth(img),
+	     kernels[k], status ? "FAIL" : "PASS");
+    }
+
+    _cfImageZoomKernel(best);
+
+    if (spaces[i] == CF_IMAGE_RGB && runs > 0)
+    {
+      ref = bench_zoom(img, 5100, 3825, CF_IZOOM_NORMAL, 1, runs);
+      printf("Bilinear, pixel by pixel: %.1f Mpixels/s\n", ref);
+
+      for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+      {
+	if (strcmp(_cfImageZoomKernel(kernels[k]), kernels[k]))
+	  continue;
+
+	secs = bench_zoom(img, 5100, 3825, CF_IZOOM_NORMAL, 0, runs);
+	printf("Bilinear, %s kernels: %.1f Mpixels/s (%.2fx)\n", kernels[k],
+	       secs, secs / ref);
+      }
+
+      _cfImageZoomKernel(best);
+
+      ref = bench_zoom(img, 5100, 3825, CF_IZOOM_FAST, 1, runs);
+      printf("Nearest, pixel by pixel: %.1f Mpixels/s\n", ref);
+      secs = bench_zoom(img, 5100, 3825, CF_IZOOM_FAST, 0, runs);
+      printf("Nearest, %s kernels: %.1f Mpixels/s (%.2fx)\n", best, secs,
+             secs / ref);
+
+      ref = bench_zoom(img, 5100, 3825, CF_IZOOM_NORMAL, 0, runs);
+
+      for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+      {
+	if (strcmp(_cfImageZoomKernel(kernels[k]), kernels[k]))
+	  continue;
+
+	secs = bench_zoom(img, 5100, 3825, CF_IZOOM_BEST, 0, runs);
+	printf("Filter, %s kernels: %.1f Mpixels/s (%.2fx bilinear time)\n",
+	       kernels[k], secs, ref / secs);
+      }
+
+      _cfImageZoomKernel(best);
+    }
+
+    cfImageClose(img);
+  }
+
+  unlink(filename);
+
+  return (status);
+}
+
+
+//
+// 'bench_zoom()' - Time scaling all rows of an image.
+//
+
+static double				// O - Output Mpixels per second
+bench_zoom(cf_image_t  *img,		// I - Image
+           int         xsize,		// I - Output width
+	   int         ysize,		// I - Output height
+	   cf_iztype_t type,		// I - Zoom type
+	   int         reference,	// I - Use pixel by pixel code?
+	   int         runs)		// I - Number of runs
+{
+  cf_izoom_t		*z;		// Zoom record
+  struct timespec	start,		// Start time
+			end;		// End time
+  double		best = 0.0,	// Best time
+			secs;		// Time of run
+  int			run,		// Current run
+			iy;		// Input row
+
+
+  for (run = 0; run < runs; run ++)
+  {
+    if ((z = _cfImageZoomNew(img, 0, 0, cfImageGetWidth(img) - 1,
+                             cfImageGetHeight(img) - 1, xsize, ysize, 0,
+			     type)) == NULL)
+      return (0.0);
+
+    if (reference)
+    {
+      free(z->xoff);
+      z->xoff = NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (iy = 0; iy < ysize; iy ++)
+      if (type == CF_IZOOM_BEST)
+        _cfImageZoomFill(z, iy);
+      else
+        _cfImageZoomFill(z, iy * cfImageGetHeight(img) / ysize);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    _cfImageZoomDelete(z);
+
+    secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+    if (run == 0 || secs < best)
+      best = secs;
+  }
+
+  return (best > 0.0 ? 1e-6 * xsize * ysize / best : 0.0);
+}
+
+
+//
+// 'test_golden()' - Compare scaled rows with rows of the old zoom code.
+//
+// The checksums are of all rows the zoom code gives for the image that
+// write_png() makes, cropped like in test_zoom().  Nearest-neighbor and
+// bilinear scaling come from the pixel by pixel code that predates the
+// kernels, filtering from the C kernels it was first written with.  That
+// bilinear code read one pixel past the input row for the last output
+// pixel of enlargements, the checksums are with the edge pixel there, as
+// the padding gives now.
+//
+
+static int				// O - 0 if same, 1 if different
+test_golden(cf_image_t   *img,		// I - Image
+            cf_icspace_t space)		// I - Colorspace of image
+{
+  static const struct
+  {
+    cf_icspace_t	space;		// Colorspace of image
+    cf_iztype_t		type;		// Zoom type
+    int			xsize,		// Output width
+			ysize,		// Output height
+			rotated;	// Rotate by 90 degrees?
+    unsigned long	crc;		// CRC-32 of all rows
+  }		golden[] =		// Checksums of old zoom code
+  {
+    { CF_IMAGE_WHITE, CF_IZOOM_FAST,   333,   211,   1, 0x080004da },
+    { CF_IMAGE_WHITE, CF_IZOOM_FAST,   -1601, 1201,  0, 0x39d4286a },
+    { CF_IMAGE_WHITE, CF_IZOOM_FAST,   1601,  -1201, 1, 0x67ccffe1 },
+    { CF_IMAGE_RGB,   CF_IZOOM_FAST,   333,   211,   1, 0xd51e9d2f },
+    { CF_IMAGE_RGB,   CF_IZOOM_FAST,   -1601, 1201,  0, 0x47360afb },
+    { CF_IMAGE_RGB,   CF_IZOOM_FAST,   1601,  -1201, 1, 0x4c86add1 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_FAST,   333,   211,   1, 0x2050d4ed },
+    { CF_IMAGE_CMYK,  CF_IZOOM_FAST,   -1601, 1201,  0, 0x1fb1803d },
+    { CF_IMAGE_CMYK,  CF_IZOOM_FAST,   1601,  -1201, 1, 0x3ca1e947 },
+    { CF_IMAGE_WHITE, CF_IZOOM_NORMAL, 333,   211,   1, 0x3abbadfa },
+    { CF_IMAGE_WHITE, CF_IZOOM_NORMAL, -1601, 1201,  0, 0x64047012 },
+    { CF_IMAGE_WHITE, CF_IZOOM_NORMAL, 1601,  -1201, 1, 0x9672e0fc },
+    { CF_IMAGE_RGB,   CF_IZOOM_NORMAL, 333,   211,   1, 0x02ea35f9 },
+    { CF_IMAGE_RGB,   CF_IZOOM_NORMAL, -1601, 1201,  0, 0xa6ec23a6 },
+    { CF_IMAGE_RGB,   CF_IZOOM_NORMAL, 1601,  -1201, 1, 0xe55d9ba0 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_NORMAL, 333,   211,   1, 0x7ea7d20a },
+    { CF_IMAGE_CMYK,  CF_IZOOM_NORMAL, -1601, 1201,  0, 0xcfc32a60 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_NORMAL, 1601,  -1201, 1, 0x5024f2d5 },
+    { CF_IMAGE_WHITE, CF_IZOOM_BEST,   333,   211,   1, 0x713f0f9e },
+    { CF_IMAGE_WHITE, CF_IZOOM_BEST,   -1601, 1201,  0, 0xb91728dd },
+    { CF_IMAGE_WHITE, CF_IZOOM_BEST,   1601,  -1201, 1, 0xc279194e },
+    { CF_IMAGE_RGB,   CF_IZOOM_BEST,   333,   211,   1, 0xffdbc9e1 },
+    { CF_IMAGE_RGB,   CF_IZOOM_BEST,   -1601, 1201,  0, 0xc787981b },
+    { CF_IMAGE_RGB,   CF_IZOOM_BEST,   1601,  -1201, 1, 0xb8c48af5 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_BEST,   333,   211,   1, 0xe305beb1 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_BEST,   -1601, 1201,  0, 0xe5b2cf86 },
+    { CF_IMAGE_CMYK,  CF_IZOOM_BEST,   1601,  -1201, 1, 0x086341bf }
+  };
+  cf_izoom_t	*z;			// Zoom record
+  unsigned long	crc;			// CRC-32 of rows
+  int		iy,			// Input or output row
+		last,			// Last row to fill
+		status = 0;		// Return value
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < sizeof(golden) / sizeof(golden[0]); i ++)
+  {
+    if (golden[i].space != space)
+      continue;
+
+    if ((z = _cfImageZoomNew(img, 1, 1, cfImageGetWidth(img) - 2,
+                             cfImageGetHeight(img) - 2, golden[i].xsize,
+			     golden[i].ysize, golden[i].rotated,
+			     golden[i].type)) == NULL)
+    {
+      printf("Unable to scale to %dx%d.\n", golden[i].xsize,
+             golden[i].ysize);
+      status = 1;
+      continue;
+    }
+
+    last = golden[i].type == CF_IZOOM_BEST ? (int)z->ysize - 1 :
+					      (int)z->ymax + 1;
+    crc  = crc32(0, NULL, 0);
+
+    for (iy = 0; iy <= last; iy ++)
+    {
+      _cfImageZoomFill(z, iy);
+      crc = crc32(crc, z->rows[z->row], z->xsize * z->depth);
+    }
+
+    if (crc != golden[i].crc)
+    {
+      printf("%s %s scaling to %dx%d differs from the old code.\n",
+	     golden[i].rotated ? "Rotated" : "Unrotated",
+	     golden[i].type == CF_IZOOM_FAST ? "nearest-neighbor" :
+	     golden[i].type == CF_IZOOM_NORMAL ? "bilinear" : "filtered",
+	     golden[i].xsize, golden[i].ysize);
+      status = 1;
+    }
+
+    _cfImageZoomDelete(z);
+  }
+
+  return (status);
+}
+
+
+//
+// 'test_zoom()' - Compare the row scaling kernels with the pixel by pixel
+//                 or C code.
+//
+// Filtering has no pixel by pixel code, its kernels are compared with the
+// C kernels instead, and the output of unscaled images with the input.
+//
+
+static int				// O - 0 if same, 1 if different
+test_zoom(cf_image_t  *img,		// I - Image
+          int         xsize,		// I - Output width
+	  int         ysize,		// I - Output height
+	  int         rotated,		// I - Rotate by 90 degrees?
+	  cf_iztype_t type)		// I - Zoom type
+{
+  cf_izoom_t	*z,			// Zoom record using the kernels
+		*zref;			// Zoom record for pixel by pixel code
+  int		xc1,			// Lower-righthand corner
+		yc1,			// ...
+		iy,			// Input row
+		last,			// Last row to fill
+		x,			// Looping var
+		y,			// Unscaled row
+		status = 0;		// Return value
+  const char	*kernel;		// Kernels under test
+  cf_ib_t	*in = NULL;		// Unscaled input row
+
+
+  //
+  // Leave out the last column and row to check the padding...
+  //
+
+  xc1 = cfImageGetWidth(img) - 2;
+  yc1 = cfImageGetHeight(img) - 2;
+
+  z    = _cfImageZoomNew(img, 1, 1, xc1, yc1, xsize, ysize, rotated, type);
+  zref = _cfImageZoomNew(img, 1, 1, xc1, yc1, xsize, ysize, rotated, type);
+
+  if (!z || !zref || !z->xoff || z->type != type ||
+      (in = malloc(z->xsize * z->depth)) == NULL)
+  {
+    printf("Unable to scale %dx%d to %dx%d.\n", xc1, yc1, xsize, ysize);
+    status = 1;
+  }
+  else
+  {
+    kernel = _cfImageZoomKernel(NULL);
+
+    if (type == CF_IZOOM_BEST)
+      last = z->ysize - 1;
+    else
+    {
+      last = z->ymax + 1;
+
+      free(zref->xoff);
+      zref->xoff = NULL;
+    }
+
+    for (iy = 0; iy <= last && !status; iy ++)
+    {
+      _cfImageZoomFill(z, iy);
+
+      if (type == CF_IZOOM_BEST)
+      {
+        _cfImageZoomKernel("c");
+        _cfImageZoomFill(zref, iy);
+        _cfImageZoomKernel(kernel);
+      }
+      else
+        _cfImageZoomFill(zref, iy);
+
+      if (memcmp(z->rows[z->row], zref->rows[zref->row],
+                 z->xsize * z->depth))
+      {
+        printf("%s %s scaling to %dx%d differs in row %d.\n",
+	       rotated ? "Rotated" : "Unrotated",
+	       type == CF_IZOOM_FAST ? "nearest-neighbor" :
+	       type == CF_IZOOM_NORMAL ? "bilinear" : "filtered",
+	       xsize, ysize, iy);
+	status = 1;
+      }
+
+      if (type == CF_IZOOM_BEST && z->xsize == z->width &&
+          z->ysize == z->height)
+      {
+        //
+	// Unscaled, filtering must give back the input pixels...
+	//
+
+        y = z->yflip ? (int)z->ysize - 1 - iy : iy;
+
+        if (rotated)
+	  cfImageGetCol(img, z->xorig - y, z->yorig, z->width, in);
+	else
+	  cfImageGetRow(img, z->xorig, z->yorig + y, z->width, in);
+
+        for (x = 0; x < (int)z->xsize; x ++)
+	  if (memcmp(z->rows[z->row] + x * z->depth,
+		     in + (xsize < 0 ? (int)z->xsize - 1 - x : x) * z->depth,
+		     z->depth))
+	    break;
+
+        if (x < (int)z->xsize)
+	{
+	  printf("%s unscaled filtering to %dx%d differs in row %d, column "
+		 "%d.\n", rotated ? "Rotated" : "Unrotated", xsize, ysize, iy,
+		 x);
+	  status = 1;
+	}
+      }
+    }
+  }
+
+  free(in);
+  if (z)
+    _cfImageZoomDelete(z);
+  if (zref)
+    _cfImageZoomDelete(zref);
+
+  return (status);
+}
+
+
+//
+// 'write_png()' - Write a test image.
+//
+// An RGB image with smooth gradients and sharp edges, so that both
+// neighbors of an interpolated pixel matter.
+//
+
+static int				// O - 0 on success, -1 on error
+write_png(const char *filename,		// I - File to write
+          int        width,		// I - Width of image
+	  int        height)		// I - Height of image
+{
+  FILE		*fp;			// PNG file
+  unsigned char	*raw,			// Filtered image data
+		*data,			// Compressed image data
+		*p,			// Pointer into image data
+		chunk[25];		// Chunk header and IHDR data
+  uLongf	datalen;		// Length of compressed data
+  uLong		crc;			// Chunk CRC
+  size_t	rawlen;			// Length of filtered image data
+  int		x, y;			// Looping vars
+
+
+  rawlen = (size_t)(width * 3 + 1) * height;
+  if ((raw = malloc(rawlen)) == NULL)
+    return (-1);
+
+  for (y = 0, p = raw; y < height; y ++)
+  {
+    *p++ = 0;				// No filter
+
+    for (x = 0; x < width; x ++)
+    {
+      *p++ = (unsigned char)(x * 255 / width);
+      *p++ = (unsigned char)((x / 7 + y / 5) & 1 ? 240 : 15);
+      *p++ = (unsigned char)(x * 31 + y * 17);
+    }
+  }
+
+  datalen = compressBound(rawlen);
+  if ((data = malloc(datalen)) == NULL ||
+      compress2(data, &datalen, raw, rawlen, 1) != Z_OK ||
+      (fp = fopen(filename, "wb")) == NULL)
+  {
+    free(raw);
+    free(data);
+    return (-1);
+  }
+
+  free(raw);
+
+  fwrite("\211PNG\r\n\032\n", 1, 8, fp);
+
+  // IHDR
+  memcpy(chunk, "\0\0\0\015IHDR", 8);
+  chunk[8]  = (unsigned char)(width >> 24);
+  chunk[9]  = (unsigned char)(width >> 16);
+  chunk[10] = (unsigned char)(width >> 8);
+  chunk[11] = (unsigned char)width;
+  chunk[12] = (unsigned char)(height >> 24);
+  chunk[13] = (unsigned char)(height >> 16);
+  chunk[14] = (unsigned char)(height >> 8);
+  chunk[15] = (unsigned char)height;
+  chunk[16] = 8;			// Bit depth
+  chunk[17] = 2;			// RGB
+  chunk[18] = chunk[19] = chunk[20] = 0;
+  crc       = crc32(0, chunk + 4, 17);
+  chunk[21] = (unsigned char)(crc >> 24);
+  chunk[22] = (unsigned char)(crc >> 16);
+  chunk[23] = (unsigned char)(crc >> 8);
+  chunk[24] = (unsigned char)crc;
+  fwrite(chunk, 1, 25, fp);
+
+  // IDAT
+  chunk[0] = (unsigned char)(datalen >> 24);
+  chunk[1] = (unsigned char)(datalen >> 16);
+  chunk[2] = (unsigned char)(datalen >> 8);
+  chunk[3] = (unsigned char)datalen;
+  memcpy(chunk + 4, "IDAT", 4);
+  crc      = crc32(crc32(0, chunk + 4, 4), data, datalen);
+  fwrite(chunk, 1, 8, fp);
+  fwrite(data, 1, datalen, fp);
+  chunk[0] = (unsigned char)(crc >> 24);
+  chunk[1] = (unsigned char)(crc >> 16);
+  chunk[2] = (unsigned char)(crc >> 8);
+  chunk[3] = (unsigned char)crc;
+  fwrite(chunk, 1, 4, fp);
+
+  // IEND
+  fwrite("\0\0\0\0IEND\256B`\202", 1, 12, fp);
+
+  free(data);
+
+  return (fclose(fp) ? -1 : 0);
+}
@@ -28,6 +28,179 @@
 #include <limits.h>
 #include <cups/cups.h>
 
+
+//
+// Types...
+//
+
+typedef enum universal_param_e		// Parameters a converter needs
+{
+  UNIVERSAL_PARAM_NONE,			// None
+  UNIVERSAL_PARAM_OUTFORMAT,		// cf_filter_out_format_t
+  UNIVERSAL_PARAM_TEXTTOPDF,		// cf_filter_texttopdf_parameter_t
+  UNIVERSAL_PARAM_BANNERTOPDF		// Template directory
+} universal_param_t;
+
+typedef struct universal_converter_s	// Edge of the conversion graph
+{
+  const char           *name;		// Name of the filter, NULL for
+					// a format which is a special case
+					// of another one (no filter needed)
+  const char           *src;		// Input format
+  const char           *dst;		// Output format
+  cf_filter_function_t function;	// Filter function
+  universal_param_t    param;		// Kind of parameters needed
+  cf_filter_out_format_t outformat;	// Output format for
+					// UNIVERSAL_PARAM_OUTFORMAT
+  int                  manage;		// Does page management (page
+					// selection, N-up, ...)?
+  int                  raster;		// Cost grows with resolution?
+  double               startup;		// Estimated cost per job (ms)
+  double               page;		// Estimated cost per page at
+					// 300 dpi (ms)
+} universal_converter_t;
+
+#define UNIVERSAL_MAX_STEPS 6		// Maximum length of a filter chain
+
+typedef struct universal_plan_s		// A filter chain
+{
+  int    num_steps;			// Number of converters, -1 if no
+					// chain found
+  int    steps[UNIVERSAL_MAX_STEPS];	// Indices into universal_converters
+  double cost;				// Total estimated cost (ms)
+} universal_plan_t;
+
+typedef struct universal_planner_s	// State of the path search
+{
+  const char       *goal;		// Format to produce
+  int              goal_manage;		// Does the goal need page
+					// management?
+  const char       *nodes[UNIVERSAL_MAX_STEPS + 1];
+					// Formats along the current path
+  int              managed[UNIVERSAL_MAX_STEPS + 1];
+					// Page management done along the
+					// current path?
+  double           *costs;		// Cost of each converter
+  int              *measured;		// Cost from measured throughput?
+  universal_plan_t cur,			// Path being explored
+		   best,		// Cheapest chain
+		   next;		// Second cheapest chain
+  cf_logfunc_t     log;			// Log function
+  void             *ld;			// Log function data
+} universal_planner_t;
+
+
+//
+// Local globals...
+//
+
+//
+// All the conversions cfFilterUniversal() can do.  "image/*" stands
+// for all image formats except the raster formats URF and PWG Raster,
+// "text/*" for all text formats.  "application/pdf" is PDF as it
+// comes from the user, "application/vnd.cups-pdf" PDF which went
+// through page management.
+//
+// Costs are rough estimates in milliseconds for one A4/Letter page,
+// for raster filters at 300 dpi, they get replaced by the throughput
+// measured in previous jobs when a cf_filter_stats_t record is
+// attached to the filter data (see CF_FILTER_STATS_EXT).
+//
+
+static const universal_converter_t universal_converters[] =
+{
+  { "imagetopdf", "image/*", "application/vnd.cups-pdf",
+    cfFilterImageToPDF, UNIVERSAL_PARAM_NONE, 0, 1, 0, 10.0, 30.0 },
+  { "imagetoraster", "image/*", "application/vnd.cups-raster",
+    cfFilterImageToRaster, UNIVERSAL_PARAM_NONE, 0, 1, 1, 10.0, 120.0 },
+  { "rastertopwg", "application/vnd.cups-raster", "image/pwg-raster",
+    cfFilterRasterToPWG, UNIVERSAL_PARAM_NONE, 0, 0, 1, 2.0, 15.0 },
+  { "rastertopwg", "application/vnd.cups-raster", "image/urf",
+    cfFilterRasterToPWG, UNIVERSAL_PARAM_NONE, 0, 0, 1, 2.0, 15.0 },
+  { "pwgtopclm", "image/pwg-raster", "application/PCLm",
+    cfFilterPWGToPDF, UNIVERSAL_PARAM_OUTFORMAT, CF_FILTER_OUT_FORMAT_PCLM,
+    0, 1, 5.0, 60.0 },
+  { "pwgtopdf", "image/pwg-raster", "application/pdf",
+    cfFilterPWGToPDF, UNIVERSAL_PARAM_OUTFORMAT, CF_FILTER_OUT_FORMAT_PDF,
+    0, 1, 5.0, 60.0 },
+  { "pwgtopdf", "image/urf", "application/pdf",
+    cfFilterPWGToPDF, UNIVERSAL_PARAM_OUTFORMAT, CF_FILTER_OUT_FORMAT_PDF,
+    0, 1, 5.0, 60.0 },
+#ifdef HAVE_GHOSTSCRIPT
+  { "ghostscript", "application/postscript", "application/pdf",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT, CF_FILTER_OUT_FORMAT_PDF,
+    0, 0, 150.0, 200.0 },
+  { "ghostscript", "application/vnd.adobe-reader-postscript",
+    "image/pwg-raster",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PWG_RASTER, 0, 1, 150.0, 400.0 },
+#endif // HAVE_GHOSTSCRIPT
+#ifdef HAVE_FONTCONFIG
+  { "texttopdf", "text/*", "application/pdf",
+    cfFilterTextToPDF, UNIVERSAL_PARAM_TEXTTOPDF, 0, 0, 0, 20.0, 20.0 },
+#endif // HAVE_FONTCONFIG
+  { "bannertopdf", "application/vnd.cups-pdf-banner", "application/pdf",
+    cfFilterBannerToPDF, UNIVERSAL_PARAM_BANNERTOPDF, 0, 0, 0, 10.0, 10.0 },
+  { "pdftopdf", "application/pdf", "application/vnd.cups-pdf",
+    cfFilterPDFToPDF, UNIVERSAL_PARAM_NONE, 0, 1, 0, 20.0, 10.0 },
+  { NULL, "application/vnd.cups-pdf", "application/pdf",
+    NULL, UNIVERSAL_PARAM_NONE, 0, 0, 0, 0.0, 0.0 },
+#ifdef HAVE_GHOSTSCRIPT
+  { "ghostscript", "application/vnd.cups-pdf", "application/vnd.cups-raster",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_CUPS_RASTER, 0, 1, 150.0, 400.0 },
+  { "ghostscript", "application/vnd.cups-pdf", "image/pwg-raster",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PWG_RASTER, 0, 1, 150.0, 400.0 },
+  { "ghostscript", "application/vnd.cups-pdf", "image/urf",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_APPLE_RASTER, 0, 1, 150.0, 400.0 },
+  { "ghostscript", "application/vnd.cups-pdf", "application/PCLm",
+    cfFilterGhostscript, UNIVERSAL_PARAM_OUTFORMAT,
+    CF_FILTER_OUT_FORMAT_PCLM, 0, 1, 150.0, 400.0 },
+#endif // HAVE_GHOSTSCRIPT
+#ifdef HAVE_POPPLER
+  { "pdftoraster", "application/vnd.cups-pdf", "application/vnd.cups-raster",
+    cfFilterPDFToRaster, UNIVERSAL_PARAM_NONE, 0, 0, 1, 20.0, 600.0 },
+  { "pdftoraster", "application/vnd.cups-pdf", "image/pwg-raster",
+    cfFilterPDFToRaster, UNIVERSAL_PARAM_NONE, 0, 0, 1, 20.0, 600.0 },
+  { "pdftoraster", "application/vnd.cups-pdf", "image/urf",
+    cfFilterPDFToRaster, UNIVERSAL_PARAM_NONE, 0, 0, 1, 20.0, 600.0 },
+#endif // HAVE_POPPLER
+};
+
+#define UNIVERSAL_NUM_CONVERTERS \
+  (int)(sizeof(universal_converters) / sizeof(universal_converters[0]))
+
+
+//
+// Local functions...
+//
+
+static void	universal_add_filter(cups_array_t *filter_chain,
+				     const universal_converter_t *conv,
+				     cf_filter_universal_parameter_t
+				       *universal_parameters,
+				     cf_logfunc_t log, void *ld);
+static void	universal_estimate(cf_filter_data_t *data, double *pages,
+				   int *xres, int *yres);
+static const char *universal_input_node(const char *input,
+					const char *input_super,
+					const char *input_type);
+static const char *universal_output_node(const char *output_type);
+static void	universal_plan_string(universal_planner_t *planner,
+				      universal_plan_t *plan, char *buf,
+				      size_t bufsize);
+static void	universal_search(universal_planner_t *planner, int depth,
+				 double cost);
+
+
+//
+// 'cfFilterUniversal()' - Convert any supported input format into any
+//                         supported output format, selecting the
+//                         cheapest chain of filter functions
+//
+
 int					// O - Error status
 cfFilterUniversal(int inputfd,		// I - File descriptor input stream
 		  int outputfd,		// I - File descriptor output stream
@@ -42,9 +215,18 @@ cfFilterUniversal(int inputfd,		// I - File descriptor input stream
   char input_type[256];
   char output_super[16];
   char output_type[256];
-  cf_filter_out_format_t *outformat;
+  const char *input_node;
+  const char *output_node;
+  const universal_converter_t *conv;
   cf_filter_filter_in_chain_t *filter, *next;
   cf_filter_universal_parameter_t *universal_parameters;
+  cf_filter_stats_t *stats;
+  universal_planner_t planner;
+  double costs[UNIVERSAL_NUM_CONVERTERS];
+  int measured[UNIVERSAL_NUM_CONVERTERS];
+  double pages, scale, per_page;
+  int xres, yres, i, j, n;
+  char best[1024], second[1024];
   cf_logfunc_t log = data->logfunc;
   void *ld = data->logdata;
   int ret = 0;
@@ -89,250 +271,102 @@ cfFilterUniversal(int inputfd,		// I - File descriptor input stream
   cups_array_t *filter_chain;
   filter_chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
 
-  if (!strcasecmp(input_super, "image") && strcasecmp(input_type, "urf") &&
-      strcasecmp(input_type, "pwg-raster"))
+  if ((input_node = universal_input_node(input, input_super,
+					 input_type)) == NULL ||
+      (output_node = universal_output_node(output_type)) == NULL)
   {
-    if (!strcasecmp(output_type, "vnd.cups-raster") ||
-	!strcasecmp(output_type, "urf") ||
-	!strcasecmp(output_type, "pwg-raster") ||
-	!strcasecmp(output_type, "PCLm"))
-    {
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterImageToRaster;
-      filter->parameters = NULL;
-      filter->name = "imagetoraster";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-
-      if (!strcasecmp(output, "image/pwg-raster") ||
-	  !strcasecmp(output, "application/PCLm"))
-      {
-	filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	filter->function = cfFilterRasterToPWG;
-	filter->parameters = NULL;
-	filter->name = "rastertopwg";
-	cupsArrayAdd(filter_chain, filter);
-	if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		     "cfFilterUniversal: Adding %s to chain", filter->name);
-
-	if (!strcasecmp(output, "application/PCLm"))
-        {
-	  outformat = malloc(sizeof(cf_filter_out_format_t));
-	  *outformat = CF_FILTER_OUT_FORMAT_PCLM;
-	  filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	  filter->function = cfFilterPWGToPDF;
-	  filter->parameters = outformat;
-	  filter->name = "pwgtopclm";
-	  cupsArrayAdd(filter_chain, filter);
-	  if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		       "cfFilterUniversal: Adding %s to chain", filter->name);
-	}
-      }
-      else if (!strcasecmp(output, "image/urf"))
-      {
-	filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	filter->function = cfFilterRasterToPWG;
-	filter->parameters = NULL;
-	filter->name = "rastertopwg";
-	cupsArrayAdd(filter_chain, filter);
-	if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		     "cfFilterUniversal: Adding %s to chain", filter->name);
-      }
-    }
-    else
-    {
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterImageToPDF;
-      filter->parameters = NULL;
-      filter->name = "imagetopdf";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-    }
+    // Input or output format unknown -> Error
+    ret = 1;
+    goto out;
   }
-  else
+
+  //
+  // Estimate the cost of each conversion, from the throughput measured
+  // in earlier jobs if we have it, otherwise from our static
+  // estimates, scaled by the number of pages and the resolution...
+  //
+
+  universal_estimate(data, &pages, &xres, &yres);
+  scale = (double)xres * yres / (300.0 * 300.0);
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterUniversal: Planning for %.0f page(s) at %dx%ddpi",
+	       pages, xres, yres);
+
+  stats = (cf_filter_stats_t *)cfFilterDataGetExt(data, CF_FILTER_STATS_EXT);
+
+  for (i = 0; i < UNIVERSAL_NUM_CONVERTERS; i ++)
   {
-#ifdef HAVE_GHOSTSCRIPT
-    if (!strcasecmp(input, "application/postscript") || !strcasecmp(input, "application/vnd.cups-postscript"))
-    {
-      outformat = malloc(sizeof(cf_filter_out_format_t));
-      *outformat = CF_FILTER_OUT_FORMAT_PDF;
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterGhostscript;
-      filter->parameters = outformat;
-      filter->name = "ghostscript";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-    }
-    else
-#endif // HAVE_GHOSTSCRIPT
-#ifdef HAVE_FONTCONFIG
-    if (!strcasecmp(input_super, "text") ||
-	(!strcasecmp(input_super, "application") && input_type[0] == 'x'))
-    {
-      cf_filter_texttopdf_parameter_t* tparameters = NULL;
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      if (universal_parameters)
+    conv        = universal_converters + i;
+    costs[i]    = conv->startup +
+                  pages * conv->page * (conv->raster ? scale : 1.0);
+    measured[i] = 0;
+
+    if (!conv->name || !stats)
+      continue;
+
+    for (j = 0, n = 0, per_page = 0.0; j < stats->num_stages; j ++)
+      if (stats->stages[j].name &&
+	  !strcmp(stats->stages[j].name, conv->name) &&
+	  stats->stages[j].status == 0 && stats->stages[j].pages > 0)
       {
-	tparameters =
-	  (cf_filter_texttopdf_parameter_t *)malloc(sizeof(cf_filter_texttopdf_parameter_t));
-	*tparameters = universal_parameters->texttopdf_params;
+	per_page += 1000.0 * stats->stages[j].cpu_time /
+	            stats->stages[j].pages;
+	n ++;
       }
-      filter->function = cfFilterTextToPDF;
-      filter->parameters = tparameters;
-      filter->name = "texttopdf";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain",
-		   filter->name);
-    }
-    else
-#endif // HAVE_FONTCONFIG
-    if (!strcasecmp(input, "image/urf") ||
-	     !strcasecmp(input, "image/pwg-raster"))
-    {
-      outformat = malloc(sizeof(cf_filter_out_format_t));
-      *outformat = CF_FILTER_OUT_FORMAT_PDF;
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterPWGToPDF;
-      filter->parameters = outformat;
-      filter->name = "pwgtopdf";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-    }
-#ifdef HAVE_GHOSTSCRIPT
-    else if (!strcasecmp(input_type, "vnd.adobe-reader-postscript"))
-    {
-      outformat = malloc(sizeof(cf_filter_out_format_t));
-      *outformat = CF_FILTER_OUT_FORMAT_PWG_RASTER;
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterGhostscript;
-      filter->parameters = outformat;
-      filter->name = "ghostscript";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-
-      outformat = malloc(sizeof(cf_filter_out_format_t));
-      *outformat = CF_FILTER_OUT_FORMAT_PDF;
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterPWGToPDF;
-      filter->parameters = outformat;
-      filter->name = "pwgtopdf";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-    }
-#endif // HAVE_GHOSTSCRIPT
-    else if (!strcasecmp(input, "application/vnd.cups-pdf-banner"))
-    {
-      filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-      filter->function = cfFilterBannerToPDF;
-      filter->parameters =
-	(universal_parameters &&
-	 universal_parameters->bannertopdf_template_dir ?
-	 strdup(universal_parameters->bannertopdf_template_dir) : NULL);
-      filter->name = "bannertopdf";
-      cupsArrayAdd(filter_chain, filter);
-      if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		   "cfFilterUniversal: Adding %s to chain", filter->name);
-    }
-    else if (!strcasestr(input_type, "pdf"))
+
+    if (n > 0)
     {
-      // Input format is not PDF and unknown -> Error
-      ret = 1;
-      goto out;
+      costs[i]    = pages * per_page / n;
+      measured[i] = 1;
     }
   }
-  if (strcasecmp(input_super, "image") ||
-      (strcasecmp(output_type, "vnd.cups-raster") &&
-       strcasecmp(output_type, "urf") && strcasecmp(output_type, "pwg-raster") &&
-       strcasecmp(output_type, "PCLm")) ||
-      !strcasecmp(input_type, "urf") ||
-      !strcasecmp(input_type, "pwg-raster"))
+
+  //
+  // Find the cheapest chain...
+  //
+
+  memset(&planner, 0, sizeof(planner));
+  planner.goal           = output_node;
+  planner.goal_manage    = strcmp(output_node, "application/pdf") != 0;
+  planner.nodes[0]       = input_node;
+  planner.managed[0]     = !strcmp(input_node, "application/vnd.cups-pdf");
+  planner.costs          = costs;
+  planner.measured       = measured;
+  planner.best.num_steps = -1;
+  planner.next.num_steps = -1;
+  planner.log            = log;
+  planner.ld             = ld;
+
+  universal_search(&planner, 0, 0.0);
+
+  if (planner.best.num_steps < 0)
   {
-    if (strcasecmp(output_type, "pdf"))
-    {
-      if (strcasecmp(input_type, "vnd.cups-pdf") &&
-	  (strcasecmp(input_super, "image") ||
-	   !strcasecmp(input_type, "urf") ||
-	   !strcasecmp(input_type, "pwg-raster")))
-      {
-	filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	filter->function = cfFilterPDFToPDF;
-	filter->parameters = NULL;
-	filter->name = "pdftopdf";
-	cupsArrayAdd(filter_chain, filter);
-	if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		     "cfFilterUniversal: Adding %s to chain", filter->name);
-      }
+    // No chain found -> Error
+    ret = 1;
+    goto out;
+  }
 
-#if defined(HAVE_GHOSTSCRIPT) || defined(HAVE_POPPLER)
-      if (strcasecmp(output_type, "vnd.cups-pdf"))
-      {
-	if (!strcasecmp(output_type, "vnd.cups-raster") ||
-	    !strcasecmp(output_type, "urf") ||
-	    !strcasecmp(output_type, "pwg-raster") ||
-	    !strcasecmp(output_type, "PCLm"))
-	{
-#  ifdef HAVE_GHOSTSCRIPT
-	  outformat = malloc(sizeof(cf_filter_out_format_t));
-	  *outformat = CF_FILTER_OUT_FORMAT_CUPS_RASTER;
-	  if (!strcasecmp(output_type, "pwg-raster"))
-	    *outformat = CF_FILTER_OUT_FORMAT_PWG_RASTER;
-	  else if (!strcasecmp(output_type, "urf"))
-	    *outformat = CF_FILTER_OUT_FORMAT_APPLE_RASTER;
-	  else if(!strcasecmp(output_type, "PCLm"))
-	    *outformat = CF_FILTER_OUT_FORMAT_PCLM;
-	  filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	  filter->function = cfFilterGhostscript;
-	  filter->parameters = outformat;
-	  filter->name = "ghostscript";
-	  cupsArrayAdd(filter_chain, filter);
-	  if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		       "cfFilterUniversal: Adding %s to chain",
-		       filter->name);
-#  else
-#    ifdef HAVE_POPPLER
-	  filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	  filter->function = cfFilterPDFToRaster;
-	  filter->parameters = NULL;
-	  filter->name = "pdftoraster";
-	  cupsArrayAdd(filter_chain, filter);
-	  if (log) log(ld, CF_LOGLEVEL_DEBUG,
-		       "cfFilterUniversal: Adding %s to chain",
-		       filter->name);
-	  if (!strcasecmp(output_type, "PCLm"))
-	  {
-	    outformat = malloc(sizeof(cf_filter_out_format_t));
-	    *outformat = CF_FILTER_OUT_FORMAT_PCLM;
-	    filter = malloc(sizeof(cf_filter_filter_in_chain_t));
-	    filter->function = cfFilterPWGToPDF;
-	    filter->parameters = outformat;
-	    filter->name = "pwgtopclm";
-	    cupsArrayAdd(filter_chain, filter);
-	    if (log) log(ld, CF_LOGLEVEL_DEBUG,
-			 "cfFilterUniversal: Adding %s to chain", filter->name);
-	  }
-#    endif // HAVE_POPPLER
-#  endif // HAVE_GHOSTSCRIPT
-	}
-	else
-	{
-#endif // HAVE_GHOSTSCRIPT || HAVE_POPPLER
-	  // Output format is not PDF and unknown -> Error
-	  ret = 1;
-	  goto out;
-#if defined(HAVE_GHOSTSCRIPT) || defined(HAVE_POPPLER)
-	}
-      }
-#endif // HAVE_GHOSTSCRIPT || HAVE_POPPLER
-    }
+  universal_plan_string(&planner, &planner.best, best, sizeof(best));
+  if (planner.next.num_steps < 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		 "cfFilterUniversal: Using %s, the only possible chain",
+		 best);
+  }
+  else
+  {
+    universal_plan_string(&planner, &planner.next, second, sizeof(second));
+    if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		 "cfFilterUniversal: Using %s, estimated cost %.0f ms; "
+		 "next best: %s, estimated cost %.0f ms",
+		 best, planner.best.cost, second, planner.next.cost);
   }
 
+  for (i = 0; i < planner.best.num_steps; i ++)
+    universal_add_filter(filter_chain,
+			 universal_converters + planner.best.steps[i],
+			 universal_parameters, log, ld);
+
  out:
 
   if (ret)
@@ -355,3 +389,296 @@ cfFilterUniversal(int inputfd,		// I - File descriptor input stream
 
   return ret;
 }
+
+
+//
+// 'universal_add_filter()' - Append the filter function of a converter,
+//                            with its parameters, to the filter chain
+//
+
+static void
+universal_add_filter(
+    cups_array_t *filter_chain,		// I - Filter chain
+    const universal_converter_t *conv,	// I - Converter
+    cf_filter_universal_parameter_t *universal_parameters,
+					// I - Parameters of cfFilterUniversal()
+    cf_logfunc_t log,			// I - Log function
+    void *ld)				// I - Log function data
+{
+  cf_filter_filter_in_chain_t *filter;
+  cf_filter_out_format_t *outformat;
+  cf_filter_texttopdf_parameter_t *tparameters;
+
+
+  if (!conv->function)
+    return;
+
+  filter = malloc(sizeof(cf_filter_filter_in_chain_t));
+  filter->function = conv->function;
+  filter->parameters = NULL;
+  filter->name = (char *)conv->name;
+
+  switch (conv->param)
+  {
+    case UNIVERSAL_PARAM_OUTFORMAT :
+	outformat = malloc(sizeof(cf_filter_out_format_t));
+	*outformat = conv->outformat;
+	filter->parameters = outformat;
+	break;
+
+    case UNIVERSAL_PARAM_TEXTTOPDF :
+	if (universal_parameters)
+	{
+	  tparameters = malloc(sizeof(cf_filter_texttopdf_parameter_t));
+	  *tparameters = universal_parameters->texttopdf_params;
+	  filter->parameters = tparameters;
+	}
+	break;
+
+    case UNIVERSAL_PARAM_BANNERTOPDF :
+	if (universal_parameters &&
+	    universal_parameters->bannertopdf_template_dir)
+	  filter->parameters =
+	    strdup(universal_parameters->bannertopdf_template_dir);
+	break;
+
+    default :
+	break;
+  }
+
+  cupsArrayAdd(filter_chain, filter);
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterUniversal: Adding %s to chain", filter->name);
+}
+
+
+//
+// 'universal_estimate()' - Estimate number of pages and resolution of
+//                          the job
+//
+
+static void
+universal_estimate(cf_filter_data_t *data, // I - Job and printer data
+		   double *pages,	// O - Number of pages, 1 if unknown
+		   int *xres,		// O - Horizontal resolution in dpi
+		   int *yres)		// O - Vertical resolution in dpi
+{
+  ipp_attribute_t *attr;
+  ipp_res_t	units;
+  const char	*val;
+  char		*ptr;
+
+
+  *pages = 1.0;
+  if ((attr = ippFindAttribute(data->job_attrs, "job-impressions",
+			       IPP_TAG_INTEGER)) != NULL ||
+      (attr = ippFindAttribute(data->job_attrs, "job-pages",
+			       IPP_TAG_INTEGER)) != NULL)
+  {
+    if (ippGetInteger(attr, 0) > 0)
+      *pages = ippGetInteger(attr, 0);
+  }
+  else if ((val = cupsGetOption("job-impressions", data->num_options,
+				data->options)) != NULL &&
+	   atoi(val) > 0)
+    *pages = atoi(val);
+
+  *xres = *yres = 0;
+  if (data->header)
+  {
+    *xres = data->header->HWResolution[0];
+    *yres = data->header->HWResolution[1];
+  }
+  if ((*xres <= 0 || *yres <= 0) &&
+      ((val = cupsGetOption("printer-resolution", data->num_options,
+			    data->options)) != NULL ||
+       (val = cupsGetOption("Resolution", data->num_options,
+			    data->options)) != NULL))
+  {
+    *xres = *yres = (int)strtol(val, &ptr, 10);
+    if (*ptr == 'x')
+      *yres = (int)strtol(ptr + 1, &ptr, 10);
+    if (!strncasecmp(ptr, "dpc", 3))
+    {
+      *xres = *xres * 254 / 100;
+      *yres = *yres * 254 / 100;
+    }
+  }
+  if ((*xres <= 0 || *yres <= 0) &&
+      (attr = ippFindAttribute(data->printer_attrs,
+			       "printer-resolution-default",
+			       IPP_TAG_RESOLUTION)) != NULL)
+  {
+    *xres = ippGetResolution(attr, 0, yres, &units);
+    if (units == IPP_RES_PER_CM)
+    {
+      *xres = *xres * 254 / 100;
+      *yres = *yres * 254 / 100;
+    }
+  }
+  if (*xres <= 0 || *yres <= 0)
+    *xres = *yres = 300;
+}
+
+
+//
+// 'universal_input_node()' - Map the input format onto the format name
+//                            used in the conversion graph
+//
+
+static const char *			// O - Format, NULL if unsupported
+universal_input_node(const char *input,	// I - Input format
+		     const char *input_super, // I - Super type
+		     const char *input_type) // I - Sub type
+{
+  if (!strcasecmp(input_super, "image") && strcasecmp(input_type, "urf") &&
+      strcasecmp(input_type, "pwg-raster"))
+    return ("image/*");
+#ifdef HAVE_GHOSTSCRIPT
+  if (!strcasecmp(input, "application/postscript") ||
+      !strcasecmp(input, "application/vnd.cups-postscript"))
+    return ("application/postscript");
+#endif // HAVE_GHOSTSCRIPT
+#ifdef HAVE_FONTCONFIG
+  if (!strcasecmp(input_super, "text") ||
+      (!strcasecmp(input_super, "application") && input_type[0] == 'x'))
+    return ("text/*");
+#endif // HAVE_FONTCONFIG
+  if (!strcasecmp(input, "image/urf"))
+    return ("image/urf");
+  if (!strcasecmp(input, "image/pwg-raster"))
+    return ("image/pwg-raster");
+#ifdef HAVE_GHOSTSCRIPT
+  if (!strcasecmp(input_type, "vnd.adobe-reader-postscript"))
+    return ("application/vnd.adobe-reader-postscript");
+#endif // HAVE_GHOSTSCRIPT
+  if (!strcasecmp(input, "application/vnd.cups-pdf-banner"))
+    return ("application/vnd.cups-pdf-banner");
+  if (!strcasecmp(input_type, "vnd.cups-pdf"))
+    return ("application/vnd.cups-pdf");
+  if (strcasestr(input_type, "pdf"))
+    return ("application/pdf");
+
+  return (NULL);
+}
+
+
+//
+// 'universal_output_node()' - Map the output format onto the format name
+//                             used in the conversion graph
+//
+
+static const char *			// O - Format, NULL if unsupported
+universal_output_node(const char *output_type) // I - Sub type
+{
+  if (!strcasecmp(output_type, "pdf"))
+    return ("application/pdf");
+  if (!strcasecmp(output_type, "vnd.cups-pdf"))
+    return ("application/vnd.cups-pdf");
+  if (!strcasecmp(output_type, "vnd.cups-raster"))
+    return ("application/vnd.cups-raster");
+  if (!strcasecmp(output_type, "urf"))
+    return ("image/urf");
+  if (!strcasecmp(output_type, "pwg-raster"))
+    return ("image/pwg-raster");
+  if (!strcasecmp(output_type, "PCLm"))
+    return ("application/PCLm");
+
+  return (NULL);
+}
+
+
+//
+// 'universal_plan_string()' - Describe a filter chain for logging
+//
+
+static void
+universal_plan_string(universal_planner_t *planner, // I - Planner
+		      universal_plan_t *plan, // I - Filter chain
+		      char *buf,	// O - Description
+		      size_t bufsize)	// I - Size of description buffer
+{
+  const universal_converter_t *conv;
+  size_t	len = 0;
+  int		i;
+
+
+  buf[0] = '\0';
+  for (i = 0; i < plan->num_steps && len < bufsize; i ++)
+  {
+    conv = universal_converters + plan->steps[i];
+    if (!conv->name)
+      continue;
+    len += snprintf(buf + len, bufsize - len, "%s%s (%.0f ms%s)",
+		    len ? ", " : "", conv->name,
+		    planner->costs[plan->steps[i]],
+		    planner->measured[plan->steps[i]] ? ", measured" : "");
+  }
+  if (!buf[0])
+    snprintf(buf, bufsize, "no filter");
+}
+
+
+//
+// 'universal_search()' - Find all filter chains from the format at the
+//                        given depth to the goal, keeping the two
+//                        cheapest
+//
+
+static void
+universal_search(universal_planner_t *planner, // I - Planner
+		 int depth,		// I - Length of the path so far
+		 double cost)		// I - Cost of the path so far
+{
+  const universal_converter_t *conv;
+  const char	*node = planner->nodes[depth];
+  char		buf[1024];
+  int		i, j, managed;
+
+
+  if (!strcmp(node, planner->goal) &&
+      (planner->managed[depth] || !planner->goal_manage))
+  {
+    planner->cur.num_steps = depth;
+    planner->cur.cost      = cost;
+
+    universal_plan_string(planner, &planner->cur, buf, sizeof(buf));
+    if (planner->log) planner->log(planner->ld, CF_LOGLEVEL_DEBUG,
+				   "cfFilterUniversal: Possible chain: %s, "
+				   "estimated cost %.0f ms", buf, cost);
+
+    if (planner->best.num_steps < 0 || cost < planner->best.cost)
+    {
+      planner->next = planner->best;
+      planner->best = planner->cur;
+    }
+    else if (planner->next.num_steps < 0 || cost < planner->next.cost)
+      planner->next = planner->cur;
+    return;
+  }
+
+  if (depth >= UNIVERSAL_MAX_STEPS)
+    return;
+
+  for (i = 0; i < UNIVERSAL_NUM_CONVERTERS; i ++)
+  {
+    conv = universal_converters + i;
+    if (strcmp(conv->src, node))
+      continue;
+
+    managed = planner->managed[depth] || conv->manage;
+
+    // Do not pass through the same format twice
+    for (j = 0; j <= depth; j ++)
+      if (!strcmp(planner->nodes[j], conv->dst) &&
+	  planner->managed[j] == managed)
+	break;
+    if (j <= depth)
+      continue;
+
+    planner->cur.steps[depth]  = i;
+    planner->nodes[depth + 1]   = conv->dst;
+    planner->managed[depth + 1] = managed;
+    universal_search(planner, depth + 1, cost + planner->costs[i]);
+  }
+}
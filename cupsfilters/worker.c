@@ -0,0 +1,1136 @@
+//
+// Persistent filter worker for libcupsfilters.
+//
+// Runs filter functions in a long-living process which receives the
+// jobs (file descriptors and filter data) through a local Unix domain
+// socket. So the initialization of the libraries used by the filter
+// functions (fontconfig, Little CMS, PDFio, ...) and the caches they
+// build up are done only once and not for each job.
+//
+// Copyright © 2026 by OpenPrinting.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+
+//
+// Include necessary headers...
+//
+
+#include "config.h"
+#include "filter.h"
+#include "libcups2-private.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif // HAVE_PTHREAD_H
+
+
+//
+// Constants...
+//
+
+#define WORKER_MAGIC          0x63665731 // "cfW1", protocol version
+#define WORKER_MAX_REQUEST    (16 * 1024 * 1024)
+					 // Maximum size of a job request
+#define WORKER_MAX_LOG        4096       // Maximum size of a log record,
+					 // longer messages get truncated
+#define WORKER_MSG_LOG        'L'        // Log message of the job
+#define WORKER_MSG_STATUS     'S'        // Exit status of the job
+
+
+//
+// Types...
+//
+
+typedef struct worker_buffer_s		// Growing buffer for (de)serializing
+{
+  unsigned char *data;			// Data
+  size_t	len,			// Bytes used/read position
+		alloc;			// Bytes allocated/total size
+  int		error;			// Overflow/allocation error?
+} worker_buffer_t;
+
+typedef struct worker_server_s		// Worker server state
+{
+  cf_filter_worker_filter_t *filters;	// Filter functions offered
+  int		num_filters;		// Number of filter functions
+  cf_logfunc_t	logfunc;		// Log function of the server
+  void		*logdata;		// User data for log function
+  int		active_jobs;		// Jobs currently running
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t mutex;		// Mutex for active_jobs
+  pthread_cond_t cond;			// Signals change of active_jobs
+#endif // HAVE_PTHREAD_H
+} worker_server_t;
+
+typedef struct worker_job_s		// Job received by the worker
+{
+  worker_server_t *server;		// Server which received the job
+  int		conn;			// Connection to the client
+  int		inputfd,		// Input of the filter function
+		outputfd;		// Output of the filter function
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t mutex;		// Mutex for writes to conn
+#endif // HAVE_PTHREAD_H
+} worker_job_t;
+
+
+//
+// Local functions...
+//
+
+static int	buffer_add(worker_buffer_t *buf, const void *data, size_t len);
+static int	buffer_add_int(worker_buffer_t *buf, int value);
+static int	buffer_add_ipp(worker_buffer_t *buf, ipp_t *ipp);
+static int	buffer_add_string(worker_buffer_t *buf, const char *s);
+static int	buffer_get(worker_buffer_t *buf, void *data, size_t len);
+static int	buffer_get_int(worker_buffer_t *buf);
+static ipp_t	*buffer_get_ipp(worker_buffer_t *buf);
+static char	*buffer_get_string(worker_buffer_t *buf);
+static ssize_t	buffer_ipp_read(void *ctx, ipp_uchar_t *buffer, size_t bytes);
+static ssize_t	buffer_ipp_write(void *ctx, ipp_uchar_t *buffer,
+				 size_t bytes);
+static int	read_all(int fd, void *buffer, size_t bytes);
+static int	write_all(int fd, const void *buffer, size_t bytes);
+static void	worker_job_free(worker_job_t *job);
+static int	worker_job_iscanceled(void *data);
+static void	worker_job_log(void *data, cf_loglevel_t level,
+			       const char *message, ...);
+static void	*worker_job_run(void *arg);
+
+
+//
+// 'cfFilterWorker()' - Filter function which lets a filter function
+//                      run in a persistent worker process started
+//                      with cfFilterWorkerServe(). Input and output
+//                      file descriptors and the job data (job and
+//                      printer IPP attributes, options, raster
+//                      header, ...) are passed through the worker's
+//                      Unix domain socket, log messages and the exit
+//                      status are returned through it, and canceling
+//                      the job is forwarded. If the worker is not
+//                      running the filter function supplied as
+//                      fallback is called in-process.
+//
+
+int					// O - Error status
+cfFilterWorker(int inputfd,		// I - File descriptor input stream
+	       int outputfd,		// I - File descriptor output stream
+	       int inputseekable,	// I - Is input stream seekable?
+	       cf_filter_data_t *data,	// I - Job and printer data
+	       void *parameters)	// I - Filter-specific parameters
+					//     (cf_filter_worker_t*)
+{
+  cf_filter_worker_t	*params = (cf_filter_worker_t *)parameters;
+  cf_logfunc_t		log = data->logfunc;
+  void			*ld = data->logdata;
+  worker_buffer_t	buf;		// Request
+  struct sockaddr_un	addr;		// Address of the worker
+  struct msghdr		msg;		// Message with file descriptors
+  struct iovec		iov;		// Data part of message
+  struct cmsghdr	*cmsg;		// Control part of message
+  union
+  {
+    char		buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr	align;
+  }			control;	// Buffer for control part
+  int			fds[2];		// File descriptors to pass on
+  struct pollfd		pfd;		// Waiting for replies
+  unsigned char		type;		// Type of reply
+  int			level;		// Log level of reply
+  uint32_t		len;		// Length of log message
+  char			*message = NULL;// Log message
+  int			status = 1;	// Exit status of the job
+  int			canceled = 0;	// Job canceled?
+  int			conn = -1;	// Connection to the worker
+  int			i;
+
+
+  if (!params || !params->socket_path || !params->filter)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorker: Socket path and filter name required.");
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  if (strlen(params->socket_path) >= sizeof(addr.sun_path))
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorker: Socket path \"%s\" too long.",
+		 params->socket_path);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  //
+  // Connect to the worker
+  //
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, params->socket_path, sizeof(addr.sun_path) - 1);
+
+  if ((conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+      connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    const char *error = strerror(errno);
+
+    if (conn >= 0)
+      close(conn);
+    if (params->function)
+    {
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "cfFilterWorker (%s): Worker at %s not available (%s), "
+		   "running filter in-process.",
+		   params->filter, params->socket_path, error);
+      return ((params->function)(inputfd, outputfd, inputseekable, data,
+				 params->parameters));
+    }
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorker (%s): Unable to connect to worker at %s: %s",
+		 params->filter, params->socket_path, error);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  //
+  // Serialize the job data, the length of the request comes first
+  //
+
+  memset(&buf, 0, sizeof(buf));
+  buffer_add_int(&buf, 0);
+  buffer_add_int(&buf, WORKER_MAGIC);
+  buffer_add_string(&buf, params->filter);
+  buffer_add_int(&buf, inputseekable);
+  buffer_add_string(&buf, data->printer);
+  buffer_add_int(&buf, data->job_id);
+  buffer_add_string(&buf, data->job_user);
+  buffer_add_string(&buf, data->job_title);
+  buffer_add_int(&buf, data->copies);
+  buffer_add_string(&buf, data->content_type);
+  buffer_add_string(&buf, data->final_content_type);
+  buffer_add_ipp(&buf, data->job_attrs);
+  buffer_add_ipp(&buf, data->printer_attrs);
+  buffer_add_int(&buf, data->header != NULL);
+  if (data->header)
+    buffer_add(&buf, data->header, sizeof(cups_page_header_t));
+  buffer_add_int(&buf, data->num_options);
+  for (i = 0; i < data->num_options; i ++)
+  {
+    buffer_add_string(&buf, data->options[i].name);
+    buffer_add_string(&buf, data->options[i].value);
+  }
+
+  if (buf.error || buf.len > WORKER_MAX_REQUEST)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorker (%s): Unable to serialize job data.",
+		 params->filter);
+    goto out;
+  }
+
+  len = (uint32_t)buf.len;
+  memcpy(buf.data, &len, sizeof(len));
+
+  //
+  // Send the file descriptors along with the first bytes of the
+  // request, then the rest of the request
+  //
+
+  fds[0] = inputfd;
+  fds[1] = outputfd;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base       = buf.data;
+  iov.iov_len        = sizeof(len);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg               = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level   = SOL_SOCKET;
+  cmsg->cmsg_type    = SCM_RIGHTS;
+  cmsg->cmsg_len     = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  while (sendmsg(conn, &msg, MSG_NOSIGNAL) < 0)
+    if (errno != EINTR)
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterWorker (%s): Unable to send job to worker: %s",
+		   params->filter, strerror(errno));
+      goto out;
+    }
+
+  if (write_all(conn, buf.data + sizeof(len), buf.len - sizeof(len)))
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorker (%s): Unable to send job to worker: %s",
+		 params->filter, strerror(errno));
+    goto out;
+  }
+
+  // The worker has its own copies of the file descriptors now, close
+  // ours so that the other filters of the chain see EOF when the
+  // worker closes them.
+  close(inputfd);
+  close(outputfd);
+  inputfd = outputfd = -1;
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterWorker (%s): Job passed to worker at %s.",
+	       params->filter, params->socket_path);
+
+  //
+  // Pass on the log messages of the job until we get its exit status,
+  // if the job gets canceled, shut down our side of the connection so
+  // that the filter function in the worker sees the job as canceled
+  //
+
+  pfd.fd     = conn;
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    if (!canceled && data->iscanceledfunc &&
+	(data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log) log(ld, CF_LOGLEVEL_DEBUG,
+		   "cfFilterWorker (%s): Job canceled, notifying worker.",
+		   params->filter);
+      shutdown(conn, SHUT_WR);
+      canceled = 1;
+    }
+
+    if (poll(&pfd, 1, data->iscanceledfunc && !canceled ? 500 : -1) <= 0)
+      continue;
+
+    if (read_all(conn, &type, 1) || read_all(conn, &level, sizeof(level)))
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterWorker (%s): Connection to worker lost.",
+		   params->filter);
+      break;
+    }
+
+    if (type == WORKER_MSG_STATUS)
+    {
+      status = level;
+      break;
+    }
+    else if (type != WORKER_MSG_LOG || read_all(conn, &len, sizeof(len)) ||
+	     len > WORKER_MAX_REQUEST ||
+	     (message = malloc(len + 1)) == NULL ||
+	     read_all(conn, message, len))
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterWorker (%s): Invalid reply from worker.",
+		   params->filter);
+      break;
+    }
+
+    message[len] = '\0';
+    if (log) log(ld, (cf_loglevel_t)level, "%s", message);
+    free(message);
+    message = NULL;
+  }
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterWorker (%s): Worker job completed with status %d.",
+	       params->filter, status);
+
+ out:
+  free(message);
+  free(buf.data);
+  if (inputfd >= 0)
+    close(inputfd);
+  if (outputfd >= 0)
+    close(outputfd);
+  close(conn);
+
+  return (status);
+}
+
+
+//
+// 'cfFilterWorkerServe()' - Run a persistent worker which executes
+//                           the jobs sent by cfFilterWorker() with
+//                           the given filter functions. Each job runs
+//                           in its own thread (if libcupsfilters is
+//                           built with threads, otherwise jobs are
+//                           run one after the other), up to max_jobs
+//                           at once. The function returns when
+//                           iscanceled() returns 1, after the running
+//                           jobs have finished.
+//
+
+int					// O - Error status
+cfFilterWorkerServe(
+    const char *socket_path,		// I - Path of the Unix domain socket
+    cf_filter_worker_filter_t *filters,	// I - Filter functions offered
+    int num_filters,			// I - Number of filter functions
+    int max_jobs,			// I - Maximum of jobs running at once,
+					//     0 for no limit
+    cf_logfunc_t log,			// I - Log function
+    void *ld,				// I - Log function data
+    cf_filter_iscanceledfunc_t iscanceled,
+					// I - Function returning 1 for shutdown
+    void *icd)				// I - Data for iscanceled function
+{
+  worker_server_t	server;		// Server state
+  worker_job_t		*job;		// Job received
+  struct sockaddr_un	addr;		// Address of the socket
+  struct pollfd		pfd;		// Waiting for connections
+  int			sock;		// Listening socket
+  int			conn;		// Connection of a client
+#ifdef HAVE_PTHREAD_H
+  pthread_t		thread;		// Thread of a job
+  pthread_attr_t	attr;		// Create job threads detached
+  struct timespec	timeout;	// Time to check for shutdown again
+  int			full;		// No free job slot?
+#endif // HAVE_PTHREAD_H
+
+
+  if (!socket_path || !filters || num_filters <= 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Socket path and filters required.");
+    return (1);
+  }
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Socket path \"%s\" too long.",
+		 socket_path);
+    return (1);
+  }
+
+  //
+  // Create the socket, only accessible for our user, as the jobs
+  // contain the users' data
+  //
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Unable to create socket: %s",
+		 strerror(errno));
+    return (1);
+  }
+
+  unlink(socket_path);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      chmod(socket_path, S_IRUSR | S_IWUSR) < 0 ||
+      listen(sock, 16) < 0)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Unable to listen on %s: %s",
+		 socket_path, strerror(errno));
+    close(sock);
+    unlink(socket_path);
+    return (1);
+  }
+
+  // We write replies to clients which could have gone away
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&server, 0, sizeof(server));
+  server.filters     = filters;
+  server.num_filters = num_filters;
+  server.logfunc     = log;
+  server.logdata     = ld;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init(&server.mutex, NULL);
+  pthread_cond_init(&server.cond, NULL);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+#endif // HAVE_PTHREAD_H
+
+  if (log) log(ld, CF_LOGLEVEL_INFO,
+	       "cfFilterWorkerServe: Listening on %s with %d filters.",
+	       socket_path, num_filters);
+
+  pfd.fd     = sock;
+  pfd.events = POLLIN;
+
+  while (!iscanceled || !iscanceled(icd))
+  {
+#ifdef HAVE_PTHREAD_H
+    //
+    // Accept the next job only when there is a free job slot, checking
+    // for shutdown once a second while all slots are busy
+    //
+
+    pthread_mutex_lock(&server.mutex);
+    while ((full = max_jobs > 0 && server.active_jobs >= max_jobs) &&
+	   (!iscanceled || !iscanceled(icd)))
+    {
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_sec ++;
+      pthread_cond_timedwait(&server.cond, &server.mutex, &timeout);
+    }
+    pthread_mutex_unlock(&server.mutex);
+
+    if (full)
+      break;
+#endif // HAVE_PTHREAD_H
+
+    if (poll(&pfd, 1, iscanceled ? 1000 : -1) <= 0)
+      continue;
+
+    if ((conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) < 0)
+    {
+      if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+	if (log) log(ld, CF_LOGLEVEL_ERROR,
+		     "cfFilterWorkerServe: Unable to accept connection: %s",
+		     strerror(errno));
+      continue;
+    }
+
+    if ((job = calloc(1, sizeof(worker_job_t))) == NULL)
+    {
+      close(conn);
+      continue;
+    }
+
+    job->server   = &server;
+    job->conn     = conn;
+    job->inputfd  = -1;
+    job->outputfd = -1;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&job->mutex, NULL);
+
+    pthread_mutex_lock(&server.mutex);
+    server.active_jobs ++;
+    pthread_mutex_unlock(&server.mutex);
+
+    if (pthread_create(&thread, &attr, worker_job_run, job))
+    {
+      if (log) log(ld, CF_LOGLEVEL_ERROR,
+		   "cfFilterWorkerServe: Unable to create job thread, "
+		   "running job directly.");
+      worker_job_run(job);
+    }
+#else
+    server.active_jobs ++;
+    worker_job_run(job);
+#endif // HAVE_PTHREAD_H
+  }
+
+  //
+  // Shut down, wait for the running jobs to finish
+  //
+
+  if (log) log(ld, CF_LOGLEVEL_INFO,
+	       "cfFilterWorkerServe: Shutting down.");
+
+  close(sock);
+  unlink(socket_path);
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&server.mutex);
+  while (server.active_jobs > 0)
+    pthread_cond_wait(&server.cond, &server.mutex);
+  pthread_mutex_unlock(&server.mutex);
+
+  pthread_attr_destroy(&attr);
+  pthread_cond_destroy(&server.cond);
+  pthread_mutex_destroy(&server.mutex);
+#endif // HAVE_PTHREAD_H
+
+  return (0);
+}
+
+
+//
+// 'buffer_add()' - Append data to a buffer.
+//
+
+static int				// O - 0 on success, -1 on error
+buffer_add(worker_buffer_t *buf,	// I - Buffer
+	   const void *data,		// I - Data
+	   size_t len)			// I - Length of data
+{
+  unsigned char	*temp;			// New allocation
+
+
+  if (buf->error)
+    return (-1);
+
+  if (buf->len + len > buf->alloc)
+  {
+    size_t alloc = buf->alloc ? buf->alloc : 4096;
+
+    while (alloc < buf->len + len)
+      alloc *= 2;
+
+    if ((temp = realloc(buf->data, alloc)) == NULL)
+    {
+      buf->error = 1;
+      return (-1);
+    }
+
+    buf->data  = temp;
+    buf->alloc = alloc;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+
+  return (0);
+}
+
+
+//
+// 'buffer_add_int()' - Append an integer to a buffer.
+//
+
+static int				// O - 0 on success, -1 on error
+buffer_add_int(worker_buffer_t *buf,	// I - Buffer
+	       int value)		// I - Value
+{
+  int32_t v = (int32_t)value;
+
+  return (buffer_add(buf, &v, sizeof(v)));
+}
+
+
+//
+// 'buffer_add_ipp()' - Append an IPP message to a buffer, preceded by
+//                      a flag whether it is present.
+//
+
+static int				// O - 0 on success, -1 on error
+buffer_add_ipp(worker_buffer_t *buf,	// I - Buffer
+	       ipp_t *ipp)		// I - IPP message or NULL
+{
+  if (buffer_add_int(buf, ipp != NULL) || !ipp)
+    return (buf->error ? -1 : 0);
+
+  ippSetState(ipp, IPP_STATE_IDLE);
+  if (ippWriteIO(buf, buffer_ipp_write, 1, NULL, ipp) != IPP_STATE_DATA)
+    buf->error = 1;
+
+  return (buf->error ? -1 : 0);
+}
+
+
+//
+// 'buffer_add_string()' - Append a string (or NULL) to a buffer.
+//
+
+static int				// O - 0 on success, -1 on error
+buffer_add_string(worker_buffer_t *buf,	// I - Buffer
+		  const char *s)	// I - String or NULL
+{
+  if (!s)
+    return (buffer_add_int(buf, -1));
+
+  if (buffer_add_int(buf, (int)strlen(s)))
+    return (-1);
+
+  return (buffer_add(buf, s, strlen(s)));
+}
+
+
+//
+// 'buffer_get()' - Read data from a buffer.
+//
+
+static int				// O - 0 on success, -1 on error
+buffer_get(worker_buffer_t *buf,	// I - Buffer
+	   void *data,			// O - Data
+	   size_t len)			// I - Length of data
+{
+  if (buf->error || len > buf->alloc - buf->len)
+  {
+    buf->error = 1;
+    return (-1);
+  }
+
+  memcpy(data, buf->data + buf->len, len);
+  buf->len += len;
+
+  return (0);
+}
+
+
+//
+// 'buffer_get_int()' - Read an integer from a buffer.
+//
+
+static int				// O - Value, 0 on error
+buffer_get_int(worker_buffer_t *buf)	// I - Buffer
+{
+  int32_t v = 0;
+
+  buffer_get(buf, &v, sizeof(v));
+
+  return ((int)v);
+}
+
+
+//
+// 'buffer_get_ipp()' - Read an IPP message from a buffer.
+//
+
+static ipp_t *				// O - IPP message or NULL
+buffer_get_ipp(worker_buffer_t *buf)	// I - Buffer
+{
+  ipp_t	*ipp;				// IPP message
+
+
+  if (!buffer_get_int(buf) || buf->error)
+    return (NULL);
+
+  ipp = ippNew();
+  if (ippReadIO(buf, buffer_ipp_read, 1, NULL, ipp) != IPP_STATE_DATA)
+  {
+    buf->error = 1;
+    ippDelete(ipp);
+    return (NULL);
+  }
+
+  return (ipp);
+}
+
+
+//
+// 'buffer_get_string()' - Read a string from a buffer.
+//
+
+static char *				// O - String (allocated) or NULL
+buffer_get_string(worker_buffer_t *buf)	// I - Buffer
+{
+  int	len;				// Length of string
+  char	*s;				// String
+
+
+  if ((len = buffer_get_int(buf)) < 0 || buf->error ||
+      (size_t)len > buf->alloc - buf->len ||
+      (s = malloc((size_t)len + 1)) == NULL)
+    return (NULL);
+
+  buffer_get(buf, s, (size_t)len);
+  s[len] = '\0';
+
+  return (s);
+}
+
+
+//
+// 'buffer_ipp_read()' - IPP read callback reading from a buffer.
+//
+
+static ssize_t				// O - Bytes read
+buffer_ipp_read(void *ctx,		// I - Buffer
+		ipp_uchar_t *buffer,	// O - Data
+		size_t bytes)		// I - Bytes requested
+{
+  worker_buffer_t *buf = (worker_buffer_t *)ctx;
+
+  if (bytes > buf->alloc - buf->len)
+    bytes = buf->alloc - buf->len;
+
+  memcpy(buffer, buf->data + buf->len, bytes);
+  buf->len += bytes;
+
+  return ((ssize_t)bytes);
+}
+
+
+//
+// 'buffer_ipp_write()' - IPP write callback appending to a buffer.
+//
+
+static ssize_t				// O - Bytes written, -1 on error
+buffer_ipp_write(void *ctx,		// I - Buffer
+		 ipp_uchar_t *buffer,	// I - Data
+		 size_t bytes)		// I - Number of bytes
+{
+  if (buffer_add((worker_buffer_t *)ctx, buffer, bytes))
+    return (-1);
+
+  return ((ssize_t)bytes);
+}
+
+
+//
+// 'read_all()' - Read exactly the given number of bytes.
+//
+
+static int				// O - 0 on success, -1 on error/EOF
+read_all(int fd,			// I - File descriptor
+	 void *buffer,			// O - Data
+	 size_t bytes)			// I - Bytes to read
+{
+  unsigned char	*ptr = (unsigned char *)buffer;
+  ssize_t	n;
+
+
+  while (bytes > 0)
+  {
+    if ((n = read(fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    else if (n == 0)
+      return (-1);
+
+    ptr   += n;
+    bytes -= (size_t)n;
+  }
+
+  return (0);
+}
+
+
+//
+// 'write_all()' - Write exactly the given number of bytes.
+//
+
+static int				// O - 0 on success, -1 on error
+write_all(int fd,			// I - File descriptor
+	  const void *buffer,		// I - Data
+	  size_t bytes)			// I - Bytes to write
+{
+  const unsigned char	*ptr = (const unsigned char *)buffer;
+  ssize_t		n;
+
+
+  while (bytes > 0)
+  {
+    if ((n = send(fd, ptr, bytes, MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+
+    ptr   += n;
+    bytes -= (size_t)n;
+  }
+
+  return (0);
+}
+
+
+//
+// 'worker_job_free()' - Close the connection of a job and mark it as
+//                       finished.
+//
+
+static void
+worker_job_free(worker_job_t *job)	// I - Job
+{
+  worker_server_t *server = job->server;
+
+
+  if (job->inputfd >= 0)
+    close(job->inputfd);
+  if (job->outputfd >= 0)
+    close(job->outputfd);
+  close(job->conn);
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy(&job->mutex);
+  free(job);
+
+  pthread_mutex_lock(&server->mutex);
+  server->active_jobs --;
+  pthread_cond_signal(&server->cond);
+  pthread_mutex_unlock(&server->mutex);
+#else
+  free(job);
+  server->active_jobs --;
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'worker_job_iscanceled()' - Check whether the client has canceled
+//                             the job. The client does not send
+//                             anything after the request, so the
+//                             connection becoming readable means that
+//                             the client has shut it down.
+//
+
+static int				// O - 1 if canceled, 0 otherwise
+worker_job_iscanceled(void *data)	// I - Job
+{
+  worker_job_t	*job = (worker_job_t *)data;
+  struct pollfd	pfd;
+
+
+  pfd.fd     = job->conn;
+  pfd.events = POLLIN;
+
+  return (poll(&pfd, 1, 0) > 0);
+}
+
+
+//
+// 'worker_job_log()' - Log function for jobs, sends the messages to
+//                      the client.
+//
+
+static void
+worker_job_log(void *data,		// I - Job
+	       cf_loglevel_t level,	// I - Log level
+	       const char *message,	// I - Printf-style message
+	       ...)			// I - Arguments
+{
+  worker_job_t	*job = (worker_job_t *)data;
+  char		buffer[WORKER_MAX_LOG];	// Message type, level, length and
+					// formatted message
+  int32_t	lvl = (int32_t)level;	// Log level
+  uint32_t	len;			// Length of message
+  size_t	head = 1 + sizeof(lvl) + sizeof(len);
+					// Bytes before the message
+  int		n;
+  va_list	arg;
+
+
+  va_start(arg, message);
+  n = vsnprintf(buffer + head, sizeof(buffer) - head, message, arg);
+  va_end(arg);
+
+  if (n < 0)
+    return;
+  len = (uint32_t)((size_t)n < sizeof(buffer) - head ? (size_t)n :
+		   sizeof(buffer) - head - 1);
+
+  buffer[0] = WORKER_MSG_LOG;
+  memcpy(buffer + 1, &lvl, sizeof(lvl));
+  memcpy(buffer + 1 + sizeof(lvl), &len, sizeof(len));
+
+  // Send the record with a single write, the filters of a forking
+  // filter chain log through the same connection from their own
+  // processes, where the mutex does not reach.  Linux queues a blocking
+  // write to a Unix stream socket in one piece if it fits in half the
+  // send buffer, which we leave at its default of 100 KB or more, so
+  // records of at most WORKER_MAX_LOG bytes do not interleave, also
+  // when the client falls behind
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&job->mutex);
+#endif // HAVE_PTHREAD_H
+  write_all(job->conn, buffer, head + len);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock(&job->mutex);
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'worker_job_run()' - Receive a job from the client and run it.
+//
+
+static void *				// O - Thread exit value (unused)
+worker_job_run(void *arg)		// I - Job
+{
+  worker_job_t	*job = (worker_job_t *)arg;
+  worker_server_t *server = job->server;
+  cf_logfunc_t	log = server->logfunc;
+  void		*ld = server->logdata;
+  cf_filter_worker_filter_t *filter = NULL;
+					// Filter function to run
+  cf_filter_data_t data;		// Job data
+  cups_page_header_t header;		// Raster header
+  worker_buffer_t buf;			// Request
+  struct msghdr	msg;			// Message with file descriptors
+  struct iovec	iov;			// Data part of message
+  struct cmsghdr *cmsg;			// Control part of message
+  union
+  {
+    char		buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr	align;
+  }		control;		// Buffer for control part
+  uint32_t	len = 0;		// Length of request
+  int32_t	status = 1;		// Exit status of the job
+  unsigned char	type = WORKER_MSG_STATUS;
+  char		*name = NULL,		// Filter name
+		*value;			// Option value
+  int		inputseekable,		// Is input seekable?
+		num_options,		// Number of options
+		i;
+  ssize_t	n;
+
+
+  memset(&data, 0, sizeof(data));
+  memset(&buf, 0, sizeof(buf));
+
+  //
+  // Receive the file descriptors with the length of the request
+  //
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = &len;
+  iov.iov_len        = sizeof(len);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  while ((n = recvmsg(job->conn, &msg, MSG_CMSG_CLOEXEC)) < 0 &&
+	 errno == EINTR);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+    {
+      memcpy(&job->inputfd, CMSG_DATA(cmsg), sizeof(int));
+      memcpy(&job->outputfd, CMSG_DATA(cmsg) + sizeof(int), sizeof(int));
+    }
+
+  if (n < (ssize_t)sizeof(len) || job->inputfd < 0 || job->outputfd < 0 ||
+      len < 2 * sizeof(len) || len > WORKER_MAX_REQUEST ||
+      (buf.data = malloc(len)) == NULL ||
+      read_all(job->conn, buf.data + sizeof(len), len - sizeof(len)))
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Invalid job request received.");
+    goto out;
+  }
+
+  buf.alloc = len;
+  buf.len   = sizeof(len);
+
+  //
+  // Deserialize the job data
+  //
+
+  if (buffer_get_int(&buf) != WORKER_MAGIC)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Job request of wrong protocol version.");
+    goto out;
+  }
+
+  name                    = buffer_get_string(&buf);
+  inputseekable           = buffer_get_int(&buf);
+  data.printer            = buffer_get_string(&buf);
+  data.job_id             = buffer_get_int(&buf);
+  data.job_user           = buffer_get_string(&buf);
+  data.job_title          = buffer_get_string(&buf);
+  data.copies             = buffer_get_int(&buf);
+  data.content_type       = buffer_get_string(&buf);
+  data.final_content_type = buffer_get_string(&buf);
+  data.job_attrs          = buffer_get_ipp(&buf);
+  data.printer_attrs      = buffer_get_ipp(&buf);
+  if (buffer_get_int(&buf) && !buffer_get(&buf, &header, sizeof(header)))
+    data.header = &header;
+  num_options             = buffer_get_int(&buf);
+  for (i = 0; i < num_options && !buf.error; i ++)
+  {
+    char *option = buffer_get_string(&buf);
+
+    value = buffer_get_string(&buf);
+    if (option && value)
+      data.num_options = cupsAddOption(option, value, data.num_options,
+				       &data.options);
+    free(option);
+    free(value);
+  }
+
+  if (buf.error || !name)
+  {
+    if (log) log(ld, CF_LOGLEVEL_ERROR,
+		 "cfFilterWorkerServe: Invalid job request received.");
+    goto out;
+  }
+
+  for (i = 0; i < server->num_filters; i ++)
+    if (server->filters[i].name && !strcmp(server->filters[i].name, name))
+    {
+      filter = server->filters + i;
+      break;
+    }
+
+  data.back_pipe[0]   = -1;
+  data.back_pipe[1]   = -1;
+  data.side_pipe[0]   = -1;
+  data.side_pipe[1]   = -1;
+  data.logfunc        = worker_job_log;
+  data.logdata        = job;
+  data.iscanceledfunc = worker_job_iscanceled;
+  data.iscanceleddata = job;
+
+  if (!filter)
+  {
+    worker_job_log(job, CF_LOGLEVEL_ERROR,
+		   "cfFilterWorkerServe: No filter \"%s\" in this worker.",
+		   name);
+    goto out;
+  }
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterWorkerServe: Running filter %s for job %d.",
+	       name, data.job_id);
+
+  //
+  // Run the filter function, it closes the file descriptors
+  //
+
+  status        = (int32_t)(filter->function)(job->inputfd, job->outputfd,
+					      inputseekable, &data,
+					      filter->parameters);
+  job->inputfd  = -1;
+  job->outputfd = -1;
+
+  if (log) log(ld, CF_LOGLEVEL_DEBUG,
+	       "cfFilterWorkerServe: Filter %s for job %d completed with "
+	       "status %d.", name, data.job_id, (int)status);
+
+ out:
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&job->mutex);
+#endif // HAVE_PTHREAD_H
+  if (!write_all(job->conn, &type, 1))
+    write_all(job->conn, &status, sizeof(status));
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock(&job->mutex);
+#endif // HAVE_PTHREAD_H
+
+  free(name);
+  free(data.printer);
+  free(data.job_user);
+  free(data.job_title);
+  free(data.content_type);
+  free(data.final_content_type);
+  if (data.job_attrs)
+    ippDelete(data.job_attrs);
+  if (data.printer_attrs)
+    ippDelete(data.printer_attrs);
+  cupsFreeOptions(data.num_options, data.options);
+  free(buf.data);
+
+  worker_job_free(job);
+
+  return (NULL);
+}